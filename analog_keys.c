@@ -0,0 +1,127 @@
+/**
+ * Analog Key Actuation
+ *
+ * Each key keeps its rest reading and the largest deflection seen, which
+ * map its reading to a travel. With rapid trigger a pressed key tracks its
+ * deepest point and releases once it has come back up by the sensitivity; a
+ * released key tracks its highest point and presses again once it has gone
+ * down by the sensitivity. Coming back above the reset point returns it to
+ * the plain actuation point. Hall sensors don't bounce, so there is no
+ * debounce: the sensitivity and hysteresis keep noise from toggling a key.
+ */
+
+#include "analog_keys.h"
+
+typedef struct {
+    uint16_t rest;              // Raw reading with the key up
+    uint16_t span;              // Raw deflection at full travel
+    uint16_t travel;
+    uint16_t extreme;           // Deepest point while pressed, highest while released
+    bool pressed;
+    bool rapid;                 // Released by rapid trigger, not yet back above the reset point
+} analog_key_t;
+
+static analog_key_t keys[ROWS][COLS];
+
+static const analog_keys_config_t defaults = {
+    .actuation = ANALOG_ACTUATION,
+    .hysteresis = ANALOG_HYSTERESIS,
+    .rt_sensitivity = ANALOG_RT_SENSITIVITY,
+    .rt_reset = ANALOG_RT_RESET,
+};
+static analog_keys_config_t config;
+
+void analog_keys_init(const analog_keys_config_t *settings) {
+    config = settings ? *settings : defaults;
+    
+    for (int row = 0; row < ROWS; row++) {
+        for (int col = 0; col < COLS; col++) {
+            analog_key_t *key = &keys[row][col];
+            key->travel = 0;
+            key->extreme = 0;
+            key->pressed = false;
+            key->rapid = false;
+        }
+    }
+}
+
+void analog_keys_calibrate(const uint16_t raw[ROWS][COLS]) {
+    for (int row = 0; row < ROWS; row++) {
+        for (int col = 0; col < COLS; col++) {
+            keys[row][col].rest = raw[row][col];
+            keys[row][col].span = ANALOG_SPAN_DEFAULT;
+        }
+    }
+}
+
+static uint16_t travel_of(analog_key_t *key, uint16_t raw) {
+#if ANALOG_PRESS_RAISES
+    int32_t deflection = (int32_t)raw - key->rest;
+#else
+    int32_t deflection = (int32_t)key->rest - raw;
+#endif
+    if (deflection <= 0) {
+        // Beyond the rest position: the sensor drifted, follow it
+        key->rest = raw;
+        return 0;
+    }
+    if (deflection > key->span) key->span = deflection;
+    return deflection * ANALOG_TRAVEL_FULL / key->span;
+}
+
+// Returns whether the key changed state
+static bool update(analog_key_t *key, int32_t travel) {
+    if (key->pressed) {
+        if (travel > key->extreme) key->extreme = travel;
+    
+        bool release;
+        if (config.rt_sensitivity) {
+            release = travel <= key->extreme - config.rt_sensitivity || travel <= config.rt_reset;
+        } else {
+            release = travel < config.actuation - config.hysteresis;
+        }
+        if (!release) return false;
+    
+        key->pressed = false;
+        key->rapid = config.rt_sensitivity && travel > config.rt_reset;
+        key->extreme = travel;
+        return true;
+    }
+    
+    if (travel < key->extreme) key->extreme = travel;
+    if (travel <= config.rt_reset) key->rapid = false;
+    
+    // Released part way down, the actuation point doesn't apply
+    bool press = key->rapid ? travel >= key->extreme + config.rt_sensitivity
+                            : travel >= config.actuation;
+    if (!press) return false;
+    
+    key->pressed = true;
+    key->extreme = travel;
+    return true;
+}
+
+uint32_t analog_keys_process(const uint16_t raw[ROWS][COLS], matrix_event_cb_t cb) {
+    uint32_t changes = 0;
+    
+    for (int row = 0; row < ROWS; row++) {
+        for (int col = 0; col < COLS; col++) {
+            analog_key_t *key = &keys[row][col];
+            key->travel = travel_of(key, raw[row][col]);
+            if (update(key, key->travel)) {
+                cb(row, col, key->pressed);
+                changes++;
+            }
+        }
+    }
+    
+    return changes;
+}
+
+uint16_t analog_keys_travel(uint8_t row, uint8_t col) {
+    return keys[row][col].travel;
+}
+
+bool analog_keys_is_pressed(uint8_t row, uint8_t col) {
+    return keys[row][col].pressed;
+}
@@ -0,0 +1,58 @@
+/**
+ * Analog Key Actuation
+ * Turns Hall-effect sensor readings into key transitions: per-key
+ * calibration to a travel distance, then either a fixed actuation point or
+ * rapid trigger, where a pressed key releases as soon as it starts coming
+ * back up and presses again as soon as it starts going down, wherever that
+ * happens in its travel.
+ *
+ * Only processes sampled values, so the halves (analog_matrix.h) and the
+ * simulator's travel-curve replay run the same code.
+ */
+
+#ifndef ANALOG_KEYS_H
+#define ANALOG_KEYS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "matrix.h"
+
+// Travel in 0.01 mm, 4 mm switches
+#define ANALOG_TRAVEL_FULL 400
+
+// Defaults, see analog_keys_config_t
+#define ANALOG_ACTUATION 120          // 1.2 mm
+#define ANALOG_HYSTERESIS 20          // Release at 1.0 mm
+#define ANALOG_RT_SENSITIVITY 15      // 0.15 mm, well above the sensor noise
+#define ANALOG_RT_RESET 20            // Fully released above 0.2 mm
+
+// Sensor: ADC counts from rest to bottom-out assumed until a key has been
+// pressed further, and the direction its output moves as the magnet comes
+// closer. The response is treated as linear over the travel.
+#define ANALOG_SPAN_DEFAULT 600
+#define ANALOG_PRESS_RAISES 1         // 0 if the output falls when pressed
+
+typedef struct {
+    uint16_t actuation;         // Travel that presses a key
+    uint16_t hysteresis;        // Fixed point: release this far above the actuation point
+    uint16_t rt_sensitivity;    // Rapid trigger: movement that changes the state, 0 = off
+    uint16_t rt_reset;          // Rapid trigger: above this the key must reach the actuation point again
+} analog_keys_config_t;
+
+// Set the actuation settings (NULL for the defaults above) and forget the
+// key states. Calibration is kept.
+void analog_keys_init(const analog_keys_config_t *config);
+
+// Take raw as the rest position of every key, and reset the learned travel
+void analog_keys_calibrate(const uint16_t raw[ROWS][COLS]);
+
+// Process one sample of every key and report the transitions through the
+// same callback as matrix_process(). Returns the number of transitions.
+uint32_t analog_keys_process(const uint16_t raw[ROWS][COLS], matrix_event_cb_t cb);
+
+// Travel of a key at the last sample
+uint16_t analog_keys_travel(uint8_t row, uint8_t col);
+
+bool analog_keys_is_pressed(uint8_t row, uint8_t col);
+
+#endif // ANALOG_KEYS_H
@@ -0,0 +1,103 @@
+/**
+ * Analog Key Matrix
+ *
+ * The CPU only moves the multiplexer selects. For each select value the ADC
+ * converts its inputs round robin, one per multiplexer, and a DMA channel
+ * paced by the ADC FIFO copies the readings out; the scan core waits for
+ * the transfer and stops the ADC before the next select. A full scan is 16
+ * selects of settle time plus three 2 us conversions, about 130 us.
+ */
+
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/adc.h"
+#include "hardware/dma.h"
+#include "hardware/gpio.h"
+#include "analog_matrix.h"
+#include "analog_keys.h"
+
+_Static_assert(ROWS * COLS <= ANALOG_MUXES * ANALOG_MUX_CHANNELS, "not enough multiplexer channels for the keys");
+
+#define SELECT_MASK (0xFu << ANALOG_MUX_SELECT_GPIO)
+
+static int dma_channel;
+
+// Readings of one scan, by select value then multiplexer
+static uint16_t samples[ANALOG_MUX_CHANNELS][ANALOG_MUXES];
+
+void analog_matrix_init(void) {
+    gpio_init_mask(SELECT_MASK);
+    gpio_set_dir_out_masked(SELECT_MASK);
+    
+    adc_init();
+    for (int mux = 0; mux < ANALOG_MUXES; mux++) {
+        adc_gpio_init(26 + mux);
+    }
+    adc_set_round_robin((1u << ANALOG_MUXES) - 1);
+    adc_fifo_setup(true, true, 1, false, false);
+    adc_set_clkdiv(0);  // Back to back, 2 us per conversion
+    
+    dma_channel = dma_claim_unused_channel(true);
+    dma_channel_config config = dma_channel_get_default_config(dma_channel);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_16);
+    channel_config_set_read_increment(&config, false);
+    channel_config_set_write_increment(&config, true);
+    channel_config_set_dreq(&config, DREQ_ADC);
+    dma_channel_configure(dma_channel, &config, samples, &adc_hw->fifo, ANALOG_MUXES, false);
+    
+    // Rest positions from the average of a few scans
+    uint32_t sum[ROWS][COLS];
+    uint16_t raw[ROWS][COLS];
+    memset(sum, 0, sizeof(sum));
+    for (int i = 0; i < ANALOG_CALIBRATION_SCANS; i++) {
+        analog_matrix_read(raw);
+        for (int row = 0; row < ROWS; row++) {
+            for (int col = 0; col < COLS; col++) {
+                sum[row][col] += raw[row][col];
+            }
+        }
+        sleep_us(SCAN_PERIOD_US);
+    }
+    for (int row = 0; row < ROWS; row++) {
+        for (int col = 0; col < COLS; col++) {
+            raw[row][col] = sum[row][col] / ANALOG_CALIBRATION_SCANS;
+        }
+    }
+    
+    analog_keys_init(NULL);
+    analog_keys_calibrate(raw);
+}
+
+void analog_matrix_read(uint16_t raw[ROWS][COLS]) {
+    for (uint32_t select = 0; select < ANALOG_MUX_CHANNELS; select++) {
+        gpio_put_masked(SELECT_MASK, select << ANALOG_MUX_SELECT_GPIO);
+        busy_wait_us_32(ANALOG_MUX_SETTLE_US);
+    
+        // Round robin starts over from ADC0 for every select
+        adc_select_input(0);
+        dma_channel_set_write_addr(dma_channel, samples[select], false);
+        dma_channel_set_trans_count(dma_channel, ANALOG_MUXES, true);
+        adc_run(true);
+        dma_channel_wait_for_finish_blocking(dma_channel);
+    
+        // A conversion may have started after the last one we wanted
+        adc_run(false);
+        while (!(adc_hw->cs & ADC_CS_READY_BITS)) {
+            tight_loop_contents();
+        }
+        adc_fifo_drain();
+    }
+    
+    for (int row = 0; row < ROWS; row++) {
+        for (int col = 0; col < COLS; col++) {
+            int index = row * COLS + col;
+            raw[row][col] = samples[index % ANALOG_MUX_CHANNELS][index / ANALOG_MUX_CHANNELS];
+        }
+    }
+}
+
+uint32_t analog_matrix_scan(matrix_event_cb_t cb) {
+    uint16_t raw[ROWS][COLS];
+    analog_matrix_read(raw);
+    return analog_keys_process(raw, cb);
+}
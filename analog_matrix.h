@@ -0,0 +1,38 @@
+/**
+ * Analog Key Matrix
+ * Hall-effect keys in place of the switch matrix (matrix.h): each key's
+ * sensor goes to a channel of a 16:1 analog multiplexer, and each
+ * multiplexer's output to an ADC input. The readings go through
+ * analog_keys.h, which reports transitions through the same callback as
+ * matrix_scan(), so the key events that come out are unchanged.
+ */
+
+#ifndef ANALOG_MATRIX_H
+#define ANALOG_MATRIX_H
+
+#include <stdint.h>
+#include "matrix.h"
+
+// Wiring: the multiplexers share their select lines S0-S3 on four
+// consecutive GPIOs (the switch matrix's row pins), and their outputs go to
+// ADC0, ADC1, ... Key (row, col) is channel (row * COLS + col) % 16 of
+// multiplexer (row * COLS + col) / 16.
+#define ANALOG_MUX_SELECT_GPIO 2
+#define ANALOG_MUX_CHANNELS 16
+#define ANALOG_MUXES 3                // ADC0-ADC2 on GPIO 26-28
+#define ANALOG_MUX_SETTLE_US 2        // Select change to a stable output
+
+#define ANALOG_CALIBRATION_SCANS 32   // Averaged for the rest positions at boot
+
+// Configure the multiplexer selects, the ADC and its DMA channel, then take
+// the rest position of every key, so the keys must be up at boot.
+void analog_matrix_init(void);
+
+// Read every key: for each select value, one DMA transfer of a round robin
+// over the multiplexer outputs
+void analog_matrix_read(uint16_t raw[ROWS][COLS]);
+
+// analog_matrix_read() + analog_keys_process()
+uint32_t analog_matrix_scan(matrix_event_cb_t cb);
+
+#endif // ANALOG_MATRIX_H
@@ -0,0 +1,74 @@
+/**
+ * Boot Timeline
+ */
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "boot_timeline.h"
+
+static const char *const phase_names[BOOT_PHASES] = {
+    [BOOT_SCAN_STARTED] = "scan started",
+    [BOOT_USB_STARTED] = "USB started",
+    [BOOT_USB_MOUNTED] = "USB mounted",
+    [BOOT_RADIO_READY] = "radio ready",
+    [BOOT_BT_WORKING] = "Bluetooth on",
+    [BOOT_DONGLE_READY] = "dongle ready",
+    [BOOT_HALVES_READY] = "halves ready",
+    [BOOT_FIRST_KEY_IN] = "first key in",
+    [BOOT_FIRST_KEY_OUT] = "first key out",
+};
+
+// 0 = not reached. A phase reached at exactly 0 us is stored as 1.
+static volatile uint32_t phase_us[BOOT_PHASES];
+static bool reported = false;
+
+void boot_mark(boot_phase_t phase) {
+    // No compare-and-swap on the M0+: if both cores mark a phase at once the
+    // later one wins, which only moves it by the time between them
+    if (phase_us[phase]) return;
+    uint32_t now = time_us_32();
+    phase_us[phase] = now ? now : 1;
+}
+
+uint32_t boot_phase_us(boot_phase_t phase) {
+    return phase_us[phase];
+}
+
+void boot_timeline_print(void) {
+    // Phases in the order they were reached
+    uint8_t order[BOOT_PHASES];
+    int count = 0;
+    for (int phase = 0; phase < BOOT_PHASES; phase++) {
+        uint32_t at = boot_phase_us(phase);
+        if (!at) continue;
+        int i = count++;
+        while (i > 0 && boot_phase_us(order[i - 1]) > at) {
+            order[i] = order[i - 1];
+            i--;
+        }
+        order[i] = phase;
+    }
+    
+    printf("Boot timeline (ms):");
+    for (int i = 0; i < count; i++) {
+        uint32_t at = boot_phase_us(order[i]);
+        printf("%s %s %lu.%lu", i ? "," : "", phase_names[order[i]],
+               (unsigned long)(at / 1000), (unsigned long)(at % 1000 / 100));
+    }
+    printf("\n");
+}
+
+void boot_timeline_task(void) {
+    if (reported) return;
+    uint32_t out = boot_phase_us(BOOT_FIRST_KEY_OUT);
+    if (!out) return;
+    reported = true;
+    
+    boot_timeline_print();
+    uint32_t in = boot_phase_us(BOOT_FIRST_KEY_IN);
+    printf("Time to first key: %lu ms", (unsigned long)(out / 1000));
+    if (in && in <= out) {
+        printf(" (in at %lu ms, held %lu ms)", (unsigned long)(in / 1000), (unsigned long)((out - in) / 1000));
+    }
+    printf("\n");
+}
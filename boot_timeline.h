@@ -0,0 +1,44 @@
+/**
+ * Boot Timeline
+ * When each boot phase finished, counted from power-on (the timer starts at
+ * reset), and the time to the first keystroke: from power-on until the
+ * first key event leaves the device, over the air on the halves or in a
+ * report to the host from whichever device has USB.
+ *
+ * Each firmware marks the phases it goes through. Marks can come from
+ * either core, and only the first mark of a phase counts.
+ */
+
+#ifndef BOOT_TIMELINE_H
+#define BOOT_TIMELINE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum {
+    BOOT_SCAN_STARTED,        // Scan core running (halves)
+    BOOT_USB_STARTED,         // tusb_init() done
+    BOOT_USB_MOUNTED,         // Host configured the device
+    BOOT_RADIO_READY,         // cyw43_arch_init() done, radio firmware loaded
+    BOOT_BT_WORKING,          // HCI up
+    BOOT_DONGLE_READY,        // Halves: the dongle subscribed to key events
+    BOOT_HALVES_READY,        // Central: every half it connects to is ready
+    BOOT_FIRST_KEY_IN,        // First key event scanned, or received from a half
+    BOOT_FIRST_KEY_OUT,       // First key event sent on to the dongle or the host
+    BOOT_PHASES
+} boot_phase_t;
+
+// Record the current time for a phase, unless it was already reached
+void boot_mark(boot_phase_t phase);
+
+// Time since power-on a phase was reached, 0 if it hasn't been
+uint32_t boot_phase_us(boot_phase_t phase);
+
+// Print the phases reached so far, in order
+void boot_timeline_print(void);
+
+// Print the timeline and the time to first key once, as soon as the first
+// key is out. Call from the main loop.
+void boot_timeline_task(void);
+
+#endif // BOOT_TIMELINE_H
@@ -20,6 +20,15 @@
 #define ENABLE_LE_CENTRAL
 #define ENABLE_L2CAP_LE_CREDIT_BASED_FLOW_CONTROL_MODE
 
+// Bonding for firmware updates (dfu.h): LE Secure Connections, with the
+// P-256 key exchange done in software
+#define ENABLE_LE_SECURE_CONNECTIONS
+#define ENABLE_MICRO_ECC_FOR_LE_SECURE_CONNECTIONS
+
+// Link layer packets up to HCI_LE_ACL_DATA_PACKET_LENGTH instead of 27 bytes,
+// for firmware updates over L2CAP (dfu.h)
+#define ENABLE_LE_DATA_LENGTH_EXTENSION
+
 // BTstack configuration. buffers, sizes, ...
 #define HCI_ACL_PAYLOAD_SIZE (1691 + 4)
 #define HCI_INCOMING_PRE_BUFFER_SIZE 14
@@ -29,7 +38,7 @@
 #define MAX_NR_BNEP_CHANNELS 0
 #define MAX_NR_BNEP_SERVICES 0
 #define MAX_NR_BTSTACK_LINK_KEY_DB_MEMORY_ENTRIES 2
-#define MAX_NR_GATT_CLIENTS 1
+#define MAX_NR_GATT_CLIENTS 2
 #define MAX_NR_HCI_CONNECTIONS 2
 #define MAX_NR_L2CAP_CHANNELS 4
 #define MAX_NR_L2CAP_SERVICES 2
@@ -0,0 +1,1246 @@
+/**
+ * BLE Central
+ * Finds the keyboard halves, connects, discovers (or reuses cached) GATT
+ * handles and hands their key event notifications to the registered handler.
+ * A half may send its key events over an L2CAP channel instead (key channel,
+ * key_event.h); those are accepted from the halves we are connected to and
+ * handled the same way.
+ * Shared by the dongle, the dongle-less (USB-connected) half and the relaying
+ * left half, which is also a peripheral of the dongle at the same time.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+
+// Prevent BTstack from redefining HID types
+#define __HID_H
+
+#include "btstack_run_loop.h"
+#include "hci.h"
+#include "hci_cmd.h"
+#include "btstack_event.h"
+#include "gap.h"
+#include "l2cap.h"
+#include "ble/att_server.h"
+#include "ble/gatt_client.h"
+#include "ble/sm.h"
+#include "bluetooth_gatt.h"
+
+#include "central.h"
+#include "key_tx_queue.h"
+#include "boot_timeline.h"
+#include "key_stats.h"
+#include "link_policy.h"
+#include "recovery.h"
+#include "dfu.h"
+
+// BLE GATT handlers
+static hci_con_handle_t left_handle = HCI_CON_HANDLE_INVALID;
+static hci_con_handle_t right_handle = HCI_CON_HANDLE_INVALID;
+static gatt_client_notification_t left_notification_listener;
+static gatt_client_notification_t right_notification_listener;
+
+// UUIDs for keyboard service
+static const uint8_t keyboard_service_uuid[] = {0x9E, 0xCA, 0xDC, 0x24, 0x0E, 0xE5, 0xA9, 0xE0, 
+                                                 0x93, 0xF3, 0xA3, 0xB5, 0x01, 0x00, 0x40, 0x6E};
+static const uint8_t keyboard_data_uuid[] = {0x9E, 0xCA, 0xDC, 0x24, 0x0E, 0xE5, 0xA9, 0xE0, 
+                                              0x93, 0xF3, 0xA3, 0xB5, 0x03, 0x00, 0x40, 0x6E};
+static const uint8_t key_stats_uuid[] = KEY_STATS_UUID128;
+static const uint8_t power_state_uuid[] = POWER_STATE_UUID128;
+
+// Link while the host is suspended: 30 ms interval, and the half may skip up
+// to 16 events in a row when it has nothing to send. A key still goes out at
+// the next event. Supervision timeout well over (1 + latency) * interval.
+#define LOW_POWER_INTERVAL 24       // 1.25 ms units
+#define LOW_POWER_LATENCY 16
+#define LOW_POWER_TIMEOUT 300       // 10 ms units
+
+// HCI LE Set PHY preference bits by link_phy_t, and the Coded coding to ask for
+static const uint8_t phy_bits[LINK_PHYS] = {0x02, 0x01, 0x04};
+#define PHY_OPTION_S2 1
+
+// LE PHY Update Complete reports the PHY as 1M = 1, 2M = 2, Coded = 3
+static const uint8_t phy_from_hci[4] = {LINK_PHY_1M, LINK_PHY_1M, LINK_PHY_2M, LINK_PHY_CODED};
+
+// Connection state
+typedef enum {
+    STATE_IDLE,
+    STATE_W4_SCAN_RESULT,
+    STATE_W4_CONNECT,
+    STATE_CONNECTED,
+    STATE_W4_DB_HASH,
+    STATE_W4_SERVICE_RESULT,
+    STATE_W4_CHARACTERISTIC_RESULT,
+    STATE_W4_DESCRIPTOR_RESULT,
+    STATE_W4_ENABLE_NOTIFICATIONS,
+    STATE_READY
+} connection_state_t;
+
+// GATT handle cache
+// Discovered handles are kept per peer address together with the peer's
+// Database Hash. On reconnect the hash is read first (one round trip); if it
+// still matches, service/characteristic/descriptor discovery is skipped.
+#define GATT_CACHE_SIZE 4
+#define DB_HASH_LEN 16
+
+typedef struct {
+    bool valid;
+    bd_addr_t addr;
+    uint8_t db_hash[DB_HASH_LEN];
+    gatt_client_characteristic_t characteristic;
+    uint16_t cccd_handle;
+} gatt_cache_entry_t;
+
+// Kept across a watchdog reset (recovery.h): the handle cache, and the
+// halves we were connected to, to connect straight back without scanning
+typedef struct {
+    bool valid;
+    bd_addr_t addr;
+    bd_addr_type_t addr_type;
+} known_half_t;
+
+static struct {
+    gatt_cache_entry_t gatt_cache[GATT_CACHE_SIZE];
+    uint8_t gatt_cache_next;         // Round-robin replacement
+    known_half_t halves[2];          // Left, right
+} __uninitialized_ram(kept);
+static uint32_t __uninitialized_ram(kept_check);
+
+// A half known from before a watchdog reset gets this long to take a direct
+// connection before we go back to scanning for it
+#define DIRECT_CONNECT_MS 1000
+static btstack_timer_source_t direct_timer;
+
+// Connect-to-ready timing, to see what the cache saves
+typedef struct {
+    uint32_t count;
+    uint32_t total_ms;
+    uint32_t last_ms;
+} setup_timing_t;
+
+static setup_timing_t setup_full = {0};
+static setup_timing_t setup_cached = {0};
+
+typedef struct {
+    bd_addr_t addr;
+    bd_addr_type_t addr_type;
+    hci_con_handle_t con_handle;
+    connection_state_t state;
+    gatt_client_service_t service;
+    gatt_client_characteristic_t characteristic;
+    uint16_t service_start;
+    uint16_t service_end;
+    uint16_t char_value_handle;
+    uint16_t char_config_handle;
+    uint8_t db_hash[DB_HASH_LEN];
+    bool db_hash_valid;
+    gatt_cache_entry_t *cache;      // Cache entry for this peer, if any
+    uint32_t connect_time;          // When the link came up
+    uint16_t conn_interval;         // Parameters as connected, restored after low power
+    uint16_t conn_latency;
+    uint16_t supervision_timeout;
+    uint16_t current_interval;      // Parameters in effect
+    uint16_t current_latency;
+    uint16_t current_timeout;
+    bool update_pending;            // Connection update sent, not complete yet
+    uint16_t power_value_handle;    // Power State characteristic, 0 = none
+    bool power_looked_up;
+    bool power_lookup_running;
+    bool low_power;                 // What the half was last told
+    link_policy_t link;             // Kept across connections of this half
+    uint8_t phy;                    // link_phy_t in use
+    uint8_t phy_requested;          // link_phy_t asked for, LINK_PHYS if none
+    bool no_2m;                     // 2M refused on this connection
+    int8_t rssi;                    // Last reading, LINK_RSSI_UNKNOWN before the first
+    int8_t rssi_min;                // Lowest reading on this connection
+    uint16_t window_packets;        // Telemetry from the half in this window
+    uint16_t window_retransmissions;
+    uint32_t link_packets;          // Since connecting
+    uint32_t link_retransmissions;
+    uint16_t drops;                 // Supervision timeouts, since boot
+    uint16_t link_changes;          // Policy decisions, since boot
+    bool is_left;
+    bool enabled;                   // Whether this central should connect to this half
+    bool direct;                    // Known from before a watchdog reset: connect without scanning
+    uint16_t key_cid;               // Key channel from the half, 0 = none
+    uint8_t key_sdu[KEY_CHANNEL_MTU];
+} keyboard_connection_t;
+
+_Static_assert(KEY_TX_BATCH_MAX * sizeof(key_event_t) <= KEY_CHANNEL_MTU, "key channel must hold a packet");
+
+static keyboard_connection_t left_kb = {.state = STATE_IDLE, .is_left = true};
+static keyboard_connection_t right_kb = {.state = STATE_IDLE, .is_left = false};
+
+static central_key_handler_t key_handler;
+static central_disconnect_handler_t disconnect_handler;
+
+// A half we should connect to but aren't connected to
+static bool needs_connection(const keyboard_connection_t *kb) {
+    return kb->enabled && kb->state == STATE_IDLE;
+}
+
+static keyboard_connection_t *connection_for_handle(hci_con_handle_t con_handle) {
+    if (con_handle == left_kb.con_handle) return &left_kb;
+    if (con_handle == right_kb.con_handle) return &right_kb;
+    return NULL;
+}
+
+static void start_scan(void) {
+    gap_set_scan_parameters(0, 0x0030, 0x0030);
+    gap_start_scan();
+}
+
+static void direct_connect_timeout(btstack_timer_source_t *timer) {
+    UNUSED(timer);
+    // Not there (yet): the cancel completes the connection with an error,
+    // and we scan for it like for any other half
+    if (left_kb.state == STATE_W4_CONNECT || right_kb.state == STATE_W4_CONNECT) gap_connect_cancel();
+}
+
+// Connect to a half we need: straight to its address if we knew it before a
+// watchdog reset, otherwise by scanning for its name
+static void connect_next(void) {
+    keyboard_connection_t *kb = NULL;
+    if (needs_connection(&left_kb) && left_kb.direct) {
+        kb = &left_kb;
+    } else if (needs_connection(&right_kb) && right_kb.direct) {
+        kb = &right_kb;
+    }
+    if (!kb) {
+        start_scan();
+        return;
+    }
+    
+    kb->direct = false;
+    kb->state = STATE_W4_CONNECT;
+    gap_connect(kb->addr, kb->addr_type);
+    btstack_run_loop_set_timer_handler(&direct_timer, direct_connect_timeout);
+    btstack_run_loop_set_timer(&direct_timer, DIRECT_CONNECT_MS);
+    btstack_run_loop_add_timer(&direct_timer);
+    printf("Reconnecting to %s keyboard...\n", kb->is_left ? "left" : "right");
+}
+
+static gatt_cache_entry_t *gatt_cache_find(const bd_addr_t addr) {
+    for (int i = 0; i < GATT_CACHE_SIZE; i++) {
+        if (kept.gatt_cache[i].valid && bd_addr_cmp(kept.gatt_cache[i].addr, addr) == 0) {
+            return &kept.gatt_cache[i];
+        }
+    }
+    return NULL;
+}
+
+static void gatt_cache_store(keyboard_connection_t *kb) {
+    if (!kb->db_hash_valid) return;  // Peer without a Database Hash can't be validated
+    
+    gatt_cache_entry_t *entry = gatt_cache_find(kb->addr);
+    if (!entry) {
+        entry = &kept.gatt_cache[kept.gatt_cache_next];
+        kept.gatt_cache_next = (kept.gatt_cache_next + 1) % GATT_CACHE_SIZE;
+    }
+    entry->valid = true;
+    bd_addr_copy(entry->addr, kb->addr);
+    memcpy(entry->db_hash, kb->db_hash, DB_HASH_LEN);
+    entry->characteristic = kb->characteristic;
+    entry->cccd_handle = kb->char_config_handle;
+    kb->cache = entry;
+    recovery_seal(&kept, sizeof(kept), &kept_check);
+}
+
+static void record_setup_time(keyboard_connection_t *kb, bool cached) {
+    setup_timing_t *timing = cached ? &setup_cached : &setup_full;
+    uint32_t elapsed = to_ms_since_boot(get_absolute_time()) - kb->connect_time;
+    timing->count++;
+    timing->total_ms += elapsed;
+    timing->last_ms = elapsed;
+    
+    printf("%s keyboard ready in %lu ms (%s)", kb->is_left ? "Left" : "Right",
+           (unsigned long)elapsed, cached ? "cached handles" : "full discovery");
+    if (setup_full.count && setup_cached.count) {
+        printf(", avg full %lu ms vs cached %lu ms",
+               (unsigned long)(setup_full.total_ms / setup_full.count),
+               (unsigned long)(setup_cached.total_ms / setup_cached.count));
+    }
+    printf("\n");
+    
+    if ((!left_kb.enabled || left_kb.state == STATE_READY) &&
+        (!right_kb.enabled || right_kb.state == STATE_READY)) {
+        boot_mark(BOOT_HALVES_READY);
+    }
+}
+
+// Forward declaration
+static void handle_gatt_client_event(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size);
+
+static void hci_packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size) {
+    UNUSED(channel);
+    UNUSED(size);
+    
+    if (packet_type != HCI_EVENT_PACKET) return;
+    
+    uint8_t event_type = hci_event_packet_get_type(packet);
+    
+    switch (event_type) {
+        case BTSTACK_EVENT_STATE:
+            if (btstack_event_state_get_state(packet) != HCI_STATE_WORKING) break;
+            boot_mark(BOOT_BT_WORKING);
+            if (left_kb.direct || right_kb.direct) connect_next();
+            break;
+            
+        case GAP_EVENT_ADVERTISING_REPORT: {
+            bd_addr_t addr;
+            gap_event_advertising_report_get_address(packet, addr);
+            uint8_t addr_type = gap_event_advertising_report_get_address_type(packet);
+            uint8_t length = gap_event_advertising_report_get_data_length(packet);
+            const uint8_t *data = gap_event_advertising_report_get_data(packet);
+            
+            // Look for device name in advertising data
+            bool is_left = false;
+            bool is_right = false;
+            
+            for (uint8_t i = 0; i < length; ) {
+                uint8_t field_length = data[i];
+                if (field_length == 0) break;
+                
+                uint8_t field_type = data[i + 1];
+                if (field_type == 0x09) {  // Complete local name
+                    if (memcmp(&data[i + 2], "KB_Left", 7) == 0) {
+                        is_left = true;
+                    } else if (memcmp(&data[i + 2], "KB_Right", 8) == 0) {
+                        is_right = true;
+                    }
+                }
+                i += field_length + 1;
+            }
+            
+            // Connect to discovered keyboard
+            if (is_left && needs_connection(&left_kb)) {
+                memcpy(left_kb.addr, addr, 6);
+                left_kb.addr_type = addr_type;
+                left_kb.state = STATE_W4_CONNECT;
+                gap_stop_scan();
+                gap_connect(addr, addr_type);
+                printf("Connecting to left keyboard...\n");
+            } else if (is_right && needs_connection(&right_kb)) {
+                memcpy(right_kb.addr, addr, 6);
+                right_kb.addr_type = addr_type;
+                right_kb.state = STATE_W4_CONNECT;
+                gap_stop_scan();
+                gap_connect(addr, addr_type);
+                printf("Connecting to right keyboard...\n");
+            }
+            break;
+        }
+        
+        case HCI_EVENT_LE_META: {
+            switch (hci_event_le_meta_get_subevent_code(packet)) {
+                case HCI_SUBEVENT_LE_CONNECTION_COMPLETE: {
+                    if (hci_subevent_le_connection_complete_get_status(packet) != ERROR_CODE_SUCCESS) {
+                        // Cancelled or failed: try again
+                        keyboard_connection_t *kb = left_kb.state == STATE_W4_CONNECT ? &left_kb :
+                                                    right_kb.state == STATE_W4_CONNECT ? &right_kb : NULL;
+                        if (!kb) break;
+                        kb->state = STATE_IDLE;
+                        connect_next();
+                        break;
+                    }
+    
+                    // Only links we initiated; a relaying half also accepts
+                    // the dongle's connection as a peripheral
+                    if (hci_subevent_le_connection_complete_get_role(packet) != HCI_ROLE_MASTER) break;
+                    hci_con_handle_t con_handle = hci_subevent_le_connection_complete_get_connection_handle(packet);
+                    
+                    // Determine which keyboard connected
+                    keyboard_connection_t *kb = NULL;
+                    if (left_kb.state == STATE_W4_CONNECT) {
+                        kb = &left_kb;
+                        left_handle = con_handle;
+                    } else if (right_kb.state == STATE_W4_CONNECT) {
+                        kb = &right_kb;
+                        right_handle = con_handle;
+                    }
+                    
+                    if (kb) {
+                        btstack_run_loop_remove_timer(&direct_timer);
+                        known_half_t *known = &kept.halves[kb->is_left ? 0 : 1];
+                        known->valid = true;
+                        bd_addr_copy(known->addr, kb->addr);
+                        known->addr_type = kb->addr_type;
+                        recovery_seal(&kept, sizeof(kept), &kept_check);
+    
+                        kb->con_handle = con_handle;
+                        kb->connect_time = to_ms_since_boot(get_absolute_time());
+                        kb->service_start = 0;
+                        kb->char_value_handle = 0;
+                        kb->char_config_handle = 0;
+                        kb->db_hash_valid = false;
+                        kb->conn_interval = hci_subevent_le_connection_complete_get_conn_interval(packet);
+                        kb->conn_latency = hci_subevent_le_connection_complete_get_conn_latency(packet);
+                        kb->supervision_timeout = hci_subevent_le_connection_complete_get_supervision_timeout(packet);
+                        kb->current_interval = kb->conn_interval;
+                        kb->current_latency = kb->conn_latency;
+                        kb->current_timeout = kb->supervision_timeout;
+                        kb->update_pending = false;
+                        kb->phy = LINK_PHY_1M;
+                        kb->phy_requested = LINK_PHYS;
+                        kb->no_2m = false;
+                        kb->rssi = LINK_RSSI_UNKNOWN;
+                        kb->rssi_min = LINK_RSSI_UNKNOWN;
+                        kb->window_packets = 0;
+                        kb->window_retransmissions = 0;
+                        kb->link_packets = 0;
+                        kb->link_retransmissions = 0;
+                        kb->power_value_handle = 0;
+                        kb->power_looked_up = false;
+                        kb->power_lookup_running = false;
+                        kb->low_power = false;
+                        kb->cache = gatt_cache_find(kb->addr);
+                        printf("%s keyboard connected, handle=%04x%s\n", 
+                               kb->is_left ? "Left" : "Right", con_handle,
+                               kb->cache ? " (handles cached)" : "");
+                        
+                        if (kb->cache) {
+                            // Listen straight away: a half that remembers our
+                            // subscription starts notifying as soon as we connect
+                            kb->characteristic = kb->cache->characteristic;
+                            kb->char_value_handle = kb->characteristic.value_handle;
+                            kb->char_config_handle = kb->cache->cccd_handle;
+                            gatt_client_listen_for_characteristic_value_updates(
+                                kb->is_left ? &left_notification_listener : &right_notification_listener,
+                                handle_gatt_client_event, con_handle, &kb->characteristic);
+                        }
+                        
+                        // Read the Database Hash to validate (or populate) the cache
+                        kb->state = STATE_W4_DB_HASH;
+                        gatt_client_read_value_of_characteristics_by_uuid16(
+                            handle_gatt_client_event, con_handle, 0x0001, 0xffff,
+                            ORG_BLUETOOTH_CHARACTERISTIC_DATABASE_HASH);
+                    }
+                    
+                    // Go on to the other keyboard if we need it
+                    if (needs_connection(&left_kb) || needs_connection(&right_kb)) {
+                        connect_next();
+                    }
+                    break;
+                }
+    
+                case HCI_SUBEVENT_LE_CONNECTION_UPDATE_COMPLETE: {
+                    keyboard_connection_t *kb = connection_for_handle(
+                        hci_subevent_le_connection_update_complete_get_connection_handle(packet));
+                    if (!kb) break;
+                    kb->update_pending = false;
+                    kb->current_interval = hci_subevent_le_connection_update_complete_get_conn_interval(packet);
+                    kb->current_latency = hci_subevent_le_connection_update_complete_get_conn_latency(packet);
+                    kb->current_timeout = hci_subevent_le_connection_update_complete_get_supervision_timeout(packet);
+                    break;
+                }
+    
+                case HCI_SUBEVENT_LE_PHY_UPDATE_COMPLETE: {
+                    keyboard_connection_t *kb = connection_for_handle(
+                        hci_subevent_le_phy_update_complete_get_connection_handle(packet));
+                    if (!kb) break;
+                    uint8_t tx_phy = hci_subevent_le_phy_update_complete_get_tx_phy(packet);
+                    if (hci_subevent_le_phy_update_complete_get_status(packet) == ERROR_CODE_SUCCESS && tx_phy <= 3) {
+                        kb->phy = phy_from_hci[tx_phy];
+                    }
+                    if (kb->phy_requested != LINK_PHYS && kb->phy != kb->phy_requested) {
+                        // One of the controllers doesn't do it: don't ask again
+                        printf("%s keyboard: PHY change refused\n", kb->is_left ? "Left" : "Right");
+                        if (kb->phy_requested == LINK_PHY_2M) kb->no_2m = true;
+                        if (kb->phy_requested == LINK_PHY_CODED) link_policy_limit(&kb->link, LINK_PHY_1M);
+                    }
+                    kb->phy_requested = LINK_PHYS;
+                    break;
+                }
+            }
+            break;
+        }
+    
+        case GAP_EVENT_RSSI_MEASUREMENT: {
+            keyboard_connection_t *kb = connection_for_handle(gap_event_rssi_measurement_get_con_handle(packet));
+            if (!kb) break;
+            kb->rssi = gap_event_rssi_measurement_get_rssi(packet);
+            if (kb->rssi < kb->rssi_min) kb->rssi_min = kb->rssi;
+            break;
+        }
+        
+        case HCI_EVENT_DISCONNECTION_COMPLETE: {
+            hci_con_handle_t handle = hci_event_disconnection_complete_get_connection_handle(packet);
+            keyboard_connection_t *kb = connection_for_handle(handle);
+            if (kb && hci_event_disconnection_complete_get_reason(packet) == ERROR_CODE_CONNECTION_TIMEOUT) {
+                // Lost, not closed: come back with the long timeout
+                kb->drops++;
+                link_policy_dropped(&kb->link);
+            }
+            if (handle == left_handle) {
+                left_handle = HCI_CON_HANDLE_INVALID;
+                left_kb.state = STATE_IDLE;
+                left_kb.con_handle = HCI_CON_HANDLE_INVALID;
+                gatt_client_stop_listening_for_characteristic_value_updates(&left_notification_listener);
+                printf("Left half disconnected\n");
+                if (disconnect_handler) disconnect_handler(SIDE_LEFT);
+                
+                // Restart scanning
+                start_scan();
+            } else if (handle == right_handle) {
+                right_handle = HCI_CON_HANDLE_INVALID;
+                right_kb.state = STATE_IDLE;
+                right_kb.con_handle = HCI_CON_HANDLE_INVALID;
+                gatt_client_stop_listening_for_characteristic_value_updates(&right_notification_listener);
+                printf("Right half disconnected\n");
+                if (disconnect_handler) disconnect_handler(SIDE_RIGHT);
+                
+                // Restart scanning
+                start_scan();
+            }
+            break;
+        }
+    }
+}
+
+// One packet of key events from a half, as notified or on its key channel
+static void handle_key_packet(keyboard_connection_t *kb, const uint8_t *data, uint16_t length) {
+    // One or more key events per packet (see key_tx_flush)
+    key_event_t events[KEY_TX_BATCH_MAX];
+    uint16_t count = length / sizeof(key_event_t);
+    if (length == 0 || length % sizeof(key_event_t) != 0 || count > KEY_TX_BATCH_MAX) return;
+    memcpy(events, data, length);
+    
+    // Link telemetry from the half is for its link policy, the rest goes on
+    uint16_t keys = 0;
+    for (uint16_t i = 0; i < count; i++) {
+        if (events[i].type == KEY_EVENT_LINK) {
+            kb->window_packets += events[i].packets;
+            kb->window_retransmissions += events[i].retransmissions;
+        } else {
+            events[keys++] = events[i];
+        }
+    }
+    if (keys) key_handler(events, keys);
+}
+
+static void handle_gatt_client_event(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size) {
+    UNUSED(packet_type);
+    UNUSED(channel);
+    UNUSED(size);
+    
+    keyboard_connection_t *kb = NULL;
+    
+    // Determine which keyboard this event is for
+    uint16_t event_handle = HCI_CON_HANDLE_INVALID;
+    switch(hci_event_packet_get_type(packet)) {
+        case GATT_EVENT_QUERY_COMPLETE:
+            event_handle = gatt_event_query_complete_get_handle(packet);
+            break;
+        case GATT_EVENT_SERVICE_QUERY_RESULT:
+            event_handle = gatt_event_service_query_result_get_handle(packet);
+            break;
+        case GATT_EVENT_CHARACTERISTIC_QUERY_RESULT:
+            event_handle = gatt_event_characteristic_query_result_get_handle(packet);
+            break;
+        case GATT_EVENT_ALL_CHARACTERISTIC_DESCRIPTORS_QUERY_RESULT:
+            event_handle = gatt_event_all_characteristic_descriptors_query_result_get_handle(packet);
+            break;
+        case GATT_EVENT_CHARACTERISTIC_VALUE_QUERY_RESULT:
+            event_handle = gatt_event_characteristic_value_query_result_get_handle(packet);
+            break;
+        case GATT_EVENT_NOTIFICATION:
+            event_handle = gatt_event_notification_get_handle(packet);
+            break;
+    }
+    
+    if (event_handle == left_kb.con_handle) kb = &left_kb;
+    else if (event_handle == right_kb.con_handle) kb = &right_kb;
+    
+    if (!kb) return;
+    
+    switch(hci_event_packet_get_type(packet)) {
+        case GATT_EVENT_SERVICE_QUERY_RESULT: {
+            gatt_event_service_query_result_get_service(packet, &kb->service);
+            kb->service_start = kb->service.start_group_handle;
+            kb->service_end = kb->service.end_group_handle;
+            printf("%s: Service found %04x-%04x\n", kb->is_left ? "Left" : "Right", 
+                   kb->service_start, kb->service_end);
+            break;
+        }
+        
+        case GATT_EVENT_CHARACTERISTIC_QUERY_RESULT: {
+            gatt_client_characteristic_t characteristic;
+            gatt_event_characteristic_query_result_get_characteristic(packet, &characteristic);
+            if (memcmp(characteristic.uuid128, keyboard_data_uuid, 16) != 0) break;
+            
+            kb->characteristic = characteristic;
+            kb->char_value_handle = characteristic.value_handle;
+            printf("%s: Characteristic found, value=%04x\n", 
+                   kb->is_left ? "Left" : "Right", kb->char_value_handle);
+            break;
+        }
+        
+        case GATT_EVENT_ALL_CHARACTERISTIC_DESCRIPTORS_QUERY_RESULT: {
+            gatt_client_characteristic_descriptor_t descriptor;
+            gatt_event_all_characteristic_descriptors_query_result_get_characteristic_descriptor(packet, &descriptor);
+            if (descriptor.uuid16 == ORG_BLUETOOTH_DESCRIPTOR_GATT_CLIENT_CHARACTERISTIC_CONFIGURATION) {
+                kb->char_config_handle = descriptor.handle;
+                printf("%s: CCCD found, config=%04x\n", 
+                       kb->is_left ? "Left" : "Right", kb->char_config_handle);
+            }
+            break;
+        }
+        
+        case GATT_EVENT_CHARACTERISTIC_VALUE_QUERY_RESULT: {
+            if (kb->state == STATE_W4_DB_HASH &&
+                gatt_event_characteristic_value_query_result_get_value_length(packet) == DB_HASH_LEN) {
+                memcpy(kb->db_hash, gatt_event_characteristic_value_query_result_get_value(packet), DB_HASH_LEN);
+                kb->db_hash_valid = true;
+            }
+            break;
+        }
+        
+        case GATT_EVENT_QUERY_COMPLETE: {
+            uint8_t status = gatt_event_query_complete_get_att_status(packet);
+            if (status != ATT_ERROR_SUCCESS && kb->state == STATE_W4_DB_HASH) {
+                // No Database Hash on this peer, fall back to full discovery
+                kb->db_hash_valid = false;
+            } else if (status != ATT_ERROR_SUCCESS) {
+                printf("%s: Query failed: %02x\n", kb->is_left ? "Left" : "Right", status);
+                kb->state = STATE_IDLE;
+                return;
+            }
+            
+            switch(kb->state) {
+                case STATE_W4_DB_HASH:
+                    if (kb->cache && kb->db_hash_valid &&
+                        memcmp(kb->cache->db_hash, kb->db_hash, DB_HASH_LEN) == 0) {
+                        // Handles still valid: enable notifications without waiting
+                        // for the response, the listener is already registered
+                        uint8_t config[] = {0x01, 0x00};  // Enable notifications
+                        kb->state = STATE_READY;
+                        gatt_client_write_value_of_characteristic(
+                            handle_gatt_client_event, kb->con_handle,
+                            kb->char_config_handle, sizeof(config), config);
+                        record_setup_time(kb, true);
+                        break;
+                    }
+                    
+                    if (kb->cache) {
+                        printf("%s: Database changed, rediscovering\n", kb->is_left ? "Left" : "Right");
+                        kb->cache->valid = false;
+                        kb->cache = NULL;
+                        gatt_client_stop_listening_for_characteristic_value_updates(
+                            kb->is_left ? &left_notification_listener : &right_notification_listener);
+                        kb->char_value_handle = 0;
+                        kb->char_config_handle = 0;
+                    }
+                    
+                    // Discover keyboard service
+                    kb->state = STATE_W4_SERVICE_RESULT;
+                    gatt_client_discover_primary_services_by_uuid128(
+                        handle_gatt_client_event, kb->con_handle, (uint8_t*)keyboard_service_uuid);
+                    break;
+                    
+                case STATE_W4_SERVICE_RESULT:
+                    if (kb->service_start != 0) {
+                        kb->state = STATE_W4_CHARACTERISTIC_RESULT;
+                        gatt_client_discover_characteristics_for_service(
+                            handle_gatt_client_event, kb->con_handle, &kb->service);
+                    }
+                    break;
+                    
+                case STATE_W4_CHARACTERISTIC_RESULT:
+                    if (kb->char_value_handle != 0) {
+                        kb->state = STATE_W4_DESCRIPTOR_RESULT;
+                        gatt_client_discover_characteristic_descriptors(
+                            handle_gatt_client_event, kb->con_handle, &kb->characteristic);
+                    }
+                    break;
+                    
+                case STATE_W4_DESCRIPTOR_RESULT:
+                    if (kb->char_config_handle != 0) {
+                        kb->state = STATE_W4_ENABLE_NOTIFICATIONS;
+                        uint8_t config[] = {0x01, 0x00};  // Enable notifications
+                        gatt_client_write_value_of_characteristic(
+                            handle_gatt_client_event, kb->con_handle,
+                            kb->char_config_handle, sizeof(config), config);
+                    }
+                    break;
+                    
+                case STATE_W4_ENABLE_NOTIFICATIONS:
+                    kb->state = STATE_READY;
+                    printf("%s keyboard ready!\n", kb->is_left ? "Left" : "Right");
+                    
+                    // Register for notifications
+                    gatt_client_listen_for_characteristic_value_updates(
+                        kb->is_left ? &left_notification_listener : &right_notification_listener,
+                        handle_gatt_client_event, kb->con_handle, &kb->characteristic);
+                    
+                    gatt_cache_store(kb);
+                    record_setup_time(kb, false);
+                    break;
+                    
+                default:
+                    break;
+            }
+            break;
+        }
+        
+        case GATT_EVENT_NOTIFICATION:
+            handle_key_packet(kb, gatt_event_notification_get_value(packet),
+                              gatt_event_notification_get_value_length(packet));
+            break;
+    }
+}
+
+static keyboard_connection_t *connection_for_key_channel(uint16_t cid) {
+    if (cid == 0) return NULL;
+    if (cid == left_kb.key_cid) return &left_kb;
+    if (cid == right_kb.key_cid) return &right_kb;
+    return NULL;
+}
+
+// Key channels the halves open to us. Credits are handed back as BTstack
+// takes each SDU, which is once it has been through the key handler.
+static void handle_key_channel_event(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size) {
+    if (packet_type == L2CAP_DATA_PACKET) {
+        keyboard_connection_t *kb = connection_for_key_channel(channel);
+        if (kb) handle_key_packet(kb, packet, size);
+        return;
+    }
+    if (packet_type != HCI_EVENT_PACKET) return;
+    
+    switch (hci_event_packet_get_type(packet)) {
+        case L2CAP_EVENT_CBM_INCOMING_CONNECTION: {
+            // Only from a half we connected to, one channel each
+            uint16_t cid = l2cap_event_cbm_incoming_connection_get_local_cid(packet);
+            keyboard_connection_t *kb = connection_for_handle(l2cap_event_cbm_incoming_connection_get_handle(packet));
+            if (!kb || kb->key_cid) {
+                l2cap_cbm_decline_connection(cid, L2CAP_CBM_CONNECTION_RESULT_NO_RESOURCES_AVAILABLE);
+                break;
+            }
+            kb->key_cid = cid;
+            l2cap_cbm_accept_connection(cid, kb->key_sdu, sizeof(kb->key_sdu), L2CAP_LE_AUTOMATIC_CREDITS);
+            break;
+        }
+    
+        case L2CAP_EVENT_CBM_CHANNEL_OPENED: {
+            keyboard_connection_t *kb = connection_for_key_channel(l2cap_event_cbm_channel_opened_get_local_cid(packet));
+            if (!kb) break;
+            if (l2cap_event_cbm_channel_opened_get_status(packet) != ERROR_CODE_SUCCESS) {
+                kb->key_cid = 0;
+                break;
+            }
+            printf("%s: Key channel open\n", kb->is_left ? "Left" : "Right");
+            break;
+        }
+            
+        case L2CAP_EVENT_CHANNEL_CLOSED: {
+            keyboard_connection_t *kb = connection_for_key_channel(l2cap_event_channel_closed_get_local_cid(packet));
+            if (kb) kb->key_cid = 0;
+            break;
+        }
+    }
+}
+
+// Key stats read in progress: find the characteristic by UUID, then read
+// its value, which is longer than an ATT packet, in chunks
+static struct {
+    hci_con_handle_t con_handle;
+    uint16_t value_handle;
+    uint16_t length;
+    bool reading;                   // Second step: the long read
+    central_stats_handler_t done;
+    uint8_t data[KEY_STATS_SIZE];
+} stats_read = {.con_handle = HCI_CON_HANDLE_INVALID};
+
+static void finish_stats_read(const uint8_t *data, uint16_t size) {
+    central_stats_handler_t done = stats_read.done;
+    stats_read.con_handle = HCI_CON_HANDLE_INVALID;
+    done(data, size);
+}
+
+static void handle_stats_read_event(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size) {
+    UNUSED(packet_type);
+    UNUSED(channel);
+    UNUSED(size);
+    
+    if (stats_read.con_handle == HCI_CON_HANDLE_INVALID) return;
+    
+    switch (hci_event_packet_get_type(packet)) {
+        case GATT_EVENT_CHARACTERISTIC_VALUE_QUERY_RESULT:
+            stats_read.value_handle = gatt_event_characteristic_value_query_result_get_value_handle(packet);
+            break;
+    
+        case GATT_EVENT_LONG_CHARACTERISTIC_VALUE_QUERY_RESULT: {
+            uint16_t offset = gatt_event_long_characteristic_value_query_result_get_value_offset(packet);
+            uint16_t length = gatt_event_long_characteristic_value_query_result_get_value_length(packet);
+            if (offset + length > KEY_STATS_SIZE) break;
+            memcpy(&stats_read.data[offset], gatt_event_long_characteristic_value_query_result_get_value(packet), length);
+            if (offset + length > stats_read.length) stats_read.length = offset + length;
+            break;
+        }
+    
+        case GATT_EVENT_QUERY_COMPLETE: {
+            if (gatt_event_query_complete_get_att_status(packet) != ATT_ERROR_SUCCESS) {
+                finish_stats_read(NULL, 0);
+            } else if (stats_read.reading) {
+                finish_stats_read(stats_read.data, stats_read.length);
+            } else if (!stats_read.value_handle) {
+                // Firmware from before the counters
+                finish_stats_read(NULL, 0);
+            } else {
+                stats_read.reading = true;
+                if (gatt_client_read_long_value_of_characteristic_using_value_handle(
+                        handle_stats_read_event, stats_read.con_handle, stats_read.value_handle) != ERROR_CODE_SUCCESS) {
+                    finish_stats_read(NULL, 0);
+                }
+            }
+            break;
+        }
+    }
+}
+
+bool central_read_key_stats(bool left, central_stats_handler_t done) {
+    const keyboard_connection_t *kb = left ? &left_kb : &right_kb;
+    if (kb->state != STATE_READY || stats_read.con_handle != HCI_CON_HANDLE_INVALID) return false;
+    
+    // Fails while the GATT client is busy with this half, e.g. rediscovering
+    if (gatt_client_read_value_of_characteristics_by_uuid128(
+            handle_stats_read_event, kb->con_handle, 0x0001, 0xffff, (uint8_t *)key_stats_uuid) != ERROR_CODE_SUCCESS) {
+        return false;
+    }
+    stats_read.con_handle = kb->con_handle;
+    stats_read.value_handle = 0;
+    stats_read.length = 0;
+    stats_read.reading = false;
+    stats_read.done = done;
+    return true;
+}
+
+// Power State lookup by UUID, once per connection
+static void handle_power_lookup_event(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size) {
+    UNUSED(packet_type);
+    UNUSED(channel);
+    UNUSED(size);
+    
+    keyboard_connection_t *kb;
+    switch (hci_event_packet_get_type(packet)) {
+        case GATT_EVENT_CHARACTERISTIC_VALUE_QUERY_RESULT:
+            kb = connection_for_handle(gatt_event_characteristic_value_query_result_get_handle(packet));
+            if (kb) kb->power_value_handle = gatt_event_characteristic_value_query_result_get_value_handle(packet);
+            break;
+    
+        case GATT_EVENT_QUERY_COMPLETE:
+            kb = connection_for_handle(gatt_event_query_complete_get_handle(packet));
+            if (!kb) break;
+            kb->power_lookup_running = false;
+            kb->power_looked_up = gatt_event_query_complete_get_att_status(packet) == ATT_ERROR_SUCCESS;
+            break;
+    }
+}
+
+// Supervision timeout the link policy wants, 10 ms units
+static uint16_t link_timeout(const keyboard_connection_t *kb) {
+    uint16_t lossy = LINK_LOSSY_TIMEOUT_MS / 10;
+    return kb->link.lossy && lossy > kb->supervision_timeout ? lossy : kb->supervision_timeout;
+}
+
+static void update_power(keyboard_connection_t *kb, bool low_power) {
+    if (kb->state != STATE_READY || kb->low_power == low_power || kb->power_lookup_running) return;
+    
+    if (!kb->power_looked_up) {
+        // Retried on the next call while the GATT client is busy with this half
+        if (gatt_client_read_value_of_characteristics_by_uuid128(
+                handle_power_lookup_event, kb->con_handle, 0x0001, 0xffff,
+                (uint8_t *)power_state_uuid) == ERROR_CODE_SUCCESS) {
+            kb->power_lookup_running = true;
+        }
+        return;
+    }
+    
+    // Halves without the characteristic still get the slower link
+    if (kb->power_value_handle) {
+        uint8_t value = low_power ? 1 : 0;
+        if (gatt_client_write_value_of_characteristic_without_response(
+                kb->con_handle, kb->power_value_handle, 1, &value) != ERROR_CODE_SUCCESS) {
+            return;
+        }
+    }
+    if (low_power) {
+        gap_update_connection_parameters(kb->con_handle, LOW_POWER_INTERVAL, LOW_POWER_INTERVAL,
+                                         LOW_POWER_LATENCY, LOW_POWER_TIMEOUT);
+    } else {
+        gap_update_connection_parameters(kb->con_handle, kb->conn_interval, kb->conn_interval,
+                                         kb->conn_latency, link_timeout(kb));
+    }
+    kb->update_pending = true;
+    kb->low_power = low_power;
+    printf("%s keyboard: %s\n", kb->is_left ? "Left" : "Right", low_power ? "low power" : "full speed");
+}
+
+void central_set_low_power(bool low_power) {
+    update_power(&left_kb, low_power);
+    update_power(&right_kb, low_power);
+}
+
+// Bring the link in line with the policy: its PHY, and its timeout unless
+// low power has its own. Whatever can't be sent now goes on the next call.
+static void apply_link(keyboard_connection_t *kb) {
+    uint8_t phy = kb->link.phy;
+    if (phy == LINK_PHY_2M && kb->no_2m) phy = LINK_PHY_1M;
+    if (phy != kb->phy && kb->phy_requested == LINK_PHYS &&
+        gap_le_set_phy(kb->con_handle, 0, phy_bits[phy], phy_bits[phy],
+                       phy == LINK_PHY_CODED ? PHY_OPTION_S2 : 0) == ERROR_CODE_SUCCESS) {
+        kb->phy_requested = phy;
+    }
+    
+    if (!kb->low_power && !kb->update_pending && kb->current_timeout != link_timeout(kb)) {
+        gap_update_connection_parameters(kb->con_handle, kb->conn_interval, kb->conn_interval,
+                                         kb->conn_latency, link_timeout(kb));
+        kb->update_pending = true;
+    }
+}
+
+// Close a telemetry window of a ready half: judge it, act on the verdict,
+// and ask for the RSSI the next one will be judged by
+static void judge_link(keyboard_connection_t *kb) {
+    link_window_t window = {
+        .rssi = kb->rssi,
+        .packets = kb->window_packets,
+        .retransmissions = kb->window_retransmissions,
+    };
+    kb->link_packets += kb->window_packets;
+    kb->link_retransmissions += kb->window_retransmissions;
+    kb->window_packets = 0;
+    kb->window_retransmissions = 0;
+    
+    // While the host sleeps the half has next to nothing to send and the
+    // link is slow on purpose: nothing to judge
+    if (!kb->low_power && link_policy_update(&kb->link, &window)) {
+        kb->link_changes++;
+        printf("%s keyboard: link to %s%s (RSSI %d dBm, %u retransmissions in %u packets)\n",
+               kb->is_left ? "Left" : "Right", kb->link.phy == LINK_PHY_2M ? "2M" :
+               kb->link.phy == LINK_PHY_1M ? "1M" : "Coded", kb->link.lossy ? ", long timeout" : "",
+               window.rssi, window.retransmissions, window.packets);
+    }
+    apply_link(kb);
+    gap_read_rssi(kb->con_handle);
+}
+
+bool central_link_task(void) {
+    static uint32_t window_start = 0;
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    if (now - window_start < LINK_WINDOW_MS) return false;
+    window_start = now;
+    
+    if (left_kb.state == STATE_READY) judge_link(&left_kb);
+    if (right_kb.state == STATE_READY) judge_link(&right_kb);
+    return true;
+}
+
+uint8_t central_link_stats(bool left, uint8_t *buffer) {
+    const keyboard_connection_t *kb = left ? &left_kb : &right_kb;
+    if (kb->state != STATE_READY) return 0;
+    
+    buffer[0] = kb->phy;
+    buffer[1] = kb->link.lossy ? 1 : 0;
+    buffer[2] = (uint8_t)kb->rssi;
+    buffer[3] = (uint8_t)kb->rssi_min;
+    little_endian_store_16(buffer, 4, kb->current_interval);
+    little_endian_store_16(buffer, 6, kb->current_latency);
+    little_endian_store_16(buffer, 8, kb->current_timeout);
+    little_endian_store_32(buffer, 10, kb->link_packets + kb->window_packets);
+    little_endian_store_32(buffer, 14, kb->link_retransmissions + kb->window_retransmissions);
+    little_endian_store_16(buffer, 18, kb->drops);
+    little_endian_store_16(buffer, 20, kb->link_changes);
+    return CENTRAL_LINK_STATS_SIZE;
+}
+
+void central_print_link_stats(void) {
+    static const char *const phy_names[LINK_PHYS] = {"2M", "1M", "Coded"};
+    for (int i = 0; i < 2; i++) {
+        const keyboard_connection_t *kb = i ? &right_kb : &left_kb;
+        if (kb->state != STATE_READY) continue;
+        printf("%s link: %s, keys over %s, RSSI %d dBm (min %d), interval %u.%02u ms, latency %u, "
+               "timeout %u ms, %lu packets, %lu retransmissions, %u drops, %u changes\n",
+               kb->is_left ? "Left" : "Right", phy_names[kb->phy], kb->key_cid ? "L2CAP" : "GATT",
+               kb->rssi, kb->rssi_min,
+               kb->current_interval * 125 / 100, kb->current_interval * 125 % 100, kb->current_latency,
+               kb->current_timeout * 10, (unsigned long)kb->link_packets,
+               (unsigned long)kb->link_retransmissions, kb->drops, kb->link_changes);
+    }
+}
+
+// Firmware update of a half (dfu.h): the image staged here, streamed over
+// an L2CAP channel at most DFU_WINDOW bytes ahead of what the half has written
+typedef enum {
+    UPDATE_NONE,
+    UPDATE_OPENING,
+    UPDATE_SENDING,         // Until the half has verified the image
+    UPDATE_SWAPPING,        // SWAP sent, waiting for the half to go
+    UPDATE_DONE,
+    UPDATE_FAILED,
+} update_phase_t;
+
+// Least an LE channel may offer; the half only sends STATUS
+#define UPDATE_RECEIVE_MTU 23
+
+static struct {
+    uint8_t phase;
+    bool left;
+    uint16_t cid;
+    const uint8_t *image;
+    uint32_t size;
+    uint32_t crc;
+    bool begun;                     // BEGIN sent
+    bool accepted;                  // Half is receiving
+    bool verified;                  // Half has checked the whole image
+    bool sdu_busy;                  // Until L2CAP_EVENT_PACKET_SENT
+    uint32_t sent;                  // Image bytes handed to L2CAP
+    uint32_t written;               // Image bytes the half has in flash
+    uint8_t tenths;                 // Progress printed so far
+    uint32_t start_ms;
+    uint32_t end_ms;
+    central_update_handler_t done;
+    uint8_t receive[UPDATE_RECEIVE_MTU];
+    uint8_t sdu[DFU_MTU];
+} update = {.phase = UPDATE_NONE};
+
+static const char *update_half(void) {
+    return update.left ? "Left" : "Right";
+}
+
+// Bytes per second the half has written so far
+static uint32_t update_rate(void) {
+    uint32_t elapsed = to_ms_since_boot(get_absolute_time()) - update.start_ms;
+    return elapsed ? (uint32_t)((uint64_t)update.written * 1000 / elapsed) : 0;
+}
+
+static void finish_update(bool ok) {
+    update.phase = ok ? UPDATE_DONE : UPDATE_FAILED;
+    update.end_ms = to_ms_since_boot(get_absolute_time());
+    printf("%s half update %s after %lu ms\n", update_half(), ok ? "installing" : "failed",
+           (unsigned long)(update.end_ms - update.start_ms));
+    update.done(ok);
+}
+
+// Next SDU: BEGIN, then DATA as far as the window allows, SWAP once the
+// half has verified the image. One at a time; each goes out straight from
+// this buffer.
+static void send_update(void) {
+    if (update.phase != UPDATE_SENDING || update.sdu_busy) return;
+    
+    uint16_t length;
+    if (!update.begun) {
+        update.sdu[0] = DFU_MSG_BEGIN;
+        little_endian_store_32(update.sdu, 1, update.size);
+        little_endian_store_32(update.sdu, 5, update.crc);
+        length = 9;
+    } else if (update.verified) {
+        update.sdu[0] = DFU_MSG_SWAP;
+        length = 1;
+    } else {
+        uint32_t limit = update.size - update.written > DFU_WINDOW ? update.written + DFU_WINDOW : update.size;
+        if (!update.accepted || update.sent >= limit) return;  // Until the half catches up
+        uint32_t chunk = limit - update.sent < DFU_DATA_SIZE ? limit - update.sent : DFU_DATA_SIZE;
+        update.sdu[0] = DFU_MSG_DATA;
+        memcpy(&update.sdu[1], update.image + update.sent, chunk);
+        length = 1 + chunk;
+    }
+    
+    if (l2cap_send(update.cid, update.sdu, length) != ERROR_CODE_SUCCESS) {
+        l2cap_request_can_send_now_event(update.cid);
+        return;
+    }
+    update.sdu_busy = true;
+    if (!update.begun) {
+        update.begun = true;
+    } else if (update.verified) {
+        update.phase = UPDATE_SWAPPING;
+    } else {
+        update.sent += length - 1;
+    }
+}
+
+static void handle_update_status(const uint8_t *status, uint16_t size) {
+    if (size < DFU_STATUS_SIZE || status[0] != DFU_MSG_STATUS) return;
+    uint8_t state = status[1];
+    if (state != DFU_RECEIVING && state != DFU_VERIFIED) {
+        // Refused the image, or it didn't check out
+        finish_update(false);
+        l2cap_disconnect(update.cid);
+        return;
+    }
+    
+    update.accepted = true;
+    update.verified = state == DFU_VERIFIED;
+    update.written = little_endian_read_32(status, 2);
+    uint8_t tenths = (uint8_t)((uint64_t)update.written * 10 / update.size);
+    if (tenths > update.tenths) {
+        update.tenths = tenths;
+        uint32_t rate = update_rate();
+        printf("%s half update: %u%%, %lu of %lu bytes at %lu.%lu kB/s\n", update_half(), tenths * 10,
+               (unsigned long)update.written, (unsigned long)update.size,
+               (unsigned long)(rate / 1000), (unsigned long)(rate % 1000 / 100));
+    }
+    send_update();
+}
+
+static void handle_update_event(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size) {
+    if (packet_type == L2CAP_DATA_PACKET) {
+        if (channel == update.cid && update.phase == UPDATE_SENDING) handle_update_status(packet, size);
+        return;
+    }
+    if (packet_type != HCI_EVENT_PACKET) return;
+    
+    switch (hci_event_packet_get_type(packet)) {
+        case L2CAP_EVENT_CBM_CHANNEL_OPENED:
+            if (l2cap_event_cbm_channel_opened_get_local_cid(packet) != update.cid) break;
+            if (l2cap_event_cbm_channel_opened_get_status(packet) != ERROR_CODE_SUCCESS) {
+                // Firmware from before updates over the air
+                finish_update(false);
+                break;
+            }
+            update.phase = UPDATE_SENDING;
+            send_update();
+            break;
+    
+        case L2CAP_EVENT_CAN_SEND_NOW:
+            if (l2cap_event_can_send_now_get_local_cid(packet) == update.cid) send_update();
+            break;
+    
+        case L2CAP_EVENT_PACKET_SENT:
+            if (l2cap_event_packet_sent_get_local_cid(packet) != update.cid) break;
+            update.sdu_busy = false;
+            send_update();
+            break;
+    
+        case L2CAP_EVENT_CHANNEL_CLOSED:
+            if (l2cap_event_channel_closed_get_local_cid(packet) != update.cid) break;
+            // The half closes the link to swap; anything earlier is a failure
+            if (update.phase == UPDATE_SWAPPING) {
+                finish_update(true);
+            } else if (update.phase == UPDATE_OPENING || update.phase == UPDATE_SENDING) {
+                finish_update(false);
+            }
+            break;
+    }
+}
+
+bool central_send_update(bool left, central_update_handler_t done) {
+    const keyboard_connection_t *kb = left ? &left_kb : &right_kb;
+    uint32_t size;
+    uint32_t crc;
+    const uint8_t *image = dfu_image(&size, &crc);
+    if (!image || kb->state != STATE_READY) return false;
+    if (update.phase == UPDATE_OPENING || update.phase == UPDATE_SENDING || update.phase == UPDATE_SWAPPING) {
+        return false;
+    }
+    
+    uint16_t cid;
+    // The half only takes firmware over a bonded, encrypted link: L2CAP pairs
+    // or re-encrypts first (handle_sm_event())
+    if (l2cap_cbm_create_channel(handle_update_event, kb->con_handle, DFU_PSM, update.receive,
+                                 sizeof(update.receive), L2CAP_LE_AUTOMATIC_CREDITS, LEVEL_2,
+                                 &cid) != ERROR_CODE_SUCCESS) {
+        return false;
+    }
+    update.phase = UPDATE_OPENING;
+    update.left = left;
+    update.cid = cid;
+    update.image = image;
+    update.size = size;
+    update.crc = crc;
+    update.begun = false;
+    update.accepted = false;
+    update.verified = false;
+    update.sdu_busy = false;
+    update.sent = 0;
+    update.written = 0;
+    update.tenths = 0;
+    update.start_ms = to_ms_since_boot(get_absolute_time());
+    update.done = done;
+    printf("Updating %s half: %lu bytes\n", left ? "left" : "right", (unsigned long)size);
+    return true;
+}
+
+uint8_t central_update_progress(uint8_t *buffer) {
+    if (update.phase == UPDATE_NONE) return 0;
+    bool ended = update.phase == UPDATE_DONE || update.phase == UPDATE_FAILED;
+    uint32_t end = ended ? update.end_ms : to_ms_since_boot(get_absolute_time());
+    
+    buffer[0] = update.left ? SIDE_LEFT : SIDE_RIGHT;
+    buffer[1] = update.phase;
+    little_endian_store_32(buffer, 2, update.size);
+    little_endian_store_32(buffer, 6, update.written);
+    little_endian_store_32(buffer, 10, end - update.start_ms);
+    return CENTRAL_UPDATE_PROGRESS_SIZE;
+}
+
+// Pairing with a half, for firmware updates: Just Works with LE Secure
+// Connections, bonded. Links where we're the peripheral aren't ours.
+static void handle_sm_event(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size) {
+    UNUSED(channel);
+    UNUSED(size);
+    
+    if (packet_type != HCI_EVENT_PACKET) return;
+    
+    switch (hci_event_packet_get_type(packet)) {
+        case SM_EVENT_JUST_WORKS_REQUEST: {
+            hci_con_handle_t handle = sm_event_just_works_request_get_handle(packet);
+            if (gap_get_role(handle) == HCI_ROLE_MASTER) sm_just_works_confirm(handle);
+            break;
+        }
+            
+        case SM_EVENT_PAIRING_COMPLETE:
+            if (gap_get_role(sm_event_pairing_complete_get_handle(packet)) != HCI_ROLE_MASTER) break;
+            if (sm_event_pairing_complete_get_status(packet) != ERROR_CODE_SUCCESS) {
+                printf("Pairing with a half failed; power-cycle it to pair again\n");
+            }
+            break;
+    }
+}
+
+void central_set_disconnect_handler(central_disconnect_handler_t handler) {
+    disconnect_handler = handler;
+}
+
+void central_init(bool connect_left, bool connect_right, central_key_handler_t handler) {
+    key_handler = handler;
+    left_kb.enabled = connect_left;
+    right_kb.enabled = connect_right;
+    link_policy_init(&left_kb.link);
+    link_policy_init(&right_kb.link);
+    
+    // After a watchdog reset: the handles and addresses of the halves
+    if (!recovery_restore(&kept, sizeof(kept), &kept_check)) {
+        memset(&kept, 0, sizeof(kept));
+        recovery_seal(&kept, sizeof(kept), &kept_check);
+    }
+    for (int i = 0; i < 2; i++) {
+        keyboard_connection_t *kb = i ? &right_kb : &left_kb;
+        if (!kb->enabled || !kept.halves[i].valid) continue;
+        bd_addr_copy(kb->addr, kept.halves[i].addr);
+        kb->addr_type = kept.halves[i].addr_type;
+        kb->direct = true;
+    }
+    
+    gatt_client_init();
+    
+    // Halves built to send their keys over L2CAP open a key channel to us
+    l2cap_cbm_register_service(handle_key_channel_event, KEY_CHANNEL_PSM, LEVEL_0);
+    
+    // Bond with a half before sending it firmware
+    static btstack_packet_callback_registration_t sm_event_callback_registration;
+    sm_set_io_capabilities(IO_CAPABILITY_NO_INPUT_NO_OUTPUT);
+    sm_set_authentication_requirements(SM_AUTHREQ_SECURE_CONNECTION | SM_AUTHREQ_BONDING);
+    sm_event_callback_registration.callback = &handle_sm_event;
+    sm_add_event_handler(&sm_event_callback_registration);
+    
+    // Register for HCI events
+    static btstack_packet_callback_registration_t hci_event_callback_registration;
+    hci_event_callback_registration.callback = &hci_packet_handler;
+    hci_add_event_handler(&hci_event_callback_registration);
+    
+    // Start scanning for the selected halves, or connect straight back to
+    // the known ones once Bluetooth is on
+    if (!left_kb.direct && !right_kb.direct) start_scan();
+}
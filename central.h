@@ -0,0 +1,84 @@
+/**
+ * BLE Central
+ * Connects to the keyboard halves and forwards their key events
+ */
+
+#ifndef CENTRAL_H
+#define CENTRAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "key_event.h"
+
+// Receives the key events of one notification, in order
+typedef void (*central_key_handler_t)(const key_event_t *events, uint16_t count);
+
+// Register the HCI handler and start scanning for the selected halves. After
+// a watchdog reset it connects straight back to the halves it was connected
+// to instead, with their cached handles (recovery.h).
+// Call after l2cap_init()/sm_init() and before hci_power_control().
+void central_init(bool connect_left, bool connect_right, central_key_handler_t handler);
+
+// Called when the link to a half drops, with its side (SIDE_LEFT or
+// SIDE_RIGHT): the releases of keys it had held down won't come
+typedef void (*central_disconnect_handler_t)(uint8_t side);
+
+void central_set_disconnect_handler(central_disconnect_handler_t handler);
+
+// Receives the Key Stats value of a half, or NULL if the read failed
+typedef void (*central_stats_handler_t)(const uint8_t *data, uint16_t size);
+
+// Read the per-key counters of a connected half (see key_stats.h). Returns
+// false if the half isn't ready or a read is already running; otherwise
+// done is called from the BTstack loop when the read finishes.
+bool central_read_key_stats(bool left, central_stats_handler_t done);
+
+// Tell the connected halves whether the host is suspended: they scan slowly
+// and their links switch to a long interval with peripheral latency, or back
+// to the parameters they connected with. Only changes are sent, each half's
+// once it's ready, so call it on every pass of the BTstack core's main loop
+// (with the BTstack lock held).
+void central_set_low_power(bool low_power);
+
+// Run the link policy (link_policy.h) of the connected halves: once every
+// LINK_WINDOW_MS, judge each link by its RSSI and the retransmissions its
+// half reported, and change its PHY or supervision timeout when the policy
+// says so. Call on every pass of the BTstack core's main loop (with the
+// BTstack lock held). Returns true when a window closed.
+bool central_link_task(void);
+
+// Link telemetry of a half, little-endian: PHY in use (0 = 2M, 1 = 1M,
+// 2 = Coded), long timeout (1), last and lowest RSSI (dBm, signed, 127 if
+// not read yet), connection interval (1.25 ms units), peripheral latency,
+// supervision timeout (10 ms units), packets and retransmissions since
+// connecting (4 bytes each), drops and policy changes since boot (2 each)
+#define CENTRAL_LINK_STATS_SIZE 22
+
+// Fill buffer with a half's link telemetry; returns its size, 0 if the half
+// isn't connected
+uint8_t central_link_stats(bool left, uint8_t *buffer);
+
+// Print the telemetry of the connected halves
+void central_print_link_stats(void);
+
+// Receives the outcome of a firmware update: true once the half has verified
+// the image and gone to install it
+typedef void (*central_update_handler_t)(bool ok);
+
+// Send the firmware staged here (dfu.h) to a ready half over an L2CAP
+// channel, and have it installed. Returns false if nothing is staged, the
+// half isn't ready or an update is already running; otherwise done is called
+// from the BTstack loop when it ends. Keys keep working until the half swaps.
+bool central_send_update(bool left, central_update_handler_t done);
+
+// Progress of the current or last update, little-endian: side, phase (1 =
+// opening the channel, 2 = sending, 3 = swapping, 4 = done, 5 = failed),
+// image size, bytes the half has written and checked, and ms since the
+// start (4 bytes each)
+#define CENTRAL_UPDATE_PROGRESS_SIZE 14
+
+// Fill buffer with the update's progress; returns its size, 0 if there
+// hasn't been one
+uint8_t central_update_progress(uint8_t *buffer);
+
+#endif // CENTRAL_H
@@ -0,0 +1,106 @@
+/**
+ * Connection Event Sync
+ */
+
+#include "conn_sync.h"
+
+// Phase estimate, published to the scan core with a sequence count: odd
+// while an update is in progress, readers retry if it changed under them
+typedef struct {
+    uint32_t anchor_us;       // A recent anchor
+    uint32_t interval_us;     // 0 = not connected
+    bool locked;
+} sync_state_t;
+
+static sync_state_t state;
+static volatile uint32_t sequence = 0;
+static conn_sync_stats_t stats = {0};
+
+static void publish(const sync_state_t *next) {
+    uint32_t seq = sequence;
+    __atomic_store_n(&sequence, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    state = *next;
+    __atomic_store_n(&sequence, seq + 2, __ATOMIC_RELEASE);
+}
+
+static sync_state_t snapshot(void) {
+    sync_state_t copy;
+    uint32_t seq;
+    do {
+        seq = __atomic_load_n(&sequence, __ATOMIC_ACQUIRE);
+        copy = state;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&sequence, __ATOMIC_RELAXED));
+    return copy;
+}
+
+void conn_sync_set_interval(uint32_t interval_us) {
+    sync_state_t next = state;
+    if (interval_us != next.interval_us) next.locked = false;
+    next.interval_us = interval_us;
+    publish(&next);
+}
+
+void conn_sync_sample(uint32_t ack_us) {
+    sync_state_t next = state;
+    if (next.interval_us == 0) return;
+    
+    uint32_t measured = ack_us - CONN_SYNC_ACK_DELAY_US;
+    stats.samples++;
+    
+    if (!next.locked || measured - next.anchor_us > CONN_SYNC_STALE_US) {
+        // First sample, or the clocks may have drifted apart since the last one
+        next.anchor_us = measured;
+        next.locked = true;
+        stats.last_error_us = 0;
+    } else {
+        // Phase error against the predicted anchors, in [-interval/2, interval/2)
+        int32_t interval = next.interval_us;
+        int32_t error = (int32_t)(measured - next.anchor_us) % interval;
+        if (error >= interval / 2) error -= interval;
+        if (error < -interval / 2) error += interval;
+    
+        // Follow slowly: one late or early sample shouldn't move the scans
+        next.anchor_us = measured - error + error / 4;
+        stats.last_error_us = error;
+    }
+    publish(&next);
+}
+
+bool conn_sync_locked(void) {
+    return snapshot().locked;
+}
+
+uint32_t conn_sync_next_scan(uint32_t now_us, uint32_t periodic_us) {
+    sync_state_t s = snapshot();
+    if (!s.locked || s.interval_us == 0) return periodic_us;
+    
+    // First pre-anchor slot after now
+    uint32_t slot = s.anchor_us - CONN_SYNC_LEAD_US;
+    int32_t since = (int32_t)(now_us - slot);
+    if (since > CONN_SYNC_STALE_US) return periodic_us;
+    if (since >= 0) slot += (since / (int32_t)s.interval_us + 1) * s.interval_us;
+    
+    if ((int32_t)(slot - periodic_us) >= 0) return periodic_us;
+    stats.aligned_scans++;
+    return slot;
+}
+
+uint32_t conn_sync_events_waited(uint32_t sent_us, uint32_t ack_us) {
+    sync_state_t s = snapshot();
+    if (!s.locked || s.interval_us == 0) return 0;
+    
+    // First anchor after the send, against the one that carried it
+    int32_t interval = s.interval_us;
+    int32_t phase = (int32_t)(sent_us - s.anchor_us) % interval;
+    if (phase < 0) phase += interval;
+    uint32_t first = sent_us - phase + interval;
+    int32_t late = (int32_t)(ack_us - CONN_SYNC_ACK_DELAY_US - first);
+    if (late < interval / 2) return 0;
+    return (late + interval / 2) / interval;
+}
+
+const conn_sync_stats_t *conn_sync_get_stats(void) {
+    return &stats;
+}
@@ -0,0 +1,54 @@
+/**
+ * Connection Event Sync
+ * Learns when the dongle's connection events happen and places a matrix
+ * scan just before each one, so an event found by that scan makes the
+ * next connection event instead of waiting most of an interval.
+ *
+ * The halves don't see connection events directly. The HCI Number Of
+ * Completed Packets event for a notification arrives a roughly constant
+ * time after the event that carried it, so its arrival time modulo the
+ * connection interval gives the anchor phase. Retransmissions arrive whole
+ * intervals later and don't disturb it.
+ *
+ * Written from the BTstack context, read by the scan core.
+ */
+
+#ifndef CONN_SYNC_H
+#define CONN_SYNC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define CONN_SYNC_LEAD_US 600        // Scan this long before the anchor: core hop, notify, SPI
+#define CONN_SYNC_ACK_DELAY_US 1000  // Anchor to Number Of Completed Packets, one packet
+#define CONN_SYNC_STALE_US 10000000  // Phase older than this has drifted too far (40 ppm: 400 us)
+
+typedef struct {
+    uint32_t samples;         // Completed-packet events used
+    uint32_t aligned_scans;   // Scans placed before an anchor
+    int32_t last_error_us;    // Phase error corrected by the last sample
+} conn_sync_stats_t;
+
+// Connection interval from the connection (update) complete event, 0 when
+// disconnected. Drops the learned phase if it changes.
+void conn_sync_set_interval(uint32_t interval_us);
+
+// A Number Of Completed Packets event for our link arrived at ack_us
+void conn_sync_sample(uint32_t ack_us);
+
+// Whether the anchor phase is known
+bool conn_sync_locked(void);
+
+// When to scan next: the next pre-anchor slot if it comes before the
+// regular scan at periodic_us, otherwise periodic_us
+uint32_t conn_sync_next_scan(uint32_t now_us, uint32_t periodic_us);
+
+// Connection events a notification handed to the stack at sent_us waited
+// beyond the first one it could have made, from its Number Of Completed
+// Packets at ack_us: retransmissions, or packets queued ahead of it.
+// 0 while the phase isn't known.
+uint32_t conn_sync_events_waited(uint32_t sent_us, uint32_t ack_us);
+
+const conn_sync_stats_t *conn_sync_get_stats(void);
+
+#endif // CONN_SYNC_H
@@ -0,0 +1,228 @@
+/**
+ * Firmware Update
+ *
+ * The buffer is a ring of whole sectors. The producer (raw HID on the
+ * dongle, the L2CAP channel on a half) appends, and dfu_task() takes a
+ * sector at a time once it's complete, or once the image's last bytes are
+ * in. Both counters only grow: received belongs to the producer, written
+ * to dfu_task(). The state changes hands the same way: dfu_begin() only
+ * starts an image when none is being received, and only dfu_task() ends one.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "pico/flash.h"
+#include "hardware/flash.h"
+#include "hardware/watchdog.h"
+#include "dfu.h"
+#include "klog.h"
+
+// Upper half of flash, up to the key stats sector and BTstack's flash bank
+#define STAGING_OFFSET (PICO_FLASH_SIZE_BYTES / 2)
+#define STAGING_SIZE (PICO_FLASH_SIZE_BYTES / 2 - 3 * FLASH_SECTOR_SIZE)
+
+// A flash image starts with the second stage boot loader, then the vector table
+#define VECTOR_TABLE_OFFSET 0x100
+#define SRAM_SIZE (264 * 1024)
+
+_Static_assert(DFU_BUFFER_SIZE % FLASH_SECTOR_SIZE == 0, "update buffer must hold whole sectors");
+
+static uint8_t buffer[DFU_BUFFER_SIZE];
+static uint8_t state = DFU_IDLE;
+static bool aborted = false;
+static uint32_t size = 0;
+static uint32_t expected_crc;
+static uint32_t crc;                // Running, over what reads back from flash
+static uint32_t received = 0;
+static uint32_t written = 0;
+static uint32_t start_ms;
+
+// Standard CRC-32 (as zlib.crc32), continued a sector at a time
+static uint32_t crc32_update(uint32_t value, const uint8_t *data, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++) {
+        value ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            value = (value >> 1) ^ (0xEDB88320 & -(value & 1));
+        }
+    }
+    return value;
+}
+
+bool dfu_begin(uint32_t image_size, uint32_t image_crc) {
+    extern char __flash_binary_end;
+    if (__atomic_load_n(&state, __ATOMIC_ACQUIRE) == DFU_RECEIVING) return false;
+    if ((uintptr_t)&__flash_binary_end - XIP_BASE > STAGING_OFFSET) {
+        KLOG("Firmware too large to stage an update\n");
+        return false;
+    }
+    // It replaces the running firmware, so it has to fit where that is too
+    if (image_size <= VECTOR_TABLE_OFFSET + 8 || image_size > STAGING_SIZE || image_size > STAGING_OFFSET) {
+        return false;
+    }
+    
+    size = image_size;
+    expected_crc = image_crc;
+    crc = 0xFFFFFFFF;
+    received = 0;
+    written = 0;
+    start_ms = to_ms_since_boot(get_absolute_time());
+    __atomic_store_n(&aborted, false, __ATOMIC_RELAXED);
+    __atomic_store_n(&state, DFU_RECEIVING, __ATOMIC_RELEASE);
+    KLOG("Staging a %lu byte update\n", (unsigned long)size);
+    return true;
+}
+
+bool dfu_write(const uint8_t *data, uint16_t len) {
+    if (__atomic_load_n(&state, __ATOMIC_ACQUIRE) != DFU_RECEIVING) return false;
+    uint32_t head = received;
+    uint32_t tail = __atomic_load_n(&written, __ATOMIC_ACQUIRE);
+    if (len > size - head || head + len - tail > DFU_BUFFER_SIZE) return false;
+    
+    for (uint16_t done = 0; done < len; ) {
+        uint32_t at = (head + done) % DFU_BUFFER_SIZE;
+        uint16_t chunk = len - done < DFU_BUFFER_SIZE - at ? len - done : DFU_BUFFER_SIZE - at;
+        memcpy(&buffer[at], data + done, chunk);
+        done += chunk;
+    }
+    __atomic_store_n(&received, head + len, __ATOMIC_RELEASE);
+    return true;
+}
+
+void dfu_abort(void) {
+    __atomic_store_n(&aborted, true, __ATOMIC_RELEASE);
+}
+
+static void finish(dfu_state_t result, const char *what) {
+    uint32_t elapsed = to_ms_since_boot(get_absolute_time()) - start_ms;
+    printf("Update %s: %lu of %lu bytes in %lu ms\n", what, (unsigned long)written,
+           (unsigned long)size, (unsigned long)elapsed);
+    __atomic_store_n(&state, result, __ATOMIC_RELEASE);
+}
+
+typedef struct {
+    uint32_t offset;
+    const uint8_t *data;
+    uint32_t length;
+} program_job_t;
+
+// Runs with the other core parked and interrupts off
+static void program_sector(void *param) {
+    const program_job_t *job = param;
+    flash_range_erase(job->offset, FLASH_SECTOR_SIZE);
+    flash_range_program(job->offset, job->data, job->length);
+}
+
+// What reset would run: a stack in RAM and a Thumb entry point in the image
+static bool vector_table_valid(void) {
+    const uint32_t *vectors = (const uint32_t *)(XIP_BASE + STAGING_OFFSET + VECTOR_TABLE_OFFSET);
+    uint32_t stack = vectors[0];
+    uint32_t reset = vectors[1];
+    return stack - SRAM_BASE <= SRAM_SIZE && (reset & 1) && reset - XIP_BASE < size;
+}
+
+void dfu_task(void) {
+    if (__atomic_load_n(&state, __ATOMIC_ACQUIRE) != DFU_RECEIVING) return;
+    if (__atomic_load_n(&aborted, __ATOMIC_ACQUIRE)) {
+        finish(DFU_FAILED, "aborted");
+        return;
+    }
+    
+    uint32_t length = size - written < FLASH_SECTOR_SIZE ? size - written : FLASH_SECTOR_SIZE;
+    if (__atomic_load_n(&received, __ATOMIC_ACQUIRE) - written < length) return;
+    
+    // Sector aligned in the image and the buffer alike. The last one is
+    // padded to whole pages; nothing else goes into the buffer after it.
+    uint8_t *data = &buffer[written % DFU_BUFFER_SIZE];
+    program_job_t job = {
+        .offset = STAGING_OFFSET + written,
+        .data = data,
+        .length = (length + FLASH_PAGE_SIZE - 1) & ~(FLASH_PAGE_SIZE - 1),
+    };
+    memset(data + length, 0xFF, job.length - length);
+    if (flash_safe_execute(program_sector, &job, 100) != PICO_OK) return;
+    
+    // Check what flash holds now, not what was in the buffer
+    crc = crc32_update(crc, (const uint8_t *)(XIP_BASE + job.offset), length);
+    __atomic_store_n(&written, written + length, __ATOMIC_RELEASE);
+    if (written < size) return;
+    
+    if (~crc != expected_crc) {
+        finish(DFU_FAILED, "failed its checksum");
+    } else if (!vector_table_valid()) {
+        finish(DFU_FAILED, "is no firmware image");
+    } else {
+        finish(DFU_VERIFIED, "verified");
+    }
+}
+
+dfu_state_t dfu_state(void) {
+    return __atomic_load_n(&state, __ATOMIC_ACQUIRE);
+}
+
+uint32_t dfu_size(void) {
+    return size;
+}
+
+uint32_t dfu_received(void) {
+    return __atomic_load_n(&received, __ATOMIC_ACQUIRE);
+}
+
+uint32_t dfu_written(void) {
+    return __atomic_load_n(&written, __ATOMIC_ACQUIRE);
+}
+
+const uint8_t *dfu_image(uint32_t *image_size, uint32_t *image_crc) {
+    if (dfu_state() != DFU_VERIFIED) return NULL;
+    *image_size = size;
+    *image_crc = expected_crc;
+    return (const uint8_t *)(XIP_BASE + STAGING_OFFSET);
+}
+
+static void __no_inline_not_in_flash_func(copy_sector)(uint32_t offset) {
+    static uint32_t sector[FLASH_SECTOR_SIZE / 4];
+    // Volatile, so the copy doesn't become a call to memcpy in flash
+    const volatile uint32_t *staged = (const volatile uint32_t *)(XIP_BASE + STAGING_OFFSET + offset);
+    for (uint32_t i = 0; i < FLASH_SECTOR_SIZE / 4; i++) {
+        sector[i] = staged[i];
+    }
+    flash_range_erase(offset, FLASH_SECTOR_SIZE);
+    flash_range_program(offset, (const uint8_t *)sector, FLASH_SECTOR_SIZE);
+}
+
+// Runs from RAM with the other core parked and interrupts off, and never
+// returns: the firmware it was called from is being overwritten. The
+// watchdog goes off first, the copy takes seconds.
+//
+// The first sector holds the second stage boot loader, which the boot ROM
+// checks before running anything from flash. It is erased first and
+// written last, so a copy cut short by a power loss can't boot a mix of
+// both firmwares: the boot ROM finds no valid boot loader and comes up as
+// the USB drive (BOOTSEL) without the button.
+static void __no_inline_not_in_flash_func(swap_image)(void *param) {
+    uint32_t image_size = *(const uint32_t *)param;
+    
+    hw_clear_bits(&watchdog_hw->ctrl, WATCHDOG_CTRL_ENABLE_BITS);
+    flash_range_erase(0, FLASH_SECTOR_SIZE);
+    for (uint32_t offset = FLASH_SECTOR_SIZE; offset < image_size; offset += FLASH_SECTOR_SIZE) {
+        copy_sector(offset);
+    }
+    copy_sector(0);
+    
+    // Reset through the watchdog, which the next boot takes for a cold one
+    // (recovery.c) with the scratch register cleared
+    watchdog_hw->scratch[4] = 0;
+    hw_set_bits(&watchdog_hw->ctrl, WATCHDOG_CTRL_TRIGGER_BITS);
+    while (true) {
+    }
+}
+
+void dfu_swap(void) {
+    uint32_t image_size;
+    uint32_t image_crc;
+    if (!dfu_image(&image_size, &image_crc)) return;
+    
+    printf("Installing the update\n");
+    stdio_flush();
+    flash_safe_execute(swap_image, &image_size, 100);
+}
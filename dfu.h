@@ -0,0 +1,99 @@
+/**
+ * Firmware Update
+ * New firmware for a half reaches it over the dongle's link, no BOOTSEL
+ * needed. The host stages the image on the dongle over raw HID. The dongle
+ * opens an L2CAP credit-based channel to the half and streams the image
+ * there in large SDUs (central.c). The half stages it again in its own
+ * flash, verifies it and then swaps it in. The half only opens the channel
+ * once the dongle's link is encrypted with an LE Secure Connections bond.
+ * It accepts a new bond only while it has none, or in the first minute after
+ * power-on (half.c).
+ *
+ * Staging, on both ends: the upper half of flash, below the key stats and
+ * BTstack's flash bank. The firmware running must fit below it, and so must
+ * the image. The image arrives in order through a buffer in RAM. The main
+ * loop writes it to flash a sector at a time, with the other core parked
+ * (flash_safe_execute(), as key_stats.c does). It computes the CRC-32 of
+ * what reads back from flash as it goes. The image is verified once the
+ * last sector is written: the CRC must match the one sent ahead of it, and
+ * the image must start with a vector table.
+ *
+ * Swap: the staged image is copied over the running one by code in RAM,
+ * with interrupts off. The chip then resets into the new firmware. Without
+ * a bootloader an interrupted copy can't be resumed: the code to do it would
+ * be in the flash being overwritten. The boot sector is erased first and
+ * written last, so power lost during the copy (a few seconds) always leaves
+ * the half in the boot ROM's USB bootloader, never in half-copied firmware.
+ *
+ * Channel protocol (DFU_PSM), one message per SDU, type byte first:
+ *   dongle -> half  BEGIN size(4) crc32(4), DATA bytes..., SWAP
+ *   half -> dongle  STATUS state(1) written(4), after BEGIN, after each
+ *                   sector written and when the image is verified or fails
+ * The dongle keeps at most DFU_WINDOW bytes ahead of what the half has
+ * written, so the half's buffer never overflows. The image streams at the
+ * link's or the flash's pace, with no round trip per write. Sent after a
+ * VERIFIED status, SWAP makes the half close the link and swap.
+ */
+
+#ifndef DFU_H
+#define DFU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define DFU_BUFFER_SIZE (16 * 1024)     // Image bytes on their way to flash, whole sectors
+#define DFU_WINDOW DFU_BUFFER_SIZE      // Most the dongle sends ahead of the half
+
+// L2CAP channel
+#define DFU_PSM 0x0081                  // LE dynamic range
+#define DFU_DATA_SIZE 1024              // Image bytes per DATA SDU
+#define DFU_MTU (1 + DFU_DATA_SIZE)     // Largest SDU either way
+
+enum {
+    DFU_MSG_BEGIN = 0x01,
+    DFU_MSG_DATA = 0x02,
+    DFU_MSG_SWAP = 0x03,
+    DFU_MSG_STATUS = 0x81,
+};
+
+#define DFU_STATUS_SIZE 6
+
+typedef enum {
+    DFU_IDLE,
+    DFU_RECEIVING,          // Between BEGIN and the last sector written
+    DFU_VERIFIED,           // Staged and checked, ready to send or swap
+    DFU_FAILED,             // Checksum or vector table wrong, or aborted
+} dfu_state_t;
+
+// Start staging an image of size bytes with this CRC-32 (as zlib.crc32).
+// Fails while another image is still being received, or if it doesn't fit.
+bool dfu_begin(uint32_t size, uint32_t crc);
+
+// Append the next bytes of the image: all of them, or none if the buffer
+// is full. Staging may happen from one core while the other runs dfu_task().
+bool dfu_write(const uint8_t *data, uint16_t len);
+
+// Give up the image being received. It stops at dfu_task()'s next call.
+void dfu_abort(void);
+
+// Write buffered bytes to flash, a sector per call, and verify the image
+// after its last sector. Core 0 main loop, without the BTstack lock. Pauses
+// the other core for about 50 ms per sector.
+void dfu_task(void);
+
+dfu_state_t dfu_state(void);
+
+// Size of the image being or last staged, bytes buffered so far, and bytes
+// written to flash and checked so far
+uint32_t dfu_size(void);
+uint32_t dfu_received(void);
+uint32_t dfu_written(void);
+
+// The verified image in flash, or NULL
+const uint8_t *dfu_image(uint32_t *size, uint32_t *crc);
+
+// Copy the verified image over the running firmware and reset into it.
+// Returns only if there is no verified image.
+void dfu_swap(void);
+
+#endif // DFU_H
@@ -2,13 +2,18 @@
  * Keyboard Dongle
  * Receives key events from both halves via BLE UART
  * Processes layers, macros, and sends USB HID to computer
+ *
+ * Key processing lives in keyboard.c and the BLE central in central.c,
+ * so the dongle-less half build can reuse them. Built with RELAY the dongle
+ * only connects to the left half, which forwards the right half's events.
  */
 
 #include <stdio.h>
-#include <string.h>
 #include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "pico/flash.h"
 #include "pico/cyw43_arch.h"
-#include "hardware/gpio.h"
+#include "hardware/sync.h"
 
 // Include TinyUSB first to avoid conflicts
 #include "tusb.h"
@@ -19,646 +24,201 @@
 // Then include BTstack headers
 #include "btstack_run_loop.h"
 #include "hci.h"
-#include "hci_cmd.h"
-#include "btstack_event.h"
-#include "gap.h"
 #include "l2cap.h"
 #include "ble/sm.h"
-#include "ble/att_server.h"
-#include "ble/gatt_client.h"
 
-// Include keymap configuration
-#include "keymap.h"
+#include "keyboard.h"
+#include "central.h"
+#include "raw_hid.h"
+#include "klog.h"
+#include "boot_timeline.h"
+#include "recovery.h"
+#include "dfu.h"
 
-// Key event structure (must match keyboard halves)
+// Per-core utilization, accumulated by each core over the stats window
 typedef struct {
-    uint8_t type;      // 0 = key press, 1 = key release
-    uint8_t row;
-    uint8_t col;
-    uint8_t side;      // 0 = left, 1 = right
-} key_event_t;
+    volatile uint32_t busy_us;
+    volatile uint32_t total_us;
+} core_stats_t;
 
-// Current layer
-static uint8_t current_layer = 0;
+static core_stats_t core_stats[2] = {0};
+#define CORE_STATS_INTERVAL_MS 10000
 
-// Key states for each side
-static bool key_state[SIDES][ROWS][COLS] = {0};
+// USB core (core 1)
 
-// USB HID keyboard report
-static uint8_t kbd_report[8] = {0};  // Modifier, reserved, 6 keys
-static bool report_changed = false;
-
-// Mouse state
-static int8_t mouse_x = 0, mouse_y = 0;
-static uint8_t mouse_buttons = 0;
-static bool mouse_report_pending = false;
-
-// Auto-click state
-static bool auto_click_active = false;
-static uint32_t auto_click_interval = 100;  // ms
-static uint32_t last_auto_click = 0;
-
-// Macro support
-#define MAX_MACRO_LENGTH 32
-#define MAX_MACROS 16
-
-typedef struct {
-    uint8_t length;
-    uint8_t keys[MAX_MACRO_LENGTH];
-} macro_t;
-
-static macro_t macros[MAX_MACROS] = {0};
-static int active_macro = -1;
-static uint8_t macro_position = 0;
-static uint32_t last_macro_time = 0;
-#define MACRO_KEY_DELAY 50  // ms between macro keys
-
-void init_macros(void) {
-    // Example macro 0: "Hello"
-    macros[0].length = 5;
-    macros[0].keys[0] = HID_KEY_H;
-    macros[0].keys[1] = HID_KEY_E;
-    macros[0].keys[2] = HID_KEY_L;
-    macros[0].keys[3] = HID_KEY_L;
-    macros[0].keys[4] = HID_KEY_O;
-    
-    // Example macro 1: Ctrl+C
-    macros[1].length = 1;
-    macros[1].keys[0] = HID_KEY_C | 0x80;  // High bit indicates Ctrl modifier
-    
-    // Add more macros as needed
-}
-
-void add_key_to_report(uint8_t keycode) {
-    // Check if it's a modifier
-    if (keycode >= HID_MOD_LEFT_CTRL && keycode <= HID_MOD_RIGHT_GUI) {
-        kbd_report[0] |= keycode;
-        return;
-    }
-    
-    // Add to key slots (skip if already present)
-    for (int i = 2; i < 8; i++) {
-        if (kbd_report[i] == keycode) return;
-    }
-    
-    // Find empty slot
-    for (int i = 2; i < 8; i++) {
-        if (kbd_report[i] == 0) {
-            kbd_report[i] = keycode;
-            return;
-        }
-    }
-}
-
-void remove_key_from_report(uint8_t keycode) {
-    // Check if it's a modifier
-    if (keycode >= HID_MOD_LEFT_CTRL && keycode <= HID_MOD_RIGHT_GUI) {
-        kbd_report[0] &= ~keycode;
-        return;
-    }
-    
-    // Remove from key slots
-    for (int i = 2; i < 8; i++) {
-        if (kbd_report[i] == keycode) {
-            kbd_report[i] = 0;
-        }
-    }
-}
-
-void send_keyboard_report(void) {
-    if (tud_hid_ready()) {
-        tud_hid_keyboard_report(1, kbd_report[0], &kbd_report[2]);
-        report_changed = false;
-    }
-}
-
-void send_mouse_report(void) {
-    if (tud_hid_ready() && mouse_report_pending) {
-        tud_hid_mouse_report(2, mouse_buttons, mouse_x, mouse_y, 0, 0);
-        mouse_x = 0;
-        mouse_y = 0;
-        mouse_report_pending = false;
-    }
-}
-
-void process_key_event(key_event_t* event) {
-    uint8_t side = event->side;
-    uint8_t row = event->row;
-    uint8_t col = event->col;
-    bool pressed = (event->type == 0);
-    
-    // Update key state
-    key_state[side][row][col] = pressed;
-    
-    // Get keycode from current layer
-    uint8_t keycode = keymap[current_layer][side][row][col];
-    
-    if (keycode == 0) return;  // No mapping
-    
-    // Handle special keys
-    if (keycode >= KEY_LAYER_1 && keycode <= KEY_LAYER_3) {
-        if (pressed) {
-            current_layer = keycode - KEY_LAYER_1 + 1;
-            printf("Layer: %d\n", current_layer);
-        } else {
-            current_layer = 0;  // Back to base layer
-        }
-        return;
-    }
-    
-    // Handle macros
-    if (keycode >= KEY_MACRO_0 && keycode < KEY_MACRO_0 + MAX_MACROS) {
-        if (pressed) {
-            active_macro = keycode - KEY_MACRO_0;
-            macro_position = 0;
-            last_macro_time = to_ms_since_boot(get_absolute_time());
-            printf("Macro %d triggered\n", active_macro);
-        }
-        return;
-    }
-    
-    // Handle mouse buttons
-    if (keycode == KEY_MOUSE_LEFT) {
-        if (pressed) mouse_buttons |= 0x01;
-        else mouse_buttons &= ~0x01;
-        mouse_report_pending = true;
-        return;
-    }
-    if (keycode == KEY_MOUSE_RIGHT) {
-        if (pressed) mouse_buttons |= 0x02;
-        else mouse_buttons &= ~0x02;
-        mouse_report_pending = true;
-        return;
-    }
-    if (keycode == KEY_MOUSE_MIDDLE) {
-        if (pressed) mouse_buttons |= 0x04;
-        else mouse_buttons &= ~0x04;
-        mouse_report_pending = true;
-        return;
-    }
-    
-    // Handle mouse movement
-    if (keycode >= KEY_MOUSE_UP && keycode <= KEY_MOUSE_RIGHT_MOVE) {
-        if (pressed) {
-            switch(keycode) {
-                case KEY_MOUSE_UP: mouse_y = -10; break;
-                case KEY_MOUSE_DOWN: mouse_y = 10; break;
-                case KEY_MOUSE_LEFT_MOVE: mouse_x = -10; break;
-                case KEY_MOUSE_RIGHT_MOVE: mouse_x = 10; break;
-            }
-            mouse_report_pending = true;
-        }
-        return;
-    }
-    
-    // Handle auto-click toggle
-    if (keycode == KEY_AUTO_CLICK) {
-        if (pressed) {
-            auto_click_active = !auto_click_active;
-            printf("Auto-click: %s\n", auto_click_active ? "ON" : "OFF");
-        }
-        return;
-    }
-    
-    // Regular keyboard key
-    if (pressed) {
-        add_key_to_report(keycode);
-    } else {
-        remove_key_from_report(keycode);
-    }
-    report_changed = true;
-}
-
-void process_macro(void) {
-    if (active_macro < 0) return;
-    
-    uint32_t now = to_ms_since_boot(get_absolute_time());
-    if (now - last_macro_time < MACRO_KEY_DELAY) return;
-    
-    macro_t* macro = &macros[active_macro];
-    
-    if (macro_position >= macro->length) {
-        // Macro complete
-        active_macro = -1;
-        macro_position = 0;
-        return;
-    }
-    
-    uint8_t key = macro->keys[macro_position];
-    bool has_ctrl = key & 0x80;
-    key &= 0x7F;
-    
-    // Press
-    memset(kbd_report, 0, sizeof(kbd_report));
-    if (has_ctrl) kbd_report[0] = HID_MOD_LEFT_CTRL;
-    kbd_report[2] = key;
-    send_keyboard_report();
-    
-    sleep_ms(20);
-    
-    // Release
-    memset(kbd_report, 0, sizeof(kbd_report));
-    send_keyboard_report();
+// Core 1 entry: TinyUSB servicing and report emission only
+void core1_usb_loop(void) {
+    // Let dfu_task() park this core while it writes flash
+    flash_safe_execute_core_init();
     
-    macro_position++;
-    last_macro_time = now;
-}
-
-void process_auto_click(void) {
-    if (!auto_click_active) return;
-    
-    uint32_t now = to_ms_since_boot(get_absolute_time());
-    if (now - last_auto_click < auto_click_interval) return;
-    
-    // Click
-    mouse_buttons |= 0x01;
-    mouse_report_pending = true;
-    send_mouse_report();
-    
-    sleep_ms(20);
-    
-    // Release
-    mouse_buttons &= ~0x01;
-    mouse_report_pending = true;
-    send_mouse_report();
-    
-    last_auto_click = now;
-}
-
-// BLE GATT handlers
-static hci_con_handle_t left_handle = HCI_CON_HANDLE_INVALID;
-static hci_con_handle_t right_handle = HCI_CON_HANDLE_INVALID;
-static gatt_client_notification_t left_notification_listener;
-static gatt_client_notification_t right_notification_listener;
-
-// UUIDs for keyboard service
-static const uint8_t keyboard_service_uuid[] = {0x9E, 0xCA, 0xDC, 0x24, 0x0E, 0xE5, 0xA9, 0xE0, 
-                                                 0x93, 0xF3, 0xA3, 0xB5, 0x01, 0x00, 0x40, 0x6E};
-
-// Connection state
-typedef enum {
-    STATE_IDLE,
-    STATE_W4_SCAN_RESULT,
-    STATE_W4_CONNECT,
-    STATE_CONNECTED,
-    STATE_W4_SERVICE_RESULT,
-    STATE_W4_CHARACTERISTIC_RESULT,
-    STATE_W4_ENABLE_NOTIFICATIONS,
-    STATE_READY
-} connection_state_t;
-
-typedef struct {
-    bd_addr_t addr;
-    bd_addr_type_t addr_type;
-    hci_con_handle_t con_handle;
-    connection_state_t state;
-    gatt_client_service_t service;
-    gatt_client_characteristic_t characteristic;
-    uint16_t service_start;
-    uint16_t service_end;
-    uint16_t char_value_handle;
-    uint16_t char_config_handle;
-    bool is_left;
-} keyboard_connection_t;
-
-static keyboard_connection_t left_kb = {.state = STATE_IDLE, .is_left = true};
-static keyboard_connection_t right_kb = {.state = STATE_IDLE, .is_left = false};
-
-static void packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size) {
-    UNUSED(channel);
-    UNUSED(size);
-    
-    if (packet_type != HCI_EVENT_PACKET) return;
-    
-    uint8_t event_type = hci_event_packet_get_type(packet);
-    
-    switch (event_type) {
-        case HCI_EVENT_DISCONNECTION_COMPLETE: {
-            hci_con_handle_t handle = hci_event_disconnection_complete_get_connection_handle(packet);
-            if (handle == left_handle) {
-                left_handle = HCI_CON_HANDLE_INVALID;
-                printf("Left half disconnected\n");
-            } else if (handle == right_handle) {
-                right_handle = HCI_CON_HANDLE_INVALID;
-                printf("Right half disconnected\n");
-            }
-            break;
-        }
-        
-        case GATT_EVENT_NOTIFICATION: {
-            key_event_t event;
-            uint16_t value_length = gatt_event_notification_get_value_length(packet);
-            if (value_length == sizeof(key_event_t)) {
-                memcpy(&event, gatt_event_notification_get_value(packet), sizeof(event));
-                process_key_event(&event);
-            }
-            break;
-        }
-    }
-}
-
-// USB HID callbacks
-void tud_hid_report_complete_cb(uint8_t instance, uint8_t const* report, uint16_t len) {
-    (void) instance;
-    (void) report;
-    (void) len;
-}
-
-uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, 
-                                uint8_t* buffer, uint16_t reqlen) {
-    (void) instance;
-    (void) report_id;
-    (void) report_type;
-    (void) buffer;
-    (void) reqlen;
-    return 0;
-}
-
-void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, 
-                            uint8_t const* buffer, uint16_t bufsize) {
-    (void) instance;
-    (void) report_id;
-    (void) report_type;
-    (void) buffer;
-    (void) bufsize;
-}
-
-// Forward declaration
-static void handle_gatt_client_event(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size);
-
-static void hci_packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size) {
-    UNUSED(channel);
-    UNUSED(size);
-    
-    if (packet_type != HCI_EVENT_PACKET) return;
+    // TinyUSB interrupts are routed to the core that calls tusb_init()
+    tusb_init();
+    boot_mark(BOOT_USB_STARTED);
+    recovery_phase(RECOVERY_USB);
     
-    uint8_t event_type = hci_event_packet_get_type(packet);
+    uint32_t window_start = time_us_32();
+    uint32_t busy_us = 0;
     
-    switch (event_type) {
-        case GAP_EVENT_ADVERTISING_REPORT: {
-            bd_addr_t addr;
-            gap_event_advertising_report_get_address(packet, addr);
-            uint8_t addr_type = gap_event_advertising_report_get_address_type(packet);
-            uint8_t length = gap_event_advertising_report_get_data_length(packet);
-            const uint8_t *data = gap_event_advertising_report_get_data(packet);
-            
-            // Look for device name in advertising data
-            bool is_left = false;
-            bool is_right = false;
-            
-            for (uint8_t i = 0; i < length; ) {
-                uint8_t field_length = data[i];
-                if (field_length == 0) break;
-                
-                uint8_t field_type = data[i + 1];
-                if (field_type == 0x09) {  // Complete local name
-                    if (memcmp(&data[i + 2], "KB_Left", 7) == 0) {
-                        is_left = true;
-                    } else if (memcmp(&data[i + 2], "KB_Right", 8) == 0) {
-                        is_right = true;
-                    }
-                }
-                i += field_length + 1;
-            }
-            
-            // Connect to discovered keyboard
-            if (is_left && left_kb.state == STATE_IDLE) {
-                memcpy(left_kb.addr, addr, 6);
-                left_kb.addr_type = addr_type;
-                left_kb.state = STATE_W4_CONNECT;
-                gap_stop_scan();
-                gap_connect(addr, addr_type);
-                printf("Connecting to left keyboard...\n");
-            } else if (is_right && right_kb.state == STATE_IDLE) {
-                memcpy(right_kb.addr, addr, 6);
-                right_kb.addr_type = addr_type;
-                right_kb.state = STATE_W4_CONNECT;
-                gap_stop_scan();
-                gap_connect(addr, addr_type);
-                printf("Connecting to right keyboard...\n");
-            }
-            break;
-        }
+    while (true) {
+        recovery_alive();
+        uint32_t start = time_us_32();
+        tud_task();
+        usb_emit_reports();
+        busy_us += time_us_32() - start;
         
-        case HCI_EVENT_LE_META: {
-            switch (hci_event_le_meta_get_subevent_code(packet)) {
-                case HCI_SUBEVENT_LE_CONNECTION_COMPLETE: {
-                    hci_con_handle_t con_handle = hci_subevent_le_connection_complete_get_connection_handle(packet);
-                    
-                    // Determine which keyboard connected
-                    keyboard_connection_t *kb = NULL;
-                    if (left_kb.state == STATE_W4_CONNECT) {
-                        kb = &left_kb;
-                        left_handle = con_handle;
-                    } else if (right_kb.state == STATE_W4_CONNECT) {
-                        kb = &right_kb;
-                        right_handle = con_handle;
-                    }
-                    
-                    if (kb) {
-                        kb->con_handle = con_handle;
-                        kb->state = STATE_W4_SERVICE_RESULT;
-                        printf("%s keyboard connected, handle=%04x\n", 
-                               kb->is_left ? "Left" : "Right", con_handle);
-                        
-                        // Discover keyboard service
-                        gatt_client_discover_primary_services_by_uuid128(
-                            handle_gatt_client_event, con_handle, (uint8_t*)keyboard_service_uuid);
-                    }
-                    
-                    // Resume scanning if we need to find the other keyboard
-                    if (left_kb.state == STATE_IDLE || right_kb.state == STATE_IDLE) {
-                        gap_set_scan_parameters(0, 0x0030, 0x0030);
-                        gap_start_scan();
-                    }
-                    break;
-                }
-            }
-            break;
-        }
+        // Woken by USB interrupts or by core 0 queueing a report
+        best_effort_wfe_or_timeout(make_timeout_time_ms(1));
         
-        case HCI_EVENT_DISCONNECTION_COMPLETE: {
-            hci_con_handle_t handle = hci_event_disconnection_complete_get_connection_handle(packet);
-            if (handle == left_handle) {
-                left_handle = HCI_CON_HANDLE_INVALID;
-                left_kb.state = STATE_IDLE;
-                left_kb.con_handle = HCI_CON_HANDLE_INVALID;
-                printf("Left half disconnected\n");
-                
-                // Restart scanning
-                gap_set_scan_parameters(0, 0x0030, 0x0030);
-                gap_start_scan();
-            } else if (handle == right_handle) {
-                right_handle = HCI_CON_HANDLE_INVALID;
-                right_kb.state = STATE_IDLE;
-                right_kb.con_handle = HCI_CON_HANDLE_INVALID;
-                printf("Right half disconnected\n");
-                
-                // Restart scanning
-                gap_set_scan_parameters(0, 0x0030, 0x0030);
-                gap_start_scan();
-            }
-            break;
+        uint32_t elapsed = time_us_32() - window_start;
+        if (elapsed >= CORE_STATS_INTERVAL_MS * 1000) {
+            core_stats[1].busy_us = busy_us;
+            core_stats[1].total_us = elapsed;
+            window_start += elapsed;
+            busy_us = 0;
         }
     }
 }
 
-static void handle_gatt_client_event(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size) {
-    UNUSED(packet_type);
-    UNUSED(channel);
-    UNUSED(size);
-    
-    keyboard_connection_t *kb = NULL;
-    
-    // Determine which keyboard this event is for
-    uint16_t event_handle = HCI_CON_HANDLE_INVALID;
-    switch(hci_event_packet_get_type(packet)) {
-        case GATT_EVENT_QUERY_COMPLETE:
-            event_handle = gatt_event_query_complete_get_handle(packet);
-            break;
-        case GATT_EVENT_SERVICE_QUERY_RESULT:
-            event_handle = gatt_event_service_query_result_get_handle(packet);
-            break;
-        case GATT_EVENT_CHARACTERISTIC_QUERY_RESULT:
-            event_handle = gatt_event_characteristic_query_result_get_handle(packet);
-            break;
-    }
-    
-    if (event_handle == left_kb.con_handle) kb = &left_kb;
-    else if (event_handle == right_kb.con_handle) kb = &right_kb;
-    
-    if (!kb) return;
-    
-    switch(hci_event_packet_get_type(packet)) {
-        case GATT_EVENT_SERVICE_QUERY_RESULT: {
-            gatt_event_service_query_result_get_service(packet, &kb->service);
-            kb->service_start = kb->service.start_group_handle;
-            kb->service_end = kb->service.end_group_handle;
-            printf("%s: Service found %04x-%04x\n", kb->is_left ? "Left" : "Right", 
-                   kb->service_start, kb->service_end);
-            break;
-        }
-        
-        case GATT_EVENT_CHARACTERISTIC_QUERY_RESULT: {
-            gatt_event_characteristic_query_result_get_characteristic(packet, &kb->characteristic);
-            kb->char_value_handle = kb->characteristic.value_handle;
-            kb->char_config_handle = kb->characteristic.value_handle + 1;  // CCC is typically next handle
-            printf("%s: Characteristic found, value=%04x, config=%04x\n", 
-                   kb->is_left ? "Left" : "Right", kb->char_value_handle, kb->char_config_handle);
-            break;
-        }
-        
-        case GATT_EVENT_QUERY_COMPLETE: {
-            uint8_t status = gatt_event_query_complete_get_att_status(packet);
-            if (status != ATT_ERROR_SUCCESS) {
-                printf("%s: Query failed: %02x\n", kb->is_left ? "Left" : "Right", status);
-                kb->state = STATE_IDLE;
-                return;
-            }
-            
-            switch(kb->state) {
-                case STATE_W4_SERVICE_RESULT:
-                    if (kb->service_start != 0) {
-                        kb->state = STATE_W4_CHARACTERISTIC_RESULT;
-                        gatt_client_discover_characteristics_for_service(
-                            handle_gatt_client_event, kb->con_handle, &kb->service);
-                    }
-                    break;
-                    
-                case STATE_W4_CHARACTERISTIC_RESULT:
-                    if (kb->char_value_handle != 0) {
-                        kb->state = STATE_W4_ENABLE_NOTIFICATIONS;
-                        uint8_t config[] = {0x01, 0x00};  // Enable notifications
-                        gatt_client_write_value_of_characteristic(
-                            handle_gatt_client_event, kb->con_handle,
-                            kb->char_config_handle, sizeof(config), config);
-                    }
-                    break;
-                    
-                case STATE_W4_ENABLE_NOTIFICATIONS:
-                    kb->state = STATE_READY;
-                    printf("%s keyboard ready!\n", kb->is_left ? "Left" : "Right");
-                    
-                    // Register for notifications
-                    gatt_client_listen_for_characteristic_value_updates(
-                        kb->is_left ? &left_notification_listener : &right_notification_listener,
-                        handle_gatt_client_event, kb->con_handle, &kb->characteristic);
-                    break;
-                    
-                default:
-                    break;
-            }
-            break;
-        }
-        
-        case GATT_EVENT_NOTIFICATION: {
-            key_event_t event;
-            uint16_t value_length = gatt_event_notification_get_value_length(packet);
-            if (value_length == sizeof(key_event_t)) {
-                memcpy(&event, gatt_event_notification_get_value(packet), sizeof(event));
-                process_key_event(&event);
-            }
-            break;
-        }
-    }
+#ifdef RELAY
+// The left half's link carries the right half's keys as well
+static void release_half(uint8_t side) {
+    UNUSED(side);
+    keyboard_release_side(SIDE_LEFT);
+    keyboard_release_side(SIDE_RIGHT);
+}
+#endif
+
+void print_core_stats(void) {
+    for (int core = 0; core < 2; core++) {
+        uint32_t total = core_stats[core].total_us;
+        if (total == 0) continue;
+        uint32_t permille = (uint32_t)((uint64_t)core_stats[core].busy_us * 1000 / total);
+        printf("Core %d: %lu.%lu%% busy%s\n", core,
+               (unsigned long)(permille / 10), (unsigned long)(permille % 10),
+               core == 0 ? " (main loop, radio interrupts not counted)" : "");
+    }
+    const spsc_queue_t *usb_queue = keyboard_usb_queue();
+    printf("USB queue: %lu reports, %lu overflows, high water %u\n",
+           (unsigned long)usb_queue->pushed, (unsigned long)usb_queue->overflows,
+           usb_queue->high_water);
 }
 
 int main() {
     stdio_init_all();
     
-    // Initialize USB
-    tusb_init();
+    // Watchdog, and what a watchdog reset left behind
+    recovery_init();
     
-    // Initialize macros
-    init_macros();
+    // Key path logging, before anything can log
+    klog_init();
+    
+    // Initialize key processing (report queue, macros) before USB starts draining it
+    keyboard_init();
+    
+    // Initialize USB on its own core
+    multicore_launch_core1(core1_usb_loop);
     
     // Initialize CYW43 for BLE
     if (cyw43_arch_init()) {
         printf("Failed to initialize CYW43\n");
         return 1;
     }
+    boot_mark(BOOT_RADIO_READY);
     
     // Initialize BTstack
     l2cap_init();
     sm_init();
-    gatt_client_init();
-    
-    // Register packet handler
-    btstack_packet_callback_registration_t callback_registration;
-    callback_registration.callback = &hci_packet_handler;
-    hci_add_event_handler(&callback_registration);
     
-    // Start scanning for keyboard halves
-    gap_set_scan_parameters(0, 0x0030, 0x0030);
-    gap_start_scan();
+#ifdef RELAY
+    // The left half relays the right half's events over its own link
+    central_init(true, false, process_key_event_batch);
+    central_set_disconnect_handler(release_half);
+#else
+    // Connect to both halves
+    central_init(true, true, process_key_event_batch);
+    central_set_disconnect_handler(keyboard_release_side);
+#endif
     
     // Turn on Bluetooth
     hci_power_control(HCI_POWER_ON);
     
     printf("Dongle initialized\n");
+#ifdef KLOG_BENCHMARK
+    klog_benchmark();
+#endif
     printf("Scanning for keyboard halves...\n");
     
     // Main loop
+    uint32_t window_start = time_us_32();
+    uint32_t idle_us = 0;
+    async_context_t *context = cyw43_arch_async_context();
     while (true) {
-        // Process USB
-        tud_task();
+        recovery_feed();
+    
+        // Macros, auto-click, scrolling and pending reports. Key events arrive
+        // from BTstack callbacks, so hold its lock while touching the same state.
+        recovery_phase(RECOVERY_KEYS);
+        async_context_acquire_lock_blocking(context);
+        keyboard_task();
+    
+        // Key stats the host asked for over raw HID
+        int stats_side = raw_hid_stats_requested();
+        if (stats_side >= 0 && !central_read_key_stats(stats_side == SIDE_LEFT, raw_hid_stats_done)) {
+            raw_hid_stats_done(NULL, 0);
+        }
+    
+        // Firmware update of a half the host asked for, and its progress
+        int update_side = raw_hid_dfu_requested();
+        if (update_side >= 0 && !central_send_update(update_side == SIDE_LEFT, raw_hid_dfu_done)) {
+            raw_hid_dfu_done(false);
+        }
+        uint8_t progress[CENTRAL_UPDATE_PROGRESS_SIZE];
+        raw_hid_set_dfu_progress(progress, central_update_progress(progress));
+    
+        // Slow the halves down while the host sleeps
+        recovery_phase(RECOVERY_BLUETOOTH);
+        central_set_low_power(keyboard_usb_suspended());
+    
+        // Keep each half's link reliable, and its telemetry current for raw HID
+        if (central_link_task()) {
+            for (int side = SIDE_LEFT; side <= SIDE_RIGHT; side++) {
+                uint8_t link_stats[CENTRAL_LINK_STATS_SIZE];
+                raw_hid_set_link_stats(side, link_stats, central_link_stats(side == SIDE_LEFT, link_stats));
+            }
+        }
+        async_context_release_lock(context);
         
-        // Process macros
-        process_macro();
+        // Firmware the host is staging for a half, a sector at a time
+        recovery_phase(RECOVERY_FLASH);
+        dfu_task();
         
-        // Process auto-click
-        process_auto_click();
+        // Log records from the key path, as far as the UART takes them
+        recovery_phase(RECOVERY_LOG);
+        klog_drain();
+        boot_timeline_task();
         
-        // Send reports if needed
-        if (report_changed) {
-            send_keyboard_report();
-        }
-        if (mouse_report_pending) {
-            send_mouse_report();
-        }
+        // Busy is everything but this wait. BTstack and the CYW43 driver run
+        // from the async context's interrupt on this core, mostly during the
+        // wait, and count as idle: core 0's figure is a lower bound on its load.
+        recovery_phase(RECOVERY_IDLE);
+        uint32_t idle_start = time_us_32();
+        best_effort_wfe_or_timeout(make_timeout_time_ms(1));
+        idle_us += time_us_32() - idle_start;
         
-        sleep_ms(1);
+        uint32_t elapsed = time_us_32() - window_start;
+        if (elapsed >= CORE_STATS_INTERVAL_MS * 1000) {
+            recovery_phase(RECOVERY_LOG);
+            core_stats[0].busy_us = elapsed - idle_us;
+            core_stats[0].total_us = elapsed;
+            window_start += elapsed;
+            idle_us = 0;
+            print_core_stats();
+            async_context_acquire_lock_blocking(context);
+            central_print_link_stats();
+            async_context_release_lock(context);
+        }
     }
     
     return 0;
 }
+
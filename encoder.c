@@ -0,0 +1,69 @@
+/**
+ * Rotary Encoders
+ */
+
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "encoder.pio.h"
+#include "encoder.h"
+
+#define ENCODER_PIO pio0    // The CYW43 driver prefers pio1
+
+static uint encoder_sm[ENCODERS];
+static int32_t reported_steps[ENCODERS];  // Steps already reported as detents
+static uint32_t last_report_us = 0;
+
+void encoder_init(const unsigned int *a_pins) {
+    // The jump table is indexed by absolute address
+    pio_add_program_at_offset(ENCODER_PIO, &quadrature_encoder_program, 0);
+    
+    for (int i = 0; i < ENCODERS; i++) {
+        uint sm = pio_claim_unused_sm(ENCODER_PIO, true);
+        encoder_sm[i] = sm;
+        reported_steps[i] = 0;
+        
+        // Inputs with pull-ups, the encoder switches them to ground
+        for (uint pin = a_pins[i]; pin <= a_pins[i] + 1; pin++) {
+            pio_gpio_init(ENCODER_PIO, pin);
+            gpio_pull_up(pin);
+        }
+        pio_sm_set_consecutive_pindirs(ENCODER_PIO, sm, a_pins[i], 2, false);
+        
+        pio_sm_config config = quadrature_encoder_program_get_default_config(0);
+        sm_config_set_in_pins(&config, a_pins[i]);
+        sm_config_set_in_shift(&config, false, false, 32);   // Left: previous state above pins
+        sm_config_set_out_shift(&config, true, false, 32);   // Right: out takes the newest state
+        sm_config_set_fifo_join(&config, PIO_FIFO_JOIN_RX);
+        sm_config_set_clkdiv(&config, 1.0f);                 // Samples every ~80 ns
+        pio_sm_init(ENCODER_PIO, sm, 0, &config);
+        pio_sm_set_enabled(ENCODER_PIO, sm, true);
+    }
+}
+
+// The state machine pushes all the time: drain the FIFO and take one more,
+// which is guaranteed current
+static int32_t read_steps(uint sm) {
+    uint32_t count = 0;
+    for (uint n = pio_sm_get_rx_fifo_level(ENCODER_PIO, sm) + 1; n > 0; n--) {
+        count = pio_sm_get_blocking(ENCODER_PIO, sm);
+    }
+    return (int32_t)count;
+}
+
+uint32_t encoder_poll(uint32_t now_us, encoder_event_cb_t cb) {
+    if (now_us - last_report_us < ENCODER_REPORT_US) return 0;
+    last_report_us = now_us;
+    
+    uint32_t events = 0;
+    for (uint8_t i = 0; i < ENCODERS; i++) {
+        int32_t detents = (read_steps(encoder_sm[i]) - reported_steps[i]) / ENCODER_STEPS_PER_DETENT;
+        if (detents == 0) continue;
+        if (detents > 127) detents = 127;
+        if (detents < -127) detents = -127;
+        
+        reported_steps[i] += detents * ENCODER_STEPS_PER_DETENT;
+        cb(i, (int8_t)(detents * ENCODER_DIRECTION));
+        events++;
+    }
+    return events;
+}
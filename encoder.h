@@ -0,0 +1,30 @@
+/**
+ * Rotary Encoders
+ * Quadrature decoding in a PIO state machine per encoder (encoder.pio), so
+ * no edge is missed however fast the knob spins. The scan core reads the
+ * counts and hands on whole detents.
+ */
+
+#ifndef ENCODER_H
+#define ENCODER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define ENCODERS 1                    // Per half (matches keymap.h)
+#define ENCODER_STEPS_PER_DETENT 4    // Edges per click of the knob
+#define ENCODER_DIRECTION 1           // -1 if clockwise counts down with your wiring
+#define ENCODER_REPORT_US 5000        // At most one event per encoder this often
+
+// Called with the detents turned since the last call, clockwise positive
+typedef void (*encoder_event_cb_t)(uint8_t index, int8_t detents);
+
+// Start a state machine per encoder on pio0. Pin B is the pin after pin A.
+void encoder_init(const unsigned int *a_pins);
+
+// Report the detents turned since the last report, at most once per
+// ENCODER_REPORT_US; the rest of a large turn follows in the next report.
+// Returns the number of events reported.
+uint32_t encoder_poll(uint32_t now_us, encoder_event_cb_t cb);
+
+#endif // ENCODER_H
@@ -0,0 +1,1190 @@
+/**
+ * Keyboard Half
+ * Scans matrix and sends key events via wireless UART to dongle
+ *
+ * Both halves are built from this file, with THIS_SIDE and HALF_NAME (the
+ * name it advertises) set per target in CMakeLists.txt.
+ *
+ * Built with DONGLELESS this half is the USB keyboard instead: it connects to
+ * the other half as a BLE central and runs the dongle's key processing itself.
+ *
+ * Built with RELAY this half is also a central of the other half and
+ * forwards its events, merged with its own, over the single link to the dongle.
+ *
+ * Built with JOYSTICK it also streams a thumbstick's motion (joystick.h), and
+ * with ENCODER the turns of its rotary encoders (encoder.h). Built with
+ * ANALOG_KEYS it reads Hall-effect keys (analog_matrix.h) instead of the
+ * switch matrix.
+ *
+ * New firmware comes from the dongle over an L2CAP channel (dfu.h); built
+ * with DONGLELESS this half sends it to the other half instead.
+ *
+ * Built with KEY_L2CAP it sends its key events over an L2CAP channel to the
+ * dongle (key_event.h) rather than as notifications, and falls back to
+ * notifications if the dongle refuses the channel.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "pico/flash.h"
+#include "pico/cyw43_arch.h"
+#ifdef DONGLELESS
+// Include TinyUSB first to avoid conflicts
+#include "tusb.h"
+// Prevent BTstack from redefining HID types
+#define __HID_H
+#endif
+#include "btstack.h"
+#include "bluetooth_gatt.h"
+#include "hardware/gpio.h"
+#include "hardware/sync.h"
+#include "spsc_queue.h"
+#include "matrix.h"
+#include "key_event.h"
+#include "key_tx_queue.h"
+#include "klog.h"
+#include "boot_timeline.h"
+#include "key_stats.h"
+#include "recovery.h"
+#include "dfu.h"
+#ifdef DONGLELESS
+#include "keyboard.h"
+#include "raw_hid.h"
+#else
+#include "conn_sync.h"
+#include "link_policy.h"
+#endif
+#if defined(DONGLELESS) || defined(RELAY)
+#include "central.h"
+#endif
+#ifdef JOYSTICK
+#include "joystick.h"
+#endif
+#ifdef ENCODER
+#include "encoder.h"
+#endif
+#ifdef ANALOG_KEYS
+#include "analog_matrix.h"
+#endif
+
+#if !defined(THIS_SIDE) || !defined(HALF_NAME)
+#error "Build with THIS_SIDE and HALF_NAME defined (see CMakeLists.txt)"
+#endif
+
+// GPIO pins for matrix (example - adjust to your wiring)
+const uint row_pins[ROWS] = {2, 3, 4, 5, 6};
+const uint col_pins[COLS] = {7, 8, 9, 10, 11, 12, 13};
+#ifdef ENCODER
+const uint encoder_pins[ENCODERS] = {14};  // Pin A, B on the next pin
+#endif
+
+#ifndef DONGLELESS
+// GATT Service and Characteristic handles
+static uint16_t keyboard_data_handle;
+static uint16_t keyboard_data_cccd_handle;
+static uint16_t db_hash_handle;
+static uint16_t key_stats_handle;
+static uint16_t power_state_handle;
+
+// Database Hash, lets the dongle reuse its cached handles on reconnect
+#define DB_HASH_LEN 16
+static uint8_t db_hash[DB_HASH_LEN];
+
+// Counters as of the first chunk of the current read, so a long read is consistent
+static uint8_t key_stats_snapshot[KEY_STATS_SIZE];
+
+static uint16_t att_read_callback(hci_con_handle_t connection_handle, uint16_t att_handle, uint16_t offset, uint8_t * buffer, uint16_t buffer_size);
+static int att_write_callback(hci_con_handle_t connection_handle, uint16_t att_handle, uint16_t transaction_mode, uint16_t offset, uint8_t *buffer, uint16_t buffer_size);
+static hci_con_handle_t connection_handle = HCI_CON_HANDLE_INVALID;
+static bool connected = false;
+static bool notifications_enabled = false;
+
+// Notification subscription is remembered for the last subscribed peer, so a
+// reconnecting dongle gets events before it has rewritten the CCCD. Kept
+// across a watchdog reset (recovery.h) as well.
+static bd_addr_t peer_addr;
+static struct {
+    bool saved;
+    bd_addr_t addr;
+} __uninitialized_ram(subscription);
+static uint32_t __uninitialized_ram(subscription_check);
+
+// Firmware update channel (dfu.h). Only taken on the dongle's link, once it
+// is encrypted with a bond from LE Secure Connections pairing. Pairing is
+// only accepted while the half has no bond, or for PAIRING_WINDOW_MS after
+// power-on, so a stranger in range can't bond and flash its own firmware.
+#define PAIRING_WINDOW_MS 60000
+static uint16_t update_cid = 0;
+static uint8_t update_sdu[DFU_MTU];
+static uint8_t update_status[DFU_STATUS_SIZE];
+static bool update_status_busy = false;     // Until L2CAP_EVENT_PACKET_SENT
+static bool update_refused = false;         // BEGIN refused: report FAILED
+static bool update_report = false;          // Report even if nothing changed
+static uint8_t update_reported_state;
+static uint32_t update_reported_written;
+static bool update_swap = false;            // SWAP received: swap once the link is down
+
+#ifdef KEY_L2CAP
+// Key channel to the dongle, opened once connected. L2CAP holds one SDU at
+// a time and sends it as the dongle's credits allow; until it has gone to
+// the controller the transmit queue keeps the events.
+static uint16_t key_cid = 0;
+static bool key_channel_open = false;
+static bool key_sdu_busy = false;           // Until L2CAP_EVENT_PACKET_SENT
+static uint16_t key_channel_mtu;
+static uint8_t key_channel_receive[KEY_CHANNEL_MTU];   // Nothing comes back, but L2CAP wants one
+static key_event_t key_sdu[KEY_TX_BATCH_MAX];
+#endif
+#endif
+
+// Debounced keys as queued for sending, written by the scan core. Kept
+// across a watchdog reset (recovery.h), so the keys let go while it
+// happened get their release.
+static matrix_row_t __uninitialized_ram(held_keys)[ROWS];
+static uint32_t __uninitialized_ram(held_keys_check);
+
+// Key events from the scan core (core 1) to the BLE core (core 0)
+#define KEY_EVENT_QUEUE_SIZE 64
+static key_event_t key_event_buffer[KEY_EVENT_QUEUE_SIZE];
+static spsc_queue_t key_event_queue;
+
+// Scan core timing statistics
+static volatile uint32_t scan_count = 0;
+static volatile uint32_t scan_overruns = 0;   // Scans that missed their slot
+static volatile uint32_t scan_max_us = 0;     // Longest single scan
+
+// Host suspend: told by the dongle (Power State), or our own USB when dongle-less.
+// The scan slows down after LOW_POWER_IDLE_MS without keys; any key speeds it up.
+#define LOW_POWER_IDLE_MS 5000
+static volatile bool low_power_requested = false;
+static volatile bool low_power = false;       // Scanning every SCAN_LOW_POWER_PERIOD_US
+static volatile uint32_t last_key_us = 0;
+
+#ifndef DONGLELESS
+// Scan-to-ack delay: start of the scan that found the events in the last
+// notification until the dongle acknowledged it
+static volatile uint32_t event_scan_us = 0;   // Scan that queued the newest event
+static uint32_t measured_scan_us = 0;         // Scan behind the notification being timed
+static bool measuring = false;
+static uint32_t scan_to_ack_count = 0;
+static uint64_t scan_to_ack_total_us = 0;
+static uint32_t scan_to_ack_max_us = 0;
+
+// Link telemetry for the dongle's link policy: when each notification still
+// in the controller was handed to it, and how many connection events the
+// acknowledged ones waited. Reported along with key events, once per
+// LINK_WINDOW_MS at most, so an idle link sends nothing.
+#define SENT_TIMES 16                          // More than the controller has buffers
+static uint32_t sent_us[SENT_TIMES];
+static uint8_t sent_first = 0;
+static uint8_t sent_count = 0;
+static uint32_t link_packets = 0;
+static uint32_t link_retransmissions = 0;
+static uint32_t link_reported_ms = 0;
+#endif
+
+#ifndef DONGLELESS
+// One packet to the dongle: on the key channel once it's open, otherwise
+// as a notification
+static bool send_key_packet(const key_event_t *events, uint16_t count) {
+#ifdef KEY_L2CAP
+    if (key_channel_open) {
+        if (key_sdu_busy) return false;
+        memcpy(key_sdu, events, count * sizeof(key_event_t));
+        if (l2cap_send(key_cid, (uint8_t *)key_sdu, count * sizeof(key_event_t)) != ERROR_CODE_SUCCESS) {
+            return false;
+        }
+        key_sdu_busy = true;
+        return true;
+    }
+#endif
+    return att_server_notify(connection_handle, keyboard_data_handle, (const uint8_t*)events,
+                             count * sizeof(key_event_t)) == ERROR_CODE_SUCCESS;
+}
+
+// Transmit queue backend: as many events as fit in one packet
+static uint16_t notify_key_events(const key_event_t *events, uint16_t count) {
+    uint16_t payload = att_server_get_mtu(connection_handle) - 3;
+#ifdef KEY_L2CAP
+    if (key_channel_open) payload = key_channel_mtu;
+#endif
+    uint16_t max_count = payload / sizeof(key_event_t);
+    if (count > max_count) count = max_count;
+    if (!measuring) {
+        measured_scan_us = event_scan_us;
+        measuring = true;
+    }
+    if (!send_key_packet(events, count)) return 0;
+    if (sent_count == SENT_TIMES) {
+        sent_first = (sent_first + 1) % SENT_TIMES;
+        sent_count--;
+    }
+    sent_us[(sent_first + sent_count++) % SENT_TIMES] = time_us_32();
+    boot_mark(BOOT_FIRST_KEY_OUT);
+    return count;
+}
+
+static void request_can_send_now(void) {
+#ifdef KEY_L2CAP
+    if (key_channel_open) {
+        // Once the SDU in flight is out and the dongle has credit for the next
+        l2cap_request_can_send_now_event(key_cid);
+        return;
+    }
+#endif
+    att_server_request_can_send_now_event(connection_handle);
+}
+
+static void update_link_ready(void) {
+    bool ready = connected && notifications_enabled && keyboard_data_handle != 0;
+#ifdef KEY_L2CAP
+    // The dongle takes the channel's events without subscribing first
+    ready = ready || (connected && key_channel_open);
+#endif
+    if (ready) boot_mark(BOOT_DONGLE_READY);
+    key_tx_set_ready(ready, to_ms_since_boot(get_absolute_time()));
+}
+
+// Telemetry for the dongle, behind the key events it describes
+static void report_link(uint32_t now_ms) {
+    if (link_packets == 0 || now_ms - link_reported_ms < LINK_WINDOW_MS) return;
+    key_event_t event = {
+        .type = KEY_EVENT_LINK,
+        .packets = link_packets < UINT8_MAX ? link_packets : UINT8_MAX,
+        .retransmissions = link_retransmissions < UINT8_MAX ? link_retransmissions : UINT8_MAX,
+        .side = THIS_SIDE,
+    };
+    key_tx_push(&event, now_ms);
+    link_packets = 0;
+    link_retransmissions = 0;
+    link_reported_ms = now_ms;
+}
+#endif
+
+#ifdef RELAY
+// Keys of the other half we've passed on as pressed and not yet released
+static matrix_row_t relayed_held[ROWS];
+
+// Events from the other half, already tagged with its side. Runs in the
+// BTstack context, so the queue is only ever touched under its lock.
+static void relay_key_events(const key_event_t *events, uint16_t count) {
+    for (uint16_t i = 0; i < count; i++) {
+        const key_event_t *event = &events[i];
+        if (event->type > KEY_EVENT_RELEASE || event->row >= ROWS || event->col >= COLS) continue;
+        matrix_row_t bit = (matrix_row_t)1 << event->col;
+        if (event->type == KEY_EVENT_PRESS) {
+            relayed_held[event->row] |= bit;
+        } else {
+            relayed_held[event->row] &= ~bit;
+        }
+    }
+    key_tx_push_batch(events, count, to_ms_since_boot(get_absolute_time()));
+}
+
+// The other half's link dropped: release what it held, on its behalf
+static void release_relayed(uint8_t side) {
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    for (uint8_t row = 0; row < ROWS; row++) {
+        for (uint8_t col = 0; col < COLS; col++) {
+            if (!(relayed_held[row] & ((matrix_row_t)1 << col))) continue;
+            key_event_t release = {.type = KEY_EVENT_RELEASE, .row = row, .col = col, .side = side};
+            key_tx_push(&release, now);
+        }
+        relayed_held[row] = 0;
+    }
+}
+#endif
+
+// Queue an event for the dongle. Caller must hold the BTstack (async context) lock.
+void send_key_event(key_event_t event) {
+    event.side = THIS_SIDE;
+    
+#ifdef DONGLELESS
+    // We are the dongle: the lock also serialises us with the other half's events
+    process_key_event(&event);
+#else
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    key_tx_push(&event, now);
+    report_link(now);
+#endif
+}
+
+#ifdef JOYSTICK
+// Runs on core 0: move the stick's motion along. A motion event is only
+// queued once the previous one has left the transmit queue, so motion never
+// piles up in front of key events; it accumulates in the meantime.
+static void process_joystick(void) {
+    joystick_task(time_us_32());
+    
+    async_context_t *context = cyw43_arch_async_context();
+    async_context_acquire_lock_blocking(context);
+    int8_t dx, dy;
+#ifdef DONGLELESS
+    if (joystick_take(&dx, &dy)) {
+#else
+    if (key_tx_count() == 0 && joystick_take(&dx, &dy)) {
+#endif
+        send_key_event((key_event_t){.type = KEY_EVENT_MOTION, .dx = dx, .dy = dy});
+    }
+    async_context_release_lock(context);
+}
+#endif
+
+// Runs on core 1: hand a debounced transition to core 0 for sending. From
+// power-on, before the radio is up: core 0 picks them up once it is.
+static void queue_key_event(uint8_t row, uint8_t col, bool pressed) {
+    key_event_t event = {
+        .type = pressed ? 0 : 1,
+        .row = row,
+        .col = col,
+    };
+    boot_mark(BOOT_FIRST_KEY_IN);
+    key_stats_record(row, col, pressed);
+    matrix_row_t bit = (matrix_row_t)1 << col;
+    held_keys[row] = pressed ? held_keys[row] | bit : held_keys[row] & ~bit;
+    recovery_seal(held_keys, sizeof(held_keys), &held_keys_check);
+    spsc_queue_push(&key_event_queue, &event);
+}
+
+// Runs on core 0 before the scan core starts: carry on from the keys held
+// before a watchdog reset
+static void restore_held_keys(void) {
+    if (!recovery_restore(held_keys, sizeof(held_keys), &held_keys_check)) {
+        memset(held_keys, 0, sizeof(held_keys));
+        recovery_seal(held_keys, sizeof(held_keys), &held_keys_check);
+        return;
+    }
+#ifdef ANALOG_KEYS
+    // Just calibrated as up, so none of them reads as pressed: release them all
+    for (uint8_t row = 0; row < ROWS; row++) {
+        for (uint8_t col = 0; col < COLS; col++) {
+            if (!((held_keys[row] >> col) & 1)) continue;
+            key_event_t event = {.type = 1, .row = row, .col = col};
+            spsc_queue_push(&key_event_queue, &event);
+        }
+    }
+    memset(held_keys, 0, sizeof(held_keys));
+    recovery_seal(held_keys, sizeof(held_keys), &held_keys_check);
+#else
+    // The first scan releases the ones let go since
+    matrix_restore(held_keys);
+#endif
+}
+
+#ifdef ENCODER
+// Runs on core 1: hand an encoder's turn to core 0
+static void queue_encoder_event(uint8_t index, int8_t detents) {
+    key_event_t event = {
+        .type = KEY_EVENT_ENCODER,
+        .encoder = index,
+        .detents = detents,
+    };
+    spsc_queue_push(&key_event_queue, &event);
+}
+#endif
+
+// Runs on core 1: only touches GPIO and the event queue
+void scan_matrix(void) {
+#ifndef DONGLELESS
+    uint32_t start = time_us_32();
+#endif
+#ifdef ANALOG_KEYS
+    uint32_t changes = analog_matrix_scan(queue_key_event);
+#else
+    uint32_t changes = matrix_scan(queue_key_event);
+#endif
+    
+    // Wake core 0 if it's waiting for events
+    if (changes) {
+        low_power = false;
+        last_key_us = time_us_32();
+#ifndef DONGLELESS
+        event_scan_us = start;
+#endif
+        __sev();
+    }
+}
+
+// Core 1 entry: scan on a fixed cadence, independent of radio activity. Once
+// the connection event phase is known, one scan per interval is moved to
+// just before the event so what it finds makes that event.
+void core1_scan_loop(void) {
+    // Let key_stats_task() park this core while it writes flash
+    flash_safe_execute_core_init();
+    recovery_phase(RECOVERY_KEYS);
+    
+    uint32_t periodic = time_us_32();
+    
+    while (true) {
+        recovery_alive();
+        uint32_t start = time_us_32();
+        scan_matrix();
+        uint32_t elapsed = time_us_32() - start;
+        
+        scan_count++;
+        if (elapsed > scan_max_us) scan_max_us = elapsed;
+#ifdef ENCODER
+        if (encoder_poll(time_us_32(), queue_encoder_event)) {
+            low_power = false;
+            last_key_us = time_us_32();
+            __sev();
+        }
+#endif
+        
+        bool slow = low_power;
+        uint32_t period = slow ? SCAN_LOW_POWER_PERIOD_US : SCAN_PERIOD_US;
+        uint32_t now = time_us_32();
+        if ((int32_t)(periodic - start) <= 0) periodic += period;
+        if ((int32_t)(now - periodic) > 0) {
+            // Missed the slot, resynchronise instead of bursting to catch up
+            scan_overruns++;
+            periodic = now + period;
+        } else if ((int32_t)(periodic - now) > (int32_t)period) {
+            // Back to full speed: don't wait out the rest of a slow period
+            periodic = now + period;
+        }
+#ifdef DONGLELESS
+        uint32_t next_scan = periodic;
+#else
+        uint32_t next_scan = slow ? periodic : conn_sync_next_scan(now, periodic);
+#endif
+        int32_t remaining;
+        while ((remaining = (int32_t)(next_scan - time_us_32())) > 0) {
+            if (slow) {
+                // Sleep between slow scans rather than spin
+                best_effort_wfe_or_timeout(make_timeout_time_us(remaining));
+            } else {
+                tight_loop_contents();
+            }
+        }
+    }
+}
+
+// Runs on core 0: forward queued key events as notifications
+void process_key_events(void) {
+    key_event_t event;
+    
+    // BTstack runs in the CYW43 async context, take its lock from the main loop
+    async_context_t *context = cyw43_arch_async_context();
+    
+    while (spsc_queue_pop(&key_event_queue, &event)) {
+        async_context_acquire_lock_blocking(context);
+        send_key_event(event);
+        async_context_release_lock(context);
+        
+        if (event.type == KEY_EVENT_ENCODER) {
+            KLOG("Encoder %d: %d detents\n", event.encoder, event.detents);
+        } else {
+            KLOG("Key %s: R%d C%d\n", event.type == 0 ? "pressed" : "released", event.row, event.col);
+        }
+    }
+}
+
+void print_scan_stats(void) {
+    static uint32_t last_overflows = 0;
+    static uint32_t last_overruns = 0;
+    
+    uint32_t overflows = key_event_queue.overflows;
+    uint32_t overruns = scan_overruns;
+    if (overflows == last_overflows && overruns == last_overruns) return;
+    
+    printf("Scan stats: scans=%lu overruns=%lu max=%luus queue overflows=%lu high water=%u\n",
+           (unsigned long)scan_count, (unsigned long)overruns, (unsigned long)scan_max_us,
+           (unsigned long)overflows, key_event_queue.high_water);
+    last_overflows = overflows;
+    last_overruns = overruns;
+}
+
+// Runs on core 0: follow the host's power state. A key that woke the scan
+// but not the host lets it slow down again once the keyboard is idle.
+static void power_task(void) {
+#ifdef DONGLELESS
+    low_power_requested = keyboard_usb_suspended();
+#endif
+    if (!low_power_requested) {
+        low_power = false;
+    } else if (!low_power && time_us_32() - last_key_us >= LOW_POWER_IDLE_MS * 1000) {
+        low_power = true;
+        KLOG("Host suspended, scanning slowly\n");
+    }
+    
+#if defined(DONGLELESS) || defined(RELAY)
+    // Pass it on to the half we connect to
+    async_context_t *context = cyw43_arch_async_context();
+    async_context_acquire_lock_blocking(context);
+    central_set_low_power(low_power_requested);
+    async_context_release_lock(context);
+#endif
+}
+
+#if defined(DONGLELESS) || defined(RELAY)
+// Link policy of our link to the other half (we are its central)
+static void link_task(void) {
+    async_context_t *context = cyw43_arch_async_context();
+    async_context_acquire_lock_blocking(context);
+    if (central_link_task()) {
+#ifdef DONGLELESS
+        // For raw HID, which asks by side
+        uint8_t link_stats[CENTRAL_LINK_STATS_SIZE];
+        uint8_t other = THIS_SIDE == SIDE_LEFT ? SIDE_RIGHT : SIDE_LEFT;
+        raw_hid_set_link_stats(other, link_stats, central_link_stats(other == SIDE_LEFT, link_stats));
+#endif
+    }
+    async_context_release_lock(context);
+}
+#endif
+
+#ifndef DONGLELESS
+void print_tx_stats(void) {
+    static uint32_t last_queued = 0;
+    static uint32_t last_overflows = 0;
+    
+    const key_tx_stats_t *stats = key_tx_get_stats();
+    if (stats->queued == last_queued && stats->overflows == last_overflows) return;
+    
+    printf("TX stats: sent=%lu packets=%lu queued=%lu retried=%lu flushed=%lu expired=%lu overflows=%lu\n",
+           (unsigned long)stats->sent, (unsigned long)stats->packets, (unsigned long)stats->queued,
+           (unsigned long)stats->retried, (unsigned long)stats->flushed,
+           (unsigned long)stats->expired, (unsigned long)stats->overflows);
+    
+    const conn_sync_stats_t *sync = conn_sync_get_stats();
+    printf("Sync stats: locked=%d samples=%lu aligned scans=%lu error=%ldus scan to ack avg=%luus max=%luus\n",
+           conn_sync_locked(), (unsigned long)sync->samples, (unsigned long)sync->aligned_scans,
+           (long)sync->last_error_us,
+           (unsigned long)(scan_to_ack_count ? scan_to_ack_total_us / scan_to_ack_count : 0),
+           (unsigned long)scan_to_ack_max_us);
+    last_queued = stats->queued;
+    last_overflows = stats->overflows;
+}
+
+// Number Of Completed Packets: the dongle acknowledged our notifications.
+// Its arrival time gives the connection event phase (see conn_sync.h).
+static void handle_completed_packets(const uint8_t *packet, uint16_t size) {
+    uint8_t handles = packet[2];
+    for (uint8_t i = 0; i < handles && 3 + 4 * i + 4 <= size; i++) {
+        hci_con_handle_t handle = little_endian_read_16(packet, 3 + 4 * i) & 0x0fff;
+        uint16_t completed = little_endian_read_16(packet, 5 + 4 * i);
+        if (handle != connection_handle || completed == 0) continue;
+        
+        uint32_t now = time_us_32();
+        conn_sync_sample(now);
+        for (; completed && sent_count; completed--, sent_count--) {
+            link_packets++;
+            link_retransmissions += conn_sync_events_waited(sent_us[sent_first], now);
+            sent_first = (sent_first + 1) % SENT_TIMES;
+        }
+        if (measuring) {
+            uint32_t delay = now - measured_scan_us;
+            scan_to_ack_count++;
+            scan_to_ack_total_us += delay;
+            if (delay > scan_to_ack_max_us) scan_to_ack_max_us = delay;
+            measuring = false;
+        }
+    }
+}
+
+#ifdef KEY_L2CAP
+// Channel refused, closed or its link gone: back to notifications
+static void close_key_channel(void) {
+    key_cid = 0;
+    key_channel_open = false;
+    key_sdu_busy = false;
+}
+
+static void key_channel_packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size) {
+    UNUSED(channel);
+    UNUSED(size);
+    
+    if (packet_type != HCI_EVENT_PACKET) return;
+    
+    switch (hci_event_packet_get_type(packet)) {
+        case L2CAP_EVENT_CBM_CHANNEL_OPENED:
+            if (l2cap_event_cbm_channel_opened_get_local_cid(packet) != key_cid) break;
+            if (l2cap_event_cbm_channel_opened_get_status(packet) != ERROR_CODE_SUCCESS) {
+                // A dongle from before the key channel: stay with notifications
+                printf("Key channel refused, notifying\n");
+                close_key_channel();
+                break;
+            }
+            key_channel_mtu = l2cap_event_cbm_channel_opened_get_remote_mtu(packet);
+            key_channel_open = true;
+            key_sdu_busy = false;
+            printf("Key channel open\n");
+            update_link_ready();
+            break;
+            
+        case L2CAP_EVENT_PACKET_SENT:
+            if (l2cap_event_packet_sent_get_local_cid(packet) != key_cid) break;
+            key_sdu_busy = false;
+            break;
+            
+        case L2CAP_EVENT_CAN_SEND_NOW:
+            if (l2cap_event_can_send_now_get_local_cid(packet) != key_cid) break;
+            key_tx_flush(to_ms_since_boot(get_absolute_time()));
+            break;
+            
+        case L2CAP_EVENT_CHANNEL_CLOSED:
+            if (l2cap_event_channel_closed_get_local_cid(packet) != key_cid) break;
+            close_key_channel();
+            update_link_ready();
+            break;
+    }
+}
+
+// Ask the dongle for a key channel on its link
+static void open_key_channel(void) {
+    if (key_cid) return;
+    uint16_t cid;
+    if (l2cap_cbm_create_channel(key_channel_packet_handler, connection_handle, KEY_CHANNEL_PSM,
+                                 key_channel_receive, sizeof(key_channel_receive),
+                                 L2CAP_LE_AUTOMATIC_CREDITS, LEVEL_0, &cid) == ERROR_CODE_SUCCESS) {
+        key_cid = cid;
+    }
+}
+#endif
+
+static void packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size) {
+    UNUSED(channel);
+    
+    if (packet_type != HCI_EVENT_PACKET) return;
+    
+    switch (hci_event_packet_get_type(packet)) {
+        case BTSTACK_EVENT_STATE:
+            if (btstack_event_state_get_state(packet) == HCI_STATE_WORKING) boot_mark(BOOT_BT_WORKING);
+            break;
+            
+        case HCI_EVENT_NUMBER_OF_COMPLETED_PACKETS:
+            handle_completed_packets(packet, size);
+            break;
+            
+        case HCI_EVENT_LE_META:
+            // Connection interval of the dongle's link (we are its peripheral)
+            switch (hci_event_le_meta_get_subevent_code(packet)) {
+                case HCI_SUBEVENT_LE_CONNECTION_COMPLETE:
+                    if (hci_subevent_le_connection_complete_get_status(packet) != 0) break;
+                    if (hci_subevent_le_connection_complete_get_role(packet) != HCI_ROLE_SLAVE) break;
+                    conn_sync_set_interval(hci_subevent_le_connection_complete_get_conn_interval(packet) * 1250);
+                    break;
+                case HCI_SUBEVENT_LE_CONNECTION_UPDATE_COMPLETE:
+                    if (hci_subevent_le_connection_update_complete_get_connection_handle(packet) != connection_handle) break;
+                    conn_sync_set_interval(hci_subevent_le_connection_update_complete_get_conn_interval(packet) * 1250);
+                    break;
+            }
+            break;
+            
+        case HCI_EVENT_DISCONNECTION_COMPLETE:
+            // Might be the relayed half's link (central.c handles that)
+            if (hci_event_disconnection_complete_get_connection_handle(packet) != connection_handle) break;
+            conn_sync_set_interval(0);
+            measuring = false;
+            sent_count = 0;
+            link_packets = 0;
+            link_retransmissions = 0;
+            low_power_requested = false;
+            connected = false;
+            notifications_enabled = false;
+            connection_handle = HCI_CON_HANDLE_INVALID;
+#ifdef KEY_L2CAP
+            close_key_channel();
+#endif
+            update_link_ready();  // Hold new events until reconnect
+            printf("Disconnected\n");
+            break;
+            
+        case ATT_EVENT_CONNECTED:
+            // Only the dongle's link, not one we opened as a central
+            if (gap_get_role(att_event_connected_get_handle(packet)) != HCI_ROLE_SLAVE) break;
+            connection_handle = att_event_connected_get_handle(packet);
+            att_event_connected_get_address(packet, peer_addr);
+            connected = true;
+            printf("Connected\n");
+#ifdef KEY_L2CAP
+            open_key_channel();
+#endif
+            
+            if (subscription.saved && bd_addr_cmp(peer_addr, subscription.addr) == 0) {
+                // Known dongle: resume notifications and flush held events now
+                notifications_enabled = true;
+                update_link_ready();
+            }
+            break;
+            
+        case ATT_EVENT_CAN_SEND_NOW:
+            // Ready to send more data
+            key_tx_flush(to_ms_since_boot(get_absolute_time()));
+            break;
+    }
+}
+
+// Tell the dongle how far the update has got, when that changed. Runs in
+// the BTstack context, from the main loop and whenever the last status has
+// gone out.
+static void send_update_status(void) {
+    if (!update_cid || update_status_busy) return;
+    uint8_t state = update_refused ? DFU_FAILED : dfu_state();
+    uint32_t written = dfu_written();
+    if (!update_report && state == update_reported_state && written == update_reported_written) return;
+    
+    update_status[0] = DFU_MSG_STATUS;
+    update_status[1] = state;
+    little_endian_store_32(update_status, 2, written);
+    if (l2cap_send(update_cid, update_status, DFU_STATUS_SIZE) != ERROR_CODE_SUCCESS) return;
+    update_status_busy = true;
+    update_report = false;
+    update_reported_state = state;
+    update_reported_written = written;
+}
+
+static void handle_update_message(const uint8_t *message, uint16_t size) {
+    switch (message[0]) {
+        case DFU_MSG_BEGIN:
+            update_refused = size < 9 ||
+                             !dfu_begin(little_endian_read_32(message, 1), little_endian_read_32(message, 5));
+            update_report = true;
+            break;
+            
+        case DFU_MSG_DATA:
+            // The dongle keeps within the buffer; if it didn't, give up
+            if (!dfu_write(&message[1], size - 1)) {
+                dfu_abort();
+                l2cap_disconnect(update_cid);
+            }
+            break;
+            
+        case DFU_MSG_SWAP:
+            // Close the link first, the swap leaves no chance later
+            if (dfu_state() != DFU_VERIFIED) break;
+            update_swap = true;
+            gap_disconnect(connection_handle);
+            printf("Update verified, swapping\n");
+            break;
+    }
+}
+
+static void update_packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size) {
+    if (packet_type == L2CAP_DATA_PACKET) {
+        if (channel != update_cid || size == 0) return;
+        handle_update_message(packet, size);
+        send_update_status();
+        return;
+    }
+    if (packet_type != HCI_EVENT_PACKET) return;
+    
+    switch (hci_event_packet_get_type(packet)) {
+        case L2CAP_EVENT_CBM_INCOMING_CONNECTION: {
+            uint16_t cid = l2cap_event_cbm_incoming_connection_get_local_cid(packet);
+            hci_con_handle_t handle = l2cap_event_cbm_incoming_connection_get_handle(packet);
+            if (update_cid || handle != connection_handle || !gap_bonded(handle)) {
+                l2cap_cbm_decline_connection(cid, L2CAP_CBM_CONNECTION_RESULT_NO_RESOURCES_AVAILABLE);
+                break;
+            }
+            update_cid = cid;
+            update_status_busy = false;
+            update_refused = false;
+            update_report = false;
+            l2cap_cbm_accept_connection(cid, update_sdu, sizeof(update_sdu), L2CAP_LE_AUTOMATIC_CREDITS);
+            break;
+        }
+            
+        case L2CAP_EVENT_CBM_CHANNEL_OPENED:
+            if (l2cap_event_cbm_channel_opened_get_local_cid(packet) != update_cid) break;
+            if (l2cap_event_cbm_channel_opened_get_status(packet) != ERROR_CODE_SUCCESS) update_cid = 0;
+            break;
+            
+        case L2CAP_EVENT_PACKET_SENT:
+            if (l2cap_event_packet_sent_get_local_cid(packet) != update_cid) break;
+            update_status_busy = false;
+            send_update_status();
+            break;
+            
+        case L2CAP_EVENT_CHANNEL_CLOSED:
+            if (l2cap_event_channel_closed_get_local_cid(packet) != update_cid) break;
+            update_cid = 0;
+            // Cut off before the whole image was in
+            if (dfu_state() == DFU_RECEIVING) dfu_abort();
+            break;
+    }
+}
+
+// Pairing requests on the dongle's link (we are its peripheral). Links this
+// half opened as a central are central.c's.
+static void sm_packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size) {
+    UNUSED(channel);
+    UNUSED(size);
+    
+    if (packet_type != HCI_EVENT_PACKET) return;
+    
+    switch (hci_event_packet_get_type(packet)) {
+        case SM_EVENT_JUST_WORKS_REQUEST: {
+            hci_con_handle_t handle = sm_event_just_works_request_get_handle(packet);
+            if (gap_get_role(handle) != HCI_ROLE_SLAVE) break;
+            bool window = to_ms_since_boot(get_absolute_time()) < PAIRING_WINDOW_MS;
+            if (le_device_db_count() == 0 || window) {
+                sm_just_works_confirm(handle);
+            } else {
+                printf("Pairing refused: power-cycle the half to pair a new dongle\n");
+                sm_bonding_decline(handle);
+            }
+            break;
+        }
+            
+        case SM_EVENT_PAIRING_COMPLETE:
+            if (gap_get_role(sm_event_pairing_complete_get_handle(packet)) != HCI_ROLE_SLAVE) break;
+            printf("Pairing %s\n", sm_event_pairing_complete_get_status(packet) == ERROR_CODE_SUCCESS ? "done" : "failed");
+            break;
+    }
+}
+
+// Runs on core 0: write what the dongle sent to flash, tell it how far we
+// are, and swap once it has said so and the link is down
+static void update_task(void) {
+    dfu_task();
+    
+    async_context_t *context = cyw43_arch_async_context();
+    async_context_acquire_lock_blocking(context);
+    send_update_status();
+    bool swap = update_swap && !connected;
+    async_context_release_lock(context);
+    
+    if (swap) dfu_swap();
+}
+
+// Hash of the ATT database layout. Not the AES-CMAC of the spec, but the
+// dongle only compares it for equality: any change to the services or
+// handles (e.g. new firmware) changes the hash and forces rediscovery.
+static void compute_db_hash(const uint8_t *db, uint16_t size) {
+    for (int half = 0; half < 2; half++) {
+        // 64-bit FNV-1a, second half seeded differently
+        uint64_t hash = 0xcbf29ce484222325ULL ^ (uint64_t)half;
+        for (uint16_t i = 0; i < size; i++) {
+            hash ^= db[i];
+            hash *= 0x100000001b3ULL;
+        }
+        for (int i = 0; i < 8; i++) {
+            db_hash[half * 8 + i] = (uint8_t)(hash >> (i * 8));
+        }
+    }
+}
+
+static uint16_t att_read_callback(hci_con_handle_t con_handle, uint16_t att_handle, 
+                                   uint16_t offset, uint8_t *buffer, uint16_t buffer_size) {
+    UNUSED(con_handle);
+    
+    if (att_handle == keyboard_data_handle) {
+        return 0;  // No data to read
+    }
+    if (att_handle == db_hash_handle) {
+        return att_read_callback_handle_blob(db_hash, DB_HASH_LEN, offset, buffer, buffer_size);
+    }
+    if (att_handle == key_stats_handle) {
+        if (offset == 0) key_stats_serialize(key_stats_snapshot);
+        return att_read_callback_handle_blob(key_stats_snapshot, KEY_STATS_SIZE, offset, buffer, buffer_size);
+    }
+    if (att_handle == power_state_handle) {
+        uint8_t value = low_power_requested ? 1 : 0;
+        return att_read_callback_handle_blob(&value, 1, offset, buffer, buffer_size);
+    }
+    return 0;
+}
+
+static int att_write_callback(hci_con_handle_t con_handle, uint16_t att_handle, 
+                              uint16_t transaction_mode, uint16_t offset, 
+                              uint8_t *buffer, uint16_t buffer_size) {
+    UNUSED(con_handle);
+    UNUSED(transaction_mode);
+    UNUSED(offset);
+    
+    if (att_handle == keyboard_data_cccd_handle && buffer_size >= 2) {
+        // Dongle subscribed: flush anything held while the link was down
+        notifications_enabled = (little_endian_read_16(buffer, 0) & GATT_CLIENT_CHARACTERISTICS_CONFIGURATION_NOTIFICATION) != 0;
+        printf("Notifications %s\n", notifications_enabled ? "enabled" : "disabled");
+        
+        subscription.saved = notifications_enabled;
+        if (notifications_enabled) bd_addr_copy(subscription.addr, peer_addr);
+        recovery_seal(&subscription, sizeof(subscription), &subscription_check);
+        update_link_ready();
+    }
+    if (att_handle == power_state_handle && buffer_size >= 1) {
+        // The dongle slows the link down as well; power_task() slows the scan
+        low_power_requested = buffer[0] != 0;
+        printf("Host %s\n", low_power_requested ? "suspended" : "awake");
+    }
+    return 0;
+}
+
+// GATT server and advertising for the dongle to connect to
+static void peripheral_init(void) {
+    // After a watchdog reset the dongle that was subscribed gets events as
+    // soon as it reconnects
+    if (!recovery_restore(&subscription, sizeof(subscription), &subscription_check)) {
+        memset(&subscription, 0, sizeof(subscription));
+        recovery_seal(&subscription, sizeof(subscription), &subscription_check);
+    }
+    
+    // Setup ATT database manually
+    uint8_t *att_db = NULL;
+    att_db_util_init();
+    
+    // GATT service with the Database Hash used to validate the dongle's handle cache
+    att_db_util_add_service_uuid16(ORG_BLUETOOTH_SERVICE_GENERIC_ATTRIBUTE);
+    db_hash_handle = att_db_util_add_characteristic_uuid16(
+        ORG_BLUETOOTH_CHARACTERISTIC_DATABASE_HASH,
+        ATT_PROPERTY_READ | ATT_PROPERTY_DYNAMIC,
+        ATT_SECURITY_NONE, ATT_SECURITY_NONE,
+        NULL, 0);
+    
+    // Service UUID: 6E400001-B5A3-F393-E0A9-E50E24DCCA9E
+    uint8_t service_uuid[] = {0x9E, 0xCA, 0xDC, 0x24, 0x0E, 0xE5, 0xA9, 0xE0, 
+                              0x93, 0xF3, 0xA3, 0xB5, 0x01, 0x00, 0x40, 0x6E};
+    
+    // Characteristic UUID: 6E400003-B5A3-F393-E0A9-E50E24DCCA9E
+    uint8_t char_uuid[] = {0x9E, 0xCA, 0xDC, 0x24, 0x0E, 0xE5, 0xA9, 0xE0, 
+                           0x93, 0xF3, 0xA3, 0xB5, 0x03, 0x00, 0x40, 0x6E};
+    
+    att_db_util_add_service_uuid128(service_uuid);
+    keyboard_data_handle = att_db_util_add_characteristic_uuid128(
+        char_uuid,
+        ATT_PROPERTY_NOTIFY,
+        ATT_SECURITY_NONE, ATT_SECURITY_NONE,
+        NULL, 0);
+    // att_db_util places the Client Characteristic Configuration right after the value
+    keyboard_data_cccd_handle = keyboard_data_handle + 1;
+    
+    // Per-key press and chatter counters, read by the dongle on request
+    uint8_t key_stats_uuid[] = KEY_STATS_UUID128;
+    key_stats_handle = att_db_util_add_characteristic_uuid128(
+        key_stats_uuid,
+        ATT_PROPERTY_READ | ATT_PROPERTY_DYNAMIC,
+        ATT_SECURITY_NONE, ATT_SECURITY_NONE,
+        NULL, 0);
+    
+    // Host suspended or not, written by the dongle
+    uint8_t power_state_uuid[] = POWER_STATE_UUID128;
+    power_state_handle = att_db_util_add_characteristic_uuid128(
+        power_state_uuid,
+        ATT_PROPERTY_READ | ATT_PROPERTY_WRITE_WITHOUT_RESPONSE | ATT_PROPERTY_DYNAMIC,
+        ATT_SECURITY_NONE, ATT_SECURITY_NONE,
+        NULL, 0);
+    
+    att_db = att_db_util_get_address();
+    compute_db_hash(att_db, att_db_util_get_size());
+    
+    // Initialize ATT server
+    att_server_init(att_db, att_read_callback, att_write_callback);
+    
+    // ATT events (connected, can send now) go to the ATT server's handler
+    att_server_register_packet_handler(&packet_handler);
+    
+    // Firmware updates from the dongle, only over a bonded, encrypted link
+    static btstack_packet_callback_registration_t sm_event_callback_registration;
+    sm_set_io_capabilities(IO_CAPABILITY_NO_INPUT_NO_OUTPUT);
+    sm_set_authentication_requirements(SM_AUTHREQ_SECURE_CONNECTION | SM_AUTHREQ_BONDING);
+    sm_set_secure_connections_only_mode(true);
+    sm_event_callback_registration.callback = &sm_packet_handler;
+    sm_add_event_handler(&sm_event_callback_registration);
+    l2cap_cbm_register_service(update_packet_handler, DFU_PSM, LEVEL_2);
+    
+    // Setup advertising data
+    uint8_t adv_data[5 + sizeof(HALF_NAME) - 1] = {
+        0x02, 0x01, 0x06,  // Flags
+        sizeof(HALF_NAME), 0x09,  // Complete local name, HALF_NAME without its NUL
+    };
+    memcpy(&adv_data[5], HALF_NAME, sizeof(HALF_NAME) - 1);
+    uint16_t adv_data_len = sizeof(adv_data);
+    gap_advertisements_set_data(adv_data_len, adv_data);
+    
+    // Set device name
+    gap_set_local_name(HALF_NAME);
+    gap_discoverable_control(1);
+    
+    // Register packet handler
+    static btstack_packet_callback_registration_t hci_event_callback_registration;
+    hci_event_callback_registration.callback = &packet_handler;
+    hci_add_event_handler(&hci_event_callback_registration);
+    
+    // Start advertising
+    uint16_t adv_int_min = 0x0030;
+    uint16_t adv_int_max = 0x0030;
+    uint8_t adv_type = 0;
+    bd_addr_t null_addr = {0};
+    gap_advertisements_set_params(adv_int_min, adv_int_max, adv_type, 0, null_addr, 0x07, 0x00);
+    gap_advertisements_enable(1);
+}
+#endif // DONGLELESS
+
+int main() {
+    stdio_init_all();
+    recovery_init();
+    klog_init();
+    
+    // Initialize matrix
+#ifdef ANALOG_KEYS
+    analog_matrix_init();
+#else
+    matrix_init(row_pins, col_pins);
+#endif
+#ifdef ENCODER
+    encoder_init(encoder_pins);
+#endif
+#ifdef JOYSTICK
+    joystick_init();
+#endif
+    spsc_queue_init(&key_event_queue, key_event_buffer, sizeof(key_event_t), KEY_EVENT_QUEUE_SIZE);
+    restore_held_keys();
+    key_stats_init();
+    
+#ifdef MATRIX_BENCHMARK
+    matrix_benchmark();
+#endif
+#ifdef KLOG_BENCHMARK
+    klog_benchmark();
+#endif
+    
+    // Matrix scanning gets core 1 to itself, and starts now: keys pressed
+    // while the radio comes up wait in the event queue, then in the
+    // transmit queue until the dongle is connected
+    multicore_launch_core1(core1_scan_loop);
+    boot_mark(BOOT_SCAN_STARTED);
+    
+#ifdef DONGLELESS
+    keyboard_init();
+    tusb_init();
+    boot_mark(BOOT_USB_STARTED);
+#else
+    key_tx_init(notify_key_events, request_can_send_now);
+#endif
+    
+    // Initialize CYW43 for BLE: loading the radio firmware is the slowest
+    // part of the boot, the scan core runs meanwhile
+    if (cyw43_arch_init()) {
+        printf("Failed to initialize\n");
+        return 1;
+    }
+    boot_mark(BOOT_RADIO_READY);
+    
+    // Initialize BTstack
+    l2cap_init();
+    sm_init();
+    
+#ifdef DONGLELESS
+    // Connect to the other half the way the dongle would
+    central_init(THIS_SIDE == SIDE_RIGHT, THIS_SIDE == SIDE_LEFT, process_key_event_batch);
+    central_set_disconnect_handler(keyboard_release_side);
+#else
+    peripheral_init();
+#endif
+#ifdef RELAY
+    // Collect the other half's events and pass them on to the dongle
+    central_init(THIS_SIDE == SIDE_RIGHT, THIS_SIDE == SIDE_LEFT, relay_key_events);
+    central_set_disconnect_handler(release_relayed);
+#endif
+    
+    // Turn on Bluetooth
+    hci_power_control(HCI_POWER_ON);
+    
+    printf("%s keyboard half initialized\n", THIS_SIDE == SIDE_LEFT ? "Left" : "Right");
+    
+    // Main loop
+    uint32_t last_stats = 0;
+    while (true) {
+        recovery_feed();
+        recovery_phase(RECOVERY_KEYS);
+        process_key_events();
+#ifdef JOYSTICK
+        process_joystick();
+#endif
+        recovery_phase(RECOVERY_LOG);
+        klog_drain();
+        boot_timeline_task();
+        recovery_phase(RECOVERY_FLASH);
+        key_stats_task();
+#ifdef DONGLELESS
+        // Firmware the host is staging for the other half
+        dfu_task();
+#else
+        update_task();
+#endif
+        recovery_phase(RECOVERY_BLUETOOTH);
+        power_task();
+#if defined(DONGLELESS) || defined(RELAY)
+        link_task();
+#endif
+        
+#ifdef DONGLELESS
+        // USB device task and the dongle's periodic key processing
+        recovery_phase(RECOVERY_USB);
+        tud_task();
+        recovery_phase(RECOVERY_KEYS);
+        async_context_t *context = cyw43_arch_async_context();
+        async_context_acquire_lock_blocking(context);
+        keyboard_task();
+        
+        // Key stats the host asked for over raw HID: ours, or the other half's
+        int stats_side = raw_hid_stats_requested();
+        if (stats_side == THIS_SIDE) {
+            static uint8_t own_stats[KEY_STATS_SIZE];
+            raw_hid_stats_done(own_stats, key_stats_serialize(own_stats));
+        } else if (stats_side >= 0 && !central_read_key_stats(stats_side == SIDE_LEFT, raw_hid_stats_done)) {
+            raw_hid_stats_done(NULL, 0);
+        }
+        
+        // Firmware update of the other half the host asked for, and its progress
+        int update_side = raw_hid_dfu_requested();
+        if (update_side >= 0 && !central_send_update(update_side == SIDE_LEFT, raw_hid_dfu_done)) {
+            raw_hid_dfu_done(false);
+        }
+        uint8_t progress[CENTRAL_UPDATE_PROGRESS_SIZE];
+        raw_hid_set_dfu_progress(progress, central_update_progress(progress));
+        async_context_release_lock(context);
+        recovery_phase(RECOVERY_USB);
+        usb_emit_reports();
+#endif
+        
+        uint32_t now = to_ms_since_boot(get_absolute_time());
+        if (now - last_stats >= 10000) {
+            recovery_phase(RECOVERY_LOG);
+            print_scan_stats();
+#ifndef DONGLELESS
+            print_tx_stats();
+#endif
+#if defined(DONGLELESS) || defined(RELAY)
+            async_context_t *context = cyw43_arch_async_context();
+            async_context_acquire_lock_blocking(context);
+            central_print_link_stats();
+            async_context_release_lock(context);
+#endif
+            last_stats = now;
+        }
+        
+        recovery_phase(RECOVERY_IDLE);
+#ifdef DONGLELESS
+        // Macros, auto-click and scrolling run on a 1 ms tick
+        best_effort_wfe_or_timeout(make_timeout_time_ms(1));
+#else
+        if (klog_pending() || dfu_state() == DFU_RECEIVING) {
+            // Come back for the rest of the log once the UART has room, or
+            // for the next sector of an update
+            best_effort_wfe_or_timeout(make_timeout_time_ms(1));
+        } else {
+#ifdef JOYSTICK
+            // Follow the stick every millisecond while it moves, and look
+            // at it now and then while it doesn't
+            best_effort_wfe_or_timeout(make_timeout_time_ms(joystick_active() ? 1 : JOYSTICK_IDLE_POLL_MS));
+#else
+            if (low_power_requested && !low_power) {
+                // Come back to slow the scan down once the keys are idle
+                best_effort_wfe_or_timeout(make_timeout_time_ms(100));
+            } else {
+                // Sleep until core 1 signals new events (or an interrupt
+                // fires), waking now and then to feed the watchdog
+                best_effort_wfe_or_timeout(make_timeout_time_ms(RECOVERY_IDLE_MS));
+            }
+#endif
+        }
+#endif
+    }
+    
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,170 @@
+/**
+ * Analog Thumbstick
+ *
+ * The ADC converts the two axes round robin into its FIFO, and a DMA channel
+ * copies them into a ring; when it reaches the end a second channel rewrites
+ * its write address, which restarts it. Even entries are x, odd ones y, and
+ * a reading is the average of the whole ring, so the CPU never touches the
+ * ADC after setup.
+ */
+
+#include "pico/stdlib.h"
+#include "hardware/adc.h"
+#include "hardware/dma.h"
+#include "joystick.h"
+
+static volatile uint16_t samples[JOYSTICK_RING];
+static volatile uint16_t *ring_start = samples;  // Read by the restart channel
+
+// Calibration, in ADC counts
+typedef struct {
+    int32_t center;
+    int32_t travel_low;         // From center to the lowest value seen
+    int32_t travel_high;
+    int8_t sign;
+} axis_t;
+
+static axis_t axes[2];
+static uint32_t last_us = 0;
+static bool deflected = false;
+
+// Motion in counts, and the fraction not yet a whole count in counts * 1e6
+static int32_t pending[2];
+static int64_t fraction[2];
+
+// Average of each axis over the ring
+static void read_axes(int32_t raw[2]) {
+    uint32_t sum[2] = {0, 0};
+    for (int i = 0; i < JOYSTICK_RING; i++) {
+        sum[i & 1] += samples[i];
+    }
+    raw[0] = sum[0] / (JOYSTICK_RING / 2);
+    raw[1] = sum[1] / (JOYSTICK_RING / 2);
+}
+
+static void start_sampling(void) {
+    adc_init();
+    adc_gpio_init(JOYSTICK_X_GPIO);
+    adc_gpio_init(JOYSTICK_Y_GPIO);
+    adc_select_input(JOYSTICK_X_GPIO - 26);
+    adc_set_round_robin((1u << (JOYSTICK_X_GPIO - 26)) | (1u << (JOYSTICK_Y_GPIO - 26)));
+    adc_fifo_setup(true, true, 1, false, false);
+    adc_set_clkdiv(48000000.0f / JOYSTICK_SAMPLE_HZ - 1);
+    
+    int data = dma_claim_unused_channel(true);
+    int restart = dma_claim_unused_channel(true);
+    
+    dma_channel_config config = dma_channel_get_default_config(data);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_16);
+    channel_config_set_read_increment(&config, false);
+    channel_config_set_write_increment(&config, true);
+    channel_config_set_dreq(&config, DREQ_ADC);
+    channel_config_set_chain_to(&config, restart);
+    dma_channel_configure(data, &config, samples, &adc_hw->fifo, JOYSTICK_RING, false);
+    
+    // Retriggering also reloads the transfer count
+    config = dma_channel_get_default_config(restart);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_32);
+    channel_config_set_read_increment(&config, false);
+    channel_config_set_write_increment(&config, false);
+    dma_channel_configure(restart, &config, &dma_hw->ch[data].al2_write_addr_trig, &ring_start, 1, false);
+    
+    dma_channel_start(data);
+    adc_run(true);
+}
+
+void joystick_init(void) {
+    start_sampling();
+    
+    // Let the ring fill a few times, then take the rest position
+    sleep_ms(20);
+    int32_t raw[2];
+    read_axes(raw);
+    for (int i = 0; i < 2; i++) {
+        axes[i].center = raw[i];
+        axes[i].travel_low = JOYSTICK_RANGE_MIN;
+        axes[i].travel_high = JOYSTICK_RANGE_MIN;
+        pending[i] = 0;
+        fraction[i] = 0;
+    }
+    axes[0].sign = JOYSTICK_X_SIGN;
+    axes[1].sign = JOYSTICK_Y_SIGN;
+    last_us = time_us_32();
+}
+
+// Deflection in -1024..1024 of the travel seen so far on that side
+static int32_t normalize(axis_t *axis, int32_t raw) {
+    int32_t offset = raw - axis->center;
+    int32_t *travel = offset < 0 ? &axis->travel_low : &axis->travel_high;
+    int32_t distance = offset < 0 ? -offset : offset;
+    if (distance > *travel) *travel = distance;
+    
+    return axis->sign * offset * 1024 / *travel;
+}
+
+static uint32_t isqrt(uint32_t n) {
+    uint32_t root = 0;
+    for (uint32_t bit = 1u << 30; bit; bit >>= 2) {
+        if (n >= root + bit) {
+            n -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+    }
+    return root;
+}
+
+void joystick_task(uint32_t now_us) {
+    uint32_t elapsed = now_us - last_us;
+    last_us = now_us;
+    if (elapsed > JOYSTICK_IDLE_POLL_MS * 1000) elapsed = JOYSTICK_IDLE_POLL_MS * 1000;
+    
+    int32_t raw[2], n[2];
+    read_axes(raw);
+    n[0] = normalize(&axes[0], raw[0]);
+    n[1] = normalize(&axes[1], raw[1]);
+    
+    // Deadzone on the distance from rest, so diagonals aren't snapped to an axis
+    int32_t magnitude = isqrt(n[0] * n[0] + n[1] * n[1]);
+    deflected = magnitude > JOYSTICK_DEADZONE;
+    if (!deflected) {
+        fraction[0] = fraction[1] = 0;
+        return;
+    }
+    
+    int32_t scaled = (magnitude - JOYSTICK_DEADZONE) * 1024 / (1024 - JOYSTICK_DEADZONE);
+    if (scaled > 1024) scaled = 1024;
+    int32_t curve = scaled * (JOYSTICK_CURVE_LINEAR + (1024 - JOYSTICK_CURVE_LINEAR) * scaled / 1024) / 1024;
+    
+    for (int i = 0; i < 2; i++) {
+        // Speed along this axis in counts/s, direction kept from the deflection
+        int64_t speed = (int64_t)JOYSTICK_MAX_SPEED * curve * n[i] / magnitude / 1024;
+        fraction[i] += speed * elapsed;
+        int32_t counts = (int32_t)(fraction[i] / 1000000);
+        fraction[i] -= (int64_t)counts * 1000000;
+    
+        pending[i] += counts;
+        if (pending[i] > JOYSTICK_BACKLOG_MAX) pending[i] = JOYSTICK_BACKLOG_MAX;
+        if (pending[i] < -JOYSTICK_BACKLOG_MAX) pending[i] = -JOYSTICK_BACKLOG_MAX;
+    }
+}
+
+bool joystick_active(void) {
+    return deflected || pending[0] || pending[1];
+}
+
+static int8_t take_axis(int32_t *value) {
+    int32_t step = *value;
+    if (step > 127) step = 127;
+    if (step < -127) step = -127;
+    *value -= step;
+    return (int8_t)step;
+}
+
+bool joystick_take(int8_t *dx, int8_t *dy) {
+    if (!pending[0] && !pending[1]) return false;
+    *dx = take_axis(&pending[0]);
+    *dy = take_axis(&pending[1]);
+    return true;
+}
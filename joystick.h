@@ -0,0 +1,49 @@
+/**
+ * Analog Thumbstick
+ * Two-axis stick on the ADC, sampled continuously by DMA and turned into
+ * pointer motion: calibrated against its rest position and travel, radial
+ * deadzone, then a response curve from deflection to speed.
+ *
+ * The motion goes to the dongle as KEY_EVENT_MOTION events on the key link.
+ */
+
+#ifndef JOYSTICK_H
+#define JOYSTICK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Wiring: wipers on ADC0/ADC1. Flip a sign if an axis moves the wrong way.
+#define JOYSTICK_X_GPIO 26
+#define JOYSTICK_Y_GPIO 27
+#define JOYSTICK_X_SIGN 1
+#define JOYSTICK_Y_SIGN (-1)          // Pushing up lowers the pointer's y
+
+#define JOYSTICK_SAMPLE_HZ 20000      // Both axes together, 10 kHz each
+#define JOYSTICK_RING 64              // Samples averaged per reading (3.2 ms)
+
+// Response, deflection in 1/1024 of full travel
+#define JOYSTICK_DEADZONE 80          // Radial, around the rest position
+#define JOYSTICK_CURVE_LINEAR 256     // Linear share of the curve, the rest is quadratic
+#define JOYSTICK_MAX_SPEED 2400       // Counts/s at full deflection
+#define JOYSTICK_RANGE_MIN 1200       // ADC counts of travel assumed until more is seen
+#define JOYSTICK_BACKLOG_MAX 1000     // Counts held while the link is busy
+
+#define JOYSTICK_IDLE_POLL_MS 10      // How often to look at a stick at rest
+
+// Start sampling. Calibrates the rest position, so the stick must be
+// untouched at boot.
+void joystick_init(void);
+
+// Advance the motion by the time since the last call (call at least every
+// few milliseconds while joystick_active())
+void joystick_task(uint32_t now_us);
+
+// Deflected past the deadzone, or motion still waiting to be taken
+bool joystick_active(void);
+
+// Take up to one message worth (+-127 per axis) of the accumulated motion.
+// Returns false if there is none.
+bool joystick_take(int8_t *dx, int8_t *dy);
+
+#endif // JOYSTICK_H
@@ -0,0 +1,54 @@
+/**
+ * Key event packet shared by the keyboard halves and the dongle
+ */
+
+#ifndef KEY_EVENT_H
+#define KEY_EVENT_H
+
+#include <stdint.h>
+
+#define KEY_EVENT_PRESS   0
+#define KEY_EVENT_RELEASE 1
+#define KEY_EVENT_MOTION  2   // Pointer motion, dx/dy instead of row/col
+#define KEY_EVENT_ENCODER 3   // Encoder turn, encoder/detents instead of row/col
+#define KEY_EVENT_LINK    4   // Link telemetry for the central, not a key (see link_policy.h)
+
+#define SIDE_LEFT  0
+#define SIDE_RIGHT 1
+
+// Power State characteristic: 6E400006-B5A3-F393-E0A9-E50E24DCCA9E, in the
+// key service. The dongle writes one byte: 1 while the host is suspended.
+#define POWER_STATE_UUID128 {0x9E, 0xCA, 0xDC, 0x24, 0x0E, 0xE5, 0xA9, 0xE0, \
+                             0x93, 0xF3, 0xA3, 0xB5, 0x06, 0x00, 0x40, 0x6E}
+
+// Key channel: an L2CAP credit-based channel a half opens to its central
+// instead of notifying (KEY_L2CAP builds). It carries the same packets as
+// the notifications, one per SDU; the central's credits pace the half.
+#define KEY_CHANNEL_PSM 0x0080          // LE dynamic range
+#define KEY_CHANNEL_MTU 23              // Least an LE channel may offer
+
+// Packet structure for key events
+typedef struct {
+    uint8_t type;      // 0 = key press, 1 = key release, 2 = motion, 3 = encoder, 4 = link
+    union {
+        struct {
+            uint8_t row;
+            uint8_t col;
+        };
+        struct {
+            int8_t dx;     // Counts, summed by the dongle until reported
+            int8_t dy;
+        };
+        struct {
+            uint8_t encoder;   // Index on its half
+            int8_t detents;    // Clockwise positive
+        };
+        struct {
+            uint8_t packets;           // Notifications acknowledged since the last report, up to 255
+            uint8_t retransmissions;   // Connection events they waited beyond their first
+        };
+    };
+    uint8_t side;      // 0 = left, 1 = right
+} key_event_t;
+
+#endif // KEY_EVENT_H
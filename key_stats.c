@@ -0,0 +1,177 @@
+/**
+ * Per-Key Counters
+ *
+ * Saved as one-page records written in turn into a flash sector, so a save
+ * programs a single page and the sector is only erased once every 16
+ * saves. At boot the record with the highest sequence number wins; one cut
+ * off by a power loss fails its end marker and is skipped.
+ *
+ * Flash can't be read while it's being written, so a save runs through
+ * flash_safe_execute(), which parks the scan core for the duration: about
+ * a millisecond for a page, 50 ms more when the sector needs erasing. It
+ * only happens after KEY_STATS_SAVE_IDLE_MS without key events.
+ */
+
+#include <string.h>
+#include "pico/stdlib.h"
+#include "pico/flash.h"
+#include "hardware/flash.h"
+#include "key_stats.h"
+
+// Below the two sectors BTstack's flash bank would use at the end of flash
+#define STORE_OFFSET (PICO_FLASH_SIZE_BYTES - 3 * FLASH_SECTOR_SIZE)
+#define STORE_PAGES (FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE)
+#define RECORD_MAGIC 0x4B535431     // "KST1"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t sequence;
+    uint32_t presses[ROWS][COLS];
+    uint16_t chatter[ROWS][COLS];
+    uint32_t end;                   // ~sequence, written last
+} record_t;
+
+_Static_assert(sizeof(record_t) <= FLASH_PAGE_SIZE, "key stats record must fit in a flash page");
+
+// Counters, written by the scan core only
+static uint32_t presses[ROWS][COLS];
+static uint16_t chatter[ROWS][COLS];
+static uint32_t released_ms[ROWS][COLS];
+static volatile uint32_t last_event_ms = 0;
+static volatile uint32_t events = 0;
+
+static uint32_t saved_events = 0;           // Value of events at the last save
+static uint32_t last_save_ms = 0;
+static bool saved_since_boot = false;
+static uint32_t sequence = 0;
+static int next_page = 0;                   // STORE_PAGES: erase before the next save
+
+static const record_t *stored_page(int page) {
+    return (const record_t *)(XIP_BASE + STORE_OFFSET + page * FLASH_PAGE_SIZE);
+}
+
+static bool page_valid(const record_t *record) {
+    return record->magic == RECORD_MAGIC && record->end == ~record->sequence;
+}
+
+static bool page_blank(int page) {
+    const uint32_t *words = (const uint32_t *)stored_page(page);
+    for (int i = 0; i < FLASH_PAGE_SIZE / 4; i++) {
+        if (words[i] != 0xFFFFFFFF) return false;
+    }
+    return true;
+}
+
+void key_stats_init(void) {
+    int newest = -1;
+    for (int page = 0; page < STORE_PAGES; page++) {
+        const record_t *record = stored_page(page);
+        if (page_valid(record) && (newest < 0 || record->sequence > stored_page(newest)->sequence)) {
+            newest = page;
+        }
+    }
+    
+    if (newest >= 0) {
+        const record_t *record = stored_page(newest);
+        memcpy(presses, record->presses, sizeof(presses));
+        memcpy(chatter, record->chatter, sizeof(chatter));
+        sequence = record->sequence;
+    }
+    next_page = newest + 1;
+    if (next_page < STORE_PAGES && !page_blank(next_page)) next_page = STORE_PAGES;
+}
+
+void key_stats_record(uint8_t row, uint8_t col, bool pressed) {
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    if (pressed) {
+        presses[row][col]++;
+        if (now - released_ms[row][col] < KEY_STATS_CHATTER_MS && chatter[row][col] < UINT16_MAX) {
+            chatter[row][col]++;
+        }
+    } else {
+        released_ms[row][col] = now;
+    }
+    last_event_ms = now;
+    events++;
+}
+
+typedef struct {
+    const record_t *record;
+    int page;
+    bool erase;
+} save_job_t;
+
+// Runs with the other core parked and interrupts off
+static void program_record(void *param) {
+    const save_job_t *job = param;
+    if (job->erase) flash_range_erase(STORE_OFFSET, FLASH_SECTOR_SIZE);
+    flash_range_program(STORE_OFFSET + job->page * FLASH_PAGE_SIZE, (const uint8_t *)job->record, FLASH_PAGE_SIZE);
+}
+
+void key_stats_task(void) {
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    uint32_t count = events;
+    if (count == saved_events) return;
+    uint32_t interval = saved_since_boot ? KEY_STATS_SAVE_INTERVAL_MS : KEY_STATS_FIRST_SAVE_MS;
+    if (now - last_save_ms < interval) return;
+    if (now - last_event_ms < KEY_STATS_SAVE_IDLE_MS) return;
+    
+    static union {
+        record_t record;
+        uint8_t page[FLASH_PAGE_SIZE];
+    } buffer;
+    memset(buffer.page, 0xFF, sizeof(buffer.page));
+    buffer.record.magic = RECORD_MAGIC;
+    buffer.record.sequence = sequence + 1;
+    memcpy(buffer.record.presses, presses, sizeof(presses));
+    memcpy(buffer.record.chatter, chatter, sizeof(chatter));
+    buffer.record.end = ~buffer.record.sequence;
+    
+    save_job_t job = {
+        .record = &buffer.record,
+        .page = next_page < STORE_PAGES ? next_page : 0,
+        .erase = next_page >= STORE_PAGES,
+    };
+    last_save_ms = now;
+    if (flash_safe_execute(program_record, &job, 100) != PICO_OK) return;
+    
+    sequence++;
+    next_page = job.page + 1;
+    saved_events = count;
+    saved_since_boot = true;
+}
+
+static uint8_t *put_le(uint8_t *p, uint32_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        *p++ = (uint8_t)(value >> (8 * i));
+    }
+    return p;
+}
+
+uint16_t key_stats_serialize(uint8_t *buffer) {
+    uint8_t *p = buffer;
+    *p++ = KEY_STATS_VERSION;
+    *p++ = ROWS;
+    *p++ = COLS;
+    *p++ = 0;
+    for (int row = 0; row < ROWS; row++) {
+        for (int col = 0; col < COLS; col++) {
+            p = put_le(p, presses[row][col], 4);
+        }
+    }
+    for (int row = 0; row < ROWS; row++) {
+        for (int col = 0; col < COLS; col++) {
+            p = put_le(p, chatter[row][col], 2);
+        }
+    }
+    for (int row = 0; row < ROWS; row++) {
+        for (int col = 0; col < COLS; col++) {
+#ifdef ANALOG_KEYS
+            *p++ = 0;
+#else
+            *p++ = matrix_debounce_scans(row, col) * SCAN_PERIOD_US / 1000;
+#endif
+        }
+    }
+    return (uint16_t)(p - buffer);
+}
@@ -0,0 +1,51 @@
+/**
+ * Per-Key Counters
+ * Presses and chatter of every key on a half, for heatmaps and for finding
+ * failing switches on boards without a logging cable. Chatter is a press
+ * following the same key's release sooner than a finger can: a switch
+ * bouncing past the debounce.
+ *
+ * Counted in RAM by the scan core, saved to flash now and then while the
+ * keyboard is idle, and read by the dongle over GATT (the Key Stats
+ * characteristic), which passes them on to the host over raw HID.
+ */
+
+#ifndef KEY_STATS_H
+#define KEY_STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "matrix.h"
+
+#define KEY_STATS_CHATTER_MS 30          // Release to press faster than this is chatter
+
+// Saving: at most this often, only after this long without key events. The
+// first save after boot comes sooner, so short sessions and resets keep theirs.
+#define KEY_STATS_SAVE_INTERVAL_MS (15 * 60 * 1000)
+#define KEY_STATS_FIRST_SAVE_MS (60 * 1000)
+#define KEY_STATS_SAVE_IDLE_MS 5000
+
+// Wire format of the characteristic, little-endian: version, rows, cols, 0,
+// then the press count (4 bytes), the chatter count (2 bytes) and the
+// current debounce in ms (1 byte, 0 on Hall-effect halves) of every key,
+// row by row
+#define KEY_STATS_VERSION 2
+#define KEY_STATS_SIZE (4 + ROWS * COLS * 7)
+
+// Characteristic UUID: 6E400005-B5A3-F393-E0A9-E50E24DCCA9E, in the key service
+#define KEY_STATS_UUID128 {0x9E, 0xCA, 0xDC, 0x24, 0x0E, 0xE5, 0xA9, 0xE0, \
+                           0x93, 0xF3, 0xA3, 0xB5, 0x05, 0x00, 0x40, 0x6E}
+
+// Load the last saved counters. Call before the scan core starts.
+void key_stats_init(void);
+
+// Count a debounced transition (scan core)
+void key_stats_record(uint8_t row, uint8_t col, bool pressed);
+
+// Save to flash when due (core 0 main loop). Briefly pauses the scan core.
+void key_stats_task(void);
+
+// The counters in the wire format; returns KEY_STATS_SIZE
+uint16_t key_stats_serialize(uint8_t *buffer);
+
+#endif // KEY_STATS_H
@@ -0,0 +1,191 @@
+/**
+ * Key Event Transmit Queue
+ *
+ * Every event goes through the queue. While the link is ready events are
+ * sent immediately; if the stack refuses one (no ACL buffers) the queue
+ * asks for a can-send-now callback and resumes from there. Events that
+ * wait are sent in batches of up to KEY_TX_BATCH_MAX per packet. While the link
+ * is down events are held for up to KEY_TX_MAX_AGE_MS so a short
+ * disconnect or reconnect doesn't lose keystrokes, and for longer before
+ * the first connection, which comes at the end of a boot. A release never
+ * expires, and a press only expires together with its release: dropping
+ * one without the other would leave the key stuck down on the host.
+ *
+ * Not thread safe: call from the BTstack context (or with its lock held).
+ */
+
+#include <stddef.h>
+#include "key_tx_queue.h"
+
+typedef struct {
+    key_event_t event;
+    uint32_t time_ms;     // When the event was queued
+    uint8_t failures;     // Failed send attempts so far
+    bool waited;          // Couldn't be sent straight away
+    bool dropped;         // Expired, to be taken out of the queue
+} key_tx_entry_t;
+
+static key_tx_entry_t entries[KEY_TX_QUEUE_SIZE];
+static uint16_t head = 0;   // Next free slot
+static uint16_t tail = 0;   // Oldest entry
+static bool ready = false;
+static bool ever_ready = false;
+static bool can_send_requested = false;
+
+static key_tx_send_t send_fn = NULL;
+static key_tx_request_t request_fn = NULL;
+static key_tx_stats_t stats = {0};
+
+void key_tx_init(key_tx_send_t send, key_tx_request_t request_can_send) {
+    send_fn = send;
+    request_fn = request_can_send;
+    head = tail = 0;
+    ready = false;
+    ever_ready = false;
+    can_send_requested = false;
+}
+
+uint16_t key_tx_count(void) {
+    return (uint16_t)(head - tail);
+}
+
+// The release of the key pressed by the entry at index, if it's queued
+static key_tx_entry_t *queued_release(uint16_t index) {
+    const key_event_t *press = &entries[index % KEY_TX_QUEUE_SIZE].event;
+    for (uint16_t i = index + 1; i != head; i++) {
+        key_tx_entry_t *entry = &entries[i % KEY_TX_QUEUE_SIZE];
+        if (entry->event.type == KEY_EVENT_RELEASE && entry->event.side == press->side &&
+            entry->event.row == press->row && entry->event.col == press->col) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void expire_old(uint32_t now_ms) {
+    uint32_t max_age = ever_ready ? KEY_TX_MAX_AGE_MS : KEY_TX_BOOT_MAX_AGE_MS;
+    
+    // Entries are in time order, so the expired ones come first. Releases
+    // stay, and so do presses of keys still held.
+    bool any = false;
+    for (uint16_t i = tail; i != head; i++) {
+        key_tx_entry_t *entry = &entries[i % KEY_TX_QUEUE_SIZE];
+        if (now_ms - entry->time_ms <= max_age) break;
+        if (entry->dropped || entry->event.type == KEY_EVENT_RELEASE) continue;
+        if (entry->event.type == KEY_EVENT_PRESS) {
+            key_tx_entry_t *release = queued_release(i);
+            if (!release) continue;
+            release->dropped = true;
+        }
+        entry->dropped = true;
+        any = true;
+    }
+    if (!any) return;
+    
+    // Close the gaps, keeping the order
+    uint16_t kept = tail;
+    for (uint16_t i = tail; i != head; i++) {
+        key_tx_entry_t *entry = &entries[i % KEY_TX_QUEUE_SIZE];
+        if (entry->dropped) {
+            stats.expired++;
+            continue;
+        }
+        if (kept != i) entries[kept % KEY_TX_QUEUE_SIZE] = *entry;
+        kept++;
+    }
+    head = kept;
+}
+
+void key_tx_flush(uint32_t now_ms) {
+    can_send_requested = false;
+    expire_old(now_ms);
+    
+    while (ready && head != tail) {
+        // Gather the oldest events into one packet
+        key_event_t batch[KEY_TX_BATCH_MAX];
+        uint16_t count = 0;
+        while (count < KEY_TX_BATCH_MAX && (uint16_t)(tail + count) != head) {
+            key_tx_entry_t *entry = &entries[(uint16_t)(tail + count) % KEY_TX_QUEUE_SIZE];
+            if (entry->failures > 0) stats.retried++;
+            batch[count++] = entry->event;
+        }
+        
+        uint16_t sent = send_fn(batch, count);
+        if (sent == 0) {
+            // Stack is busy, pick up again on can-send-now
+            for (uint16_t i = 0; i < count; i++) {
+                key_tx_entry_t *entry = &entries[(uint16_t)(tail + i) % KEY_TX_QUEUE_SIZE];
+                if (!entry->waited) {
+                    entry->waited = true;
+                    stats.queued++;
+                }
+                if (entry->failures < 255) entry->failures++;
+            }
+            can_send_requested = true;
+            request_fn();
+            return;
+        }
+        
+        stats.packets++;
+        for (uint16_t i = 0; i < sent; i++) {
+            stats.sent++;
+            if (entries[tail % KEY_TX_QUEUE_SIZE].waited) stats.flushed++;
+            tail++;
+        }
+    }
+}
+
+static bool enqueue(const key_event_t *event, uint32_t now_ms) {
+    if (key_tx_count() >= KEY_TX_QUEUE_SIZE) {
+        stats.overflows++;
+        return false;
+    }
+    
+    key_tx_entry_t *entry = &entries[head % KEY_TX_QUEUE_SIZE];
+    entry->event = *event;
+    entry->time_ms = now_ms;
+    entry->failures = 0;
+    entry->waited = false;
+    entry->dropped = false;
+    head++;
+    
+    // Held until the link comes back (or the event expires), or behind a
+    // pending can-send-now request
+    if (!ready || can_send_requested) {
+        entry->waited = true;
+        stats.queued++;
+    }
+    return true;
+}
+
+void key_tx_push(const key_event_t *event, uint32_t now_ms) {
+    key_tx_push_batch(event, 1, now_ms);
+}
+
+void key_tx_push_batch(const key_event_t *events, uint16_t count, uint32_t now_ms) {
+    expire_old(now_ms);
+    
+    for (uint16_t i = 0; i < count; i++) {
+        enqueue(&events[i], now_ms);
+    }
+    
+    if (ready && !can_send_requested) key_tx_flush(now_ms);
+}
+
+void key_tx_set_ready(bool is_ready, uint32_t now_ms) {
+    ready = is_ready;
+    if (ready) ever_ready = true;
+    if (!ready) {
+        can_send_requested = false;
+        return;
+    }
+    key_tx_flush(now_ms);
+}
+
+bool key_tx_is_ready(void) {
+    return ready;
+}
+
+const key_tx_stats_t *key_tx_get_stats(void) {
+    return &stats;
+}
@@ -0,0 +1,53 @@
+/**
+ * Key Event Transmit Queue
+ * Bounded queue between the matrix scanner and the BLE link on the halves
+ */
+
+#ifndef KEY_TX_QUEUE_H
+#define KEY_TX_QUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "key_event.h"
+
+#define KEY_TX_QUEUE_SIZE 64       // Power of two
+#define KEY_TX_MAX_AGE_MS 2000     // Drop events older than this instead of sending them late
+#define KEY_TX_BOOT_MAX_AGE_MS 5000  // Until the link is first ready: keys pressed while booting
+#define KEY_TX_BATCH_MAX 5         // Events offered per send, 5 fill a default-MTU notification
+
+// Try to send up to count events now as one packet; return how many were
+// sent (0 if the stack can't take any)
+typedef uint16_t (*key_tx_send_t)(const key_event_t *events, uint16_t count);
+// Ask the stack to call key_tx_flush() when it can send again
+typedef void (*key_tx_request_t)(void);
+
+typedef struct {
+    uint32_t sent;        // Events delivered to the stack
+    uint32_t packets;     // Sends they went out in
+    uint32_t queued;      // Events that had to wait (link down or stack busy)
+    uint32_t retried;     // Send attempts after a failed one
+    uint32_t flushed;     // Waiting events delivered later
+    uint32_t expired;     // Events dropped for exceeding KEY_TX_MAX_AGE_MS
+    uint32_t overflows;   // Events dropped because the queue was full
+} key_tx_stats_t;
+
+void key_tx_init(key_tx_send_t send, key_tx_request_t request_can_send);
+
+// Queue an event and send it straight away if the link is ready
+void key_tx_push(const key_event_t *event, uint32_t now_ms);
+
+// Queue several events and send them together, e.g. when relaying a batch
+void key_tx_push_batch(const key_event_t *events, uint16_t count, uint32_t now_ms);
+
+// Send as many queued events as the stack accepts, dropping expired ones.
+// Call on link ready and on ATT_EVENT_CAN_SEND_NOW.
+void key_tx_flush(uint32_t now_ms);
+
+// Link usable for notifications (connected and subscribed)
+void key_tx_set_ready(bool ready, uint32_t now_ms);
+bool key_tx_is_ready(void);
+
+uint16_t key_tx_count(void);
+const key_tx_stats_t *key_tx_get_stats(void);
+
+#endif // KEY_TX_QUEUE_H
@@ -0,0 +1,950 @@
+/**
+ * Keyboard Logic
+ * Layers, macros, mouse keys, encoders and USB HID report generation.
+ * Shared by the dongle and the dongle-less (USB-connected) half.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+#include "spsc_queue.h"
+
+// Include TinyUSB first to avoid conflicts
+#include "tusb.h"
+#include "usb_descriptors.h"
+
+#include "keyboard.h"
+#include "raw_hid.h"
+#include "text_inject.h"
+#include "klog.h"
+#include "boot_timeline.h"
+#include "recovery.h"
+
+// Include keymap configuration
+#include "keymap.h"
+
+// Resolved report states from key processing to the USB side (may be another core)
+typedef enum {
+    USB_MSG_KEYBOARD,   // report: modifier, reserved, 6 keys
+    USB_MSG_MOUSE,      // report: buttons, x, y, wheel, pan
+    USB_MSG_CONSUMER    // report: usage (little-endian), 0 = released
+} usb_msg_type_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t report[8];
+} usb_msg_t;
+
+#define USB_QUEUE_SIZE 64
+static usb_msg_t usb_msg_buffer[USB_QUEUE_SIZE];
+static spsc_queue_t usb_queue;
+
+// Held keys and the layers they hold on. Kept across a watchdog reset
+// (recovery.h), sealed after every change.
+static struct {
+    // Layer state: bit n set while layer n is held. Layer 0 is always active.
+    uint8_t layer_state;
+    // Action each held key resolved to when it was pressed (0 = not held). The
+    // release uses this, so it undoes the press even if the layers changed since.
+    uint8_t latched_action[SIDES][ROWS][COLS];
+} __uninitialized_ram(held);
+static uint32_t __uninitialized_ram(held_check);
+
+// Keymap flattened for the current layer_state, transparency already resolved.
+// Rebuilt only when layer_state changes, so a key press is a single lookup.
+static uint8_t active_keymap[SIDES][ROWS][COLS];
+
+// USB HID keyboard report
+static uint8_t kbd_report[8] = {0};  // Modifier, reserved, 6 keys
+static bool report_changed = false;
+
+// Keycodes released since the last queued report. Pressing one again first
+// queues the report with it up, or a quick re-press between keyboard_task()
+// runs (e.g. two events in one notification) would be merged away.
+static uint32_t released_unreported[256 / 32];
+
+// Mouse state
+static int8_t mouse_x = 0, mouse_y = 0;
+static int8_t mouse_wheel = 0, mouse_pan = 0;
+static uint8_t mouse_buttons = 0;
+static bool mouse_report_pending = false;
+
+// Pointer motion from the halves (thumbstick) and encoder scrolling, summed
+// until reported. A report carries up to +-127 per axis, the rest goes in
+// the next one.
+static int16_t motion_x = 0, motion_y = 0;
+static int16_t motion_wheel = 0, motion_pan = 0;
+
+// Encoders: a detent taps its key once while turned slowly; above
+// ENCODER_ACCEL_START detents/s every further ENCODER_ACCEL_STEP adds a tap
+#define ENCODER_ACCEL_START 8
+#define ENCODER_ACCEL_STEP 8
+#define ENCODER_ACCEL_MAX 6       // Taps per detent at most
+#define ENCODER_TAPS_MAX 16       // Per event: two reports each, the USB queue holds 64
+#define ENCODER_IDLE_MS 200       // First detent after a pause is never accelerated
+static uint32_t encoder_last_ms[SIDES][ENCODERS];
+
+// Consumer control usages for KEY_CONSUMER_FIRST..KEY_CONSUMER_LAST
+static const uint16_t consumer_usages[] = {
+    HID_USAGE_CONSUMER_VOLUME_INCREMENT,
+    HID_USAGE_CONSUMER_VOLUME_DECREMENT,
+    HID_USAGE_CONSUMER_MUTE,
+    HID_USAGE_CONSUMER_PLAY_PAUSE,
+};
+_Static_assert(sizeof(consumer_usages) / sizeof(consumer_usages[0]) == KEY_CONSUMER_LAST - KEY_CONSUMER_FIRST + 1,
+               "one usage per consumer key");
+
+// Consumer control state. Like report_changed, what hasn't been queued yet
+// stays pending and keyboard_task() retries it.
+static uint16_t consumer_held = 0;       // Usage of the media key held, 0 = none
+static uint16_t consumer_reported = 0;   // Usage in the last report queued
+static uint16_t consumer_tap_usage = 0;  // Usage the encoder taps
+static uint8_t consumer_taps = 0;        // Taps not finished, up to ENCODER_TAPS_MAX
+static bool consumer_tap_down = false;   // First of them pressed, release not queued yet
+
+// Smooth scrolling state
+// Scroll keys stream wheel/pan deltas at the report rate. When the host has
+// enabled the Resolution Multiplier one detent is SCROLL_RESOLUTION counts,
+// otherwise deltas are whole detents.
+#define SCROLL_SPEED_MIN 4       // detents/s right after the initial step
+#define SCROLL_SPEED_MAX 40      // detents/s once fully accelerated
+#define SCROLL_ACCEL_MS 800      // ms to reach SCROLL_SPEED_MAX
+static volatile bool scroll_hires_wheel = false;  // Set by host via feature report
+static volatile bool scroll_hires_pan = false;
+static int8_t scroll_dir_v = 0, scroll_dir_h = 0;  // -1, 0, 1 per held scroll key
+static uint32_t scroll_start_v = 0, scroll_start_h = 0;
+static uint32_t last_scroll_time = 0;
+static int32_t scroll_accum_v = 0, scroll_accum_h = 0;  // counts * 1000
+
+// USB suspend. The callbacks run on the USB side, wakeup requests come
+// from key processing; only the USB side calls into TinyUSB.
+static volatile bool usb_suspended = false;
+static volatile bool remote_wakeup_allowed = false;  // Host enabled it before suspending
+static volatile bool wake_requested = false;         // A key asked the host to wake up
+static bool wake_signalled = false;                  // tud_remote_wakeup() done (USB side)
+static volatile uint32_t wake_key_us = 0;            // When that key arrived
+static uint32_t wake_resume_us = 0;                  // When the host resumed, 0 = not measuring
+
+// Auto-click state
+static bool auto_click_active = false;
+static uint32_t auto_click_interval = 100;  // ms
+static uint32_t last_auto_click = 0;
+
+// Macro support
+#define MAX_MACRO_LENGTH 32
+#define MAX_MACROS 16
+
+typedef struct {
+    uint8_t length;
+    uint8_t keys[MAX_MACRO_LENGTH];
+} macro_t;
+
+// Keymap and macros, replaced as one unit by live updates
+typedef struct {
+    uint8_t keymap[MAX_LAYERS][SIDES][ROWS][COLS];
+    macro_t macros[MAX_MACROS];
+} keyboard_config_t;
+
+// Double buffered: key processing reads *live while the USB side fills the
+// other buffer. keyboard_task() swaps them once an update has been committed.
+static keyboard_config_t config_buffers[2];
+static keyboard_config_t *live = &config_buffers[0];
+static keyboard_config_t *shadow = &config_buffers[1];
+static volatile bool update_pending = false;  // Shadow committed, waiting for swap
+
+static int active_macro = -1;  // Macro being typed by the text injector
+
+#ifdef TEXT_INJECT_BENCHMARK
+// Typed instead of the macros, to measure the injection rate
+#define BENCHMARK_TEXT_LEN 1000
+static char benchmark_text[BENCHMARK_TEXT_LEN];
+
+static void init_benchmark_text(void) {
+    // Repeats ("ll", "oo") and shifted characters exercise every report path
+    static const char sample[] = "The quick brown FOX jumps over the lazy dog, 0123456789 times! ";
+    for (int i = 0; i < BENCHMARK_TEXT_LEN; i++) {
+        benchmark_text[i] = sample[i % (sizeof(sample) - 1)];
+    }
+}
+#endif
+
+void init_macros(void) {
+    macro_t *macros = live->macros;
+    
+    // Example macro 0: "Hello"
+    macros[0].length = 5;
+    macros[0].keys[0] = HID_KEY_H;
+    macros[0].keys[1] = HID_KEY_E;
+    macros[0].keys[2] = HID_KEY_L;
+    macros[0].keys[3] = HID_KEY_L;
+    macros[0].keys[4] = HID_KEY_O;
+    
+    // Example macro 1: Ctrl+C
+    macros[1].length = 1;
+    macros[1].keys[0] = HID_KEY_C | 0x80;  // High bit indicates Ctrl modifier
+    
+    // Add more macros as needed
+}
+
+void add_key_to_report(uint8_t keycode) {
+    // Check if it's a modifier
+    if (keycode >= KEY_MOD_FIRST && keycode <= KEY_MOD_LAST) {
+        kbd_report[0] |= 1 << (keycode - KEY_MOD_FIRST);
+        return;
+    }
+    
+    // Add to key slots (skip if already present)
+    for (int i = 2; i < 8; i++) {
+        if (kbd_report[i] == keycode) return;
+    }
+    
+    // Find empty slot
+    for (int i = 2; i < 8; i++) {
+        if (kbd_report[i] == 0) {
+            kbd_report[i] = keycode;
+            return;
+        }
+    }
+}
+
+void remove_key_from_report(uint8_t keycode) {
+    // Check if it's a modifier
+    if (keycode >= KEY_MOD_FIRST && keycode <= KEY_MOD_LAST) {
+        kbd_report[0] &= ~(1 << (keycode - KEY_MOD_FIRST));
+        return;
+    }
+    
+    // Remove from key slots
+    for (int i = 2; i < 8; i++) {
+        if (kbd_report[i] == keycode) {
+            kbd_report[i] = 0;
+        }
+    }
+}
+
+// Queue the current keyboard report for the USB core.
+// If the queue is full report_changed stays set and the main loop retries.
+void send_keyboard_report(void) {
+    usb_msg_t msg = {.type = USB_MSG_KEYBOARD};
+    memcpy(msg.report, kbd_report, sizeof(kbd_report));
+    
+    if (spsc_queue_push(&usb_queue, &msg)) {
+        report_changed = false;
+        memset(released_unreported, 0, sizeof(released_unreported));
+        __sev();
+    }
+}
+
+static int16_t clamp_int8(int32_t value) {
+    if (value > 127) return 127;
+    if (value < -127) return -127;
+    return value;
+}
+
+static int16_t add_saturated(int16_t a, int32_t b) {
+    int32_t sum = a + b;
+    if (sum > INT16_MAX) return INT16_MAX;
+    if (sum < -INT16_MAX) return -INT16_MAX;
+    return sum;
+}
+
+void send_mouse_report(void) {
+    if (!mouse_report_pending) return;
+    
+    int16_t x = clamp_int8(mouse_x + motion_x);
+    int16_t y = clamp_int8(mouse_y + motion_y);
+    int16_t wheel = clamp_int8(mouse_wheel + motion_wheel);
+    int16_t pan = clamp_int8(mouse_pan + motion_pan);
+    usb_msg_t msg = {
+        .type = USB_MSG_MOUSE,
+        .report = {mouse_buttons, (uint8_t)x, (uint8_t)y, (uint8_t)wheel, (uint8_t)pan}
+    };
+    
+    if (spsc_queue_push(&usb_queue, &msg)) {
+        __sev();
+        motion_x -= x - mouse_x;
+        motion_y -= y - mouse_y;
+        motion_wheel -= wheel - mouse_wheel;
+        motion_pan -= pan - mouse_pan;
+        mouse_x = 0;
+        mouse_y = 0;
+        mouse_wheel = 0;
+        mouse_pan = 0;
+        mouse_report_pending = motion_x || motion_y || motion_wheel || motion_pan;
+    }
+}
+
+// Queue the next consumer report: encoder taps first, a press and then a
+// release each, then the media key held. Taps wait for an empty USB queue,
+// so a fast turn never crowds out keys. Retried from keyboard_task().
+static void send_consumer_report(void) {
+    uint16_t usage;
+    if (consumer_taps) {
+        if (spsc_queue_count(&usb_queue)) return;
+        usage = consumer_tap_down ? 0 : consumer_tap_usage;
+    } else {
+        usage = consumer_held;
+        if (usage == consumer_reported) return;
+    }
+    
+    usb_msg_t msg = {.type = USB_MSG_CONSUMER, .report = {usage & 0xFF, usage >> 8}};
+    if (!spsc_queue_push(&usb_queue, &msg)) return;
+    __sev();
+    consumer_reported = usage;
+    if (consumer_taps) {
+        if (consumer_tap_down) consumer_taps--;
+        consumer_tap_down = !consumer_tap_down;
+    }
+}
+
+static bool consumer_report_pending(void) {
+    return consumer_taps || consumer_held != consumer_reported;
+}
+
+// Scroll speed in detents/s after being held for held_ms.
+// Quadratic ease-in so short holds stay precise and long holds get fast.
+static uint32_t scroll_speed(uint32_t held_ms) {
+    if (held_ms >= SCROLL_ACCEL_MS) return SCROLL_SPEED_MAX;
+    uint32_t t = held_ms * 1000 / SCROLL_ACCEL_MS;  // 0..999
+    return SCROLL_SPEED_MIN + (SCROLL_SPEED_MAX - SCROLL_SPEED_MIN) * t * t / 1000000;
+}
+
+// Advance one scroll axis by elapsed_ms, returns the counts to report
+static int8_t scroll_step(int8_t dir, uint32_t start, int32_t *accum, bool hires,
+                          uint32_t now, uint32_t elapsed_ms) {
+    if (dir == 0) return 0;
+
+    uint32_t resolution = hires ? SCROLL_RESOLUTION : 1;
+    *accum += (int32_t)(scroll_speed(now - start) * resolution * elapsed_ms);
+
+    int32_t counts = *accum / 1000;
+    if (counts > 127) counts = 127;
+    *accum -= counts * 1000;
+    return (int8_t)(dir * counts);
+}
+
+void scroll_key_event(uint8_t keycode, bool pressed) {
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    bool vertical = (keycode == KEY_SCROLL_UP || keycode == KEY_SCROLL_DOWN);
+    int8_t dir = (keycode == KEY_SCROLL_UP || keycode == KEY_SCROLL_RIGHT) ? 1 : -1;
+    int8_t *axis_dir = vertical ? &scroll_dir_v : &scroll_dir_h;
+
+    if (pressed) {
+        *axis_dir = dir;
+        // Step a full detent immediately so a tap behaves like a wheel click
+        if (vertical) {
+            scroll_start_v = now;
+            scroll_accum_v = 0;
+            mouse_wheel = dir * (scroll_hires_wheel ? SCROLL_RESOLUTION : 1);
+        } else {
+            scroll_start_h = now;
+            scroll_accum_h = 0;
+            mouse_pan = dir * (scroll_hires_pan ? SCROLL_RESOLUTION : 1);
+        }
+        last_scroll_time = now;
+        mouse_report_pending = true;
+    } else if (*axis_dir == dir) {
+        *axis_dir = 0;
+    }
+}
+
+void process_scroll(void) {
+    if (scroll_dir_v == 0 && scroll_dir_h == 0) return;
+
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    uint32_t elapsed = now - last_scroll_time;
+    
+    // Wait for the previous report (e.g. the initial detent) to go out
+    if (elapsed == 0 || mouse_report_pending) return;
+    last_scroll_time = now;
+
+    mouse_wheel = scroll_step(scroll_dir_v, scroll_start_v, &scroll_accum_v,
+                              scroll_hires_wheel, now, elapsed);
+    mouse_pan = scroll_step(scroll_dir_h, scroll_start_h, &scroll_accum_h,
+                            scroll_hires_pan, now, elapsed);
+    if (mouse_wheel || mouse_pan) {
+        mouse_report_pending = true;
+    }
+}
+
+// Resolve every key against the active layers, top layer first
+static void rebuild_active_keymap(void) {
+    for (int side = 0; side < SIDES; side++) {
+        for (int row = 0; row < ROWS; row++) {
+            for (int col = 0; col < COLS; col++) {
+                uint8_t keycode = KEY_NONE;
+                for (int layer = MAX_LAYERS - 1; layer >= 0; layer--) {
+                    if (!(held.layer_state & (1 << layer))) continue;
+                    uint8_t k = live->keymap[layer][side][row][col];
+                    if (k != KEY_TRANSPARENT) {
+                        keycode = k;
+                        break;
+                    }
+                }
+                active_keymap[side][row][col] = keycode;
+            }
+        }
+    }
+}
+
+static void set_layer_state(uint8_t state) {
+    state |= 1;  // Base layer can't be turned off
+    if (state == held.layer_state) return;
+    held.layer_state = state;
+    recovery_seal(&held, sizeof(held), &held_check);
+    rebuild_active_keymap();
+    KLOG("Layers: 0x%02x\n", held.layer_state);
+}
+
+// Key for an encoder's direction on the active layers, top layer first
+static uint8_t encoder_keycode(uint8_t side, uint8_t encoder, bool clockwise) {
+    for (int layer = MAX_LAYERS - 1; layer >= 0; layer--) {
+        if (!(held.layer_state & (1 << layer))) continue;
+        uint8_t k = encoder_map[layer][side][encoder][clockwise];
+        if (k != KEY_TRANSPARENT) return k;
+    }
+    return KEY_NONE;
+}
+
+// A press or a turn while the host sleeps wakes it, if it allows that
+static void request_wakeup(void) {
+    if (!usb_suspended || !remote_wakeup_allowed || wake_requested) return;
+    wake_key_us = time_us_32();
+    wake_requested = true;
+}
+
+static void process_encoder_event(const key_event_t *event) {
+    if (event->side >= SIDES || event->encoder >= ENCODERS || event->detents == 0) return;
+    request_wakeup();
+    
+    // Speed from the time since this encoder's last event. Events are
+    // coalesced on the half, so a fast turn arrives as several detents.
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    uint32_t *last = &encoder_last_ms[event->side][event->encoder];
+    uint32_t elapsed = now - *last;
+    *last = now;
+    
+    uint32_t detents = event->detents < 0 ? -event->detents : event->detents;
+    uint32_t speed = elapsed < ENCODER_IDLE_MS ? detents * 1000 / (elapsed ? elapsed : 1) : 0;
+    uint32_t taps_per_detent = 1;
+    if (speed > ENCODER_ACCEL_START) {
+        taps_per_detent += (speed - ENCODER_ACCEL_START) / ENCODER_ACCEL_STEP;
+        if (taps_per_detent > ENCODER_ACCEL_MAX) taps_per_detent = ENCODER_ACCEL_MAX;
+    }
+    uint32_t taps = detents * taps_per_detent;
+    if (taps > ENCODER_TAPS_MAX) taps = ENCODER_TAPS_MAX;
+    
+    uint8_t keycode = encoder_keycode(event->side, event->encoder, event->detents > 0);
+    
+    if (keycode >= KEY_SCROLL_UP && keycode <= KEY_SCROLL_RIGHT) {
+        // Scroll by whole detents, through the 16-bit backlog
+        int32_t dir = (keycode == KEY_SCROLL_UP || keycode == KEY_SCROLL_RIGHT) ? 1 : -1;
+        if (keycode == KEY_SCROLL_UP || keycode == KEY_SCROLL_DOWN) {
+            motion_wheel = add_saturated(motion_wheel, dir * taps * (scroll_hires_wheel ? SCROLL_RESOLUTION : 1));
+        } else {
+            motion_pan = add_saturated(motion_pan, dir * taps * (scroll_hires_pan ? SCROLL_RESOLUTION : 1));
+        }
+        mouse_report_pending = true;
+    } else if (keycode >= KEY_CONSUMER_FIRST && keycode <= KEY_CONSUMER_LAST) {
+        // Add to the taps not sent yet. Turned the other way, the new taps
+        // replace them; a tap under way still gets its release.
+        uint16_t usage = consumer_usages[keycode - KEY_CONSUMER_FIRST];
+        if (usage != consumer_tap_usage) {
+            consumer_tap_usage = usage;
+            consumer_taps = consumer_tap_down;
+        }
+        taps += consumer_taps;
+        consumer_taps = taps > ENCODER_TAPS_MAX ? ENCODER_TAPS_MAX : taps;
+        send_consumer_report();
+    } else if (keycode <= 0xA4 || (keycode >= KEY_MOD_FIRST && keycode <= KEY_MOD_LAST)) {
+        if (keycode == KEY_TRANSPARENT || keycode == KEY_NONE) return;
+        
+        // Press and release in consecutive reports, around what is held
+        if (report_changed) send_keyboard_report();
+        for (uint32_t i = 0; i < taps; i++) {
+            add_key_to_report(keycode);
+            send_keyboard_report();
+            remove_key_from_report(keycode);
+            send_keyboard_report();
+        }
+    }
+    // Layer, macro and other mouse keys don't make sense on a knob
+}
+
+void process_key_event(const key_event_t* event) {
+    // Pointer motion isn't a key, it only adds to the next mouse report
+    if (event->type == KEY_EVENT_MOTION) {
+        motion_x = add_saturated(motion_x, event->dx);
+        motion_y = add_saturated(motion_y, event->dy);
+        mouse_report_pending = true;
+        return;
+    }
+    if (event->type == KEY_EVENT_ENCODER) {
+        process_encoder_event(event);
+        return;
+    }
+    // Link telemetry is for the central; anything newer isn't ours to guess at
+    if (event->type != KEY_EVENT_PRESS && event->type != KEY_EVENT_RELEASE) return;
+    
+    uint8_t side = event->side;
+    uint8_t row = event->row;
+    uint8_t col = event->col;
+    bool pressed = (event->type == 0);
+    
+    // Events come off the radio, don't trust them to index the keymap
+    if (side >= SIDES || row >= ROWS || col >= COLS) return;
+    boot_mark(BOOT_FIRST_KEY_IN);
+    if (pressed) request_wakeup();
+    
+    // Latch the action on press, replay it on release
+    uint8_t keycode;
+    if (pressed) {
+        if (held.latched_action[side][row][col]) return;  // Already held
+        keycode = active_keymap[side][row][col];
+        held.latched_action[side][row][col] = keycode;
+    } else {
+        keycode = held.latched_action[side][row][col];
+        held.latched_action[side][row][col] = 0;
+    }
+    recovery_seal(&held, sizeof(held), &held_check);
+    
+    if (keycode == KEY_TRANSPARENT || keycode == KEY_NONE) return;  // No mapping
+    
+    // Handle special keys
+    if (keycode >= KEY_LAYER_1 && keycode <= KEY_LAYER_3) {
+        uint8_t bit = 1 << (keycode - KEY_LAYER_1 + 1);
+        set_layer_state(pressed ? (held.layer_state | bit) : (held.layer_state & ~bit));
+        return;
+    }
+    
+    // Handle macros
+    if (keycode >= KEY_MACRO_0 && keycode < KEY_MACRO_0 + MAX_MACROS) {
+        if (pressed && active_macro < 0) {
+            int macro = keycode - KEY_MACRO_0;
+#ifdef TEXT_INJECT_BENCHMARK
+            bool started = text_inject_start((const uint8_t *)benchmark_text, BENCHMARK_TEXT_LEN, true);
+#else
+            bool started = text_inject_start(live->macros[macro].keys, live->macros[macro].length, false);
+#endif
+            if (started) {
+                active_macro = macro;
+                KLOG("Macro %d triggered\n", active_macro);
+            }
+        }
+        return;
+    }
+    
+    // Handle mouse buttons
+    if (keycode == KEY_MOUSE_LEFT) {
+        if (pressed) mouse_buttons |= 0x01;
+        else mouse_buttons &= ~0x01;
+        mouse_report_pending = true;
+        return;
+    }
+    if (keycode == KEY_MOUSE_RIGHT) {
+        if (pressed) mouse_buttons |= 0x02;
+        else mouse_buttons &= ~0x02;
+        mouse_report_pending = true;
+        return;
+    }
+    if (keycode == KEY_MOUSE_MIDDLE) {
+        if (pressed) mouse_buttons |= 0x04;
+        else mouse_buttons &= ~0x04;
+        mouse_report_pending = true;
+        return;
+    }
+    
+    // Handle mouse movement
+    if (keycode >= KEY_MOUSE_UP && keycode <= KEY_MOUSE_RIGHT_MOVE) {
+        if (pressed) {
+            switch(keycode) {
+                case KEY_MOUSE_UP: mouse_y = -10; break;
+                case KEY_MOUSE_DOWN: mouse_y = 10; break;
+                case KEY_MOUSE_LEFT_MOVE: mouse_x = -10; break;
+                case KEY_MOUSE_RIGHT_MOVE: mouse_x = 10; break;
+            }
+            mouse_report_pending = true;
+        }
+        return;
+    }
+    
+    // Handle scrolling
+    if (keycode >= KEY_SCROLL_UP && keycode <= KEY_SCROLL_RIGHT) {
+        scroll_key_event(keycode, pressed);
+        return;
+    }
+    
+    // Media keys: the usage while held, 0 once released
+    if (keycode >= KEY_CONSUMER_FIRST && keycode <= KEY_CONSUMER_LAST) {
+        consumer_held = pressed ? consumer_usages[keycode - KEY_CONSUMER_FIRST] : 0;
+        send_consumer_report();
+        return;
+    }
+    
+    // Handle auto-click toggle
+    if (keycode == KEY_AUTO_CLICK) {
+        if (pressed) {
+            auto_click_active = !auto_click_active;
+            KLOG("Auto-click: %s\n", auto_click_active ? "ON" : "OFF");
+        }
+        return;
+    }
+    
+    // Regular keyboard key
+    if (pressed) {
+        if (released_unreported[keycode / 32] & (1u << (keycode % 32))) send_keyboard_report();
+        add_key_to_report(keycode);
+    } else {
+        remove_key_from_report(keycode);
+        released_unreported[keycode / 32] |= 1u << (keycode % 32);
+    }
+    report_changed = true;
+}
+
+void process_key_event_batch(const key_event_t *events, uint16_t count) {
+    for (uint16_t i = 0; i < count; i++) {
+        process_key_event(&events[i]);
+    }
+}
+
+void keyboard_release_side(uint8_t side) {
+    if (side >= SIDES) return;
+    for (uint8_t row = 0; row < ROWS; row++) {
+        for (uint8_t col = 0; col < COLS; col++) {
+            if (!held.latched_action[side][row][col]) continue;
+            key_event_t release = {.type = KEY_EVENT_RELEASE, .row = row, .col = col, .side = side};
+            process_key_event(&release);
+        }
+    }
+}
+
+// Once the text injector is done, put back the report for the keys still held
+void process_macro(void) {
+    if (active_macro < 0 || text_inject_active()) return;
+    
+    active_macro = -1;
+    report_changed = true;
+    
+#ifdef TEXT_INJECT_BENCHMARK
+    const text_inject_stats_t *stats = text_inject_get_stats();
+    uint32_t ms = stats->us / 1000;
+    printf("Text injection: %lu chars, %lu reports in %lu ms = %lu chars/s\n",
+           (unsigned long)stats->chars, (unsigned long)stats->reports, (unsigned long)ms,
+           (unsigned long)(stats->us ? (uint64_t)stats->chars * 1000000 / stats->us : 0));
+#endif
+}
+
+void process_auto_click(void) {
+    if (!auto_click_active) return;
+    
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    if (now - last_auto_click < auto_click_interval) return;
+    
+    // Click
+    mouse_buttons |= 0x01;
+    mouse_report_pending = true;
+    send_mouse_report();
+    
+    // Release
+    mouse_buttons &= ~0x01;
+    mouse_report_pending = true;
+    send_mouse_report();
+    
+    last_auto_click = now;
+}
+
+void keyboard_init(void) {
+    spsc_queue_init(&usb_queue, usb_msg_buffer, sizeof(usb_msg_t), USB_QUEUE_SIZE);
+    
+    // After a watchdog reset the keys held before it keep their layers, and
+    // their releases still undo them. The host released everything when the
+    // USB device went away, and the reports start out empty.
+    if (!recovery_restore(&held, sizeof(held), &held_check)) {
+        memset(&held, 0, sizeof(held));
+        held.layer_state = 1;
+        recovery_seal(&held, sizeof(held), &held_check);
+    }
+    
+    // Start from the compiled-in keymap
+    memcpy(live->keymap, keymap, sizeof(live->keymap));
+    init_macros();
+    rebuild_active_keymap();
+#ifdef TEXT_INJECT_BENCHMARK
+    init_benchmark_text();
+#endif
+}
+
+// Live keymap updates
+// The USB side owns *shadow until it commits; from then until the swap the
+// key processing side owns it. The swap happens between key events, and held
+// keys keep the actions latched when they were pressed.
+
+static bool keycode_valid(uint8_t keycode) {
+    if (keycode <= 0xA4) return true;  // Transparent, none and the HID keyboard page up to ExSel
+    if (keycode >= KEY_MOUSE_LEFT && keycode <= KEY_CONSUMER_LAST) return true;
+    if (keycode >= KEY_MACRO_0 && keycode < KEY_MACRO_0 + MAX_MACROS) return true;
+    if (keycode >= KEY_LAYER_1 && keycode <= KEY_LAYER_3) return true;
+    return keycode >= KEY_MOD_FIRST && keycode <= KEY_MOD_LAST;
+}
+
+static bool config_valid(const keyboard_config_t *config) {
+    const uint8_t *codes = &config->keymap[0][0][0][0];
+    for (size_t i = 0; i < sizeof(config->keymap); i++) {
+        if (!keycode_valid(codes[i])) return false;
+    }
+    for (int i = 0; i < MAX_MACROS; i++) {
+        if (config->macros[i].length > MAX_MACRO_LENGTH) return false;
+    }
+    return true;
+}
+
+void keyboard_config_layout(keyboard_config_layout_t *layout) {
+    layout->layers = MAX_LAYERS;
+    layout->sides = SIDES;
+    layout->rows = ROWS;
+    layout->cols = COLS;
+    layout->max_macros = MAX_MACROS;
+    layout->max_macro_length = MAX_MACRO_LENGTH;
+    layout->keymap_size = sizeof(live->keymap);
+    layout->size = sizeof(keyboard_config_t);
+}
+
+const uint8_t *keyboard_config_live(void) {
+    return (const uint8_t *)live;
+}
+
+uint8_t *keyboard_update_begin(void) {
+    if (keyboard_update_pending()) return NULL;
+    
+    // Edits start from the current config so partial updates work. *live only
+    // changes in the swap, which can't happen while no update is pending.
+    memcpy(shadow, live, sizeof(*shadow));
+    return (uint8_t *)shadow;
+}
+
+bool keyboard_update_commit(void) {
+    if (keyboard_update_pending() || !config_valid(shadow)) return false;
+    __atomic_store_n(&update_pending, true, __ATOMIC_RELEASE);
+    __sev();  // Wake the key processing core to do the swap
+    return true;
+}
+
+bool keyboard_update_pending(void) {
+    return __atomic_load_n(&update_pending, __ATOMIC_ACQUIRE);
+}
+
+// Swap in a committed update. Waits for a running macro to finish so it
+// doesn't continue with another macro's keys.
+static void apply_pending_update(void) {
+    if (!keyboard_update_pending() || active_macro >= 0) return;
+    
+    keyboard_config_t *old = live;
+    live = shadow;
+    shadow = old;
+    rebuild_active_keymap();
+    
+    __atomic_store_n(&update_pending, false, __ATOMIC_RELEASE);
+    printf("Keymap updated\n");
+}
+
+void keyboard_task(void) {
+    // Swap in a new keymap between key events
+    apply_pending_update();
+    
+    // Process macros
+    process_macro();
+    
+    // Process auto-click
+    process_auto_click();
+    
+    // Stream scroll deltas while scroll keys are held
+    process_scroll();
+    
+    // Send reports if needed
+    if (report_changed) {
+        send_keyboard_report();
+    }
+    if (mouse_report_pending) {
+        send_mouse_report();
+    }
+    if (consumer_report_pending()) {
+        send_consumer_report();
+    }
+}
+
+const spsc_queue_t *keyboard_usb_queue(void) {
+    return &usb_queue;
+}
+
+// USB side
+
+// Add a mouse message's deltas into another with the same buttons. Refuses
+// (returns false) if a sum wouldn't fit the report, so no motion is clipped.
+static bool merge_mouse_msg(usb_msg_t *into, const usb_msg_t *from) {
+    int16_t sum[5];
+    for (int i = 1; i < 5; i++) {
+        sum[i] = (int8_t)into->report[i] + (int8_t)from->report[i];
+        if (sum[i] > 127 || sum[i] < -127) return false;
+    }
+    for (int i = 1; i < 5; i++) {
+        into->report[i] = (uint8_t)(int8_t)sum[i];
+    }
+    return true;
+}
+
+// While the host sleeps without allowing remote wakeup, keys can't wake it,
+// so presses made meanwhile must not be typed when it resumes. Only the last
+// keyboard and consumer reports are kept, the keys still held; motion is dropped.
+static usb_msg_t held_msgs[2];   // Keyboard, consumer
+static bool have_held_msg[2];
+
+static void keep_held_state(const usb_msg_t *msg) {
+    if (msg->type == USB_MSG_MOUSE) return;
+    int slot = msg->type == USB_MSG_CONSUMER;
+    held_msgs[slot] = *msg;
+    have_held_msg[slot] = true;
+}
+
+// Send the next queued report whenever the HID endpoint is free
+void usb_emit_reports(void) {
+    static usb_msg_t pending;
+    static bool have_pending = false;
+    
+    // Reports wait for the host to resume. Signal resume once for a key.
+    if (usb_suspended) {
+        if (wake_requested && !wake_signalled) {
+            wake_signalled = true;
+            tud_remote_wakeup();
+        }
+        if (!remote_wakeup_allowed) {
+            if (have_pending) keep_held_state(&pending);
+            have_pending = false;
+            usb_msg_t msg;
+            while (spsc_queue_pop(&usb_queue, &msg)) keep_held_state(&msg);
+        }
+        return;
+    }
+    
+    // Typed text owns the endpoint until it's done; reports queued meanwhile
+    // go out afterwards, ending with the keys still held
+    text_inject_task();
+    if (text_inject_active()) return;
+    
+    // The held state from a suspend goes out before anything queued since
+    for (int slot = 0; slot < 2 && !have_pending; slot++) {
+        if (!have_held_msg[slot]) continue;
+        pending = held_msgs[slot];
+        have_pending = true;
+        have_held_msg[slot] = false;
+    }
+    if (!have_pending) {
+        have_pending = spsc_queue_pop(&usb_queue, &pending);
+        if (!have_pending) return;
+    }
+    
+    // While waiting for the endpoint, fold in further mouse motion so it isn't
+    // sent as a backlog of small reports
+    if (pending.type == USB_MSG_MOUSE) {
+        usb_msg_t next;
+        while (spsc_queue_peek(&usb_queue, &next) && next.type == USB_MSG_MOUSE &&
+               next.report[0] == pending.report[0] && merge_mouse_msg(&pending, &next)) {
+            spsc_queue_pop(&usb_queue, &next);
+        }
+    }
+    
+    if (!tud_hid_ready()) return;
+    
+    if (pending.type == USB_MSG_KEYBOARD) {
+        tud_hid_keyboard_report(REPORT_ID_KEYBOARD, pending.report[0], &pending.report[2]);
+        boot_mark(BOOT_FIRST_KEY_OUT);
+        if (wake_resume_us) {
+            KLOG("USB wake: resumed %lu us, first report %lu us after the key\n",
+                 (unsigned long)(wake_resume_us - wake_key_us), (unsigned long)(time_us_32() - wake_key_us));
+            wake_resume_us = 0;
+        }
+    } else if (pending.type == USB_MSG_CONSUMER) {
+        tud_hid_n_report(ITF_NUM_HID, REPORT_ID_CONSUMER, pending.report, 2);
+    } else {
+        tud_hid_mouse_report(REPORT_ID_MOUSE, pending.report[0], (int8_t)pending.report[1],
+                             (int8_t)pending.report[2], (int8_t)pending.report[3],
+                             (int8_t)pending.report[4]);
+    }
+    have_pending = false;
+}
+
+// USB HID callbacks (run wherever tud_task() runs)
+// Instance ITF_NUM_RAW_HID is the raw HID interface, handled in raw_hid.c
+void tud_hid_report_complete_cb(uint8_t instance, uint8_t const* report, uint16_t len) {
+    (void) report;
+    (void) len;
+    
+    // Typed text advances as soon as the host has taken the previous report
+    if (instance == ITF_NUM_HID) text_inject_report_complete();
+}
+
+uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, 
+                                uint8_t* buffer, uint16_t reqlen) {
+    if (instance == ITF_NUM_RAW_HID) return 0;
+    
+    if (report_type == HID_REPORT_TYPE_FEATURE && report_id == REPORT_ID_MOUSE_RES_MULTIPLIER && reqlen >= 1) {
+        buffer[0] = (scroll_hires_wheel ? 1 : 0) | ((scroll_hires_pan ? 1 : 0) << RES_MULTIPLIER_PAN_SHIFT);
+        return 1;
+    }
+    return 0;
+}
+
+void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, 
+                            uint8_t const* buffer, uint16_t bufsize) {
+    if (instance == ITF_NUM_RAW_HID) {
+        raw_hid_receive(buffer, bufsize);
+        return;
+    }
+    
+    if (report_type == HID_REPORT_TYPE_FEATURE && report_id == REPORT_ID_MOUSE_RES_MULTIPLIER && bufsize >= 1) {
+        // Last byte is the feature data whether or not the report ID was stripped
+        uint8_t value = buffer[bufsize - 1];
+        scroll_hires_wheel = (value & RES_MULTIPLIER_WHEEL_MASK) != 0;
+        scroll_hires_pan = ((value >> RES_MULTIPLIER_PAN_SHIFT) & RES_MULTIPLIER_WHEEL_MASK) != 0;
+        KLOG("Hi-res scroll: wheel %s, pan %s\n",
+             scroll_hires_wheel ? "ON" : "OFF", scroll_hires_pan ? "ON" : "OFF");
+    }
+}
+
+void tud_mount_cb(void) {
+    text_inject_reset();
+    boot_mark(BOOT_USB_MOUNTED);
+}
+
+// Resolution Multiplier returns to its default when the host resets the device.
+// A bus reset or unplug also drops the typed text's report in flight, and
+// the key state kept while the host slept: the next host never saw those keys.
+void tud_umount_cb(void) {
+    text_inject_reset();
+    scroll_hires_wheel = false;
+    scroll_hires_pan = false;
+    usb_suspended = false;
+    have_held_msg[0] = false;
+    have_held_msg[1] = false;
+}
+
+void tud_suspend_cb(bool remote_wakeup_en) {
+    remote_wakeup_allowed = remote_wakeup_en;
+    wake_requested = false;
+    wake_signalled = false;
+    wake_resume_us = 0;
+    usb_suspended = true;
+    KLOG("USB suspended, remote wakeup %s\n", remote_wakeup_en ? "on" : "off");
+}
+
+void tud_resume_cb(void) {
+    // Measure the wake only if a key caused it, not the host waking on its own
+    if (wake_requested) wake_resume_us = time_us_32() | 1;
+    usb_suspended = false;
+    wake_requested = false;
+    KLOG("USB resumed\n");
+}
+
+bool keyboard_usb_suspended(void) {
+    return usb_suspended && !wake_requested;
+}
@@ -0,0 +1,73 @@
+/**
+ * Keyboard Logic
+ * Layers, macros, mouse keys and USB HID report generation
+ */
+
+#ifndef KEYBOARD_H
+#define KEYBOARD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "spsc_queue.h"
+#include "key_event.h"
+
+// Set up the report queue and macros
+void keyboard_init(void);
+
+// Apply one key event from either half
+void process_key_event(const key_event_t* event);
+
+// Apply the events of one notification in order (central_key_handler_t)
+void process_key_event_batch(const key_event_t *events, uint16_t count);
+
+// A half's link dropped: release every key still held on that side, and with
+// them the layers they hold. Its releases may never arrive.
+void keyboard_release_side(uint8_t side);
+
+// Macros, auto-click, scrolling and queueing pending reports.
+// Call regularly from the same context as process_key_event().
+void keyboard_task(void);
+
+// USB side: send the next queued report when the HID endpoint is free.
+// Call after tud_task(), on the core that owns TinyUSB.
+void usb_emit_reports(void);
+
+// Report queue statistics
+const spsc_queue_t *keyboard_usb_queue(void);
+
+// The host has suspended the bus and no key has asked it to wake up yet:
+// the halves can scan slowly on a long-latency link. A key press while the
+// host allows remote wakeup clears this at once and wakes the host.
+bool keyboard_usb_suspended(void);
+
+// Live keymap and macro updates
+// The config image is the keymap ([layer][side][row][col] keycodes) followed
+// by the macros (per macro: length, then max_macro_length keys).
+typedef struct {
+    uint8_t layers;
+    uint8_t sides;
+    uint8_t rows;
+    uint8_t cols;
+    uint8_t max_macros;
+    uint8_t max_macro_length;
+    uint16_t keymap_size;   // Bytes of keymap at the start of the image
+    uint16_t size;          // Bytes in the whole image
+} keyboard_config_layout_t;
+
+void keyboard_config_layout(keyboard_config_layout_t *layout);
+
+// Image currently in use, for reading back
+const uint8_t *keyboard_config_live(void);
+
+// Start an update: returns the shadow image (a copy of the live one) to
+// modify, or NULL while a previous commit is still waiting to be swapped in
+uint8_t *keyboard_update_begin(void);
+
+// Validate the shadow image and hand it over to be swapped in by
+// keyboard_task(). The shadow must not be touched again until
+// keyboard_update_pending() returns false.
+bool keyboard_update_commit(void);
+
+bool keyboard_update_pending(void);
+
+#endif // KEYBOARD_H
@@ -13,6 +13,7 @@
 #define COLS 7
 #define SIDES 2
 #define MAX_LAYERS 4
+#define ENCODERS 1     // Rotary encoders per half (matches encoder.h)
 
 // HID keycodes
 #define HID_KEY_A 0x04
@@ -95,7 +96,7 @@
 #define HID_KEY_ARROW_DOWN 0x51
 #define HID_KEY_ARROW_UP 0x52
 
-// Modifiers
+// Modifier bits in the report's modifier byte
 #define HID_MOD_LEFT_CTRL 0x01
 #define HID_MOD_LEFT_SHIFT 0x02
 #define HID_MOD_LEFT_ALT 0x04
@@ -105,6 +106,20 @@
 #define HID_MOD_RIGHT_ALT 0x40
 #define HID_MOD_RIGHT_GUI 0x80
 
+// Modifier keys for the keymap. The HID_MOD_* bits can't be used as keycodes:
+// 0x01-0x80 overlaps ordinary keys (HID_MOD_LEFT_GUI is HID_KEY_E).
+// Same order as the modifier bits, so bit = 1 << (keycode - KEY_MOD_FIRST).
+#define KEY_LEFT_CTRL 0xF8
+#define KEY_LEFT_SHIFT 0xF9
+#define KEY_LEFT_ALT 0xFA
+#define KEY_LEFT_GUI 0xFB
+#define KEY_RIGHT_CTRL 0xFC
+#define KEY_RIGHT_SHIFT 0xFD
+#define KEY_RIGHT_ALT 0xFE
+#define KEY_RIGHT_GUI 0xFF
+#define KEY_MOD_FIRST KEY_LEFT_CTRL
+#define KEY_MOD_LAST KEY_RIGHT_GUI
+
 // Special key codes for layers and macros
 #define KEY_LAYER_1 0xF0
 #define KEY_LAYER_2 0xF1
@@ -118,12 +133,32 @@
 #define KEY_MOUSE_LEFT_MOVE 0xD5
 #define KEY_MOUSE_RIGHT_MOVE 0xD6
 #define KEY_AUTO_CLICK 0xD7
+#define KEY_SCROLL_UP 0xD8
+#define KEY_SCROLL_DOWN 0xD9
+#define KEY_SCROLL_LEFT 0xDA
+#define KEY_SCROLL_RIGHT 0xDB
+
+// Consumer control (media) keys, sent in their own report
+#define KEY_VOLUME_UP 0xDC
+#define KEY_VOLUME_DOWN 0xDD
+#define KEY_MUTE 0xDE
+#define KEY_PLAY_PAUSE 0xDF
+#define KEY_CONSUMER_FIRST KEY_VOLUME_UP
+#define KEY_CONSUMER_LAST KEY_PLAY_PAUSE
 
-// Convenience macro for empty keys
-#define ___ 0
+// Transparent: use the key from the next active layer down
+#define KEY_TRANSPARENT 0x00
+// Explicitly no key, even if a lower layer maps one (HID ErrorRollOver, never sent)
+#define KEY_NONE 0x01
+
+// Convenience macros for the keymap
+#define ___ KEY_TRANSPARENT
+#define XXX KEY_NONE
 
 // Keymap - [layer][side][row][col]
-// Customize this to match your preferred layout
+// Customize this to match your preferred layout.
+// Layer keys are momentary; the highest held layer wins and ___ falls through
+// to the layers below it (layer 0 is always active).
 static const uint8_t keymap[MAX_LAYERS][SIDES][ROWS][COLS] = {
     // Layer 0 - Base QWERTY
     {
@@ -132,16 +167,16 @@ static const uint8_t keymap[MAX_LAYERS][SIDES][ROWS][COLS] = {
             {HID_KEY_ESC,        HID_KEY_1,       HID_KEY_2,       HID_KEY_3,       HID_KEY_4,       HID_KEY_5,       ___},
             {HID_KEY_TAB,        HID_KEY_Q,       HID_KEY_W,       HID_KEY_E,       HID_KEY_R,       HID_KEY_T,       ___},
             {HID_KEY_CAPS_LOCK,  HID_KEY_A,       HID_KEY_S,       HID_KEY_D,       HID_KEY_F,       HID_KEY_G,       ___},
-            {HID_MOD_LEFT_SHIFT, HID_KEY_Z,       HID_KEY_X,       HID_KEY_C,       HID_KEY_V,       HID_KEY_B,       ___},
-            {HID_MOD_LEFT_CTRL,  HID_MOD_LEFT_GUI,HID_MOD_LEFT_ALT,KEY_LAYER_1,     HID_KEY_SPACE,   ___,             ___}
+            {KEY_LEFT_SHIFT,     HID_KEY_Z,       HID_KEY_X,       HID_KEY_C,       HID_KEY_V,       HID_KEY_B,       ___},
+            {KEY_LEFT_CTRL,      KEY_LEFT_GUI,    KEY_LEFT_ALT,    KEY_LAYER_1,     HID_KEY_SPACE,   ___,             ___}
         },
         // Right half
         {
             {___,                HID_KEY_6,       HID_KEY_7,       HID_KEY_8,            HID_KEY_9,           HID_KEY_0,           HID_KEY_BACKSPACE},
             {___,                HID_KEY_Y,       HID_KEY_U,       HID_KEY_I,            HID_KEY_O,           HID_KEY_P,           HID_KEY_LEFTBRACE},
             {___,                HID_KEY_H,       HID_KEY_J,       HID_KEY_K,            HID_KEY_L,           HID_KEY_SEMICOLON,   HID_KEY_APOSTROPHE},
-            {___,                HID_KEY_N,       HID_KEY_M,       HID_KEY_COMMA,        HID_KEY_DOT,         HID_KEY_SLASH,       HID_MOD_RIGHT_SHIFT},
-            {___,                ___,             HID_KEY_SPACE,   KEY_LAYER_2,          HID_MOD_RIGHT_ALT,   HID_MOD_RIGHT_CTRL,  ___}
+            {___,                HID_KEY_N,       HID_KEY_M,       HID_KEY_COMMA,        HID_KEY_DOT,         HID_KEY_SLASH,       KEY_RIGHT_SHIFT},
+            {___,                ___,             HID_KEY_SPACE,   KEY_LAYER_2,          KEY_RIGHT_ALT,       KEY_RIGHT_CTRL,      ___}
         }
     },
     
@@ -170,8 +205,8 @@ static const uint8_t keymap[MAX_LAYERS][SIDES][ROWS][COLS] = {
         // Left half
         {
             {___,                KEY_MACRO_0,     KEY_MACRO_0+1,   KEY_MACRO_0+2,   ___,             ___,             ___},
-            {___,                KEY_MOUSE_LEFT,  KEY_MOUSE_UP,    KEY_MOUSE_RIGHT, ___,             ___,             ___},
-            {___,                KEY_MOUSE_LEFT_MOVE, KEY_MOUSE_DOWN, KEY_MOUSE_RIGHT_MOVE, ___,      ___,             ___},
+            {___,                KEY_MOUSE_LEFT,  KEY_MOUSE_UP,    KEY_MOUSE_RIGHT, ___,             KEY_SCROLL_UP,   ___},
+            {___,                KEY_MOUSE_LEFT_MOVE, KEY_MOUSE_DOWN, KEY_MOUSE_RIGHT_MOVE, KEY_SCROLL_LEFT, KEY_SCROLL_DOWN, KEY_SCROLL_RIGHT},
             {___,                ___,             ___,             ___,             ___,             ___,             ___},
             {___,                ___,             ___,             ___,             KEY_AUTO_CLICK,  ___,             ___}
         },
@@ -206,4 +241,30 @@ static const uint8_t keymap[MAX_LAYERS][SIDES][ROWS][COLS] = {
     }
 };
 
+// Encoders - [layer][side][encoder][counter-clockwise, clockwise]
+// Each detent taps the key (faster turns tap it more often, see keyboard.c);
+// scroll keys scroll by a detent instead. ___ falls through as in the keymap.
+static const uint8_t encoder_map[MAX_LAYERS][SIDES][ENCODERS][2] = {
+    // Layer 0 - Volume
+    {
+        {{KEY_VOLUME_DOWN, KEY_VOLUME_UP}},
+        {{KEY_VOLUME_DOWN, KEY_VOLUME_UP}}
+    },
+    // Layer 1 - Cursor
+    {
+        {{HID_KEY_ARROW_UP, HID_KEY_ARROW_DOWN}},
+        {{HID_KEY_ARROW_LEFT, HID_KEY_ARROW_RIGHT}}
+    },
+    // Layer 2 - Scrolling
+    {
+        {{KEY_SCROLL_DOWN, KEY_SCROLL_UP}},
+        {{KEY_SCROLL_LEFT, KEY_SCROLL_RIGHT}}
+    },
+    // Layer 3
+    {
+        {{___, ___}},
+        {{___, ___}}
+    }
+};
+
 #endif // KEYMAP_H
\ No newline at end of file
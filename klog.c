@@ -0,0 +1,179 @@
+/**
+ * Deferred tokenized logging
+ *
+ * Frame on the wire: 0x00, COBS-encoded record, 0x00. Text printed with
+ * printf() never contains a zero byte, so the decoder can tell frames from
+ * text on the same UART. A printf() that lands inside a frame corrupts only
+ * that frame, which the decoder reports and skips.
+ */
+
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+#include "hardware/uart.h"
+#include "spsc_queue.h"
+#include "klog.h"
+
+#ifdef KLOG_BENCHMARK
+#include <stdio.h>
+#include "hardware/clocks.h"
+#include "hardware/structs/systick.h"
+#endif
+
+// One ring per core, each with a single producer (interrupts are masked
+// around the push) and klog_drain() as the consumer
+static klog_record_t ring_buffer[2][KLOG_RING_SIZE];
+static spsc_queue_t rings[2];
+static uint32_t reported_overflows[2];
+
+// Frame being sent: record of up to 24 bytes, COBS adds one, plus delimiters
+#define KLOG_FRAME_MAX (2 + 1 + 8 + 4 * KLOG_MAX_ARGS)
+static uint8_t frame[KLOG_FRAME_MAX];
+static uint8_t frame_len = 0;
+static uint8_t frame_pos = 0;
+
+void klog_init(void) {
+    for (int core = 0; core < 2; core++) {
+        spsc_queue_init(&rings[core], ring_buffer[core], sizeof(klog_record_t), KLOG_RING_SIZE);
+        reported_overflows[core] = 0;
+    }
+    frame_len = 0;
+    frame_pos = 0;
+}
+
+void klog_write(const char *fmt, uint8_t nargs, uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+    klog_record_t record = {
+        .fmt = (uint32_t)(uintptr_t)fmt,
+        .time_us = time_us_32(),
+        .args = {a, b, c, d},
+        .nargs = nargs,
+    };
+    
+    // Keeps a KLOG() in an interrupt handler from interleaving with one in
+    // the code it interrupted on the same core
+    uint32_t irq = save_and_disable_interrupts();
+    spsc_queue_push(&rings[get_core_num()], &record);
+    restore_interrupts(irq);
+}
+
+static void put_u32(uint8_t *p, uint32_t value) {
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+// Consistent Overhead Byte Stuffing: no zero bytes in the output
+static uint8_t cobs_encode(const uint8_t *in, uint8_t len, uint8_t *out) {
+    uint8_t code_pos = 0;
+    uint8_t out_len = 1;
+    uint8_t code = 1;
+    
+    for (uint8_t i = 0; i < len; i++) {
+        if (in[i] == 0) {
+            out[code_pos] = code;
+            code_pos = out_len++;
+            code = 1;
+        } else {
+            out[out_len++] = in[i];
+            code++;
+        }
+    }
+    out[code_pos] = code;
+    return out_len;
+}
+
+static void build_frame(const klog_record_t *record) {
+    uint8_t raw[8 + 4 * KLOG_MAX_ARGS];
+    uint8_t nargs = record->nargs > KLOG_MAX_ARGS ? KLOG_MAX_ARGS : record->nargs;
+    
+    put_u32(&raw[0], record->fmt);
+    put_u32(&raw[4], record->time_us);
+    for (uint8_t i = 0; i < nargs; i++) {
+        put_u32(&raw[8 + 4 * i], record->args[i]);
+    }
+    
+    frame[0] = 0;
+    frame_len = 1 + cobs_encode(raw, 8 + 4 * nargs, &frame[1]);
+    frame[frame_len++] = 0;
+    frame_pos = 0;
+}
+
+// Oldest record across both rings, or a drop notice once a ring that
+// overflowed has emptied (the dropped records came after everything in it)
+static bool next_record(klog_record_t *record) {
+    klog_record_t head[2];
+    bool have[2];
+    for (int core = 0; core < 2; core++) {
+        have[core] = spsc_queue_peek(&rings[core], &head[core]);
+        
+        uint32_t overflows = rings[core].overflows;
+        if (!have[core] && overflows != reported_overflows[core]) {
+            *record = (klog_record_t){.fmt = 0, .time_us = time_us_32(),
+                                      .args = {overflows - reported_overflows[core], core}, .nargs = 2};
+            reported_overflows[core] = overflows;
+            return true;
+        }
+    }
+    
+    int core;
+    if (have[0] && have[1]) {
+        core = (int32_t)(head[1].time_us - head[0].time_us) < 0 ? 1 : 0;
+    } else if (have[0] || have[1]) {
+        core = have[0] ? 0 : 1;
+    } else {
+        return false;
+    }
+    spsc_queue_pop(&rings[core], record);
+    return true;
+}
+
+void klog_drain(void) {
+    uart_inst_t *uart = uart_default;
+    
+    while (uart_is_writable(uart)) {
+        if (frame_pos == frame_len) {
+            klog_record_t record;
+            if (!next_record(&record)) return;
+            build_frame(&record);
+        }
+        uart_putc_raw(uart, frame[frame_pos++]);
+    }
+}
+
+bool klog_pending(void) {
+    return frame_pos != frame_len ||
+           spsc_queue_count(&rings[0]) || spsc_queue_count(&rings[1]) ||
+           rings[0].overflows != reported_overflows[0] ||
+           rings[1].overflows != reported_overflows[1];
+}
+
+#ifdef KLOG_BENCHMARK
+
+#define BENCH_ROUNDS 64
+#define BENCH_CALLS (KLOG_RING_SIZE / 2)
+
+void klog_benchmark(void) {
+    systick_hw->rvr = 0xFFFFFF;
+    systick_hw->cvr = 0;
+    systick_hw->csr = 0x5;  // Enable, processor clock, no interrupt
+    
+    uint64_t cycles = 0;
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        uint32_t start = systick_hw->cvr;
+        for (int i = 0; i < BENCH_CALLS; i++) {
+            KLOG("Benchmark %d: R%d C%d\n", i, round, 3);
+        }
+        cycles += (start - systick_hw->cvr) & 0xFFFFFF;
+    
+        // Discard, the ring would overflow otherwise
+        klog_record_t record;
+        while (spsc_queue_pop(&rings[get_core_num()], &record)) {}
+    }
+    
+    uint32_t per_call = (uint32_t)(cycles / (BENCH_ROUNDS * BENCH_CALLS));
+    printf("KLOG: %lu cycles per call (%lu ns)\n", (unsigned long)per_call,
+           (unsigned long)((uint64_t)per_call * 1000000000u / clock_get_hz(clk_sys)));
+}
+
+#endif // KLOG_BENCHMARK
@@ -0,0 +1,72 @@
+/**
+ * Deferred tokenized logging
+ *
+ * KLOG("Key %s: R%d C%d\n", ...) stores the address of its format string
+ * (kept in the .klog_fmt section, placed in flash by klog.ld) and up to four
+ * 32-bit arguments in a RAM ring of the calling core. klog_drain(), called
+ * from a main loop, sends the records to the UART as binary frames without
+ * blocking; tools/klog_decode.py expands them back into text using the ELF.
+ *
+ * Arguments are integers. %s only works with string constants (the decoder
+ * reads them from the ELF), e.g. pressed ? "down" : "up".
+ *
+ * Built with KLOG_PRINTF (host simulator) KLOG() is a plain printf.
+ */
+
+#ifndef KLOG_H
+#define KLOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define KLOG_RING_SIZE 64     // Records per core, power of two
+#define KLOG_MAX_ARGS 4
+
+// Record as stored in the ring. A frame carries fmt, time_us and the first
+// nargs arguments, little-endian.
+typedef struct {
+    uint32_t fmt;             // Format string address, 0 = records dropped
+    uint32_t time_us;
+    uint32_t args[KLOG_MAX_ARGS];
+    uint8_t nargs;
+} klog_record_t;
+
+#ifdef KLOG_PRINTF
+
+#include <stdio.h>
+#define KLOG(...) printf(__VA_ARGS__)
+
+#else
+
+// Number of arguments after the format, 0-4
+#define KLOG_NARGS(...) KLOG_NARGS_(_, ##__VA_ARGS__, 4, 3, 2, 1, 0)
+#define KLOG_NARGS_(_, a, b, c, d, n, ...) n
+
+#define KLOG(fmt, ...) KLOG_(fmt, KLOG_NARGS(__VA_ARGS__), ##__VA_ARGS__, 0, 0, 0, 0)
+#define KLOG_(fmt, n, a, b, c, d, ...) do { \
+    _Static_assert(n <= KLOG_MAX_ARGS, "KLOG takes at most 4 arguments"); \
+    static const char klog_fmt_[] __attribute__((section(".klog_fmt"), used)) = fmt; \
+    klog_write(klog_fmt_, n, (uint32_t)(uintptr_t)(a), (uint32_t)(uintptr_t)(b), \
+               (uint32_t)(uintptr_t)(c), (uint32_t)(uintptr_t)(d)); \
+} while (0)
+
+#endif // KLOG_PRINTF
+
+void klog_init(void);
+
+// Producer side, through KLOG(). Safe from either core and from interrupts.
+void klog_write(const char *fmt, uint8_t nargs, uint32_t a, uint32_t b, uint32_t c, uint32_t d);
+
+// Send as much as the UART takes right now, oldest record first across both
+// cores. Call from one low-priority context (a main loop).
+void klog_drain(void);
+
+// Records or a partial frame still waiting for the UART
+bool klog_pending(void);
+
+#ifdef KLOG_BENCHMARK
+// Print the cost of a KLOG() call
+void klog_benchmark(void);
+#endif
+
+#endif // KLOG_H
@@ -0,0 +1,118 @@
+/**
+ * Link Policy
+ */
+
+#include "link_policy.h"
+
+// Below this a PHY runs out of signal. Coded is the last resort.
+static const int16_t rssi_floor[LINK_PHYS] = {
+    [LINK_PHY_2M] = LINK_RSSI_FLOOR_2M,
+    [LINK_PHY_1M] = LINK_RSSI_FLOOR_1M,
+    [LINK_PHY_CODED] = -128,
+};
+
+void link_policy_init(link_policy_t *policy) {
+    *policy = (link_policy_t){
+        .phy = LINK_PHY_2M,
+        .max_phy = LINK_PHY_CODED,
+        .recover = LINK_RECOVER_WINDOWS,
+        .since_step_up = UINT16_MAX,
+        .rssi_q4 = LINK_RSSI_UNKNOWN * 4,
+    };
+}
+
+void link_policy_dropped(link_policy_t *policy) {
+    policy->lossy = true;
+    policy->clean = 0;
+    policy->hold = LINK_HOLD_WINDOWS;
+    policy->packets = 0;
+    policy->retransmissions = 0;
+}
+
+void link_policy_limit(link_policy_t *policy, link_phy_t max_phy) {
+    policy->max_phy = max_phy;
+    if (policy->phy > max_phy) policy->phy = max_phy;
+}
+
+static void change_phy(link_policy_t *policy, uint8_t phy) {
+    if (phy > policy->phy && policy->since_step_up < policy->recover) {
+        // The last step back didn't hold: wait longer before the next one
+        policy->recover = policy->recover * 2 < LINK_RECOVER_MAX_WINDOWS ? policy->recover * 2 : LINK_RECOVER_MAX_WINDOWS;
+    }
+    if (phy < policy->phy) policy->since_step_up = 0;
+    policy->phy = phy;
+    policy->strong = 0;
+    policy->clean = 0;
+    policy->hold = LINK_HOLD_WINDOWS;
+    policy->packets = 0;
+    policy->retransmissions = 0;
+}
+
+bool link_policy_update(link_policy_t *policy, const link_window_t *window) {
+    if (window->rssi != LINK_RSSI_UNKNOWN) {
+        int16_t sample = window->rssi * 4;
+        if (policy->rssi_q4 == LINK_RSSI_UNKNOWN * 4) {
+            policy->rssi_q4 = sample;
+        } else {
+            policy->rssi_q4 += (sample - policy->rssi_q4) / 4;
+        }
+    }
+    if (policy->since_step_up < UINT16_MAX) policy->since_step_up++;
+    if (policy->since_step_up == LINK_RECOVER_MAX_WINDOWS) {
+        // The last step back held for long enough: forget the flapping
+        policy->recover = LINK_RECOVER_WINDOWS;
+    }
+    
+    if (policy->hold) {
+        // Telemetry from before the change, or from while it was made
+        policy->hold--;
+        return false;
+    }
+    
+    // Retransmission rate, once there are enough packets to tell
+    policy->packets += window->packets;
+    policy->retransmissions += window->retransmissions;
+    bool judged = policy->packets >= LINK_MIN_PACKETS;
+    uint32_t permille = judged ? policy->retransmissions * 1000 / policy->packets : 0;
+    if (judged) {
+        policy->packets = 0;
+        policy->retransmissions = 0;
+    }
+    bool lossy = judged && permille >= LINK_LOSSY_PERMILLE;
+    bool clean = judged && permille <= LINK_CLEAN_PERMILLE;
+    
+    bool known = policy->rssi_q4 != LINK_RSSI_UNKNOWN * 4;
+    int16_t rssi = policy->rssi_q4 / 4;
+    int16_t floor = rssi_floor[policy->phy];
+    bool weak = known && rssi < floor;
+    bool thin = known && rssi < floor + LINK_RSSI_MARGIN_DB;
+    bool had_lossy = policy->lossy;
+    
+    // Degrading: act on the first bad window
+    if (lossy) policy->lossy = true;
+    if ((weak || (lossy && thin)) && policy->phy < policy->max_phy) {
+        change_phy(policy, policy->phy + 1);
+        return true;
+    }
+    if (policy->lossy != had_lossy) {
+        policy->clean = 0;
+        return true;
+    }
+    
+    // Recovering: only after a run of good windows
+    bool strong = known && policy->phy > LINK_PHY_2M &&
+                  rssi >= rssi_floor[policy->phy - 1] + LINK_RSSI_HYSTERESIS_DB && (!judged || clean);
+    policy->strong = strong ? policy->strong + 1 : 0;
+    if (judged) policy->clean = clean ? policy->clean + 1 : 0;
+    
+    if (policy->strong >= policy->recover) {
+        change_phy(policy, policy->phy - 1);
+        return true;
+    }
+    if (policy->lossy && policy->clean >= policy->recover) {
+        policy->lossy = false;
+        policy->clean = 0;
+        return true;
+    }
+    return false;
+}
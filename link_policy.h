@@ -0,0 +1,92 @@
+/**
+ * Link Policy
+ * Picks the settings of a half's link from its telemetry: the fastest ones
+ * while the link is clean, more robust ones while it degrades, and back once
+ * it has recovered.
+ *
+ * Two causes, two remedies. A weak signal (low RSSI) calls for a PHY with
+ * more sensitivity: 2M, then 1M (about 3 dB better), then Coded S=2 (about
+ * 4 dB more) where both ends support it. Retransmissions with a strong
+ * signal are interference, 2.4 GHz Wi-Fi usually: a slower PHY only keeps
+ * each packet on the air longer, so the PHY stays and the supervision
+ * timeout is raised, letting the link ride out a burst instead of dropping
+ * and reconnecting. Retransmissions close to the signal limit step the PHY
+ * down as well. The connection interval and peripheral latency stay as
+ * connected: a retransmission waits for the next connection event, so a
+ * longer interval would only make every retry slower.
+ *
+ * Plain logic without BTstack: the central feeds it a window of telemetry
+ * at a time and applies what it decides (central.c), the simulator runs it
+ * against a modelled link (sim/link_replay.c).
+ */
+
+#ifndef LINK_POLICY_H
+#define LINK_POLICY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// PHYs, fastest first
+typedef enum {
+    LINK_PHY_2M,
+    LINK_PHY_1M,
+    LINK_PHY_CODED,
+    LINK_PHYS
+} link_phy_t;
+
+#define LINK_WINDOW_MS 1000             // One telemetry window
+#define LINK_RSSI_UNKNOWN 127
+#define LINK_LOSSY_TIMEOUT_MS 2000      // Supervision timeout while lossy, if longer than as connected
+
+// Signal: step to a slower PHY below its floor, back up once the RSSI is
+// this far above the faster PHY's floor
+#define LINK_RSSI_FLOOR_2M -80          // dBm
+#define LINK_RSSI_FLOOR_1M -88
+#define LINK_RSSI_HYSTERESIS_DB 6
+#define LINK_RSSI_MARGIN_DB 6           // Retransmissions this close to the floor: the signal's fault
+
+// Retransmissions: connection events a packet waited beyond its first, per
+// thousand packets, judged over at least LINK_MIN_PACKETS
+#define LINK_MIN_PACKETS 20
+#define LINK_LOSSY_PERMILLE 150
+#define LINK_CLEAN_PERMILLE 30
+
+// Recovery: clean windows in a row before stepping back. Doubles each time
+// a step back has to be undone within that many windows, up to the maximum.
+#define LINK_RECOVER_WINDOWS 10
+#define LINK_RECOVER_MAX_WINDOWS 80
+#define LINK_HOLD_WINDOWS 2             // Not judged after a change, while it takes effect
+
+typedef struct {
+    int8_t rssi;                // dBm, LINK_RSSI_UNKNOWN if not measured
+    uint16_t packets;           // Packets the half got acknowledged
+    uint16_t retransmissions;   // Connection events they waited beyond their first
+} link_window_t;
+
+typedef struct {
+    uint8_t phy;                // link_phy_t to use
+    bool lossy;                 // Use the long supervision timeout
+    uint8_t max_phy;            // Slowest PHY both ends support
+    uint8_t hold;               // Windows left before judging again
+    uint16_t strong;            // Windows in a row with signal to spare for a faster PHY
+    uint16_t clean;             // Judged windows in a row with few retransmissions
+    uint16_t recover;           // Windows in a row needed to step back
+    uint16_t since_step_up;     // Windows since the last step back to a faster PHY
+    int16_t rssi_q4;            // Smoothed RSSI in quarter dB, LINK_RSSI_UNKNOWN * 4 if none yet
+    uint32_t packets;           // Collected until LINK_MIN_PACKETS
+    uint32_t retransmissions;
+} link_policy_t;
+
+// Start on the fastest PHY, with the normal timeout
+void link_policy_init(link_policy_t *policy);
+
+// The link came back after a supervision timeout: start on the long one
+void link_policy_dropped(link_policy_t *policy);
+
+// The PHY just tried isn't supported; use nothing slower than max_phy
+void link_policy_limit(link_policy_t *policy, link_phy_t max_phy);
+
+// Judge one window. Returns true if phy or lossy changed.
+bool link_policy_update(link_policy_t *policy, const link_window_t *window);
+
+#endif // LINK_POLICY_H
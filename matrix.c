@@ -0,0 +1,335 @@
+/**
+ * Key Matrix Scanning
+ *
+ * Each row is stored as a bitmask. Debounce uses a per-key lockout held in
+ * three vertical counter planes: after a transition a key ignores further
+ * changes for MATRIX_DEBOUNCE_SCANS scans, and every key's counter is
+ * decremented in parallel with a handful of bitwise operations per row.
+ * Transitions are found by XOR and walked with count-trailing-zeros, so the
+ * per-key work only happens for keys that actually changed.
+ *
+ * The lockout is per key. Contacts that disagree with a locked key are
+ * bounce, and how far into the lockout the last one came is that key's
+ * bounce duration. A key still bouncing in the last scan of its lockout,
+ * or bouncing and then changing again right after it, gets two scans more; one that settles
+ * with a scan to spare MATRIX_DEBOUNCE_DECAY times in a row gets one less.
+ * Reloads use per-key bit planes, so the common path stays bit-parallel.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/gpio.h"
+#include "matrix.h"
+
+_Static_assert(MATRIX_DEBOUNCE_MAX_SCANS <= 7, "debounce lockout must fit in 3-bit vertical counters");
+_Static_assert(MATRIX_DEBOUNCE_MIN_SCANS >= 1 && MATRIX_DEBOUNCE_MIN_SCANS <= MATRIX_DEBOUNCE_MAX_SCANS,
+               "debounce bounds out of order");
+
+// Starting lockout, within the bounds
+#define START_SCANS (MATRIX_DEBOUNCE_SCANS < MATRIX_DEBOUNCE_MIN_SCANS ? MATRIX_DEBOUNCE_MIN_SCANS : \
+                     MATRIX_DEBOUNCE_SCANS > MATRIX_DEBOUNCE_MAX_SCANS ? MATRIX_DEBOUNCE_MAX_SCANS : \
+                     MATRIX_DEBOUNCE_SCANS)
+
+// A change this many scans after a lockout ended is taken for bounce too
+#define CHATTER_SCANS 2
+
+static const unsigned int *matrix_row_pins;
+
+// gpio_get_all() byte lane -> column bits, only for lanes that hold columns
+static matrix_row_t col_lut[4][256];
+static uint8_t col_lanes[4];
+static uint8_t col_lane_count = 0;
+
+// Debounced state
+static matrix_row_t state[ROWS];
+
+// Lockout counters, bit plane n of every key in the row
+static matrix_row_t lock0[ROWS], lock1[ROWS], lock2[ROWS];
+
+// Lockout of every key, as bit planes for reloading and as numbers
+static matrix_row_t reload0[ROWS], reload1[ROWS], reload2[ROWS];
+static uint8_t window[ROWS][COLS];
+
+// Adaptation, per key
+static uint8_t bounce_age[ROWS][COLS];      // Last scan of the lockout with bounce, 0 = none
+static uint8_t settled[ROWS][COLS];         // Lockouts in a row settling with a scan to spare
+static uint32_t last_change[ROWS][COLS];    // Scan of the last transition
+static uint32_t scan_number = 0;
+
+static void set_window(int row, int col, uint8_t scans) {
+    matrix_row_t bit = (matrix_row_t)1 << col;
+    window[row][col] = scans;
+    reload0[row] = (scans & 1) ? (reload0[row] | bit) : (reload0[row] & ~bit);
+    reload1[row] = (scans & 2) ? (reload1[row] | bit) : (reload1[row] & ~bit);
+    reload2[row] = (scans & 4) ? (reload2[row] | bit) : (reload2[row] & ~bit);
+}
+
+static void reset_debounce(void) {
+    memset(lock0, 0, sizeof(lock0));
+    memset(lock1, 0, sizeof(lock1));
+    memset(lock2, 0, sizeof(lock2));
+    memset(bounce_age, 0, sizeof(bounce_age));
+    memset(settled, 0, sizeof(settled));
+    memset(last_change, 0, sizeof(last_change));
+    scan_number = 0;
+    for (int row = 0; row < ROWS; row++) {
+        for (int col = 0; col < COLS; col++) {
+            set_window(row, col, START_SCANS);
+        }
+    }
+}
+
+// Called for each accepted transition, before the lockout is reloaded
+static void adapt_window(int row, int col) {
+    uint8_t scans = window[row][col];
+    uint8_t bounce = bounce_age[row][col];
+    uint32_t since = scan_number - last_change[row][col];
+    bounce_age[row][col] = 0;
+    last_change[row][col] = scan_number;
+    
+    if (bounce >= scans || (bounce && since <= (uint32_t)scans + CHATTER_SCANS)) {
+        // Bounce outlasted the lockout, and this transition may be more of it
+        settled[row][col] = 0;
+        uint8_t longer = scans + 2;
+        set_window(row, col, longer > MATRIX_DEBOUNCE_MAX_SCANS ? MATRIX_DEBOUNCE_MAX_SCANS : longer);
+    } else if (bounce + 1 < scans) {
+        if (++settled[row][col] >= MATRIX_DEBOUNCE_DECAY) {
+            settled[row][col] = 0;
+            if (scans > MATRIX_DEBOUNCE_MIN_SCANS) set_window(row, col, scans - 1);
+        }
+    } else {
+        settled[row][col] = 0;
+    }
+}
+
+void matrix_init(const unsigned int *row_pins, const unsigned int *col_pins) {
+    matrix_row_pins = row_pins;
+    
+    // Initialize row pins as outputs (high)
+    for (int i = 0; i < ROWS; i++) {
+        gpio_init(row_pins[i]);
+        gpio_set_dir(row_pins[i], GPIO_OUT);
+        gpio_put(row_pins[i], 1);
+    }
+    
+    // Initialize column pins as inputs with pull-up
+    for (int i = 0; i < COLS; i++) {
+        gpio_init(col_pins[i]);
+        gpio_set_dir(col_pins[i], GPIO_IN);
+        gpio_pull_up(col_pins[i]);
+    }
+    
+    // Precompute the GPIO -> column remap, one table per byte of gpio_get_all()
+    memset(col_lut, 0, sizeof(col_lut));
+    bool lane_used[4] = {false};
+    for (int col = 0; col < COLS; col++) {
+        uint lane = col_pins[col] / 8;
+        uint bit = col_pins[col] % 8;
+        lane_used[lane] = true;
+        for (int value = 0; value < 256; value++) {
+            if (value & (1u << bit)) col_lut[lane][value] |= (matrix_row_t)1 << col;
+        }
+    }
+    col_lane_count = 0;
+    for (int lane = 0; lane < 4; lane++) {
+        if (lane_used[lane]) col_lanes[col_lane_count++] = lane;
+    }
+    
+    memset(state, 0, sizeof(state));
+    reset_debounce();
+}
+
+void matrix_read(matrix_row_t raw[ROWS]) {
+    for (int row = 0; row < ROWS; row++) {
+        // Set current row low
+        gpio_put(matrix_row_pins[row], 0);
+        busy_wait_us_32(10);  // Small delay for signal to settle
+        
+        uint32_t pins = ~gpio_get_all();  // Active low
+        
+        // Set row back high
+        gpio_put(matrix_row_pins[row], 1);
+        
+        matrix_row_t bits = 0;
+        for (int i = 0; i < col_lane_count; i++) {
+            uint lane = col_lanes[i];
+            bits |= col_lut[lane][(pins >> (lane * 8)) & 0xFF];
+        }
+        raw[row] = bits;
+    }
+}
+
+uint32_t matrix_process(const matrix_row_t raw[ROWS], matrix_event_cb_t cb) {
+    uint32_t changes = 0;
+    scan_number++;
+    
+    for (int row = 0; row < ROWS; row++) {
+        matrix_row_t c0 = lock0[row], c1 = lock1[row], c2 = lock2[row];
+        matrix_row_t locked = c0 | c1 | c2;
+    
+        // Note how far into the lockout each bouncing key is
+        matrix_row_t bouncing = (raw[row] ^ state[row]) & locked;
+        while (bouncing) {
+            uint8_t col = (uint8_t)__builtin_ctz(bouncing);
+            bouncing &= bouncing - 1;
+            uint8_t remaining = ((c0 >> col) & 1) | (((c1 >> col) & 1) << 1) | (((c2 >> col) & 1) << 2);
+            bounce_age[row][col] = window[row][col] - remaining + 1;
+        }
+        
+        // Count every locked key down by one
+        matrix_row_t borrow1 = locked & ~c0;
+        matrix_row_t borrow2 = borrow1 & ~c1;
+        c0 ^= locked;
+        c1 ^= borrow1;
+        c2 ^= borrow2;
+        
+        // Accept changes on keys whose lockout has expired
+        matrix_row_t changed = (raw[row] ^ state[row]) & ~locked;
+        if (changed) {
+            state[row] ^= changed;
+            
+            matrix_row_t pending = changed;
+            while (pending) {
+                uint8_t col = (uint8_t)__builtin_ctz(pending);
+                pending &= pending - 1;
+                adapt_window(row, col);
+                cb(row, col, (state[row] >> col) & 1);
+                changes++;
+            }
+    
+            // Reload the lockout for changed keys, each with its own length
+            c0 = (c0 & ~changed) | (reload0[row] & changed);
+            c1 = (c1 & ~changed) | (reload1[row] & changed);
+            c2 = (c2 & ~changed) | (reload2[row] & changed);
+        }
+        
+        lock0[row] = c0;
+        lock1[row] = c1;
+        lock2[row] = c2;
+    }
+    
+    return changes;
+}
+
+uint32_t matrix_scan(matrix_event_cb_t cb) {
+    matrix_row_t raw[ROWS];
+    matrix_read(raw);
+    return matrix_process(raw, cb);
+}
+
+bool matrix_is_pressed(uint8_t row, uint8_t col) {
+    return (state[row] >> col) & 1;
+}
+
+void matrix_restore(const matrix_row_t pressed[ROWS]) {
+    memcpy(state, pressed, sizeof(state));
+}
+
+uint8_t matrix_debounce_scans(uint8_t row, uint8_t col) {
+    return window[row][col];
+}
+
+#ifdef MATRIX_BENCHMARK
+
+#include "hardware/structs/systick.h"
+
+#define BENCH_FLIPS 500
+
+// The previous per-cell implementation, kept for comparison
+static bool ref_key_state[ROWS][COLS];
+static uint32_t ref_last_change_time[ROWS][COLS];
+
+static uint32_t reference_process(const matrix_row_t raw[ROWS], uint32_t now, matrix_event_cb_t cb) {
+    uint32_t changes = 0;
+    for (int row = 0; row < ROWS; row++) {
+        for (int col = 0; col < COLS; col++) {
+            bool current = (raw[row] >> col) & 1;
+            if (current != ref_key_state[row][col]) {
+                if (now - ref_last_change_time[row][col] > DEBOUNCE_MS) {
+                    ref_key_state[row][col] = current;
+                    ref_last_change_time[row][col] = now;
+                    cb(row, col, current);
+                    changes++;
+                }
+            }
+        }
+    }
+    return changes;
+}
+
+static void bench_cb(uint8_t row, uint8_t col, bool pressed) {
+    (void) row;
+    (void) col;
+    (void) pressed;
+}
+
+static void matrix_reset(void) {
+    memset(state, 0, sizeof(state));
+    reset_debounce();
+    memset(ref_key_state, 0, sizeof(ref_key_state));
+    memset(ref_last_change_time, 0, sizeof(ref_last_change_time));
+}
+
+// SysTick counts down from 0xFFFFFF at the CPU clock
+static inline uint32_t cycles_now(void) {
+    return systick_hw->cvr;
+}
+
+static inline uint32_t cycles_since(uint32_t start) {
+    return (start - systick_hw->cvr) & 0xFFFFFF;
+}
+
+void matrix_benchmark(void) {
+    static const int key_counts[] = {0, 1, 2, 4, 8, 16, ROWS * COLS};
+    matrix_row_t idle[ROWS] = {0};
+    matrix_row_t active[ROWS];
+    
+    systick_hw->rvr = 0xFFFFFF;
+    systick_hw->cvr = 0;
+    systick_hw->csr = 0x5;  // Enable, processor clock, no interrupt
+    
+    printf("Matrix benchmark: mean CPU cycles per scan with N keys changing (GPIO reads excluded)\n");
+    printf("changed  bitsliced  per-cell\n");
+    
+    for (uint i = 0; i < count_of(key_counts); i++) {
+        int keys = key_counts[i];
+        
+        // First `keys` positions, spread across the rows
+        memset(active, 0, sizeof(active));
+        for (int k = 0; k < keys; k++) {
+            active[k % ROWS] |= (matrix_row_t)1 << (k / ROWS);
+        }
+        
+        matrix_reset();
+        uint64_t bitsliced = 0, reference = 0;
+        uint32_t now = 0;
+        
+        // Alternate idle/active, letting the lockout expire in between so
+        // every timed scan sees exactly `keys` transitions
+        for (int flip = 0; flip < BENCH_FLIPS; flip++) {
+            const matrix_row_t *sample = (flip & 1) ? idle : active;
+            
+            uint32_t start = cycles_now();
+            matrix_process(sample, bench_cb);
+            bitsliced += cycles_since(start);
+            
+            start = cycles_now();
+            reference_process(sample, now, bench_cb);
+            reference += cycles_since(start);
+            
+            for (int n = 0; n < MATRIX_DEBOUNCE_MAX_SCANS; n++) {
+                matrix_process(sample, bench_cb);
+            }
+            now += DEBOUNCE_MS + 1;
+        }
+        
+        printf("%7d  %9lu  %8lu\n", keys,
+               (unsigned long)(bitsliced / BENCH_FLIPS), (unsigned long)(reference / BENCH_FLIPS));
+    }
+    
+    // Leave the matrix in a clean state for normal scanning
+    matrix_reset();
+}
+
+#endif // MATRIX_BENCHMARK
@@ -0,0 +1,83 @@
+/**
+ * Key Matrix Scanning
+ * Bit-sliced matrix state, debounce and change detection for the halves
+ */
+
+#ifndef MATRIX_H
+#define MATRIX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Matrix configuration - adjust to your keyboard layout (matches keymap.h)
+#define ROWS 5
+#define COLS 7
+
+// Debounce timing: every key starts at DEBOUNCE_MS and adapts within the
+// bounds to the bounce it shows. Equal bounds give a fixed debounce.
+#define DEBOUNCE_MS 5
+#ifndef DEBOUNCE_MIN_MS
+#define DEBOUNCE_MIN_MS 2
+#endif
+#ifndef DEBOUNCE_MAX_MS
+#define DEBOUNCE_MAX_MS 7
+#endif
+
+// Scan period of the dedicated scan core, and while the host is suspended
+#define SCAN_PERIOD_US 1000
+#define SCAN_LOW_POWER_PERIOD_US 10000
+
+// Debounce lockout in scans, held in 3-bit vertical counters (max 7)
+#define MATRIX_MS_TO_SCANS(ms) (((ms) * 1000 + SCAN_PERIOD_US - 1) / SCAN_PERIOD_US)
+#define MATRIX_DEBOUNCE_SCANS MATRIX_MS_TO_SCANS(DEBOUNCE_MS)
+#define MATRIX_DEBOUNCE_MIN_SCANS MATRIX_MS_TO_SCANS(DEBOUNCE_MIN_MS)
+#define MATRIX_DEBOUNCE_MAX_SCANS MATRIX_MS_TO_SCANS(DEBOUNCE_MAX_MS)
+
+// Transitions settling with a scan to spare before a key's lockout shrinks by one
+#define MATRIX_DEBOUNCE_DECAY 64
+
+// One bit per column
+#if COLS <= 8
+typedef uint8_t matrix_row_t;
+#elif COLS <= 16
+typedef uint16_t matrix_row_t;
+#else
+typedef uint32_t matrix_row_t;
+#endif
+
+// Called once per debounced transition
+typedef void (*matrix_event_cb_t)(uint8_t row, uint8_t col, bool pressed);
+
+// Configure row outputs/column inputs and build the column mask table
+void matrix_init(const unsigned int *row_pins, const unsigned int *col_pins);
+
+// Drive each row and read all columns with one gpio_get_all() per row.
+// raw[row] gets one bit per column, set when pressed.
+void matrix_read(matrix_row_t raw[ROWS]);
+
+// Debounce one raw sample and report the transitions. Cost is a few word
+// operations per row plus one callback per changed key.
+// Returns the number of transitions.
+uint32_t matrix_process(const matrix_row_t raw[ROWS], matrix_event_cb_t cb);
+
+// matrix_read() + matrix_process()
+uint32_t matrix_scan(matrix_event_cb_t cb);
+
+// Debounced state of one key
+bool matrix_is_pressed(uint8_t row, uint8_t col);
+
+// Start from these debounced states instead of every key up, e.g. the keys
+// held before a watchdog reset: the next scan reports the ones let go since
+// as released, and no press for the ones still held. Call after matrix_init().
+void matrix_restore(const matrix_row_t pressed[ROWS]);
+
+// Current debounce lockout of one key, in scans
+uint8_t matrix_debounce_scans(uint8_t row, uint8_t col);
+
+#ifdef MATRIX_BENCHMARK
+// Time matrix_process() against the old per-cell debounce for a range of
+// changed-key counts and print the results
+void matrix_benchmark(void);
+#endif
+
+#endif // MATRIX_H
@@ -0,0 +1,317 @@
+/**
+ * Raw HID Configuration Interface
+ * Command handling for live keymap and macro updates, key stats reads, link
+ * telemetry, the crash record and firmware updates of the halves, runs on
+ * the USB side
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+
+// Include TinyUSB first to avoid conflicts
+#include "tusb.h"
+#include "usb_descriptors.h"
+
+#include "keyboard.h"
+#include "raw_hid.h"
+#include "key_stats.h"
+#include "recovery.h"
+#include "dfu.h"
+#include "klog.h"
+
+// Shadow image between BEGIN and COMMIT, NULL otherwise
+static uint8_t *shadow_image = NULL;
+
+// Key stats fetch. The command side moves it to REQUESTED, the BTstack side
+// on to FETCHING and then DONE or FAILED, filling stats_data first.
+enum {
+    STATS_NONE,
+    STATS_REQUESTED,
+    STATS_FETCHING,
+    STATS_DONE,
+    STATS_FAILED,
+};
+static uint8_t stats_state = STATS_NONE;
+static uint8_t stats_side;
+static uint8_t stats_data[KEY_STATS_SIZE];
+static uint16_t stats_size;
+
+// Published by the BTstack side. The sequence count is odd while a copy is
+// being written; readers retry.
+typedef struct {
+    uint32_t sequence;
+    uint8_t size;
+    uint8_t data[RAW_HID_MAX_DATA];
+} published_t;
+
+// Link telemetry by side, once a window
+static published_t link_stats[SIDE_RIGHT + 1];
+
+// Firmware update send, handed over like the stats fetch, and its progress
+static uint8_t dfu_send_state = RAW_HID_DFU_SEND_NONE;
+static uint8_t dfu_send_side;
+static published_t dfu_progress;
+
+// Standard CRC-32 (as zlib.crc32), small and slow is fine for a few hundred bytes
+static uint32_t crc32(const uint8_t *data, uint16_t len) {
+    uint32_t crc = 0xFFFFFFFF;
+    for (uint16_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+static bool range_valid(uint16_t offset, uint8_t len, uint16_t size) {
+    return len <= RAW_HID_MAX_DATA && offset <= size && len <= size - offset;
+}
+
+static void publish(published_t *published, const uint8_t *data, uint8_t size) {
+    uint32_t sequence = published->sequence;
+    __atomic_store_n(&published->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    published->size = size;
+    memcpy(published->data, data, size);
+    __atomic_store_n(&published->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+// Copies at most max bytes; returns the size
+static uint8_t read_published(const published_t *published, uint8_t *data, uint8_t max) {
+    uint32_t sequence;
+    uint8_t size;
+    do {
+        sequence = __atomic_load_n(&published->sequence, __ATOMIC_ACQUIRE);
+        size = published->size < max ? published->size : max;
+        memcpy(data, published->data, size);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((sequence & 1) || sequence != __atomic_load_n(&published->sequence, __ATOMIC_RELAXED));
+    return size;
+}
+
+static uint32_t read_le32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void store_le32(uint8_t *p, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+static bool dfu_sending(void) {
+    uint8_t state = __atomic_load_n(&dfu_send_state, __ATOMIC_ACQUIRE);
+    return state == RAW_HID_DFU_SEND_REQUESTED || state == RAW_HID_DFU_SEND_SENDING;
+}
+
+void raw_hid_receive(const uint8_t *data, uint16_t len) {
+    uint8_t reply[RAW_HID_REPORT_SIZE] = {0};
+    if (len < 1) return;
+    
+    uint8_t cmd = data[0];
+    uint8_t args[RAW_HID_REPORT_SIZE] = {0};
+    memcpy(args, &data[1], len - 1 < sizeof(args) ? len - 1 : sizeof(args));
+    
+    keyboard_config_layout_t layout;
+    keyboard_config_layout(&layout);
+    
+    uint16_t offset = args[0] | (args[1] << 8);
+    uint8_t length = args[2];
+    uint8_t status = RAW_HID_OK;
+    
+    reply[0] = cmd;
+    
+    switch (cmd) {
+        case RAW_HID_CMD_GET_INFO:
+            reply[2] = RAW_HID_PROTOCOL_VERSION;
+            reply[3] = layout.layers;
+            reply[4] = layout.sides;
+            reply[5] = layout.rows;
+            reply[6] = layout.cols;
+            reply[7] = layout.max_macros;
+            reply[8] = layout.max_macro_length;
+            reply[9] = layout.keymap_size & 0xFF;
+            reply[10] = layout.keymap_size >> 8;
+            reply[11] = layout.size & 0xFF;
+            reply[12] = layout.size >> 8;
+            break;
+            
+        case RAW_HID_CMD_READ:
+            if (!range_valid(offset, length, layout.size)) {
+                status = RAW_HID_ERR_RANGE;
+                break;
+            }
+            memcpy(&reply[2], keyboard_config_live() + offset, length);
+            break;
+            
+        case RAW_HID_CMD_BEGIN:
+            shadow_image = keyboard_update_begin();
+            if (!shadow_image) status = RAW_HID_ERR_BUSY;
+            break;
+            
+        case RAW_HID_CMD_WRITE:
+            if (!shadow_image) {
+                status = RAW_HID_ERR_NO_UPDATE;
+            } else if (!range_valid(offset, length, layout.size)) {
+                status = RAW_HID_ERR_RANGE;
+            } else {
+                memcpy(shadow_image + offset, &args[3], length);
+            }
+            break;
+            
+        case RAW_HID_CMD_COMMIT: {
+            if (!shadow_image) {
+                status = RAW_HID_ERR_NO_UPDATE;
+                break;
+            }
+            uint32_t expected = read_le32(args);
+            if (crc32(shadow_image, layout.size) != expected) {
+                status = RAW_HID_ERR_CHECKSUM;
+            } else if (!keyboard_update_commit()) {
+                status = RAW_HID_ERR_INVALID;
+            } else {
+                // The shadow now belongs to the key processing side
+                shadow_image = NULL;
+            }
+            KLOG("Keymap update %s\n", status == RAW_HID_OK ? "committed" : "rejected");
+            break;
+        }
+            
+        case RAW_HID_CMD_STATUS:
+            reply[2] = keyboard_update_pending() ? 1 : 0;
+            break;
+            
+        case RAW_HID_CMD_STATS_FETCH: {
+            uint8_t state = __atomic_load_n(&stats_state, __ATOMIC_ACQUIRE);
+            if (args[0] >= layout.sides) {
+                status = RAW_HID_ERR_RANGE;
+            } else if (state == STATS_REQUESTED || state == STATS_FETCHING) {
+                status = RAW_HID_ERR_BUSY;
+            } else {
+                stats_side = args[0];
+                __atomic_store_n(&stats_state, STATS_REQUESTED, __ATOMIC_RELEASE);
+            }
+            break;
+        }
+    
+        case RAW_HID_CMD_STATS_READ: {
+            uint8_t state = __atomic_load_n(&stats_state, __ATOMIC_ACQUIRE);
+            if (state == STATS_REQUESTED || state == STATS_FETCHING) {
+                status = RAW_HID_ERR_BUSY;
+            } else if (state != STATS_DONE) {
+                status = RAW_HID_ERR_UNAVAILABLE;
+            } else if (!range_valid(offset, length, stats_size)) {
+                status = RAW_HID_ERR_RANGE;
+            } else {
+                memcpy(&reply[2], stats_data + offset, length);
+            }
+            break;
+        }
+    
+        case RAW_HID_CMD_LINK_STATS: {
+            if (args[0] > SIDE_RIGHT) {
+                status = RAW_HID_ERR_RANGE;
+                break;
+            }
+            reply[2] = read_published(&link_stats[args[0]], &reply[3], RAW_HID_MAX_DATA);
+            if (reply[2] == 0) status = RAW_HID_ERR_UNAVAILABLE;
+            break;
+        }
+    
+        case RAW_HID_CMD_CRASH_INFO:
+            reply[2] = recovery_serialize(&reply[3]);
+            break;
+    
+        case RAW_HID_CMD_DFU_BEGIN:
+            // Not while the staged image is being sent
+            if (dfu_sending()) {
+                status = RAW_HID_ERR_BUSY;
+            } else if (dfu_state() == DFU_RECEIVING) {
+                // Left over from an upload that never finished: drop it,
+                // the retry starts afresh
+                dfu_abort();
+                status = RAW_HID_ERR_BUSY;
+            } else if (!dfu_begin(read_le32(args), read_le32(&args[4]))) {
+                status = RAW_HID_ERR_RANGE;
+            }
+            break;
+    
+        case RAW_HID_CMD_DFU_WRITE:
+            if (dfu_state() != DFU_RECEIVING) {
+                status = RAW_HID_ERR_NO_UPDATE;
+            } else if (args[0] > RAW_HID_MAX_DFU_DATA || args[0] > dfu_size() - dfu_received()) {
+                status = RAW_HID_ERR_RANGE;
+            } else if (!dfu_write(&args[1], args[0])) {
+                // Buffer full until the next sector is written
+                status = RAW_HID_ERR_BUSY;
+            }
+            break;
+    
+        case RAW_HID_CMD_DFU_SEND:
+            if (args[0] >= layout.sides) {
+                status = RAW_HID_ERR_RANGE;
+            } else if (dfu_sending()) {
+                status = RAW_HID_ERR_BUSY;
+            } else if (dfu_state() != DFU_VERIFIED) {
+                status = RAW_HID_ERR_UNAVAILABLE;
+            } else {
+                dfu_send_side = args[0];
+                __atomic_store_n(&dfu_send_state, RAW_HID_DFU_SEND_REQUESTED, __ATOMIC_RELEASE);
+            }
+            break;
+    
+        case RAW_HID_CMD_DFU_STATUS:
+            reply[2] = dfu_state();
+            store_le32(&reply[3], dfu_size());
+            store_le32(&reply[7], dfu_written());
+            reply[11] = __atomic_load_n(&dfu_send_state, __ATOMIC_ACQUIRE);
+            reply[12] = read_published(&dfu_progress, &reply[13], RAW_HID_REPORT_SIZE - 13);
+            break;
+    
+        default:
+            status = RAW_HID_ERR_UNKNOWN_CMD;
+            break;
+    }
+    
+    reply[1] = status;
+    tud_hid_n_report(ITF_NUM_RAW_HID, 0, reply, sizeof(reply));
+}
+
+int raw_hid_stats_requested(void) {
+    if (__atomic_load_n(&stats_state, __ATOMIC_ACQUIRE) != STATS_REQUESTED) return -1;
+    __atomic_store_n(&stats_state, STATS_FETCHING, __ATOMIC_RELAXED);
+    return stats_side;
+}
+
+void raw_hid_stats_done(const uint8_t *data, uint16_t size) {
+    if (data && size <= sizeof(stats_data)) {
+        memcpy(stats_data, data, size);
+        stats_size = size;
+        __atomic_store_n(&stats_state, STATS_DONE, __ATOMIC_RELEASE);
+    } else {
+        __atomic_store_n(&stats_state, STATS_FAILED, __ATOMIC_RELEASE);
+    }
+    printf("Key stats fetch %s\n", data ? "done" : "failed");
+}
+
+void raw_hid_set_link_stats(uint8_t side, const uint8_t *data, uint8_t size) {
+    if (side > SIDE_RIGHT || size > sizeof(link_stats[side].data)) return;
+    publish(&link_stats[side], data, size);
+}
+
+int raw_hid_dfu_requested(void) {
+    if (__atomic_load_n(&dfu_send_state, __ATOMIC_ACQUIRE) != RAW_HID_DFU_SEND_REQUESTED) return -1;
+    __atomic_store_n(&dfu_send_state, RAW_HID_DFU_SEND_SENDING, __ATOMIC_RELAXED);
+    return dfu_send_side;
+}
+
+void raw_hid_dfu_done(bool ok) {
+    __atomic_store_n(&dfu_send_state, ok ? RAW_HID_DFU_SEND_DONE : RAW_HID_DFU_SEND_FAILED, __ATOMIC_RELEASE);
+}
+
+void raw_hid_set_dfu_progress(const uint8_t *data, uint8_t size) {
+    if (size > sizeof(dfu_progress.data)) return;
+    publish(&dfu_progress, data, size);
+}
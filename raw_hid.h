@@ -0,0 +1,114 @@
+/**
+ * Raw HID Configuration Interface
+ * Vendor-defined HID interface for reading and replacing the keymap and
+ * macros at runtime, without reflashing or re-enumerating.
+ *
+ * Each 32-byte OUT report is one command and gets one 32-byte IN report back:
+ * the command byte, a status byte, then any reply data. Multi-byte values are
+ * little-endian. Send one command at a time and wait for its reply.
+ *
+ * Update sequence: BEGIN, WRITE the changed ranges of the config image (see
+ * keyboard.h for its layout), COMMIT with the CRC-32 of the whole image, then
+ * poll STATUS until the update is no longer pending.
+ *
+ * Key stats: STATS_FETCH a side, then STATS_READ its counters (see
+ * key_stats.h for the format) once it no longer answers BUSY. A fetch reads
+ * them from the half over the air, which takes a few connection intervals.
+ *
+ * Link telemetry: LINK_STATS a side for its link's current state (see
+ * central.h for the format), refreshed once a second.
+ *
+ * Crash record: CRASH_INFO for how the last run of this device ended, a
+ * hang or a fault caught by the watchdog (see recovery.h for the format).
+ *
+ * Firmware update of a half (see dfu.h): DFU_BEGIN with the image's size and
+ * CRC-32, DFU_WRITE all of it in order (retry a write answered BUSY), then
+ * poll DFU_STATUS until the image is verified. DFU_SEND a side and poll
+ * DFU_STATUS again until the send is done; the half then installs the image
+ * and reconnects. The staged image is kept until the next BEGIN or reset and
+ * can be sent to more than one half. An install cut short by a power loss is
+ * not resumed: the half comes back as the ROM's USB drive and needs the UF2
+ * copied over USB (dfu.h).
+ */
+
+#ifndef RAW_HID_H
+#define RAW_HID_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define RAW_HID_REPORT_SIZE 32
+#define RAW_HID_USAGE_PAGE 0xFF60
+#define RAW_HID_USAGE 0x61
+#define RAW_HID_PROTOCOL_VERSION 5
+
+// Most image bytes a READ or WRITE can carry
+#define RAW_HID_MAX_DATA (RAW_HID_REPORT_SIZE - 4)
+
+// Most firmware bytes a DFU_WRITE can carry
+#define RAW_HID_MAX_DFU_DATA (RAW_HID_REPORT_SIZE - 2)
+
+enum {
+    RAW_HID_CMD_GET_INFO = 0x01,    // -> version, keyboard_config_layout_t fields
+    RAW_HID_CMD_READ     = 0x02,    // offset(2) len(1) -> len bytes of the live image
+    RAW_HID_CMD_BEGIN    = 0x10,    // Copy the live image into the shadow
+    RAW_HID_CMD_WRITE    = 0x11,    // offset(2) len(1) data(len) into the shadow
+    RAW_HID_CMD_COMMIT   = 0x12,    // crc32(4) of the shadow -> validate and queue the swap
+    RAW_HID_CMD_STATUS   = 0x13,    // -> update pending (1)
+    RAW_HID_CMD_STATS_FETCH = 0x20, // side(1) -> start reading that half's key stats
+    RAW_HID_CMD_STATS_READ  = 0x21, // offset(2) len(1) -> len bytes of the fetched stats
+    RAW_HID_CMD_LINK_STATS  = 0x22, // side(1) -> len(1), len bytes of that half's link telemetry
+    RAW_HID_CMD_CRASH_INFO  = 0x23, // -> len(1), len bytes of the crash record
+    RAW_HID_CMD_DFU_BEGIN   = 0x30, // size(4) crc32(4) -> start staging firmware for a half
+    RAW_HID_CMD_DFU_WRITE   = 0x31, // len(1) data(len) -> append to the staged firmware
+    RAW_HID_CMD_DFU_SEND    = 0x32, // side(1) -> send the staged firmware to that half to install
+    RAW_HID_CMD_DFU_STATUS  = 0x33, // -> staging state(1) size(4) written(4), send state(1),
+                                    //    len(1), len bytes of progress (central.h)
+};
+
+enum {
+    RAW_HID_OK = 0,
+    RAW_HID_ERR_UNKNOWN_CMD,
+    RAW_HID_ERR_RANGE,          // Offset/length outside the image
+    RAW_HID_ERR_BUSY,           // Previous commit not swapped in yet
+    RAW_HID_ERR_NO_UPDATE,      // WRITE or COMMIT without BEGIN
+    RAW_HID_ERR_CHECKSUM,       // Shadow doesn't match the host's CRC
+    RAW_HID_ERR_INVALID,        // Shadow has unknown keycodes or bad macro lengths
+    RAW_HID_ERR_UNAVAILABLE,    // Stats not fetched, the half couldn't be read, or isn't connected
+};
+
+// DFU_STATUS: staging state as dfu_state_t (dfu.h), send state as below
+enum {
+    RAW_HID_DFU_SEND_NONE,
+    RAW_HID_DFU_SEND_REQUESTED,
+    RAW_HID_DFU_SEND_SENDING,
+    RAW_HID_DFU_SEND_DONE,      // The half is installing it
+    RAW_HID_DFU_SEND_FAILED,
+};
+
+// Handle an OUT report from the raw HID interface (from tud_hid_set_report_cb)
+void raw_hid_receive(const uint8_t *data, uint16_t len);
+
+// The side a STATS_FETCH asked for, or -1. Taking it starts the fetch, which
+// must end with raw_hid_stats_done(). Call from the core running BTstack.
+int raw_hid_stats_requested(void);
+
+// The fetched stats, or NULL if the read failed. Copies the data.
+void raw_hid_stats_done(const uint8_t *data, uint16_t size);
+
+// Publish a side's link telemetry (central_link_stats()), size 0 if it isn't
+// connected. Call from the core running BTstack.
+void raw_hid_set_link_stats(uint8_t side, const uint8_t *data, uint8_t size);
+
+// The side a DFU_SEND asked for, or -1. Taking it starts the send, which
+// must end with raw_hid_dfu_done(). Call from the core running BTstack.
+int raw_hid_dfu_requested(void);
+
+// The send ended: the half took the image and is installing it, or not
+void raw_hid_dfu_done(bool ok);
+
+// Publish the send's progress (central_update_progress()). Call from the
+// core running BTstack.
+void raw_hid_set_dfu_progress(const uint8_t *data, uint8_t size);
+
+#endif // RAW_HID_H
@@ -0,0 +1,186 @@
+/**
+ * Watchdog Recovery
+ *
+ * The watchdog's own reset reason tells a timeout from a reboot the
+ * firmware asked for. A hang leaves no chance to record anything, so the
+ * loops keep their phase and pass times in uninitialised RAM all along and
+ * the next boot works out from them which core stopped. A hard fault is
+ * recorded by its handler, which then resets through the watchdog.
+ */
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "hardware/watchdog.h"
+#include "hardware/exception.h"
+#include "recovery.h"
+
+#define RUN_MAGIC 0x52435631        // "RCV1"
+
+// The run in progress: what the next boot finds after a watchdog reset
+typedef struct {
+    uint32_t magic;
+    volatile uint8_t phase[2];
+    volatile uint32_t pass_us[2];   // Last time round each core's loop, 0 = not yet
+    volatile uint32_t uptime_ms;    // At the last feed, or the fault
+    volatile bool faulted;
+    volatile uint8_t fault_core;
+    volatile uint32_t fault_pc;
+    uint16_t recoveries;            // Watchdog resets since power-on
+} run_t;
+
+static run_t __uninitialized_ram(run);
+
+// How the last run ended
+static struct {
+    uint8_t reason;
+    uint8_t core;
+    uint8_t phase[2];
+    uint32_t pc;
+    uint32_t uptime_ms;
+    uint16_t recoveries;
+} last;
+
+static bool warm = false;
+static bool running = false;        // Main loop feeding, on the short timeout
+
+static const char *const phase_names[RECOVERY_PHASES] = {
+    [RECOVERY_BOOT] = "boot",
+    [RECOVERY_IDLE] = "idle",
+    [RECOVERY_KEYS] = "keys",
+    [RECOVERY_BLUETOOTH] = "Bluetooth",
+    [RECOVERY_USB] = "USB",
+    [RECOVERY_FLASH] = "flash",
+    [RECOVERY_LOG] = "log",
+};
+
+static const char *phase_name(uint8_t phase) {
+    return phase < RECOVERY_PHASES ? phase_names[phase] : "?";
+}
+
+// Stacked on exception entry: r0-r3, r12, lr, pc, xpsr
+void __attribute__((used, noreturn)) recovery_fault(const uint32_t *frame) {
+    run.fault_pc = frame[6];
+    run.fault_core = get_core_num();
+    run.uptime_ms = to_ms_since_boot(get_absolute_time());
+    run.faulted = true;
+    watchdog_reboot(0, 0, 1);
+    while (true) {
+        tight_loop_contents();
+    }
+}
+
+// Hard fault entry: hand the stacked registers on. Nothing runs on the
+// process stack, so they are on the main stack.
+static void __attribute__((naked)) hard_fault_handler(void) {
+    __asm volatile(
+        "mrs r0, msp\n"
+        "ldr r1, =recovery_fault\n"
+        "bx r1\n"
+        ".ltorg\n"
+    );
+}
+
+static void print_last(void) {
+    if (last.reason == RECOVERY_COLD) return;
+    if (last.reason == RECOVERY_FAULT) {
+        printf("Recovered from a hard fault on core %d at 0x%08lx", last.core, (unsigned long)last.pc);
+    } else {
+        printf("Recovered from a hang on core %d", last.core);
+    }
+    printf(" (core 0 %s, core 1 %s) after %lu ms, %u watchdog resets since power-on\n",
+           phase_name(last.phase[0]), phase_name(last.phase[1]),
+           (unsigned long)last.uptime_ms, last.recoveries);
+}
+
+void recovery_init(void) {
+    bool known = run.magic == RUN_MAGIC;
+    if (known && run.faulted && watchdog_caused_reboot()) {
+        last.reason = RECOVERY_FAULT;
+        last.core = run.fault_core;
+        last.pc = run.fault_pc;
+    } else if (known && watchdog_enable_caused_reboot()) {
+        // The core that went longer without coming round its loop
+        last.reason = RECOVERY_HANG;
+        last.core = run.pass_us[1] && (int32_t)(run.pass_us[0] - run.pass_us[1]) > 0 ? 1 : 0;
+    }
+    warm = last.reason != RECOVERY_COLD;
+    if (warm) {
+        last.phase[0] = run.phase[0];
+        last.phase[1] = run.phase[1];
+        last.uptime_ms = run.uptime_ms;
+        last.recoveries = run.recoveries + 1;
+    }
+    
+    run = (run_t){
+        .magic = RUN_MAGIC,
+        .recoveries = last.recoveries,
+    };
+    exception_set_exclusive_handler(HARDFAULT_EXCEPTION, hard_fault_handler);
+    watchdog_enable(RECOVERY_BOOT_WATCHDOG_MS, true);
+    print_last();
+}
+
+bool recovery_warm(void) {
+    return warm;
+}
+
+void recovery_feed(void) {
+    uint32_t now = time_us_32();
+    run.pass_us[0] = now;
+    run.uptime_ms = to_ms_since_boot(get_absolute_time());
+    if (!running) {
+        running = true;
+        watchdog_enable(RECOVERY_WATCHDOG_MS, true);
+    }
+    
+    // Core 1 is supervised once it has come round its loop
+    uint32_t core1 = run.pass_us[1];
+    if (core1 && (int32_t)(now - core1) > RECOVERY_STALL_MS * 1000) return;
+    watchdog_update();
+}
+
+void recovery_alive(void) {
+    run.pass_us[1] = time_us_32();
+}
+
+void recovery_phase(recovery_phase_t phase) {
+    run.phase[get_core_num()] = phase;
+}
+
+// FNV-1a, seeded with the size so a state of another layout doesn't match
+static uint32_t checksum(const void *state, uint32_t size) {
+    const uint8_t *bytes = state;
+    uint32_t hash = 0x811C9DC5 ^ size;
+    for (uint32_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x01000193;
+    }
+    return hash;
+}
+
+void recovery_seal(const void *state, uint32_t size, uint32_t *check) {
+    *check = checksum(state, size);
+}
+
+bool recovery_restore(const void *state, uint32_t size, const uint32_t *check) {
+    return warm && *check == checksum(state, size);
+}
+
+static uint8_t *put_le(uint8_t *p, uint32_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        *p++ = (uint8_t)(value >> (8 * i));
+    }
+    return p;
+}
+
+uint8_t recovery_serialize(uint8_t *buffer) {
+    uint8_t *p = buffer;
+    *p++ = last.reason;
+    *p++ = last.core;
+    *p++ = last.phase[0];
+    *p++ = last.phase[1];
+    p = put_le(p, last.pc, 4);
+    p = put_le(p, last.uptime_ms, 4);
+    p = put_le(p, last.recoveries, 2);
+    return (uint8_t)(p - buffer);
+}
@@ -0,0 +1,84 @@
+/**
+ * Watchdog Recovery
+ * Every firmware runs under the RP2040 watchdog. Core 0's main loop feeds it,
+ * and only while core 1's loop is still going round as well, so a hang on
+ * either core (BTstack, TinyUSB, the scan) resets the chip.
+ *
+ * A watchdog reset leaves RAM alone. What a firmware needs to pick up where
+ * it stopped lives in uninitialised RAM (__uninitialized_ram) and is sealed
+ * with a checksum whenever it changes: the halves a central was connected
+ * to, the dongle a half was subscribed by, the keys held and the layers
+ * they turned on. After a watchdog reset each module gets its state back if
+ * the seal holds and skips what it no longer needs, e.g. scanning for
+ * halves whose addresses it knows. Power-on, the reset button and new
+ * firmware boot cold.
+ *
+ * Why the last run ended is kept the same way: a hang, with the core that
+ * stopped and what each core's loop was doing, or a hard fault and where
+ * (panic() ends in one too). Printed at boot and readable over raw HID.
+ */
+
+#ifndef RECOVERY_H
+#define RECOVERY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define RECOVERY_BOOT_WATCHDOG_MS 5000   // Until the main loop first feeds it: loading the radio firmware
+#define RECOVERY_WATCHDOG_MS 1000        // Main loop; outlasts the worst case of a flash sector erase
+#define RECOVERY_STALL_MS 250            // Core 1 not round its loop for this long stops the feeding
+#define RECOVERY_IDLE_MS 100             // Longest a main loop may sleep between feeds
+
+typedef enum {
+    RECOVERY_COLD,          // Power-on, reset button, new firmware
+    RECOVERY_HANG,          // A main loop stopped and the watchdog fired
+    RECOVERY_FAULT,         // Hard fault
+} recovery_reason_t;
+
+// What a core's loop is doing, for the crash record
+typedef enum {
+    RECOVERY_BOOT,          // Starting up
+    RECOVERY_IDLE,          // Waiting for work; BTstack and USB interrupts run here
+    RECOVERY_KEYS,          // Scanning, sending or processing key events
+    RECOVERY_BLUETOOTH,     // Central, link and power work under the BTstack lock
+    RECOVERY_USB,           // TinyUSB and reports
+    RECOVERY_FLASH,         // Saving the key stats, staging firmware
+    RECOVERY_LOG,           // Log and statistics output
+    RECOVERY_PHASES
+} recovery_phase_t;
+
+// Wire format of the record, little-endian: reason, core that hung or
+// faulted, phase of core 0 and of core 1, faulting instruction address (4
+// bytes, 0 for a hang), uptime when it happened in ms (4), watchdog resets
+// since power-on (2)
+#define RECOVERY_INFO_SIZE 14
+
+// First thing in main(), after stdio: find out how the last run ended and
+// start the watchdog with RECOVERY_BOOT_WATCHDOG_MS
+void recovery_init(void);
+
+// This boot follows a watchdog reset
+bool recovery_warm(void);
+
+// Core 0's main loop, every pass and at least every RECOVERY_IDLE_MS. The
+// first call tightens the watchdog to RECOVERY_WATCHDOG_MS.
+void recovery_feed(void);
+
+// Core 1's loop, every pass
+void recovery_alive(void);
+
+// Note what the calling core's loop is doing
+void recovery_phase(recovery_phase_t phase);
+
+// Seal a module's state in uninitialised RAM after changing it; the
+// checksum goes to *check
+void recovery_seal(const void *state, uint32_t size, uint32_t *check);
+
+// At boot: true if this is a warm boot and the state still matches its
+// seal. Otherwise the module starts from scratch, and seals that.
+bool recovery_restore(const void *state, uint32_t size, const uint32_t *check);
+
+// The record of how the last run ended; returns RECOVERY_INFO_SIZE
+uint8_t recovery_serialize(uint8_t *buffer);
+
+#endif // RECOVERY_H
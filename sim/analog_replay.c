@@ -0,0 +1,397 @@
+/**
+ * Analog Key Replay
+ * Feeds key travel curves through the firmware's analog_keys.c, once with a
+ * fixed actuation point and once with rapid trigger, and measures how long
+ * after the finger changes direction each reports the press or release.
+ *
+ * A direction change is where the curve turns around by more than --intent:
+ * the last moment at its highest point before going down (a press) or at its
+ * deepest point before coming up (a release), give or take INTENT_TOLERANCE. Each is matched to the first
+ * transition of that kind before the next direction change.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+#include "analog_keys.h"
+
+#define ADC_MAX 4095
+
+// A recorded finger resting at a point wobbles a little: it hasn't turned
+// until it leaves the extreme by more than this (0.05 mm)
+#define INTENT_TOLERANCE 5
+
+typedef struct {
+    uint64_t time_us;
+    uint16_t travel;            // 0.01 mm
+} sample_t;
+
+typedef struct {
+    uint64_t time_us;
+    bool pressed;
+} transition_t;
+
+typedef struct {
+    transition_t *items;
+    size_t count;
+    size_t capacity;
+} transitions_t;
+
+// Curve and results of one key
+typedef struct {
+    sample_t *samples;
+    size_t count;
+    size_t capacity;
+    size_t cursor;              // Replay position in samples
+    transitions_t intents;
+    transitions_t reported;
+} key_curve_t;
+
+typedef struct {
+    uint32_t intended[2];       // By pressed
+    uint32_t found[2];
+    uint64_t latency_us[2];
+    uint64_t max_us[2];
+    uint32_t spurious;
+} score_t;
+
+static key_curve_t curves[ROWS][COLS];
+static uint64_t replay_time_us;
+
+// Sensor model
+static uint32_t sensor_rest = 2000;
+static uint32_t sensor_span = ANALOG_SPAN_DEFAULT;
+static double sensor_noise = 2;
+static uint64_t rng_state = 1;
+
+static void *grow(void *items, size_t *capacity, size_t count, size_t size) {
+    if (count < *capacity) return items;
+    *capacity = *capacity ? *capacity * 2 : 64;
+    items = realloc(items, *capacity * size);
+    if (!items) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    return items;
+}
+
+static void transition_add(transitions_t *list, uint64_t time_us, bool pressed) {
+    list->items = grow(list->items, &list->capacity, list->count, sizeof(transition_t));
+    list->items[list->count++] = (transition_t){time_us, pressed};
+}
+
+static double rand_unit(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (rng_state >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double rand_gauss(void) {
+    double u = rand_unit();
+    if (u < 1e-12) u = 1e-12;
+    return sqrt(-2 * log(u)) * cos(2 * M_PI * rand_unit());
+}
+
+// Text file, one sample per line: <time ms> <row> <col> <travel mm>.
+// Samples of a key must be in time order; other keys can be interleaved.
+static bool load_curves(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    
+    char line[256];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), f)) {
+        line_number++;
+        char *p = line;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == '#' || *p == '\n' || *p == '\0') continue;
+    
+        double time_ms, travel_mm;
+        unsigned row, col;
+        if (sscanf(p, "%lf %u %u %lf", &time_ms, &row, &col, &travel_mm) != 4 ||
+            row >= ROWS || col >= COLS || time_ms < 0 || travel_mm < 0) {
+            fprintf(stderr, "%s:%d: expected <time ms> <row> <col> <travel mm>\n", path, line_number);
+            fclose(f);
+            return false;
+        }
+    
+        key_curve_t *curve = &curves[row][col];
+        uint64_t time_us = (uint64_t)(time_ms * 1000);
+        if (curve->count && time_us < curve->samples[curve->count - 1].time_us) {
+            fprintf(stderr, "%s:%d: samples of a key must be in time order\n", path, line_number);
+            fclose(f);
+            return false;
+        }
+        double travel = travel_mm * 100;
+        if (travel > ANALOG_TRAVEL_FULL) travel = ANALOG_TRAVEL_FULL;
+        curve->samples = grow(curve->samples, &curve->capacity, curve->count, sizeof(sample_t));
+        curve->samples[curve->count++] = (sample_t){time_us, (uint16_t)(travel + 0.5)};
+    }
+    fclose(f);
+    return true;
+}
+
+// Turning points of a key's curve by more than min_travel
+static void find_intents(key_curve_t *curve, uint16_t min_travel) {
+    if (curve->count == 0) return;
+    
+    bool down = false;
+    uint16_t extreme = curve->samples[0].travel;
+    uint64_t extreme_us = curve->samples[0].time_us;
+    for (size_t i = 1; i < curve->count; i++) {
+        const sample_t *s = &curve->samples[i];
+        if (!down) {
+            if (s->travel <= extreme + INTENT_TOLERANCE) {
+                if (s->travel < extreme) extreme = s->travel;
+                extreme_us = s->time_us;
+            } else if (s->travel >= extreme + min_travel) {
+                transition_add(&curve->intents, extreme_us, true);
+                down = true;
+                extreme = s->travel;
+                extreme_us = s->time_us;
+            }
+        } else {
+            if (s->travel + INTENT_TOLERANCE >= extreme) {
+                if (s->travel > extreme) extreme = s->travel;
+                extreme_us = s->time_us;
+            } else if (s->travel + min_travel <= extreme) {
+                transition_add(&curve->intents, extreme_us, false);
+                down = false;
+                extreme = s->travel;
+                extreme_us = s->time_us;
+            }
+        }
+    }
+}
+
+// Travel at a time, linear between samples
+static double travel_at(key_curve_t *curve, uint64_t time_us) {
+    if (curve->count == 0) return 0;
+    while (curve->cursor + 1 < curve->count && curve->samples[curve->cursor + 1].time_us <= time_us) {
+        curve->cursor++;
+    }
+    const sample_t *a = &curve->samples[curve->cursor];
+    if (curve->cursor + 1 == curve->count || time_us <= a->time_us) return a->travel;
+    
+    const sample_t *b = a + 1;
+    double f = (double)(time_us - a->time_us) / (b->time_us - a->time_us);
+    return a->travel + (b->travel - a->travel) * f;
+}
+
+static uint16_t sensor_read(double travel) {
+    double raw = sensor_rest + travel * sensor_span / ANALOG_TRAVEL_FULL + rand_gauss() * sensor_noise;
+    if (raw < 0) raw = 0;
+    if (raw > ADC_MAX) raw = ADC_MAX;
+    return (uint16_t)(raw + 0.5);
+}
+
+static void on_transition(uint8_t row, uint8_t col, bool pressed) {
+    transition_add(&curves[row][col].reported, replay_time_us, pressed);
+}
+
+static void replay(const analog_keys_config_t *config, uint64_t end_us) {
+    uint16_t raw[ROWS][COLS];
+    for (int row = 0; row < ROWS; row++) {
+        for (int col = 0; col < COLS; col++) {
+            curves[row][col].cursor = 0;
+            curves[row][col].reported.count = 0;
+            raw[row][col] = sensor_rest;
+        }
+    }
+    analog_keys_init(config);
+    analog_keys_calibrate(raw);
+    
+    for (replay_time_us = 0; replay_time_us <= end_us; replay_time_us += SCAN_PERIOD_US) {
+        for (int row = 0; row < ROWS; row++) {
+            for (int col = 0; col < COLS; col++) {
+                raw[row][col] = sensor_read(travel_at(&curves[row][col], replay_time_us));
+            }
+        }
+        analog_keys_process(raw, on_transition);
+    }
+}
+
+// Match the reported transitions to the intents. latency[] gets each intent's
+// latency, or UINT64_MAX if it wasn't reported.
+static void score(score_t *result, uint64_t *latency[ROWS][COLS]) {
+    memset(result, 0, sizeof(*result));
+    for (int row = 0; row < ROWS; row++) {
+        for (int col = 0; col < COLS; col++) {
+            key_curve_t *curve = &curves[row][col];
+            size_t next = 0;
+            uint32_t matched = 0;
+            for (size_t i = 0; i < curve->intents.count; i++) {
+                const transition_t *intent = &curve->intents.items[i];
+                uint64_t until = i + 1 < curve->intents.count ? curve->intents.items[i + 1].time_us : UINT64_MAX;
+                result->intended[intent->pressed]++;
+                latency[row][col][i] = UINT64_MAX;
+    
+                while (next < curve->reported.count && curve->reported.items[next].time_us < intent->time_us) next++;
+                for (size_t j = next; j < curve->reported.count && curve->reported.items[j].time_us < until; j++) {
+                    if (curve->reported.items[j].pressed != intent->pressed) continue;
+                    uint64_t delay = curve->reported.items[j].time_us - intent->time_us;
+                    latency[row][col][i] = delay;
+                    result->found[intent->pressed]++;
+                    result->latency_us[intent->pressed] += delay;
+                    if (delay > result->max_us[intent->pressed]) result->max_us[intent->pressed] = delay;
+                    matched++;
+                    break;
+                }
+            }
+            result->spurious += curve->reported.count - matched;
+        }
+    }
+}
+
+static void print_score(const char *name, const score_t *s) {
+    printf("  %-24s", name);
+    for (int pressed = 1; pressed >= 0; pressed--) {
+        printf(" %4u/%-4u", s->found[pressed], s->intended[pressed]);
+        if (s->found[pressed]) {
+            printf(" %6.2f / %6.2f", s->latency_us[pressed] / 1000.0 / s->found[pressed], s->max_us[pressed] / 1000.0);
+        } else {
+            printf(" %6s / %6s", "-", "-");
+        }
+    }
+    printf(" %8u\n", s->spurious);
+}
+
+static void usage(const char *name) {
+    printf("Usage: %s [options] FILE...\n"
+           "Each FILE holds key travel curves: <time ms> <row> <col> <travel mm> per line.\n"
+           "  --actuation MM      Actuation point (default %.2f)\n"
+           "  --hysteresis MM     Fixed point: release this far above actuation (default %.2f)\n"
+           "  --sensitivity MM    Rapid trigger sensitivity (default %.2f)\n"
+           "  --reset MM          Rapid trigger reset point (default %.2f)\n"
+           "  --intent MM         Smallest turn of the finger counted as a press or release (default 0.30)\n"
+           "  --noise COUNTS      Sensor noise, standard deviation in ADC counts (default 2)\n"
+           "  --span COUNTS       Sensor output over the full travel (default %d)\n"
+           "  --seed N            Random seed (default 1)\n",
+           name, ANALOG_ACTUATION / 100.0, ANALOG_HYSTERESIS / 100.0, ANALOG_RT_SENSITIVITY / 100.0,
+           ANALOG_RT_RESET / 100.0, ANALOG_SPAN_DEFAULT);
+}
+
+static uint16_t parse_mm(const char *text) {
+    return (uint16_t)(strtod(text, NULL) * 100 + 0.5);
+}
+
+int main(int argc, char **argv) {
+    analog_keys_config_t fixed = {
+        .actuation = ANALOG_ACTUATION,
+        .hysteresis = ANALOG_HYSTERESIS,
+        .rt_sensitivity = 0,
+        .rt_reset = ANALOG_RT_RESET,
+    };
+    uint16_t sensitivity = ANALOG_RT_SENSITIVITY;
+    uint16_t min_intent = 30;
+    
+    static const struct option options[] = {
+        {"actuation", required_argument, NULL, 'a'},
+        {"hysteresis", required_argument, NULL, 'y'},
+        {"sensitivity", required_argument, NULL, 'S'},
+        {"reset", required_argument, NULL, 'r'},
+        {"intent", required_argument, NULL, 'i'},
+        {"noise", required_argument, NULL, 'n'},
+        {"span", required_argument, NULL, 'p'},
+        {"seed", required_argument, NULL, 's'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (opt) {
+            case 'a': fixed.actuation = parse_mm(optarg); break;
+            case 'y': fixed.hysteresis = parse_mm(optarg); break;
+            case 'S': sensitivity = parse_mm(optarg); break;
+            case 'r': fixed.rt_reset = parse_mm(optarg); break;
+            case 'i': min_intent = parse_mm(optarg); break;
+            case 'n': sensor_noise = strtod(optarg, NULL); break;
+            case 'p': sensor_span = strtoul(optarg, NULL, 0); break;
+            case 's': rng_state = strtoull(optarg, NULL, 0); break;
+            default: usage(argv[0]); return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (optind == argc || sensitivity == 0 || min_intent == 0 || sensor_span == 0 ||
+        fixed.hysteresis >= fixed.actuation || rng_state == 0) {
+        usage(argv[0]);
+        return 2;
+    }
+    analog_keys_config_t rapid = fixed;
+    rapid.rt_sensitivity = sensitivity;
+    
+    int64_t saved_total[2] = {0, 0};
+    uint32_t saved_count[2] = {0, 0};
+    for (int file = optind; file < argc; file++) {
+        memset(curves, 0, sizeof(curves));
+        if (!load_curves(argv[file])) return 2;
+    
+        uint64_t end_us = 0;
+        uint64_t *fixed_latency[ROWS][COLS], *rapid_latency[ROWS][COLS];
+        for (int row = 0; row < ROWS; row++) {
+            for (int col = 0; col < COLS; col++) {
+                key_curve_t *curve = &curves[row][col];
+                find_intents(curve, min_intent);
+                if (curve->count && curve->samples[curve->count - 1].time_us > end_us) {
+                    end_us = curve->samples[curve->count - 1].time_us;
+                }
+                fixed_latency[row][col] = calloc(curve->intents.count + 1, sizeof(uint64_t));
+                rapid_latency[row][col] = calloc(curve->intents.count + 1, sizeof(uint64_t));
+            }
+        }
+        end_us += 100000;
+    
+        score_t fixed_score, rapid_score;
+        replay(&fixed, end_us);
+        score(&fixed_score, fixed_latency);
+        replay(&rapid, end_us);
+        score(&rapid_score, rapid_latency);
+    
+        printf("%s\n", argv[file]);
+        printf("  %-24s %9s %15s %9s %15s %8s\n", "", "Presses", "mean / max ms", "Releases", "mean / max ms", "Spurious");
+        char name[64];
+        snprintf(name, sizeof(name), "Fixed %.2f mm", fixed.actuation / 100.0);
+        print_score(name, &fixed_score);
+        snprintf(name, sizeof(name), "Rapid trigger %.2f mm", rapid.rt_sensitivity / 100.0);
+        print_score(name, &rapid_score);
+    
+        // Saving where both reported the same intent
+        int64_t saved[2] = {0, 0};
+        uint32_t count[2] = {0, 0};
+        for (int row = 0; row < ROWS; row++) {
+            for (int col = 0; col < COLS; col++) {
+                key_curve_t *curve = &curves[row][col];
+                for (size_t i = 0; i < curve->intents.count; i++) {
+                    uint64_t a = fixed_latency[row][col][i], b = rapid_latency[row][col][i];
+                    if (a == UINT64_MAX || b == UINT64_MAX) continue;
+                    bool pressed = curve->intents.items[i].pressed;
+                    saved[pressed] += (int64_t)a - (int64_t)b;
+                    count[pressed]++;
+                }
+                free(fixed_latency[row][col]);
+                free(rapid_latency[row][col]);
+                free(curve->samples);
+                free(curve->intents.items);
+                free(curve->reported.items);
+            }
+        }
+        printf("  Rapid trigger saves %.2f ms per press, %.2f ms per release (reported by both)\n",
+               count[1] ? saved[1] / 1000.0 / count[1] : 0.0, count[0] ? saved[0] / 1000.0 / count[0] : 0.0);
+        for (int i = 0; i < 2; i++) {
+            saved_total[i] += saved[i];
+            saved_count[i] += count[i];
+        }
+    }
+    
+    if (argc - optind > 1) {
+        printf("All files: rapid trigger saves %.2f ms per press, %.2f ms per release\n",
+               saved_count[1] ? saved_total[1] / 1000.0 / saved_count[1] : 0.0,
+               saved_count[0] ? saved_total[0] / 1000.0 / saved_count[0] : 0.0);
+    }
+    return 0;
+}
@@ -0,0 +1,165 @@
+/**
+ * BLE Link Model
+ */
+
+#include <string.h>
+#include "sim.h"
+#include "ble_link.h"
+
+void ble_link_init(ble_link_t *link, const ble_link_config_t *config, uint64_t first_event_us,
+                   ble_radio_t *sender, ble_radio_t *receiver) {
+    memset(link, 0, sizeof(*link));
+    link->config = *config;
+    if (link->config.buffers > BLE_LINK_MAX_BUFFERS) link->config.buffers = BLE_LINK_MAX_BUFFERS;
+    if (link->config.buffers == 0) link->config.buffers = 1;
+    if (link->config.per_event == 0) link->config.per_event = 1;
+    if (link->config.max_events > BLE_LINK_MAX_EVENTS || link->config.max_events == 0) {
+        link->config.max_events = BLE_LINK_MAX_EVENTS;
+    }
+    if (link->config.transport == BLE_TRANSPORT_L2CAP && link->config.credits == 0) {
+        link->config.credits = 1;
+    }
+    link->radio[0] = sender;
+    link->radio[1] = receiver;
+    link->anchor_us = first_event_us;
+    link->credits = link->config.credits;
+    link->granted = link->config.credits;
+}
+
+static bool l2cap(const ble_link_t *link) {
+    return link->config.transport == BLE_TRANSPORT_L2CAP;
+}
+
+// The held SDU goes to the controller once it has a credit and a buffer
+static bool release_pending(ble_link_t *link) {
+    if (!link->have_pending || link->credits == 0 || link->count >= link->config.buffers) return false;
+    link->credits--;
+    link->buffer[link->count++] = link->pending;
+    link->have_pending = false;
+    return true;
+}
+
+uint16_t ble_link_notify(ble_link_t *link, const key_event_t *events, uint16_t count) {
+    // Notifications need a buffer now; a channel holds one SDU until it gets one
+    if (l2cap(link) ? link->have_pending : link->count >= link->config.buffers) {
+        link->stats.refused++;
+        return 0;
+    }
+    if (count > link->config.max_events) count = link->config.max_events;
+    
+    ble_packet_t *packet = l2cap(link) ? &link->pending : &link->buffer[link->count++];
+    memcpy(packet->events, events, count * sizeof(key_event_t));
+    packet->count = count;
+    link->stats.notified++;
+    if (l2cap(link)) {
+        link->have_pending = true;
+        if (!release_pending(link) && link->credits == 0) link->stats.credit_waits++;
+    }
+    return count;
+}
+
+void ble_link_request_can_send_now(ble_link_t *link) {
+    link->can_send_requested = true;
+}
+
+uint64_t ble_link_next_event(ble_link_t *link) {
+    int32_t jitter = link->config.anchor_jitter_us;
+    int64_t t = (int64_t)link->anchor_us + sim_rand_range(-jitter, jitter);
+    return t < (int64_t)sim_time_us ? sim_time_us : (uint64_t)t;
+}
+
+static void deliver_packet(ble_link_t *link, const ble_packet_t *packet, uint64_t arrival,
+                           ble_link_deliver_t deliver, void *context) {
+    if (link->config.rx_jitter_us) arrival += sim_rand_range(0, link->config.rx_jitter_us);
+    
+    if (link->have_held) {
+        // The held packet goes after this one
+        link->have_held = false;
+        deliver(context, packet->events, packet->count, arrival);
+        deliver(context, link->held.events, link->held.count, arrival);
+        link->stats.delivered += 2;
+        return;
+    }
+    if (link->config.reorder > 0 && sim_rand_unit() < link->config.reorder) {
+        link->have_held = true;
+        link->held = *packet;
+        link->stats.reordered++;
+        return;
+    }
+    deliver(context, packet->events, packet->count, arrival);
+    link->stats.delivered++;
+}
+
+static bool radio_busy(const ble_link_t *link, uint64_t now) {
+    return link->radio[0]->busy_until > now || link->radio[1]->busy_until > now;
+}
+
+bool ble_link_connection_event(ble_link_t *link, uint64_t now, ble_link_deliver_t deliver, void *context) {
+    link->anchor_us += link->config.interval_us * (1.0 + link->config.drift_ppm / 1e6);
+    link->acked = 0;
+    
+    if (radio_busy(link, now) && !link->skipped_last) {
+        // The other link's event is still on the air
+        link->skipped_last = true;
+        link->stats.skipped++;
+        return false;
+    }
+    link->skipped_last = false;
+    
+    // Credits handed back ride on the receiver's first reply
+    uint32_t overhead_us = BLE_EVENT_OVERHEAD_US;
+    if (link->grant) {
+        overhead_us += BLE_CREDIT_BYTES * BLE_BYTE_US;
+        link->stats.grants++;
+        if (sim_rand_unit() >= link->config.loss) {
+            link->credits += link->grant;
+            link->grant = 0;
+        }
+    }
+    
+    // The SDU length is one byte less than the ATT opcode and handle
+    uint32_t packet_us = BLE_PACKET_US;
+    if (l2cap(link)) packet_us -= (BLE_GATT_HEADER - BLE_L2CAP_HEADER) * BLE_BYTE_US;
+    
+    uint8_t sent = 0;
+    bool freed = false;
+    while (sent < link->config.per_event && link->count > 0) {
+        link->stats.transmissions++;
+        sent++;
+        if (sim_rand_unit() < link->config.loss) {
+            // Not acknowledged: retransmitted next event, nothing overtakes it
+            link->stats.lost++;
+            break;
+        }
+        deliver_packet(link, &link->buffer[0], now + overhead_us + sent * packet_us, deliver, context);
+        memmove(&link->buffer[0], &link->buffer[1], (link->count - 1) * sizeof(ble_packet_t));
+        link->count--;
+        link->acked++;
+        freed = true;
+        
+        if (l2cap(link) && --link->granted < (link->config.credits + 1) / 2 && !link->grant) {
+            link->grant = link->config.credits;
+            link->granted += link->config.credits;
+        }
+    }
+    
+    uint64_t end = now + overhead_us + sent * packet_us;
+    link->event_end_us = end;
+    for (int i = 0; i < 2; i++) {
+        if (link->radio[i]->busy_until < end) link->radio[i]->busy_until = end;
+    }
+    
+    // Don't hold a packet back forever when nothing follows it
+    if (link->have_held && link->count == 0) {
+        link->have_held = false;
+        deliver(context, link->held.events, link->held.count, now + link->config.interval_us / 2);
+        link->stats.delivered++;
+    }
+    
+    bool can_send = l2cap(link) ? release_pending(link) : freed;
+    if (can_send && link->can_send_requested) {
+        link->can_send_requested = false;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,138 @@
+/**
+ * BLE Link Model
+ * One half -> dongle (or right half -> relaying left half) connection
+ * carrying key event notifications.
+ *
+ * Notifications go into the sender's controller buffers (att_server_notify
+ * fails when they are full), each holding up to max_events key events. At
+ * each connection event the controller sends up to per_event packets in
+ * order; a lost packet is retransmitted at the next event and holds back the
+ * ones behind it, as the link layer does. Received packets can be delayed on
+ * the receiving side (host stack jitter), which may reorder them against
+ * another link.
+ *
+ * Both ends of a link have a radio that may be shared with another link. A
+ * connection event that starts while either radio is still busy with another
+ * link's event is skipped, unless this link skipped its previous event too,
+ * so colliding links take turns. A link timed by a different clock than the
+ * other links on its radios drifts against them by drift_ppm.
+ *
+ * After each connection event acked and event_end_us tell the sender's host
+ * what a Number Of Completed Packets event would: how many packets the
+ * receiver acknowledged, and when.
+ *
+ * With the L2CAP transport the packets are SDUs on a credit-based channel
+ * (KEY_L2CAP builds). Each takes one of the sender's credits. Out of credits
+ * or controller buffers, L2CAP holds one SDU and refuses the next send until
+ * it has gone to the controller. The receiver hands back `credits` more once
+ * the sender has fewer than half of that left, as BTstack's automatic
+ * credits do. The grant goes out in the receiver's reply at the next
+ * connection event, can be lost like any packet, and makes that event longer.
+ */
+
+#ifndef BLE_LINK_H
+#define BLE_LINK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "key_event.h"
+#include "key_tx_queue.h"
+
+#define BLE_LINK_MAX_BUFFERS 16
+#define BLE_LINK_MAX_EVENTS KEY_TX_BATCH_MAX
+
+// Air time: empty packet exchange that opens every connection event, and
+// each data packet with its acknowledgement (1M PHY, 20 byte payload)
+#define BLE_EVENT_OVERHEAD_US 330
+#define BLE_PACKET_US 650
+
+// Protocol bytes ahead of the key events in each packet: the L2CAP header,
+// then the ATT opcode and handle of a notification or the SDU length on a
+// channel. A credit grant is a whole L2CAP signalling packet.
+#define BLE_GATT_HEADER 7
+#define BLE_L2CAP_HEADER 6
+#define BLE_CREDIT_BYTES 12
+#define BLE_BYTE_US 8               // On the 1M PHY
+
+typedef enum {
+    BLE_TRANSPORT_GATT,             // Notifications
+    BLE_TRANSPORT_L2CAP,            // Key channel
+} ble_transport_t;
+
+typedef struct {
+    uint32_t interval_us;       // Connection interval
+    uint32_t anchor_jitter_us;  // Connection event timing error, +-
+    double drift_ppm;           // Clock offset against the other links
+    double loss;                // Probability a transmission is lost
+    uint32_t rx_jitter_us;      // Extra delay on the receiver, 0..rx_jitter_us
+    double reorder;             // Probability a packet is delivered after the next one
+    uint8_t buffers;            // Controller buffers on the sender
+    uint8_t per_event;          // Packets per connection event
+    uint8_t max_events;         // Key events per packet (ATT MTU)
+    uint8_t transport;          // ble_transport_t
+    uint8_t credits;            // L2CAP: credits the receiver grants at a time
+} ble_link_config_t;
+
+typedef struct {
+    uint32_t notified;          // Packets accepted from the sender
+    uint32_t refused;           // Notify calls refused (buffers full)
+    uint32_t transmissions;     // Packets sent over the air, including retries
+    uint32_t lost;              // Transmissions that had to be repeated
+    uint32_t delivered;         // Packets handed to the receiver
+    uint32_t reordered;         // Packets held back behind the next one
+    uint32_t skipped;           // Connection events lost to another link
+    uint32_t credit_waits;      // L2CAP: SDUs held for want of a credit
+    uint32_t grants;            // L2CAP: credit packets sent, including retries
+} ble_link_stats_t;
+
+// One radio, possibly serving several links
+typedef struct {
+    uint64_t busy_until;
+} ble_radio_t;
+
+typedef struct {
+    key_event_t events[BLE_LINK_MAX_EVENTS];
+    uint8_t count;
+} ble_packet_t;
+
+typedef struct {
+    ble_link_config_t config;
+    ble_radio_t *radio[2];      // Sender and receiver
+    ble_packet_t buffer[BLE_LINK_MAX_BUFFERS];
+    uint8_t count;
+    double anchor_us;           // Nominal time of the next connection event
+    bool can_send_requested;
+    bool skipped_last;          // Lost the previous event, wins the next one
+    bool have_held;             // Packet held back for reordering
+    ble_packet_t held;
+    uint8_t acked;              // Packets acknowledged in the last connection event
+    uint64_t event_end_us;      // End of the last connection event
+    uint16_t credits;           // L2CAP: the sender's credits
+    uint16_t granted;           // L2CAP: credits the receiver has given and not had used
+    uint16_t grant;             // L2CAP: credits to hand back at the next event, 0 = none
+    bool have_pending;          // L2CAP: SDU held, waiting for a credit or a buffer
+    ble_packet_t pending;
+    ble_link_stats_t stats;
+} ble_link_t;
+
+// Called for each packet the receiver gets, with its arrival time
+typedef void (*ble_link_deliver_t)(void *context, const key_event_t *events, uint8_t count, uint64_t time_us);
+
+void ble_link_init(ble_link_t *link, const ble_link_config_t *config, uint64_t first_event_us,
+                   ble_radio_t *sender, ble_radio_t *receiver);
+
+// Sender side: att_server_notify() (or l2cap_send()) with up to max_events
+// events, returning how many were taken, and the request for a can-send-now
+// event
+uint16_t ble_link_notify(ble_link_t *link, const key_event_t *events, uint16_t count);
+void ble_link_request_can_send_now(ble_link_t *link);
+
+// Time of the next connection event, with jitter applied
+uint64_t ble_link_next_event(ble_link_t *link);
+
+// Run the connection event at now. Returns true if the sender asked to be
+// told when it can send again and now can: buffers were freed, or the held
+// SDU went to the controller.
+bool ble_link_connection_event(ble_link_t *link, uint64_t now, ble_link_deliver_t deliver, void *context);
+
+#endif // BLE_LINK_H
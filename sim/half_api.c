@@ -0,0 +1,26 @@
+/**
+ * Half Firmware API
+ * Built once per half alongside that half's copy of the firmware sources,
+ * so the names below resolve to that half's prefixed functions
+ */
+
+#include "half_api.h"
+
+const half_api_t SIM_HALF(half_api) = {
+    .init = matrix_init,
+    .scan = matrix_scan,
+    .is_pressed = matrix_is_pressed,
+    .debounce_scans = matrix_debounce_scans,
+    .tx_init = key_tx_init,
+    .tx_push = key_tx_push,
+    .tx_push_batch = key_tx_push_batch,
+    .tx_flush = key_tx_flush,
+    .tx_set_ready = key_tx_set_ready,
+    .tx_count = key_tx_count,
+    .tx_stats = key_tx_get_stats,
+    .sync_set_interval = conn_sync_set_interval,
+    .sync_sample = conn_sync_sample,
+    .sync_locked = conn_sync_locked,
+    .sync_next_scan = conn_sync_next_scan,
+    .sync_stats = conn_sync_get_stats,
+};
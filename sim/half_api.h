@@ -0,0 +1,38 @@
+/**
+ * Half Firmware API
+ * matrix.c, key_tx_queue.c and conn_sync.c keep their state in file statics, so the
+ * simulator builds them once per half with prefixed symbol names
+ * (half_symbols.h) and reaches each copy through this table.
+ */
+
+#ifndef HALF_API_H
+#define HALF_API_H
+
+#include "matrix.h"
+#include "key_tx_queue.h"
+#include "conn_sync.h"
+
+// Member names differ from the functions so the prefixing doesn't touch them
+typedef struct {
+    void (*init)(const unsigned int *row_pins, const unsigned int *col_pins);
+    uint32_t (*scan)(matrix_event_cb_t cb);
+    bool (*is_pressed)(uint8_t row, uint8_t col);
+    uint8_t (*debounce_scans)(uint8_t row, uint8_t col);
+    void (*tx_init)(key_tx_send_t send, key_tx_request_t request_can_send);
+    void (*tx_push)(const key_event_t *event, uint32_t now_ms);
+    void (*tx_push_batch)(const key_event_t *events, uint16_t count, uint32_t now_ms);
+    void (*tx_flush)(uint32_t now_ms);
+    void (*tx_set_ready)(bool ready, uint32_t now_ms);
+    uint16_t (*tx_count)(void);
+    const key_tx_stats_t *(*tx_stats)(void);
+    void (*sync_set_interval)(uint32_t interval_us);
+    void (*sync_sample)(uint32_t ack_us);
+    bool (*sync_locked)(void);
+    uint32_t (*sync_next_scan)(uint32_t now_us, uint32_t periodic_us);
+    const conn_sync_stats_t *(*sync_stats)(void);
+} half_api_t;
+
+extern const half_api_t left_half_api;
+extern const half_api_t right_half_api;
+
+#endif // HALF_API_H
@@ -0,0 +1,36 @@
+/**
+ * Half Firmware Symbol Prefixing
+ * Force-included when building a half's copy of the firmware sources, with
+ * SIM_HALF_PREFIX set to left_ or right_
+ */
+
+#ifndef HALF_SYMBOLS_H
+#define HALF_SYMBOLS_H
+
+#define SIM_CONCAT_(a, b) a##b
+#define SIM_CONCAT(a, b) SIM_CONCAT_(a, b)
+#define SIM_HALF(name) SIM_CONCAT(SIM_HALF_PREFIX, name)
+
+#define matrix_init SIM_HALF(matrix_init)
+#define matrix_read SIM_HALF(matrix_read)
+#define matrix_process SIM_HALF(matrix_process)
+#define matrix_scan SIM_HALF(matrix_scan)
+#define matrix_is_pressed SIM_HALF(matrix_is_pressed)
+#define matrix_restore SIM_HALF(matrix_restore)
+#define matrix_debounce_scans SIM_HALF(matrix_debounce_scans)
+#define key_tx_init SIM_HALF(key_tx_init)
+#define key_tx_push SIM_HALF(key_tx_push)
+#define key_tx_push_batch SIM_HALF(key_tx_push_batch)
+#define key_tx_flush SIM_HALF(key_tx_flush)
+#define key_tx_set_ready SIM_HALF(key_tx_set_ready)
+#define key_tx_is_ready SIM_HALF(key_tx_is_ready)
+#define key_tx_count SIM_HALF(key_tx_count)
+#define key_tx_get_stats SIM_HALF(key_tx_get_stats)
+#define conn_sync_set_interval SIM_HALF(conn_sync_set_interval)
+#define conn_sync_sample SIM_HALF(conn_sync_sample)
+#define conn_sync_locked SIM_HALF(conn_sync_locked)
+#define conn_sync_next_scan SIM_HALF(conn_sync_next_scan)
+#define conn_sync_get_stats SIM_HALF(conn_sync_get_stats)
+#define conn_sync_events_waited SIM_HALF(conn_sync_events_waited)
+
+#endif // HALF_SYMBOLS_H
@@ -0,0 +1,384 @@
+/**
+ * Link Policy Replay
+ * Runs the firmware's link_policy.c against a modelled link and compares it
+ * with staying on one PHY: how long key events take to get across, how many
+ * are lost and how often the link drops.
+ *
+ * The scenario sets the signal and the Wi-Fi load over time. Around the
+ * scenario's RSSI the signal fades slowly (a hand, a body, a door) and from
+ * packet to packet. A transmission fails from noise when the signal is near
+ * the PHY's sensitivity, or from a Wi-Fi frame overlapping it while a burst
+ * of Wi-Fi traffic is on: longer packets are hit more often. A failed
+ * exchange ends the connection event; what was left is retried at the next
+ * one. With no successful exchange for the supervision timeout the link
+ * drops, and key events wait for the reconnect (or expire, as in
+ * key_tx_queue.c).
+ *
+ * Telemetry goes to the policy once a window: the RSSI the dongle would read
+ * and the retransmissions the half would report. PHY and timeout changes
+ * take effect a few connection events later, as the link layer procedures
+ * do.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+#include "link_policy.h"
+#include "key_tx_queue.h"
+
+// Sensitivity (half the exchanges fail), and air time of a key event
+// packet with its acknowledgement, per PHY
+static const double phy_sensitivity[LINK_PHYS] = {-91, -94, -98};
+static const double phy_air_us[LINK_PHYS] = {250, 400, 900};
+static const char *const phy_names[LINK_PHYS] = {"2M", "1M", "Coded S=2"};
+
+#define NOISE_SLOPE_DB 1.5          // Noise failures go from 10% to 90% over 6.6 dB
+#define FADE_DB 4.0                 // Slow fading, standard deviation
+#define FADE_TIME_MS 300.0          // and how long it lasts
+#define FAST_FADE_DB 2.0            // From packet to packet
+#define RSSI_READ_DB 2.0            // Error of an RSSI reading
+
+// Wi-Fi: bursts of frames on the channels it shares with us
+#define WIFI_COVER 0.65             // Our data channels under busy Wi-Fi (three 20 MHz channels)
+#define WIFI_FRAME_US 1500.0
+#define WIFI_OCCUPANCY 0.7          // Air time taken by frames during a burst
+#define WIFI_BURST_MS 200.0         // Mean burst length
+
+#define PER_EVENT 4                 // Packets per connection event
+#define PROCEDURE_EVENTS 8          // A PHY or parameter update takes effect after this many
+#define RECONNECT_MS 600            // Dropped link back up: advertising, connection, cached handles
+#define KEY_HOLD_MS 90              // Press to release
+#define LATE_MS 50                  // Key events this late count as late
+
+typedef struct {
+    double time_s;
+    double rssi;
+    double wifi;                    // Time in Wi-Fi bursts, 0..1
+} segment_t;
+
+typedef struct {
+    const char *name;
+    bool adaptive;
+    link_phy_t phy;                 // Fixed strategies
+} strategy_t;
+
+typedef struct {
+    double *delays_ms;
+    uint32_t delivered;
+    uint32_t late;
+    uint32_t expired;
+    uint32_t drops;
+    uint32_t changes;
+    uint64_t phy_us[LINK_PHYS];
+    uint64_t lossy_us;
+} result_t;
+
+static segment_t *segments;
+static size_t segment_count;
+static uint64_t *arrivals;          // Key events, in time order
+static size_t arrival_count;
+
+static uint32_t interval_us = 7500;
+static uint32_t timeout_ms = 720;
+static double key_rate = 15;
+static bool verbose = false;
+static uint64_t seed = 1;
+
+// Separate streams: the environment is the same for every strategy
+typedef struct {
+    uint64_t state;
+} rng_t;
+
+static double rand_unit(rng_t *rng) {
+    rng->state ^= rng->state << 13;
+    rng->state ^= rng->state >> 7;
+    rng->state ^= rng->state << 17;
+    return (rng->state >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double rand_gauss(rng_t *rng) {
+    double u = rand_unit(rng);
+    if (u < 1e-12) u = 1e-12;
+    return sqrt(-2 * log(u)) * cos(2 * M_PI * rand_unit(rng));
+}
+
+static double rand_exp(rng_t *rng, double mean) {
+    double u = rand_unit(rng);
+    if (u < 1e-12) u = 1e-12;
+    return -mean * log(u);
+}
+
+// Text file, one segment per line: <time s> <rssi dBm> <wifi 0..1>, held
+// until the next line. The last line's time ends the run.
+static bool load_scenario(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    
+    char line[256];
+    int line_number = 0;
+    size_t capacity = 0;
+    while (fgets(line, sizeof(line), f)) {
+        line_number++;
+        char *p = line;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == '#' || *p == '\n' || *p == '\0') continue;
+    
+        segment_t segment;
+        if (sscanf(p, "%lf %lf %lf", &segment.time_s, &segment.rssi, &segment.wifi) != 3 ||
+            segment.wifi < 0 || segment.wifi >= 1 ||
+            (segment_count && segment.time_s <= segments[segment_count - 1].time_s)) {
+            fprintf(stderr, "%s:%d: expected <time s> <rssi dBm> <wifi 0..1>, times increasing\n", path, line_number);
+            fclose(f);
+            return false;
+        }
+        if (segment_count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            segments = realloc(segments, capacity * sizeof(segment_t));
+        }
+        segments[segment_count++] = segment;
+    }
+    fclose(f);
+    if (segment_count < 2) {
+        fprintf(stderr, "%s: needs at least two lines\n", path);
+        return false;
+    }
+    return true;
+}
+
+static const segment_t *segment_at(uint64_t time_us) {
+    size_t i = 0;
+    while (i + 1 < segment_count && segments[i + 1].time_s * 1e6 <= time_us) i++;
+    return &segments[i];
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Keystrokes at random, a press and a release each
+static void make_arrivals(uint64_t end_us) {
+    rng_t rng = {seed * 0x9E3779B97F4A7C15ULL | 1};
+    size_t capacity = (size_t)(end_us / 1e6 * key_rate * 3) + 16;
+    arrivals = malloc(capacity * sizeof(uint64_t));
+    double t = rand_exp(&rng, 1e6 / key_rate);
+    while (t < end_us && arrival_count + 2 <= capacity) {
+        arrivals[arrival_count++] = (uint64_t)t;
+        arrivals[arrival_count++] = (uint64_t)t + KEY_HOLD_MS * 1000;
+        t += rand_exp(&rng, 1e6 / key_rate);
+    }
+    qsort(arrivals, arrival_count, sizeof(uint64_t), compare_u64);
+}
+
+static void run(const strategy_t *strategy, result_t *result) {
+    memset(result, 0, sizeof(*result));
+    result->delays_ms = malloc(arrival_count * sizeof(double));
+    rng_t environment = {seed};
+    rng_t air = {seed ^ 0xD1B54A32D192ED03ULL};
+    
+    uint64_t end_us = (uint64_t)(segments[segment_count - 1].time_s * 1e6);
+    double fade_keep = exp(-(interval_us / 1000.0) / FADE_TIME_MS);
+    double fade = 0;
+    bool wifi_busy = false;
+    uint64_t wifi_switch_us = 0;
+    
+    link_policy_t policy;
+    link_policy_init(&policy);
+    uint8_t phy = strategy->adaptive ? policy.phy : strategy->phy;
+    bool lossy = strategy->adaptive ? policy.lossy : false;
+    uint64_t pending_us = 0;            // When the policy's last decision takes effect, 0 = none
+    
+    bool up = true;
+    uint64_t up_at_us = 0;
+    uint64_t last_ok_us = 0;
+    size_t head = 0;                    // First key event not yet delivered
+    size_t next = 0;                    // First key event not yet arrived
+    link_window_t window = {.rssi = LINK_RSSI_UNKNOWN};
+    uint64_t window_end_us = LINK_WINDOW_MS * 1000;
+    
+    for (uint64_t t = 0; t < end_us; t += interval_us) {
+        const segment_t *segment = segment_at(t);
+    
+        // Environment, the same whatever the link does
+        fade = fade * fade_keep + sqrt(1 - fade_keep * fade_keep) * FADE_DB * rand_gauss(&environment);
+        double fast = FAST_FADE_DB * rand_gauss(&environment);
+        double rssi = segment->rssi + fade + fast;
+        double read_error = RSSI_READ_DB * rand_gauss(&environment);
+        if (t >= wifi_switch_us) {
+            wifi_busy = !wifi_busy && segment->wifi > 0;
+            double burst_us = WIFI_BURST_MS * 1000;
+            double gap_us = segment->wifi > 0 ? burst_us * (1 - segment->wifi) / segment->wifi : 1e6;
+            wifi_switch_us = t + (uint64_t)rand_exp(&environment, wifi_busy ? burst_us : gap_us);
+        }
+        while (next < arrival_count && arrivals[next] <= t) next++;
+    
+        if (pending_us && t >= pending_us) {
+            if (phy != policy.phy) result->changes++;
+            phy = policy.phy;
+            lossy = policy.lossy;
+            pending_us = 0;
+        }
+        result->phy_us[phy] += interval_us;
+        if (lossy) result->lossy_us += interval_us;
+    
+        if (!up) {
+            if (t < up_at_us) continue;
+            up = true;
+            last_ok_us = t;
+        }
+    
+        // Key events past their age are dropped before sending
+        while (head < next && t - arrivals[head] > KEY_TX_MAX_AGE_MS * 1000) {
+            head++;
+            result->expired++;
+        }
+    
+        // Connection event: an empty exchange if there's nothing to send
+        double p_noise = 1 / (1 + exp((rssi - phy_sensitivity[phy]) / NOISE_SLOPE_DB));
+        double p_wifi = wifi_busy ? WIFI_COVER * (1 - exp(-WIFI_OCCUPANCY * (phy_air_us[phy] + WIFI_FRAME_US) / WIFI_FRAME_US)) : 0;
+        double p_ok = (1 - p_noise) * (1 - p_wifi);
+        int exchanges = 0;
+        do {
+            if (rand_unit(&air) >= p_ok) {
+                // Everything still waiting goes again at the next event
+                size_t waiting = (next - head + KEY_TX_BATCH_MAX - 1) / KEY_TX_BATCH_MAX;
+                window.retransmissions += waiting < PER_EVENT - exchanges ? waiting : PER_EVENT - exchanges;
+                break;
+            }
+            last_ok_us = t;
+            exchanges++;
+            double done_us = t + exchanges * phy_air_us[phy];
+            int batch = 0;
+            while (head < next && batch < KEY_TX_BATCH_MAX) {
+                double delay = (done_us - arrivals[head]) / 1000;
+                result->delays_ms[result->delivered++] = delay;
+                if (delay > LATE_MS) result->late++;
+                head++;
+                batch++;
+            }
+            if (batch) window.packets++;
+        } while (head < next && exchanges < PER_EVENT);
+        window.rssi = (int8_t)lround(rssi + read_error);
+    
+        uint32_t timeout_us = (lossy && LINK_LOSSY_TIMEOUT_MS > timeout_ms ? LINK_LOSSY_TIMEOUT_MS : timeout_ms) * 1000;
+        if (t - last_ok_us > timeout_us) {
+            up = false;
+            up_at_us = t + RECONNECT_MS * 1000;
+            result->drops++;
+            window = (link_window_t){.rssi = LINK_RSSI_UNKNOWN};
+            if (strategy->adaptive) {
+                // The central applies the policy's settings once the link is back
+                link_policy_dropped(&policy);
+                pending_us = up_at_us;
+            }
+            if (verbose) printf("  %s: %.1f s link dropped\n", strategy->name, t / 1e6);
+            continue;
+        }
+    
+        if (t >= window_end_us) {
+            window_end_us += LINK_WINDOW_MS * 1000;
+            if (strategy->adaptive && link_policy_update(&policy, &window)) {
+                pending_us = t + PROCEDURE_EVENTS * interval_us;
+                if (verbose) {
+                    printf("  %s: %.1f s rssi %d, %u/%u retransmitted -> %s%s\n", strategy->name, t / 1e6,
+                           window.rssi, window.retransmissions, window.packets,
+                           phy_names[policy.phy], policy.lossy ? ", long timeout" : "");
+                }
+            }
+            window = (link_window_t){.rssi = LINK_RSSI_UNKNOWN};
+        }
+    }
+    result->expired += next - head;
+}
+
+static void print_result(const char *name, const result_t *r, uint64_t end_us) {
+    qsort(r->delays_ms, r->delivered, sizeof(double), compare_double);
+    double total = 0;
+    for (uint32_t i = 0; i < r->delivered; i++) total += r->delays_ms[i];
+    printf("  %-12s", name);
+    if (r->delivered) {
+        printf(" %6.2f / %7.2f / %7.1f", total / r->delivered, r->delays_ms[(size_t)(r->delivered * 0.99)],
+               r->delays_ms[r->delivered - 1]);
+    } else {
+        printf(" %6s / %7s / %7s", "-", "-", "-");
+    }
+    printf(" %6u %6u %6u  ", r->late, r->expired, r->drops);
+    for (int phy = 0; phy < LINK_PHYS; phy++) {
+        printf("%s%3.0f", phy ? " /" : "", 100.0 * r->phy_us[phy] / end_us);
+    }
+    printf("  %5.0f %7u\n", 100.0 * r->lossy_us / end_us, r->changes);
+}
+
+static void usage(const char *name) {
+    printf("Usage: %s [options] SCENARIO\n"
+           "SCENARIO holds <time s> <rssi dBm> <wifi 0..1> per line, each held until the next;\n"
+           "wifi is the share of time in Wi-Fi bursts. The last line ends the run.\n"
+           "  --interval MS       Connection interval (default 7.5)\n"
+           "  --timeout MS        Supervision timeout as connected (default 720)\n"
+           "  --rate N            Keystrokes per second (default 15)\n"
+           "  --seed N            Random seed (default 1)\n"
+           "  --verbose           Print the policy's decisions and the drops\n",
+           name);
+}
+
+int main(int argc, char **argv) {
+    static const struct option options[] = {
+        {"interval", required_argument, NULL, 'i'},
+        {"timeout", required_argument, NULL, 't'},
+        {"rate", required_argument, NULL, 'r'},
+        {"seed", required_argument, NULL, 's'},
+        {"verbose", no_argument, NULL, 'v'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (opt) {
+            case 'i': interval_us = (uint32_t)(strtod(optarg, NULL) * 1000 + 0.5); break;
+            case 't': timeout_ms = strtoul(optarg, NULL, 0); break;
+            case 'r': key_rate = strtod(optarg, NULL); break;
+            case 's': seed = strtoull(optarg, NULL, 0); break;
+            case 'v': verbose = true; break;
+            default: usage(argv[0]); return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (optind + 1 != argc || interval_us < 7500 || timeout_ms == 0 || key_rate <= 0 || seed == 0) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (!load_scenario(argv[optind])) return 2;
+    
+    uint64_t end_us = (uint64_t)(segments[segment_count - 1].time_s * 1e6);
+    make_arrivals(end_us);
+    
+    static const strategy_t strategies[] = {
+        {"Fixed 2M", false, LINK_PHY_2M},
+        {"Fixed 1M", false, LINK_PHY_1M},
+        {"Fixed Coded", false, LINK_PHY_CODED},
+        {"Adaptive", true, LINK_PHY_2M},
+    };
+    result_t results[sizeof(strategies) / sizeof(strategies[0])];
+    for (size_t i = 0; i < sizeof(strategies) / sizeof(strategies[0]); i++) {
+        run(&strategies[i], &results[i]);
+    }
+    
+    printf("%s: %.0f s, %zu key events, %.2f ms interval, %u ms timeout\n", argv[optind], end_us / 1e6,
+           arrival_count, interval_us / 1000.0, timeout_ms);
+    printf("  %-12s %25s %6s %6s %6s  %-15s %5s %7s\n", "", "Delay mean / p99 / max ms", "Late", "Lost", "Drops",
+           "2M / 1M / Coded", "Lossy", "Changes");
+    for (size_t i = 0; i < sizeof(strategies) / sizeof(strategies[0]); i++) {
+        print_result(strategies[i].name, &results[i], end_us);
+        free(results[i].delays_ms);
+    }
+    return 0;
+}
@@ -0,0 +1,229 @@
+/**
+ * Latency and Correctness Metrics
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "keymap.h"
+#include "usb_descriptors.h"
+#include "metrics.h"
+
+#define USAGES 256
+#define HISTOGRAM_BUCKETS 20    // 1 ms each, last one catches the rest
+
+typedef struct {
+    uint32_t *index;            // Trace transitions for this usage, in time order
+    uint32_t count;
+    uint32_t next;              // Next one the host should report
+} usage_transitions_t;
+
+static const trace_t *trace;
+static usage_transitions_t usages[USAGES];
+static bool tracked[USAGES];    // Usage of exactly one key (metrics_key_usage())
+static bool *matched;           // Per trace transition
+
+static uint32_t *latency_us[2]; // Press, release
+static uint32_t latency_count[2];
+static uint32_t *side_latency_us[2];    // Both transitions, by half
+static uint32_t side_latency_count[2];
+static uint32_t *scan_to_air_us[2];     // By half
+static uint32_t scan_to_air_count[2];
+
+static bool host_down[USAGES];
+static uint64_t max_reported_time;      // Latest physical time reported so far
+static uint64_t report_max_time;        // Same, within the current report
+static uint32_t misordered;
+static uint32_t spurious;               // Host saw a change the trace doesn't explain
+static uint32_t reports;
+
+static int raw_usage(uint8_t code) {
+    if (code >= KEY_MOD_FIRST && code <= KEY_MOD_LAST) return 0xE0 + (code - KEY_MOD_FIRST);
+    if (code >= HID_KEY_A && code <= 0xA4) return code;
+    return -1;
+}
+
+int metrics_key_usage(uint8_t side, uint8_t row, uint8_t col) {
+    int usage = raw_usage(keymap[0][side][row][col]);
+    if (usage < 0) return -1;
+    
+    // Two keys with one keycode can't be told apart on the host
+    for (int s = 0; s < SIDES; s++) {
+        for (int r = 0; r < ROWS; r++) {
+            for (int c = 0; c < COLS; c++) {
+                if ((s != side || r != row || c != col) && raw_usage(keymap[0][s][r][c]) == usage) {
+                    return -1;
+                }
+            }
+        }
+    }
+    return usage;
+}
+
+bool metrics_key_trackable(uint8_t side, uint8_t row, uint8_t col) {
+    return metrics_key_usage(side, row, col) >= 0;
+}
+
+void metrics_init(const trace_t *t) {
+    trace = t;
+    for (int s = 0; s < SIDES; s++) {
+        for (int r = 0; r < ROWS; r++) {
+            for (int c = 0; c < COLS; c++) {
+                int usage = metrics_key_usage(s, r, c);
+                if (usage >= 0) tracked[usage] = true;
+            }
+        }
+    }
+    matched = calloc(t->count + 1, sizeof(bool));
+    latency_us[0] = calloc(t->count + 1, sizeof(uint32_t));
+    latency_us[1] = calloc(t->count + 1, sizeof(uint32_t));
+    side_latency_us[0] = calloc(t->count + 1, sizeof(uint32_t));
+    side_latency_us[1] = calloc(t->count + 1, sizeof(uint32_t));
+    scan_to_air_us[0] = calloc(t->count + 1, sizeof(uint32_t));
+    scan_to_air_us[1] = calloc(t->count + 1, sizeof(uint32_t));
+    
+    for (uint32_t i = 0; i < t->count; i++) {
+        const trace_event_t *e = &t->events[i];
+        int usage = metrics_key_usage(e->side, e->row, e->col);
+        if (usage < 0) continue;
+        usage_transitions_t *u = &usages[usage];
+        u->index = realloc(u->index, (u->count + 1) * sizeof(uint32_t));
+        u->index[u->count++] = i;
+    }
+}
+
+static void host_transition(int usage, bool down, uint64_t time_us, bool verbose) {
+    // Shared keycodes can't be matched to a key, and aren't in the trace
+    if (!tracked[usage]) return;
+    usage_transitions_t *u = &usages[usage];
+    if (u->next >= u->count) {
+        spurious++;
+        return;
+    }
+    
+    uint32_t i = u->index[u->next];
+    const trace_event_t *e = &trace->events[i];
+    if (e->pressed != down) {
+        // Host missed a press/release pair, or saw one twice
+        spurious++;
+        return;
+    }
+    u->next++;
+    matched[i] = true;
+    
+    uint32_t latency = (uint32_t)(time_us - e->time_us);
+    latency_us[down ? 0 : 1][latency_count[down ? 0 : 1]++] = latency;
+    side_latency_us[e->side][side_latency_count[e->side]++] = latency;
+    
+    if (e->time_us < max_reported_time) misordered++;
+    if (e->time_us > report_max_time) report_max_time = e->time_us;
+    
+    if (verbose) {
+        printf("%10.3f ms  %-7s 0x%02x  %c R%u C%u  latency %6.3f ms%s\n",
+               time_us / 1000.0, down ? "down" : "up", usage, e->side ? 'R' : 'L',
+               e->row, e->col, latency / 1000.0, e->time_us < max_reported_time ? "  (out of order)" : "");
+    }
+}
+
+void metrics_host_report(const uint8_t *report, uint16_t len, uint64_t time_us, bool verbose) {
+    if (len < 9 || report[0] != REPORT_ID_KEYBOARD) return;
+    reports++;
+    
+    bool now_down[USAGES] = {false};
+    for (int bit = 0; bit < 8; bit++) {
+        if (report[1] & (1 << bit)) now_down[0xE0 + bit] = true;
+    }
+    for (int i = 3; i < 9; i++) {
+        if (report[i]) now_down[report[i]] = true;
+    }
+    
+    // Events within one report are simultaneous to the host, so ordering is
+    // only checked against earlier reports
+    report_max_time = max_reported_time;
+    for (int usage = 0; usage < USAGES; usage++) {
+        if (now_down[usage] == host_down[usage]) continue;
+        host_down[usage] = now_down[usage];
+        host_transition(usage, now_down[usage], time_us, verbose);
+    }
+    max_reported_time = report_max_time;
+}
+
+void metrics_scan_to_air(uint8_t side, uint32_t delay_us) {
+    // At most one per transition, unless bounce outlasted the debounce
+    if (scan_to_air_count[side] <= trace->count) {
+        scan_to_air_us[side][scan_to_air_count[side]++] = delay_us;
+    }
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : (x > y);
+}
+
+// Jitter is the standard deviation of the latency
+static void print_distribution(FILE *out, const char *name, uint32_t *values, uint32_t count, bool histogram) {
+    if (count == 0) {
+        fprintf(out, "%s latency: no samples\n", name);
+        return;
+    }
+    qsort(values, count, sizeof(uint32_t), compare_u32);
+    
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < count; i++) sum += values[i];
+    double mean = (double)sum / count;
+    double variance = 0;
+    for (uint32_t i = 0; i < count; i++) variance += (values[i] - mean) * (values[i] - mean);
+    
+    #define PCT(p) (values[(uint32_t)((count - 1) * (p) / 100)] / 1000.0)
+    fprintf(out, "%s latency (ms, %u samples): min %.3f  mean %.3f  p50 %.3f  p90 %.3f  p99 %.3f  "
+            "max %.3f  jitter %.3f\n",
+            name, count, values[0] / 1000.0, mean / 1000.0,
+            PCT(50), PCT(90), PCT(99), values[count - 1] / 1000.0, sqrt(variance / count) / 1000.0);
+    #undef PCT
+    if (!histogram) return;
+    
+    uint32_t buckets[HISTOGRAM_BUCKETS] = {0};
+    uint32_t largest = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t b = values[i] / 1000;
+        if (b >= HISTOGRAM_BUCKETS) b = HISTOGRAM_BUCKETS - 1;
+        if (++buckets[b] > largest) largest = buckets[b];
+    }
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        if (!buckets[b]) continue;
+        int bar = (int)(buckets[b] * 50 / largest);
+        fprintf(out, "  %2d%s ms %6u |", b, b == HISTOGRAM_BUCKETS - 1 ? "+" : " ", buckets[b]);
+        for (int i = 0; i < bar; i++) fputc('#', out);
+        fputc('\n', out);
+    }
+}
+
+uint32_t metrics_print(FILE *out) {
+    uint32_t lost_presses = 0, lost_releases = 0, untracked = 0;
+    for (uint32_t i = 0; i < trace->count; i++) {
+        const trace_event_t *e = &trace->events[i];
+        if (metrics_key_usage(e->side, e->row, e->col) < 0) {
+            untracked++;
+        } else if (!matched[i]) {
+            if (e->pressed) lost_presses++;
+            else lost_releases++;
+        }
+    }
+    
+    uint32_t stuck = 0;
+    for (int usage = 0; usage < USAGES; usage++) {
+        if (host_down[usage]) stuck++;
+    }
+    
+    fprintf(out, "Transitions: %zu (%u not tracked), host reports: %u\n", trace->count, untracked, reports);
+    print_distribution(out, "Press", latency_us[0], latency_count[0], true);
+    print_distribution(out, "Release", latency_us[1], latency_count[1], true);
+    print_distribution(out, "Left half", side_latency_us[0], side_latency_count[0], false);
+    print_distribution(out, "Right half", side_latency_us[1], side_latency_count[1], false);
+    print_distribution(out, "Left scan-to-air", scan_to_air_us[0], scan_to_air_count[0], false);
+    print_distribution(out, "Right scan-to-air", scan_to_air_us[1], scan_to_air_count[1], false);
+    fprintf(out, "Lost presses: %u  lost releases: %u  stuck keys: %u  out of order: %u  spurious: %u\n",
+            lost_presses, lost_releases, stuck, misordered, spurious);
+    
+    return lost_presses + lost_releases + stuck;
+}
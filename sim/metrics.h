@@ -0,0 +1,36 @@
+/**
+ * Latency and Correctness Metrics
+ * Matches the host's view of the keyboard (decoded USB reports) against the
+ * physical transitions of the trace
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "trace.h"
+
+// Usage the host should see for a key on the base layer: the keycode, or
+// 0xE0-0xE7 for modifiers. -1 for keys the metrics can't follow (layer,
+// mouse and macro keys, unmapped keys, keycodes used by more than one key).
+int metrics_key_usage(uint8_t side, uint8_t row, uint8_t col);
+
+// Trace filter for the generator: keys with a usage
+bool metrics_key_trackable(uint8_t side, uint8_t row, uint8_t col);
+
+void metrics_init(const trace_t *trace);
+
+// A report the host received at time_us (report ID first)
+void metrics_host_report(const uint8_t *report, uint16_t len, uint64_t time_us, bool verbose);
+
+// A half's own key event reached the other end of its link delay_us after
+// the scan that found it
+void metrics_scan_to_air(uint8_t side, uint32_t delay_us);
+
+// Print the latency distribution and error counts. Returns the number of
+// lost and stuck keys (misordering between the halves is expected).
+uint32_t metrics_print(FILE *out);
+
+#endif // METRICS_H
@@ -0,0 +1,40 @@
+/**
+ * Keyboard Simulator
+ * Virtual time, random numbers, GPIO and USB device shared by the models
+ */
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "matrix.h"
+
+// Virtual time in microseconds
+extern uint64_t sim_time_us;
+
+// Deterministic random numbers (xorshift), seeded from the command line
+void sim_seed(uint32_t seed);
+uint32_t sim_rand(void);
+double sim_rand_unit(void);                       // [0, 1)
+int32_t sim_rand_range(int32_t lo, int32_t hi);   // [lo, hi]
+
+// Virtual GPIO bank of one half: rows are driven low one at a time and a
+// closed switch pulls its column low (diodes assumed, no ghosting)
+typedef struct {
+    uint8_t row_pin[ROWS];
+    uint8_t col_pin[COLS];
+    uint32_t out_enable;
+    uint32_t out_level;
+    bool contact[ROWS][COLS];   // Physical switch state, including bounce
+} sim_gpio_bank_t;
+
+// Bank the GPIO calls go to; set before running a half's code
+extern sim_gpio_bank_t *sim_gpio;
+
+// USB device: one IN endpoint for the keyboard/mouse interface. The host
+// poll takes the loaded report (if any), passes it to cb and completes it.
+typedef void (*sim_usb_report_cb_t)(const uint8_t *report, uint16_t len);
+void sim_usb_poll(sim_usb_report_cb_t cb);
+
+#endif // SIM_H
@@ -0,0 +1,178 @@
+/**
+ * Keyboard Simulator
+ * Virtual time, random numbers, GPIO, the TinyUSB device stand-in and the
+ * watchdog recovery and firmware staging ones
+ */
+
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/gpio.h"
+#include "tusb.h"
+#include "usb_descriptors.h"
+#include "recovery.h"
+#include "dfu.h"
+#include "sim.h"
+
+uint64_t sim_time_us = 0;
+
+static uint32_t rng_state = 1;
+
+void sim_seed(uint32_t seed) {
+    rng_state = seed ? seed : 1;
+}
+
+uint32_t sim_rand(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+double sim_rand_unit(void) {
+    return sim_rand() / 4294967296.0;
+}
+
+int32_t sim_rand_range(int32_t lo, int32_t hi) {
+    if (hi <= lo) return lo;
+    return lo + (int32_t)(sim_rand() % (uint32_t)(hi - lo + 1));
+}
+
+// GPIO
+
+sim_gpio_bank_t *sim_gpio = NULL;
+
+void gpio_init(unsigned int gpio) {
+    sim_gpio->out_enable &= ~(1u << gpio);
+    sim_gpio->out_level &= ~(1u << gpio);
+}
+
+void gpio_set_dir(unsigned int gpio, bool out) {
+    if (out) sim_gpio->out_enable |= 1u << gpio;
+    else sim_gpio->out_enable &= ~(1u << gpio);
+}
+
+void gpio_put(unsigned int gpio, bool value) {
+    if (value) sim_gpio->out_level |= 1u << gpio;
+    else sim_gpio->out_level &= ~(1u << gpio);
+}
+
+void gpio_pull_up(unsigned int gpio) {
+    (void)gpio;  // Every undriven pin reads high
+}
+
+uint32_t gpio_get_all(void) {
+    uint32_t pins = ~sim_gpio->out_enable | sim_gpio->out_level;
+    
+    for (int row = 0; row < ROWS; row++) {
+        uint32_t row_bit = 1u << sim_gpio->row_pin[row];
+        if (!(sim_gpio->out_enable & row_bit) || (sim_gpio->out_level & row_bit)) continue;
+        for (int col = 0; col < COLS; col++) {
+            if (sim_gpio->contact[row][col]) pins &= ~(1u << sim_gpio->col_pin[col]);
+        }
+    }
+    return pins;
+}
+
+// USB device
+
+static uint8_t ep_report[16];
+static uint16_t ep_len = 0;     // Report loaded into the endpoint, 0 if free
+
+bool tud_hid_ready(void) {
+    return ep_len == 0;
+}
+
+// The simulated host never suspends
+bool tud_remote_wakeup(void) {
+    return false;
+}
+
+static bool load_report(uint8_t report_id, const void *report, uint16_t len) {
+    if (ep_len != 0 || len + 1 > sizeof(ep_report)) return false;
+    ep_report[0] = report_id;
+    memcpy(&ep_report[1], report, len);
+    ep_len = len + 1;
+    return true;
+}
+
+bool tud_hid_n_report(uint8_t instance, uint8_t report_id, void const *report, uint16_t len) {
+    // The raw HID interface has its own endpoint and no simulated host
+    if (instance != ITF_NUM_HID) return true;
+    return load_report(report_id, report, len);
+}
+
+bool tud_hid_keyboard_report(uint8_t report_id, uint8_t modifier, const uint8_t keycode[6]) {
+    uint8_t report[8] = {modifier, 0};
+    if (keycode) memcpy(&report[2], keycode, 6);
+    return load_report(report_id, report, sizeof(report));
+}
+
+bool tud_hid_mouse_report(uint8_t report_id, uint8_t buttons, int8_t x, int8_t y, int8_t vertical, int8_t horizontal) {
+    uint8_t report[5] = {buttons, (uint8_t)x, (uint8_t)y, (uint8_t)vertical, (uint8_t)horizontal};
+    return load_report(report_id, report, sizeof(report));
+}
+
+void sim_usb_poll(sim_usb_report_cb_t cb) {
+    if (ep_len == 0) return;  // NAK
+    
+    uint8_t report[sizeof(ep_report)];
+    uint16_t len = ep_len;
+    memcpy(report, ep_report, len);
+    ep_len = 0;
+    
+    cb(report, len);
+    tud_hid_report_complete_cb(ITF_NUM_HID, report, len);
+}
+
+// Watchdog recovery: every run is a cold boot, with nothing to restore
+
+void recovery_seal(const void *state, uint32_t size, uint32_t *check) {
+    (void)state;
+    (void)size;
+    *check = 0;
+}
+
+bool recovery_restore(const void *state, uint32_t size, const uint32_t *check) {
+    (void)state;
+    (void)size;
+    (void)check;
+    return false;
+}
+
+uint8_t recovery_serialize(uint8_t *buffer) {
+    memset(buffer, 0, RECOVERY_INFO_SIZE);
+    return RECOVERY_INFO_SIZE;
+}
+
+// Firmware update: no flash to stage an image in
+
+bool dfu_begin(uint32_t size, uint32_t crc) {
+    (void)size;
+    (void)crc;
+    return false;
+}
+
+bool dfu_write(const uint8_t *data, uint16_t len) {
+    (void)data;
+    (void)len;
+    return false;
+}
+
+void dfu_abort(void) {
+}
+
+dfu_state_t dfu_state(void) {
+    return DFU_IDLE;
+}
+
+uint32_t dfu_size(void) {
+    return 0;
+}
+
+uint32_t dfu_received(void) {
+    return 0;
+}
+
+uint32_t dfu_written(void) {
+    return 0;
+}
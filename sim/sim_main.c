@@ -0,0 +1,518 @@
+/**
+ * Keyboard Simulator
+ * Runs the halves' scan/debounce/transmit code and the dongle's key
+ * processing on virtual time, joined by a BLE link model and polled by an
+ * emulated USB host, and reports what the host saw against a typing trace.
+ *
+ * Each half: matrix_scan() every SCAN_PERIOD_US on a virtual GPIO bank, plus
+ * one scan just before each connection event once conn_sync has the phase
+ * (--free-run leaves it out), events straight into its key_tx queue (the
+ * core 1 -> core 0 hop takes microseconds on hardware), notifications into
+ * its BLE link.
+ * Dongle: process_key_event() on packet arrival, keyboard_task() every
+ * millisecond, usb_emit_reports() whenever the endpoint may have freed up.
+ *
+ * With --relay the right half's link ends at the left half, which pushes
+ * what it receives into its own key_tx queue (as the RELAY firmware build
+ * does), and only the left half's link reaches the dongle.
+ *
+ * --transport l2cap sends the key events over credit-based L2CAP channels
+ * instead of notifications (the KEY_L2CAP build), for comparing the two.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include "pico/stdlib.h"
+#include "sim.h"
+#include "half_api.h"
+#include "ble_link.h"
+#include "trace.h"
+#include "metrics.h"
+#include "keyboard.h"
+
+// Virtual GPIO pins, as on the real halves
+static const unsigned int row_pins[ROWS] = {2, 3, 4, 5, 6};
+static const unsigned int col_pins[COLS] = {7, 8, 9, 10, 11, 12, 13};
+
+// Event queue
+
+typedef enum {
+    EV_SWITCH,          // Physical contact change (trace or bounce)
+    EV_SCAN,            // Half scans its matrix
+    EV_CONN_EVENT,      // Connection event on a half's link
+    EV_DELIVER,         // Packet reaches the dongle (or the relaying left half)
+    EV_DONGLE_TICK,     // Dongle main loop: macros, scrolling, pending reports
+    EV_USB_POLL,        // Host polls the IN endpoint
+} event_type_t;
+
+typedef struct {
+    uint64_t time_us;
+    uint64_t seq;       // Insertion order, keeps equal times FIFO
+    uint8_t type;
+    uint8_t half;
+    uint8_t row;
+    uint8_t col;
+    bool pressed;
+    uint8_t count;
+    key_event_t keys[BLE_LINK_MAX_EVENTS];
+} sim_event_t;
+
+static sim_event_t *heap = NULL;
+static size_t heap_count = 0, heap_capacity = 0;
+static uint64_t next_seq = 0;
+
+static bool event_before(const sim_event_t *a, const sim_event_t *b) {
+    return a->time_us != b->time_us ? a->time_us < b->time_us : a->seq < b->seq;
+}
+
+static void schedule(sim_event_t event) {
+    if (heap_count == heap_capacity) {
+        heap_capacity = heap_capacity ? heap_capacity * 2 : 1024;
+        heap = realloc(heap, heap_capacity * sizeof(sim_event_t));
+        if (!heap) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+    event.seq = next_seq++;
+    size_t i = heap_count++;
+    while (i > 0 && event_before(&event, &heap[(i - 1) / 2])) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = event;
+}
+
+static sim_event_t pop_event(void) {
+    sim_event_t top = heap[0];
+    sim_event_t last = heap[--heap_count];
+    size_t i = 0;
+    while (true) {
+        size_t child = 2 * i + 1;
+        if (child >= heap_count) break;
+        if (child + 1 < heap_count && event_before(&heap[child + 1], &heap[child])) child++;
+        if (!event_before(&heap[child], &last)) break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = last;
+    return top;
+}
+
+// Halves
+
+typedef struct {
+    const half_api_t *api;
+    uint8_t side;
+    sim_gpio_bank_t gpio;
+    ble_radio_t radio;
+    ble_link_t link;        // To the dongle, or to the left half when relaying
+    uint64_t periodic_us;   // Next regular scan
+    uint64_t found_us[ROWS][COLS];  // Scan that found the key's last transition
+    uint32_t scans;
+} sim_half_t;
+
+static sim_half_t halves[2];
+static sim_half_t *current = NULL;     // Half whose firmware code is running
+static ble_radio_t dongle_radio;
+static bool relay = false;
+
+static void enter_half(sim_half_t *half) {
+    current = half;
+    sim_gpio = &half->gpio;
+}
+
+static void on_matrix_event(uint8_t row, uint8_t col, bool pressed) {
+    key_event_t event = {
+        .type = pressed ? KEY_EVENT_PRESS : KEY_EVENT_RELEASE,
+        .row = row,
+        .col = col,
+        .side = current->side,
+    };
+    current->found_us[row][col] = sim_time_us;
+    current->api->tx_push(&event, to_ms_since_boot(get_absolute_time()));
+}
+
+static uint16_t on_notify(const key_event_t *events, uint16_t count) {
+    return ble_link_notify(&current->link, events, count);
+}
+
+static void on_request_can_send_now(void) {
+    ble_link_request_can_send_now(&current->link);
+}
+
+static void init_half(sim_half_t *half, const half_api_t *api, uint8_t side) {
+    memset(half, 0, sizeof(*half));
+    half->api = api;
+    half->side = side;
+    for (int i = 0; i < ROWS; i++) half->gpio.row_pin[i] = row_pins[i];
+    for (int i = 0; i < COLS; i++) half->gpio.col_pin[i] = col_pins[i];
+    
+    enter_half(half);
+    api->init(row_pins, col_pins);
+    api->tx_init(on_notify, on_request_can_send_now);
+    api->tx_set_ready(true, 0);  // Connected and subscribed from the start
+}
+
+// Dongle
+
+static void on_deliver(void *context, const key_event_t *events, uint8_t count, uint64_t time_us) {
+    sim_half_t *half = context;
+    for (uint8_t i = 0; i < count; i++) {
+        // Not the relayed half's events, their scan was on the other half
+        if (events[i].side != half->side) continue;
+        metrics_scan_to_air(half->side, time_us - half->found_us[events[i].row][events[i].col]);
+    }
+    
+    sim_event_t event = {.time_us = time_us, .type = EV_DELIVER, .half = half->side, .count = count};
+    memcpy(event.keys, events, count * sizeof(key_event_t));
+    schedule(event);
+}
+
+static bool verbose = false;
+
+static void on_host_report(const uint8_t *report, uint16_t len) {
+    metrics_host_report(report, len, sim_time_us, verbose);
+}
+
+// Worn switches, bouncing for longer than the others
+static bool worn[2][ROWS][COLS];
+
+// Pick keys of random trace events until `count` different ones are worn
+static void pick_worn(const trace_t *trace, uint32_t count) {
+    uint32_t picked = 0;
+    for (int tries = 0; picked < count && tries < 10000; tries++) {
+        const trace_event_t *e = &trace->events[sim_rand_range(0, (int32_t)trace->count - 1)];
+        if (worn[e->side][e->row][e->col]) continue;
+        worn[e->side][e->row][e->col] = true;
+        picked++;
+    }
+}
+
+// Trace with switch bounce: a few extra contact changes right after each
+// transition, all settling before the debounce lockout ends unless the
+// switch is worn
+static void schedule_trace(const trace_t *trace, uint32_t bounce_us, uint32_t worn_bounce_us) {
+    for (size_t i = 0; i < trace->count; i++) {
+        const trace_event_t *e = &trace->events[i];
+        sim_event_t event = {.time_us = e->time_us, .type = EV_SWITCH, .half = e->side,
+                             .row = e->row, .col = e->col, .pressed = e->pressed};
+        schedule(event);
+        
+        bool is_worn = worn[e->side][e->row][e->col];
+        uint32_t span_us = is_worn ? worn_bounce_us : bounce_us;
+        if (span_us == 0) continue;
+        int bounces = sim_rand_range(is_worn ? 1 : 0, 3);
+        uint64_t t = e->time_us;
+        for (int b = 0; b < bounces; b++) {
+            t += sim_rand_range(1, span_us / (2 * bounces) + 1);
+            event.time_us = t;
+            event.pressed = !e->pressed;
+            schedule(event);
+            t += sim_rand_range(1, span_us / (2 * bounces) + 1);
+            event.time_us = t;
+            event.pressed = e->pressed;
+            schedule(event);
+        }
+    }
+}
+
+// Debounce each key ended up with: the worn ones, and the range of the rest
+static void print_debounce(uint32_t worn_bounce_us) {
+    uint8_t low = UINT8_MAX, high = 0;
+    if (worn_bounce_us) printf("Debounce of worn keys (bounce up to %u us):", worn_bounce_us);
+    for (int side = 0; side < 2; side++) {
+        for (int row = 0; row < ROWS; row++) {
+            for (int col = 0; col < COLS; col++) {
+                uint8_t scans = halves[side].api->debounce_scans(row, col);
+                if (worn[side][row][col]) {
+                    printf(" %c%d,%d %u", side == SIDE_LEFT ? 'L' : 'R', row, col, scans);
+                    continue;
+                }
+                if (scans < low) low = scans;
+                if (scans > high) high = scans;
+            }
+        }
+    }
+    if (worn_bounce_us) printf("\n");
+    printf("Debounce of other keys: %u..%u scans\n", low, high);
+}
+
+static void print_half_stats(const sim_half_t *half) {
+    const key_tx_stats_t *tx = half->api->tx_stats();
+    const ble_link_stats_t *link = &half->link.stats;
+    bool l2cap = half->link.config.transport == BLE_TRANSPORT_L2CAP;
+    printf("%s half: scans %u, tx sent %u in %u packets, queued %u retried %u expired %u overflows %u\n",
+           half->side == SIDE_LEFT ? "Left" : "Right", half->scans,
+           tx->sent, tx->packets, tx->queued, tx->retried, tx->expired, tx->overflows);
+    printf("  link to %s: %s %u refused %u, air %u (lost %u), delivered %u (reordered %u), "
+           "events skipped %u\n",
+           relay && half->side == SIDE_RIGHT ? "left half" : "dongle", l2cap ? "SDUs" : "notified",
+           link->notified, link->refused, link->transmissions, link->lost,
+           link->delivered, link->reordered, link->skipped);
+    
+    // Protocol bytes on the air for each key event, retransmissions and
+    // credit grants included
+    uint32_t header = l2cap ? BLE_L2CAP_HEADER : BLE_GATT_HEADER;
+    uint64_t overhead = (uint64_t)link->transmissions * header + (uint64_t)link->grants * BLE_CREDIT_BYTES;
+    printf("  overhead %.2f bytes per key event", tx->sent ? (double)overhead / tx->sent : 0.0);
+    if (l2cap) printf(", credit waits %u, credit packets %u", link->credit_waits, link->grants);
+    printf("\n");
+    const conn_sync_stats_t *sync = half->api->sync_stats();
+    printf("  scan sync: %s, %u samples, %u aligned scans, last error %d us\n",
+           half->api->sync_locked() ? "locked" : "free-running",
+           sync->samples, sync->aligned_scans, sync->last_error_us);
+}
+
+// Next scan of a half: the regular one, or conn_sync's pre-event slot if
+// that comes first (core1_scan_loop in the firmware)
+static uint64_t next_scan_time(sim_half_t *half) {
+    if (half->periodic_us <= sim_time_us) half->periodic_us += SCAN_PERIOD_US;
+    uint32_t now = time_us_32();
+    uint32_t next = half->api->sync_next_scan(now, (uint32_t)half->periodic_us);
+    return sim_time_us + (int32_t)(next - now);
+}
+
+static void usage(const char *name) {
+    printf("Usage: %s [options]\n"
+           "  --trace FILE        Replay a trace (<time ms> <L|R> <row> <col> <d|u> per line)\n"
+           "  --keys N            Generate N random keystrokes (default 2000)\n"
+           "  --rate N            Generated keystrokes per second (default 10)\n"
+           "  --hold MS           Generated hold time (default 90)\n"
+           "  --interval US       Connection interval (default 7500)\n"
+           "  --jitter US         Connection event timing jitter, +- (default 0)\n"
+           "  --relay             Right half connects to the left half, which relays to the dongle\n"
+           "  --drift PPM         Relayed link's clock offset against the dongle link (default 20)\n"
+           "  --free-run          Scan on the fixed period only, not aligned to connection events\n"
+           "  --loss P            Transmission loss probability (default 0)\n"
+           "  --rx-jitter US      Dongle receive delay, 0..US (default 0)\n"
+           "  --reorder P         Probability a packet is held behind the next (default 0)\n"
+           "  --buffers N         Controller buffers per half (default 4)\n"
+           "  --per-event N       Packets per connection event (default 4)\n"
+           "  --transport T       Key events as gatt notifications or on l2cap channels (default gatt)\n"
+           "  --credits N         L2CAP credits granted at a time (default 10)\n"
+           "  --poll US           USB host polling interval (default 1000)\n"
+           "  --bounce US         Switch bounce after each transition (default 0)\n"
+           "  --worn N            N keys bounce for --worn-bounce instead (default 0)\n"
+           "  --worn-bounce US    Bounce of the worn keys (default 6000)\n"
+           "  --seed N            Random seed (default 1)\n"
+           "  --verbose           Print every key the host sees\n", name);
+}
+
+int main(int argc, char **argv) {
+    ble_link_config_t link = {
+        .interval_us = 7500,
+        .buffers = 4,
+        .per_event = 4,
+        .transport = BLE_TRANSPORT_GATT,
+        .credits = 10,              // BTstack's automatic credits
+    };
+    trace_gen_config_t gen = {.keystrokes = 2000, .rate = 10, .hold_ms = 90};
+    const char *trace_path = NULL;
+    uint32_t poll_us = 1000;
+    uint32_t bounce_us = 0;
+    uint32_t worn_keys = 0;
+    uint32_t worn_bounce_us = 6000;
+    uint32_t seed = 1;
+    double drift_ppm = 20;
+    bool free_run = false;
+    
+    static const struct option options[] = {
+        {"trace", required_argument, NULL, 't'},
+        {"keys", required_argument, NULL, 'k'},
+        {"rate", required_argument, NULL, 'r'},
+        {"hold", required_argument, NULL, 'H'},
+        {"interval", required_argument, NULL, 'i'},
+        {"jitter", required_argument, NULL, 'j'},
+        {"relay", no_argument, NULL, 'R'},
+        {"drift", required_argument, NULL, 'D'},
+        {"free-run", no_argument, NULL, 'F'},
+        {"loss", required_argument, NULL, 'l'},
+        {"rx-jitter", required_argument, NULL, 'x'},
+        {"reorder", required_argument, NULL, 'o'},
+        {"buffers", required_argument, NULL, 'b'},
+        {"per-event", required_argument, NULL, 'e'},
+        {"transport", required_argument, NULL, 'T'},
+        {"credits", required_argument, NULL, 'C'},
+        {"poll", required_argument, NULL, 'p'},
+        {"bounce", required_argument, NULL, 'B'},
+        {"worn", required_argument, NULL, 'W'},
+        {"worn-bounce", required_argument, NULL, 'w'},
+        {"seed", required_argument, NULL, 's'},
+        {"verbose", no_argument, NULL, 'v'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (opt) {
+            case 't': trace_path = optarg; break;
+            case 'k': gen.keystrokes = strtoul(optarg, NULL, 0); break;
+            case 'r': gen.rate = strtod(optarg, NULL); break;
+            case 'H': gen.hold_ms = strtoul(optarg, NULL, 0); break;
+            case 'i': link.interval_us = strtoul(optarg, NULL, 0); break;
+            case 'j': link.anchor_jitter_us = strtoul(optarg, NULL, 0); break;
+            case 'R': relay = true; break;
+            case 'D': drift_ppm = strtod(optarg, NULL); break;
+            case 'F': free_run = true; break;
+            case 'l': link.loss = strtod(optarg, NULL); break;
+            case 'x': link.rx_jitter_us = strtoul(optarg, NULL, 0); break;
+            case 'o': link.reorder = strtod(optarg, NULL); break;
+            case 'b': link.buffers = strtoul(optarg, NULL, 0); break;
+            case 'e': link.per_event = strtoul(optarg, NULL, 0); break;
+            case 'T':
+                if (strcmp(optarg, "gatt") != 0 && strcmp(optarg, "l2cap") != 0) {
+                    fprintf(stderr, "Transport must be gatt or l2cap\n");
+                    return 2;
+                }
+                link.transport = strcmp(optarg, "l2cap") == 0 ? BLE_TRANSPORT_L2CAP : BLE_TRANSPORT_GATT;
+                break;
+            case 'C': link.credits = strtoul(optarg, NULL, 0); break;
+            case 'p': poll_us = strtoul(optarg, NULL, 0); break;
+            case 'B': bounce_us = strtoul(optarg, NULL, 0); break;
+            case 'W': worn_keys = strtoul(optarg, NULL, 0); break;
+            case 'w': worn_bounce_us = strtoul(optarg, NULL, 0); break;
+            case 's': seed = strtoul(optarg, NULL, 0); break;
+            case 'v': verbose = true; break;
+            default: usage(argv[0]); return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (link.interval_us == 0 || poll_us == 0) {
+        fprintf(stderr, "Interval and poll period must be non-zero\n");
+        return 2;
+    }
+    
+    sim_seed(seed);
+    
+    trace_t trace = {0};
+    if (trace_path) {
+        if (!trace_load(&trace, trace_path)) return 2;
+    } else {
+        trace_generate(&trace, &gen, metrics_key_trackable);
+    }
+    if (trace.count == 0) {
+        fprintf(stderr, "Empty trace\n");
+        return 2;
+    }
+    metrics_init(&trace);
+    
+    init_half(&halves[SIDE_LEFT], &left_half_api, SIDE_LEFT);
+    init_half(&halves[SIDE_RIGHT], &right_half_api, SIDE_RIGHT);
+    keyboard_init();
+    
+    // The central spaces its links half an interval apart: the dongle both
+    // links in the dual-link topology, the left half its link to the right
+    // half in the relay topology. That link runs off the left half's clock
+    // and so drifts against the dongle's.
+    uint64_t first_event = sim_rand_range(0, link.interval_us);
+    ble_link_init(&halves[SIDE_LEFT].link, &link, first_event,
+                  &halves[SIDE_LEFT].radio, &dongle_radio);
+    ble_link_config_t right_link = link;
+    if (relay) right_link.drift_ppm = drift_ppm;
+    ble_link_init(&halves[SIDE_RIGHT].link, &right_link, first_event + link.interval_us / 2,
+                  &halves[SIDE_RIGHT].radio, relay ? &halves[SIDE_LEFT].radio : &dongle_radio);
+    for (int side = 0; side < 2; side++) {
+        // LE Connection Complete: the interval the halves learn the phase against
+        if (!free_run) halves[side].api->sync_set_interval(halves[side].link.config.interval_us);
+    }
+    
+    // Run until everything has settled after the last transition
+    uint64_t end_us = trace.events[trace.count - 1].time_us + 500000;
+    
+    pick_worn(&trace, worn_keys);
+    schedule_trace(&trace, bounce_us, worn_bounce_us);
+    for (int side = 0; side < 2; side++) {
+        halves[side].periodic_us = sim_rand_range(0, SCAN_PERIOD_US);
+        schedule((sim_event_t){.time_us = halves[side].periodic_us, .type = EV_SCAN, .half = side});
+        schedule((sim_event_t){.time_us = ble_link_next_event(&halves[side].link), .type = EV_CONN_EVENT, .half = side});
+    }
+    schedule((sim_event_t){.time_us = sim_rand_range(0, 1000), .type = EV_DONGLE_TICK});
+    schedule((sim_event_t){.time_us = sim_rand_range(0, poll_us), .type = EV_USB_POLL});
+    
+    while (heap_count > 0) {
+        sim_event_t event = pop_event();
+        if (event.time_us > end_us) break;
+        sim_time_us = event.time_us;
+        sim_half_t *half = &halves[event.half];
+        
+        switch (event.type) {
+            case EV_SWITCH:
+                half->gpio.contact[event.row][event.col] = event.pressed;
+                break;
+                
+            case EV_SCAN:
+                enter_half(half);
+                half->api->scan(on_matrix_event);
+                half->scans++;
+                event.time_us = next_scan_time(half);
+                schedule(event);
+                break;
+                
+            case EV_CONN_EVENT:
+                enter_half(half);
+                if (ble_link_connection_event(&half->link, sim_time_us, on_deliver, half)) {
+                    // ATT_EVENT_CAN_SEND_NOW, or L2CAP_EVENT_CAN_SEND_NOW on a channel
+                    half->api->tx_flush(to_ms_since_boot(get_absolute_time()));
+                }
+                if (half->link.acked) {
+                    // Number Of Completed Packets at the end of the event
+                    half->api->sync_sample((uint32_t)half->link.event_end_us);
+                }
+                event.time_us = ble_link_next_event(&half->link);
+                schedule(event);
+                break;
+                
+            case EV_DELIVER:
+                if (relay && event.half == SIDE_RIGHT) {
+                    // Relaying left half: straight into its transmit queue
+                    sim_half_t *left = &halves[SIDE_LEFT];
+                    enter_half(left);
+                    left->api->tx_push_batch(event.keys, event.count, to_ms_since_boot(get_absolute_time()));
+                    break;
+                }
+                process_key_event_batch(event.keys, event.count);
+                usb_emit_reports();
+                break;
+                
+            case EV_DONGLE_TICK:
+                keyboard_task();
+                usb_emit_reports();
+                event.time_us += 1000;
+                schedule(event);
+                break;
+                
+            case EV_USB_POLL:
+                sim_usb_poll(on_host_report);
+                usb_emit_reports();
+                event.time_us += poll_us;
+                schedule(event);
+                break;
+        }
+    }
+    
+    printf("\nLink: interval %.2f ms, jitter %u us, loss %.3f, rx jitter %u us, reorder %.3f, "
+           "%u buffers, %u per event; USB poll %u us; bounce %u us; seed %u\n",
+           link.interval_us / 1000.0, link.anchor_jitter_us, link.loss, link.rx_jitter_us,
+           link.reorder, link.buffers, link.per_event, poll_us, bounce_us, seed);
+    if (relay) {
+        printf("Relay topology: right half -> left half (drift %.0f ppm) -> dongle\n", drift_ppm);
+    } else {
+        printf("Dual-link topology: each half -> dongle\n");
+    }
+    if (link.transport == BLE_TRANSPORT_L2CAP) {
+        printf("Key events on L2CAP channels, %u credits at a time\n", link.credits);
+    } else {
+        printf("Key events as GATT notifications\n");
+    }
+    printf("Scans: %s\n", free_run ? "free-running" : "aligned to connection events");
+    print_half_stats(&halves[SIDE_LEFT]);
+    print_half_stats(&halves[SIDE_RIGHT]);
+    print_debounce(worn_keys ? worn_bounce_us : 0);
+    uint32_t errors = metrics_print(stdout);
+    
+    trace_free(&trace);
+    free(heap);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,21 @@
+/**
+ * Simulator stand-in for the Pico SDK GPIO API
+ * Reads and writes go to the virtual GPIO bank of the half being run
+ */
+
+#ifndef SIM_HARDWARE_GPIO_H
+#define SIM_HARDWARE_GPIO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define GPIO_IN false
+#define GPIO_OUT true
+
+void gpio_init(unsigned int gpio);
+void gpio_set_dir(unsigned int gpio, bool out);
+void gpio_put(unsigned int gpio, bool value);
+void gpio_pull_up(unsigned int gpio);
+uint32_t gpio_get_all(void);
+
+#endif // SIM_HARDWARE_GPIO_H
@@ -0,0 +1,12 @@
+/**
+ * Simulator stand-in for the Pico SDK sync primitives
+ * Everything runs on one thread, so cross-core wakeups are no-ops
+ */
+
+#ifndef SIM_HARDWARE_SYNC_H
+#define SIM_HARDWARE_SYNC_H
+
+static inline void __sev(void) {}
+static inline void __wfe(void) {}
+
+#endif // SIM_HARDWARE_SYNC_H
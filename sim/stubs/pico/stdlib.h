@@ -0,0 +1,45 @@
+/**
+ * Simulator stand-in for the Pico SDK
+ * Time comes from the simulator's virtual clock
+ */
+
+#ifndef SIM_PICO_STDLIB_H
+#define SIM_PICO_STDLIB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+typedef unsigned int uint;
+typedef uint64_t absolute_time_t;
+
+// Virtual time in microseconds, advanced by the event loop
+extern uint64_t sim_time_us;
+
+static inline absolute_time_t get_absolute_time(void) {
+    return sim_time_us;
+}
+
+static inline uint32_t to_ms_since_boot(absolute_time_t t) {
+    return (uint32_t)(t / 1000);
+}
+
+static inline uint32_t time_us_32(void) {
+    return (uint32_t)sim_time_us;
+}
+
+static inline uint64_t time_us_64(void) {
+    return sim_time_us;
+}
+
+// Settling delays take no virtual time; code that needs time passes
+// schedules an event instead
+static inline void busy_wait_us_32(uint32_t us) {
+    (void)us;
+}
+
+// Nothing survives a reset here, see sim_hw.c
+#define __uninitialized_ram(name) name
+
+#endif // SIM_PICO_STDLIB_H
@@ -0,0 +1,73 @@
+/**
+ * Simulator stand-in for TinyUSB
+ * Only the device-side HID calls the dongle code makes. Reports go to a
+ * single emulated IN endpoint that the simulated host polls (sim_usb.c).
+ */
+
+#ifndef SIM_TUSB_H
+#define SIM_TUSB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum {
+    HID_REPORT_TYPE_INVALID = 0,
+    HID_REPORT_TYPE_INPUT,
+    HID_REPORT_TYPE_OUTPUT,
+    HID_REPORT_TYPE_FEATURE
+} hid_report_type_t;
+
+#define KEYBOARD_MODIFIER_LEFTCTRL 0x01
+#define KEYBOARD_MODIFIER_LEFTSHIFT 0x02
+
+// Consumer page usages of the media keys
+#define HID_USAGE_CONSUMER_PLAY_PAUSE 0xCD
+#define HID_USAGE_CONSUMER_MUTE 0xE2
+#define HID_USAGE_CONSUMER_VOLUME_INCREMENT 0xE9
+#define HID_USAGE_CONSUMER_VOLUME_DECREMENT 0xEA
+
+// US layout {shift, keycode} per ASCII character, as in TinyUSB's hid.h
+#define HID_ASCII_TO_KEYCODE \
+    {0, 0x00}, {0, 0x00}, {0, 0x00}, {0, 0x00}, \
+    {0, 0x00}, {0, 0x00}, {0, 0x00}, {0, 0x00}, \
+    {0, 0x2a}, {0, 0x2b}, {0, 0x28}, {0, 0x00}, \
+    {0, 0x00}, {0, 0x28}, {0, 0x00}, {0, 0x00}, \
+    {0, 0x00}, {0, 0x00}, {0, 0x00}, {0, 0x00}, \
+    {0, 0x00}, {0, 0x00}, {0, 0x00}, {0, 0x00}, \
+    {0, 0x00}, {0, 0x00}, {0, 0x00}, {0, 0x29}, \
+    {0, 0x00}, {0, 0x00}, {0, 0x00}, {0, 0x00}, \
+    {0, 0x2c}, {1, 0x1e}, {1, 0x34}, {1, 0x20}, \
+    {1, 0x21}, {1, 0x22}, {1, 0x24}, {0, 0x34}, \
+    {1, 0x26}, {1, 0x27}, {1, 0x25}, {1, 0x2e}, \
+    {0, 0x36}, {0, 0x2d}, {0, 0x37}, {0, 0x38}, \
+    {0, 0x27}, {0, 0x1e}, {0, 0x1f}, {0, 0x20}, \
+    {0, 0x21}, {0, 0x22}, {0, 0x23}, {0, 0x24}, \
+    {0, 0x25}, {0, 0x26}, {1, 0x33}, {0, 0x33}, \
+    {1, 0x36}, {0, 0x2e}, {1, 0x37}, {1, 0x38}, \
+    {1, 0x1f}, {1, 0x04}, {1, 0x05}, {1, 0x06}, \
+    {1, 0x07}, {1, 0x08}, {1, 0x09}, {1, 0x0a}, \
+    {1, 0x0b}, {1, 0x0c}, {1, 0x0d}, {1, 0x0e}, \
+    {1, 0x0f}, {1, 0x10}, {1, 0x11}, {1, 0x12}, \
+    {1, 0x13}, {1, 0x14}, {1, 0x15}, {1, 0x16}, \
+    {1, 0x17}, {1, 0x18}, {1, 0x19}, {1, 0x1a}, \
+    {1, 0x1b}, {1, 0x1c}, {1, 0x1d}, {0, 0x2f}, \
+    {0, 0x31}, {0, 0x30}, {1, 0x23}, {1, 0x2d}, \
+    {0, 0x35}, {0, 0x04}, {0, 0x05}, {0, 0x06}, \
+    {0, 0x07}, {0, 0x08}, {0, 0x09}, {0, 0x0a}, \
+    {0, 0x0b}, {0, 0x0c}, {0, 0x0d}, {0, 0x0e}, \
+    {0, 0x0f}, {0, 0x10}, {0, 0x11}, {0, 0x12}, \
+    {0, 0x13}, {0, 0x14}, {0, 0x15}, {0, 0x16}, \
+    {0, 0x17}, {0, 0x18}, {0, 0x19}, {0, 0x1a}, \
+    {0, 0x1b}, {0, 0x1c}, {0, 0x1d}, {1, 0x2f}, \
+    {1, 0x31}, {1, 0x30}, {1, 0x35}, {0, 0x4c},
+
+bool tud_hid_ready(void);
+bool tud_remote_wakeup(void);
+bool tud_hid_n_report(uint8_t instance, uint8_t report_id, void const *report, uint16_t len);
+bool tud_hid_keyboard_report(uint8_t report_id, uint8_t modifier, const uint8_t keycode[6]);
+bool tud_hid_mouse_report(uint8_t report_id, uint8_t buttons, int8_t x, int8_t y, int8_t vertical, int8_t horizontal);
+
+// Implemented by the dongle code
+void tud_hid_report_complete_cb(uint8_t instance, uint8_t const *report, uint16_t len);
+
+#endif // SIM_TUSB_H
@@ -0,0 +1,106 @@
+/**
+ * Typing Traces
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+#include "key_event.h"
+#include "trace.h"
+
+static void trace_add(trace_t *trace, uint64_t time_us, uint8_t side, uint8_t row, uint8_t col, bool pressed) {
+    if (trace->count == trace->capacity) {
+        trace->capacity = trace->capacity ? trace->capacity * 2 : 256;
+        trace->events = realloc(trace->events, trace->capacity * sizeof(trace_event_t));
+        if (!trace->events) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+    trace->events[trace->count] = (trace_event_t){time_us, side, row, col, pressed, (uint32_t)trace->count};
+    trace->count++;
+}
+
+static int compare_events(const void *a, const void *b) {
+    const trace_event_t *x = a, *y = b;
+    if (x->time_us != y->time_us) return x->time_us < y->time_us ? -1 : 1;
+    return x->order < y->order ? -1 : (x->order > y->order);
+}
+
+static void trace_sort(trace_t *trace) {
+    qsort(trace->events, trace->count, sizeof(trace_event_t), compare_events);
+}
+
+bool trace_load(trace_t *trace, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    
+    char line[256];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), f)) {
+        line_number++;
+        char *p = line;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == '#' || *p == '\n' || *p == '\0') continue;
+        
+        double time_ms;
+        char side, action;
+        unsigned row, col;
+        if (sscanf(p, "%lf %c %u %u %c", &time_ms, &side, &row, &col, &action) != 5 ||
+            (side != 'L' && side != 'R') || (action != 'd' && action != 'u') ||
+            row >= ROWS || col >= COLS || time_ms < 0) {
+            fprintf(stderr, "%s:%d: expected <time ms> <L|R> <row> <col> <d|u>\n", path, line_number);
+            fclose(f);
+            return false;
+        }
+        trace_add(trace, (uint64_t)(time_ms * 1000), side == 'L' ? SIDE_LEFT : SIDE_RIGHT,
+                  row, col, action == 'd');
+    }
+    fclose(f);
+    trace_sort(trace);
+    return true;
+}
+
+void trace_generate(trace_t *trace, const trace_gen_config_t *config, trace_key_filter_t filter) {
+    typedef struct { uint8_t side, row, col; uint64_t released_us; } candidate_t;
+    candidate_t keys[2 * ROWS * COLS];
+    int key_count = 0;
+    
+    for (uint8_t side = 0; side < 2; side++) {
+        for (uint8_t row = 0; row < ROWS; row++) {
+            for (uint8_t col = 0; col < COLS; col++) {
+                if (filter(side, row, col)) keys[key_count++] = (candidate_t){side, row, col, 0};
+            }
+        }
+    }
+    if (key_count == 0) return;
+    
+    uint32_t gap_us = (uint32_t)(1000000 / (config->rate > 0 ? config->rate : 1));
+    uint64_t t = 10000;  // Let the links settle first
+    for (uint32_t i = 0; i < config->keystrokes; i++) {
+        t += sim_rand_range(gap_us / 2, gap_us * 3 / 2);
+        
+        // Pick a key that isn't still held from an earlier press
+        candidate_t *key = NULL;
+        for (int tries = 0; tries < 16 && !key; tries++) {
+            candidate_t *k = &keys[sim_rand() % key_count];
+            if (k->released_us + 1000 < t) key = k;
+        }
+        if (!key) continue;
+        
+        uint32_t hold_us = sim_rand_range(config->hold_ms * 500, config->hold_ms * 1500);
+        trace_add(trace, t, key->side, key->row, key->col, true);
+        trace_add(trace, t + hold_us, key->side, key->row, key->col, false);
+        key->released_us = t + hold_us;
+    }
+    trace_sort(trace);
+}
+
+void trace_free(trace_t *trace) {
+    free(trace->events);
+    memset(trace, 0, sizeof(*trace));
+}
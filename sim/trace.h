@@ -0,0 +1,47 @@
+/**
+ * Typing Traces
+ * Physical key transitions to replay, loaded from a file or generated
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct {
+    uint64_t time_us;
+    uint8_t side;
+    uint8_t row;
+    uint8_t col;
+    bool pressed;
+    uint32_t order;     // Position in the file / generation order, breaks ties
+} trace_event_t;
+
+typedef struct {
+    trace_event_t *events;
+    size_t count;
+    size_t capacity;
+} trace_t;
+
+typedef struct {
+    uint32_t keystrokes;        // Key presses to generate
+    double rate;                // Average presses per second
+    uint32_t hold_ms;           // Average hold time
+} trace_gen_config_t;
+
+// Decides whether a key can be used in generated traces
+typedef bool (*trace_key_filter_t)(uint8_t side, uint8_t row, uint8_t col);
+
+// Text file, one transition per line: <time ms> <L|R> <row> <col> <d|u>
+// Blank lines and lines starting with # are ignored.
+bool trace_load(trace_t *trace, const char *path);
+
+// Random typing over the keys the filter accepts. Rollover happens naturally
+// when a key is held longer than the gap to the next press.
+void trace_generate(trace_t *trace, const trace_gen_config_t *config, trace_key_filter_t filter);
+
+void trace_free(trace_t *trace);
+
+#endif // TRACE_H
@@ -0,0 +1,58 @@
+/**
+ * Lock-free single-producer/single-consumer queue
+ */
+
+#include <string.h>
+#include "spsc_queue.h"
+
+void spsc_queue_init(spsc_queue_t *q, void *buffer, uint16_t elem_size, uint16_t capacity) {
+    q->buffer = (uint8_t *)buffer;
+    q->elem_size = elem_size;
+    q->capacity = capacity;
+    q->head = 0;
+    q->tail = 0;
+    q->pushed = 0;
+    q->overflows = 0;
+    q->high_water = 0;
+}
+
+bool spsc_queue_push(spsc_queue_t *q, const void *elem) {
+    uint32_t head = q->head;
+    uint32_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+    uint32_t used = head - tail;
+    
+    if (used >= q->capacity) {
+        q->overflows++;
+        return false;
+    }
+    
+    memcpy(&q->buffer[(head & (q->capacity - 1)) * q->elem_size], elem, q->elem_size);
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+    
+    q->pushed++;
+    if (used + 1 > q->high_water) q->high_water = used + 1;
+    return true;
+}
+
+bool spsc_queue_peek(spsc_queue_t *q, void *elem) {
+    uint32_t tail = q->tail;
+    uint32_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+    
+    if (head == tail) return false;
+    
+    memcpy(elem, &q->buffer[(tail & (q->capacity - 1)) * q->elem_size], q->elem_size);
+    return true;
+}
+
+bool spsc_queue_pop(spsc_queue_t *q, void *elem) {
+    if (!spsc_queue_peek(q, elem)) return false;
+    
+    __atomic_store_n(&q->tail, q->tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+uint16_t spsc_queue_count(const spsc_queue_t *q) {
+    uint32_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+    uint32_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+    return (uint16_t)(head - tail);
+}
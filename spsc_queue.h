@@ -0,0 +1,41 @@
+/**
+ * Lock-free single-producer/single-consumer queue
+ * Used to pass fixed-size messages between the two RP2040 cores
+ */
+
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// One core pushes, the other pops. Head is only written by the producer and
+// tail only by the consumer, so no locks are needed; the acquire/release
+// ordering on the indices publishes the element data between cores.
+typedef struct {
+    uint8_t *buffer;
+    uint16_t elem_size;
+    uint16_t capacity;            // Power of two
+    volatile uint32_t head;       // Next slot to write (producer)
+    volatile uint32_t tail;       // Next slot to read (consumer)
+    volatile uint32_t pushed;     // Total messages accepted
+    volatile uint32_t overflows;  // Messages dropped because the queue was full
+    volatile uint16_t high_water; // Deepest fill level seen
+} spsc_queue_t;
+
+// buffer must hold capacity * elem_size bytes, capacity a power of two
+void spsc_queue_init(spsc_queue_t *q, void *buffer, uint16_t elem_size, uint16_t capacity);
+
+// Producer side. Returns false (and counts an overflow) if full.
+bool spsc_queue_push(spsc_queue_t *q, const void *elem);
+
+// Consumer side. Returns false if empty.
+bool spsc_queue_pop(spsc_queue_t *q, void *elem);
+
+// Consumer side. Copies the oldest element without removing it.
+bool spsc_queue_peek(spsc_queue_t *q, void *elem);
+
+// Number of queued elements (approximate when called from the other core)
+uint16_t spsc_queue_count(const spsc_queue_t *q);
+
+#endif // SPSC_QUEUE_H
@@ -0,0 +1,159 @@
+/**
+ * Text Injection
+ * Report sequencing for typed text and macros, runs on the USB side
+ *
+ * Each character is one report with its modifier packed in, so typing "ab"
+ * sends {a} then {b}: the host sees a released and b pressed in one step.
+ * A release report is only inserted when the next character uses the same
+ * key as the last one ("ll", "aA"), which the host would otherwise miss.
+ * With the endpoint polled every 1 ms that is up to 1000 reports/s, limited
+ * in practice by how often the host polls.
+ */
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+
+// Include TinyUSB first to avoid conflicts
+#include "tusb.h"
+#include "usb_descriptors.h"
+
+#include "text_inject.h"
+
+#define MOD_FLAG 0x80   // High bit of a macro key / layout entry: add a modifier
+
+// US layout: {shift, keycode} for each ASCII character
+static const uint8_t ascii_to_keycode[128][2] = { HID_ASCII_TO_KEYCODE };
+
+// Request, written by the key processing side before setting active
+static const uint8_t *text_data;
+static uint16_t text_len;
+static bool text_ascii;
+static volatile bool active = false;   // Set by start, cleared by the USB side when done
+
+// USB side state
+static uint16_t position;
+static uint8_t last_keycode;    // Key held in the last report sent, 0 if none
+static bool started;            // Working on the current request
+static bool in_flight;          // A text report was sent and hasn't completed
+static bool have_staged;        // Next report computed but not accepted by TinyUSB yet
+static uint8_t staged_modifier;
+static uint8_t staged_keycode;
+static uint32_t start_us;
+static text_inject_stats_t stats;
+
+bool text_inject_start(const uint8_t *data, uint16_t len, bool ascii) {
+    if (text_inject_active()) return false;
+    
+    text_data = data;
+    text_len = len;
+    text_ascii = ascii;
+    __atomic_store_n(&active, true, __ATOMIC_RELEASE);
+    __sev();  // Wake the USB core
+    return true;
+}
+
+bool text_inject_active(void) {
+    return __atomic_load_n(&active, __ATOMIC_ACQUIRE);
+}
+
+const text_inject_stats_t *text_inject_get_stats(void) {
+    return &stats;
+}
+
+// Next report to send: false when the text is done and all keys released
+static bool next_report(uint8_t *modifier, uint8_t *keycode) {
+    while (position < text_len) {
+        uint8_t c = text_data[position];
+        uint8_t key, mod;
+        if (text_ascii) {
+            if (c >= 128) c = 0;
+            key = ascii_to_keycode[c][1];
+            mod = ascii_to_keycode[c][0] ? KEYBOARD_MODIFIER_LEFTSHIFT : 0;
+        } else {
+            key = c & ~MOD_FLAG;
+            mod = (c & MOD_FLAG) ? KEYBOARD_MODIFIER_LEFTCTRL : 0;
+        }
+        
+        if (key == 0) {
+            position++;  // No mapping, skip
+            continue;
+        }
+        
+        if (key == last_keycode) {
+            // Same key again: release it first or the host sees no new press
+            *modifier = 0;
+            *keycode = 0;
+            last_keycode = 0;
+            return true;
+        }
+        
+        *modifier = mod;
+        *keycode = key;
+        last_keycode = key;
+        position++;
+        stats.chars++;
+        return true;
+    }
+    
+    if (last_keycode) {
+        // Release the last key
+        *modifier = 0;
+        *keycode = 0;
+        last_keycode = 0;
+        return true;
+    }
+    return false;
+}
+
+static void send_next_report(void) {
+    if (!have_staged) {
+        if (!next_report(&staged_modifier, &staged_keycode)) {
+            stats.us = time_us_32() - start_us;
+            started = false;
+            __atomic_store_n(&active, false, __ATOMIC_RELEASE);
+            __sev();  // Let the key processing side restore its report
+            return;
+        }
+        have_staged = true;
+    }
+    
+    uint8_t keys[6] = {staged_keycode, 0, 0, 0, 0, 0};
+    if (tud_hid_keyboard_report(REPORT_ID_KEYBOARD, staged_modifier, keys)) {
+        in_flight = true;
+        have_staged = false;
+        stats.reports++;
+    }
+    // Otherwise the endpoint is busy or the bus suspended, text_inject_task() retries
+}
+
+void text_inject_task(void) {
+    if (!text_inject_active() || in_flight) return;
+    
+    if (!started) {
+        started = true;
+        position = 0;
+        last_keycode = 0;
+        stats = (text_inject_stats_t){0};
+        start_us = time_us_32();
+    }
+    
+    if (tud_hid_ready()) send_next_report();
+}
+
+void text_inject_report_complete(void) {
+    if (!in_flight) return;
+    in_flight = false;
+    send_next_report();
+}
+
+// The host dropped any report in flight, so the text can't finish. Stop
+// here rather than wait forever for a completion that won't come.
+void text_inject_reset(void) {
+    in_flight = false;
+    have_staged = false;
+    if (started) stats.us = time_us_32() - start_us;
+    started = false;
+    __atomic_store_n(&active, false, __ATOMIC_RELEASE);
+    __sev();  // Let the key processing side restore its report
+}
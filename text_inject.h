@@ -0,0 +1,42 @@
+/**
+ * Text Injection
+ * Types strings and macros as fast as the host polls, one report per
+ * completed report instead of on a timer.
+ */
+
+#ifndef TEXT_INJECT_H
+#define TEXT_INJECT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+    uint32_t chars;     // Characters typed (unmapped ones are skipped)
+    uint32_t reports;   // Reports sent, including releases between repeats
+    uint32_t us;        // First report sent to last report completed
+} text_inject_stats_t;
+
+// Key processing side: start typing len bytes of data. With ascii set the
+// bytes are characters, mapped through the US layout table. Otherwise they
+// are macro keys: an HID keycode, high bit for Ctrl. data must stay valid
+// until text_inject_active() returns false. Returns false if already typing.
+bool text_inject_start(const uint8_t *data, uint16_t len, bool ascii);
+
+bool text_inject_active(void);
+
+// Stats of the last finished injection
+const text_inject_stats_t *text_inject_get_stats(void);
+
+// USB side, on the core that owns TinyUSB.
+// Sends the first report once the endpoint is free; later ones are sent from
+// text_inject_report_complete(). While typing, nothing else should be sent
+// on the keyboard/mouse interface.
+void text_inject_task(void);
+
+// Call from tud_hid_report_complete_cb() for the keyboard/mouse interface
+void text_inject_report_complete(void);
+
+// Call when the device is reset or unplugged: abandons the text being typed
+void text_inject_reset(void);
+
+#endif // TEXT_INJECT_H
@@ -0,0 +1,291 @@
+#!/usr/bin/env python3
+"""
+Read and update the keymap/macros, read the per-key counters and the link
+telemetry of the halves, find out why the keyboard last reset, and install
+new firmware on a half, over the raw HID interface (see raw_hid.h).
+
+Needs the hidapi bindings: pip install hidapi
+
+  keymap_tool.py info
+  keymap_tool.py dump image.bin
+  keymap_tool.py load image.bin
+  keymap_tool.py set LAYER SIDE ROW COL KEYCODE
+  keymap_tool.py stats SIDE
+  keymap_tool.py link [SIDE]
+  keymap_tool.py crash
+  keymap_tool.py dfu SIDE half_firmware.uf2|.bin
+"""
+
+import struct
+import sys
+import time
+import zlib
+
+import hid
+
+VID, PID = 0xCAFE, 0x4010
+USAGE_PAGE, USAGE = 0xFF60, 0x61
+REPORT_SIZE = 32
+MAX_DATA = REPORT_SIZE - 4
+
+CMD_GET_INFO, CMD_READ = 0x01, 0x02
+CMD_BEGIN, CMD_WRITE, CMD_COMMIT, CMD_STATUS = 0x10, 0x11, 0x12, 0x13
+CMD_STATS_FETCH, CMD_STATS_READ, CMD_LINK_STATS, CMD_CRASH_INFO = 0x20, 0x21, 0x22, 0x23
+CMD_DFU_BEGIN, CMD_DFU_WRITE, CMD_DFU_SEND, CMD_DFU_STATUS = 0x30, 0x31, 0x32, 0x33
+MAX_DFU_DATA = REPORT_SIZE - 2
+
+STATUS_NAMES = ["ok", "unknown command", "out of range", "busy",
+                "no update started", "checksum mismatch", "invalid keymap",
+                "stats unavailable"]
+STATUS_BUSY = 3
+STATUS_UNAVAILABLE = 7
+
+PHY_NAMES = ["2M", "1M", "Coded"]
+PHASE_NAMES = ["boot", "idle", "keys", "Bluetooth", "USB", "flash", "log"]
+
+DFU_RECEIVING, DFU_VERIFIED = 1, 2
+SEND_DONE, SEND_FAILED = 3, 4
+UPDATE_PHASES = ["", "opening channel", "sending", "swapping", "done", "failed"]
+UF2_MAGIC = (0x0A324655, 0x9E5D5157)
+FLASH_BASE = 0x10000000
+
+
+def open_device():
+    for info in hid.enumerate(VID, PID):
+        if info["usage_page"] == USAGE_PAGE and info["usage"] == USAGE:
+            dev = hid.device()
+            dev.open_path(info["path"])
+            return dev
+    sys.exit("Raw HID interface not found")
+
+
+def command_raw(dev, cmd, payload=b""):
+    # Leading 0 is the (absent) report ID
+    dev.write(b"\x00" + (bytes([cmd]) + payload).ljust(REPORT_SIZE, b"\x00"))
+    reply = bytes(dev.read(REPORT_SIZE, 1000))
+    if len(reply) < 2 or reply[0] != cmd:
+        sys.exit("No reply to command 0x%02x" % cmd)
+    return reply
+
+
+def command(dev, cmd, payload=b"", retry_busy=False):
+    while True:
+        reply = command_raw(dev, cmd, payload)
+        if not (retry_busy and reply[1] == STATUS_BUSY):
+            break
+        time.sleep(0.01)
+    if reply[1] != 0:
+        name = STATUS_NAMES[reply[1]] if reply[1] < len(STATUS_NAMES) else reply[1]
+        sys.exit("Command 0x%02x failed: %s" % (cmd, name))
+    return reply[2:]
+
+
+def get_info(dev):
+    r = command(dev, CMD_GET_INFO)
+    keys = ("version", "layers", "sides", "rows", "cols", "max_macros", "max_macro_length")
+    info = dict(zip(keys, r[:7]))
+    info["keymap_size"], info["size"] = struct.unpack_from("<HH", r, 7)
+    return info
+
+
+def read_image(dev, size):
+    image = b""
+    while len(image) < size:
+        n = min(MAX_DATA, size - len(image))
+        image += command(dev, CMD_READ, struct.pack("<HB", len(image), n))[:n]
+    return image
+
+
+def write_image(dev, image, old=None):
+    command(dev, CMD_BEGIN)
+    for offset in range(0, len(image), MAX_DATA):
+        chunk = image[offset:offset + MAX_DATA]
+        if old is not None and old[offset:offset + MAX_DATA] == chunk:
+            continue  # BEGIN copied the live image, only send what changed
+        command(dev, CMD_WRITE, struct.pack("<HB", offset, len(chunk)) + chunk)
+    command(dev, CMD_COMMIT, struct.pack("<I", zlib.crc32(image)))
+    while command(dev, CMD_STATUS)[0]:
+        pass  # Swapped in between key events, usually within a millisecond
+
+
+def read_stats(dev, side):
+    command(dev, CMD_STATS_FETCH, bytes([side]))
+    # Busy until the dongle has the counters from the half
+    version, rows, cols = command(dev, CMD_STATS_READ, struct.pack("<HB", 0, 4), retry_busy=True)[:3]
+    if version not in (1, 2):
+        sys.exit("Unknown key stats version %d" % version)
+    keys = rows * cols
+    size = 4 + keys * (6 if version == 1 else 7)
+    data = b""
+    while len(data) < size:
+        n = min(MAX_DATA, size - len(data))
+        data += command(dev, CMD_STATS_READ, struct.pack("<HB", len(data), n))[:n]
+    presses = struct.unpack_from("<%dI" % keys, data, 4)
+    chatter = struct.unpack_from("<%dH" % keys, data, 4 + keys * 4)
+    debounce = data[4 + keys * 6:] if version >= 2 else b""
+    return rows, cols, presses, chatter, debounce
+
+
+def print_stats(rows, cols, presses, chatter, debounce):
+    print("Presses:")
+    for row in range(rows):
+        print(" ".join("%7d" % presses[row * cols + col] for col in range(cols)))
+    print("Chatter:")
+    for row in range(rows):
+        print(" ".join("%7d" % chatter[row * cols + col] for col in range(cols)))
+    if any(debounce):
+        print("Debounce (ms):")
+        for row in range(rows):
+            print(" ".join("%7d" % debounce[row * cols + col] for col in range(cols)))
+    # A key that chatters on more than 1% of its presses is worth a look
+    for i, count in enumerate(chatter):
+        if count and count * 100 > presses[i]:
+            print("Key %d,%d chatters: %d of %d presses" % (i // cols, i % cols, count, presses[i]))
+
+
+def print_link(dev, side):
+    # Asked for directly: a half that isn't connected is no error here
+    reply = bytes(command_raw(dev, CMD_LINK_STATS, bytes([side])))
+    name = "Left" if side == 0 else "Right"
+    if reply[1] == STATUS_UNAVAILABLE:
+        print("%s: not connected" % name)
+        return
+    if reply[1] != 0:
+        sys.exit("Command 0x%02x failed: %s" % (CMD_LINK_STATS, STATUS_NAMES[reply[1]]))
+    (phy, lossy, rssi, rssi_min, interval, latency, timeout, packets, retransmissions,
+     drops, changes) = struct.unpack_from("<BBbbHHHIIHH", reply, 3)
+    rssi_text = "RSSI %d dBm (min %d)" % (rssi, rssi_min) if rssi != 127 else "RSSI not read yet"
+    print("%s: %s%s, %s" % (name, PHY_NAMES[phy] if phy < len(PHY_NAMES) else phy,
+                             ", long timeout" if lossy else "", rssi_text))
+    print("  interval %.2f ms, latency %d, timeout %d ms" % (interval * 1.25, latency, timeout * 10))
+    rate = " (%.1f%%)" % (100.0 * retransmissions / packets) if packets else ""
+    print("  %d packets, %d retransmissions%s, %d drops, %d policy changes" %
+          (packets, retransmissions, rate, drops, changes))
+
+
+def print_crash(dev):
+    r = command(dev, CMD_CRASH_INFO)
+    reason, core, phase0, phase1, pc, uptime, resets = struct.unpack_from("<BBBBIIH", r, 1)
+    if reason == 0:
+        print("No watchdog reset since power-on")
+        return
+    phase = lambda p: PHASE_NAMES[p] if p < len(PHASE_NAMES) else str(p)
+    what = "Hard fault on core %d at 0x%08x" % (core, pc) if reason == 2 else "Hang on core %d" % core
+    print("%s after %.1f s (core 0 %s, core 1 %s)" % (what, uptime / 1000.0, phase(phase0), phase(phase1)))
+    print("%d watchdog resets since power-on" % resets)
+
+
+def load_firmware(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    if not path.endswith(".uf2"):
+        return data
+    # UF2: 512-byte blocks, each with up to 476 bytes for a flash address
+    image = bytearray()
+    for block in range(0, len(data), 512):
+        magic0, magic1, _, address, size = struct.unpack_from("<IIIII", data, block)
+        if (magic0, magic1) != UF2_MAGIC or address < FLASH_BASE:
+            sys.exit("Not a UF2 file of a flash image")
+        offset = address - FLASH_BASE
+        image.extend(b"\xff" * (offset + size - len(image)))
+        image[offset:offset + size] = data[block + 32:block + 32 + size]
+    return bytes(image)
+
+
+def dfu_status(dev):
+    r = command(dev, CMD_DFU_STATUS)
+    state, size, written, send, length = struct.unpack_from("<BIIBB", r)
+    progress = struct.unpack_from("<BBIII", r, 11) if length >= 14 else None
+    return state, size, written, send, progress
+
+
+def stage_firmware(dev, image):
+    start = time.time()
+    # Busy while a previous send runs, or once after an unfinished upload
+    command(dev, CMD_DFU_BEGIN, struct.pack("<II", len(image), zlib.crc32(image)), retry_busy=True)
+    for offset in range(0, len(image), MAX_DFU_DATA):
+        chunk = image[offset:offset + MAX_DFU_DATA]
+        command(dev, CMD_DFU_WRITE, bytes([len(chunk)]) + chunk, retry_busy=True)
+        if offset % 8192 < MAX_DFU_DATA:
+            print("\rStaging: %d%%" % (100 * offset // len(image)), end="", flush=True)
+    while True:
+        state = dfu_status(dev)[0]
+        if state != DFU_RECEIVING:
+            break
+        time.sleep(0.01)
+    if state != DFU_VERIFIED:
+        sys.exit("\nThe image didn't verify on the dongle")
+    print("\rStaged %d bytes in %.1f s" % (len(image), time.time() - start))
+
+
+def send_firmware(dev, side):
+    command(dev, CMD_DFU_SEND, bytes([side]), retry_busy=True)
+    name = "Left" if side == 0 else "Right"
+    while True:
+        _, _, _, send, progress = dfu_status(dev)
+        if progress and progress[0] == side:
+            _, phase, size, written, elapsed = progress
+            rate = written / elapsed if elapsed else 0.0
+            print("\r%s: %s, %d%% (%d of %d bytes), %.1f kB/s " %
+                  (name, UPDATE_PHASES[phase] if phase < len(UPDATE_PHASES) else phase,
+                   100 * written // size, written, size, rate), end="", flush=True)
+        if send in (SEND_DONE, SEND_FAILED):
+            break
+        time.sleep(0.2)
+    print()
+    if send == SEND_FAILED:
+        sys.exit("%s half update failed" % name)
+    print("%s half is installing the update and reconnects in a few seconds" % name)
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit(__doc__)
+    dev = open_device()
+    info = get_info(dev)
+    action = sys.argv[1]
+
+    if action == "info":
+        for key, value in info.items():
+            print("%s: %s" % (key, value))
+    elif action == "dump":
+        with open(sys.argv[2], "wb") as f:
+            f.write(read_image(dev, info["size"]))
+    elif action == "load":
+        with open(sys.argv[2], "rb") as f:
+            image = f.read()
+        if len(image) != info["size"]:
+            sys.exit("Image is %d bytes, keyboard expects %d" % (len(image), info["size"]))
+        write_image(dev, image, read_image(dev, info["size"]))
+    elif action == "set":
+        layer, side, row, col = (int(v, 0) for v in sys.argv[2:6])
+        keycode = int(sys.argv[6], 0)
+        old = read_image(dev, info["size"])
+        index = ((layer * info["sides"] + side) * info["rows"] + row) * info["cols"] + col
+        image = bytearray(old)
+        image[index] = keycode
+        write_image(dev, bytes(image), old)
+    elif action == "stats":
+        print_stats(*read_stats(dev, int(sys.argv[2], 0)))
+    elif action == "link":
+        if info["version"] < 3:
+            sys.exit("Firmware too old for link telemetry")
+        sides = [int(sys.argv[2], 0)] if len(sys.argv) > 2 else range(info["sides"])
+        for side in sides:
+            print_link(dev, side)
+    elif action == "crash":
+        if info["version"] < 4:
+            sys.exit("Firmware too old for the crash record")
+        print_crash(dev)
+    elif action == "dfu":
+        if info["version"] < 5:
+            sys.exit("Firmware too old for updates of the halves")
+        side = int(sys.argv[2], 0)
+        stage_firmware(dev, load_firmware(sys.argv[3]))
+        send_firmware(dev, side)
+    else:
+        sys.exit(__doc__)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,175 @@
+#!/usr/bin/env python3
+"""
+Expand the binary KLOG() records (see klog.h) in a UART capture back into
+text, using the firmware ELF for the format strings. Plain printf() text
+on the same UART is passed through unchanged.
+
+Needs pyserial (pip install pyserial) to read a serial port.
+
+  klog_decode.py build/left_half.elf /dev/ttyUSB0 [--baud 115200]
+  klog_decode.py build/dongle.elf capture.bin
+  klog_decode.py build/dongle.elf - < capture.bin
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+FORMAT_SECTION = ".klog_fmt"
+CONVERSION = re.compile(r"%([-+ #0]*\d*(?:\.\d+)?)(hh|h|ll|l|z|j|t)?([diouxXcsp%])")
+
+
+def read_elf(path):
+    """Loadable segments as (address, bytes) and sections by name as (address, bytes)"""
+    with open(path, "rb") as f:
+        elf = f.read()
+    if elf[:4] != b"\x7fELF" or elf[5] != 1:
+        sys.exit("%s is not a little-endian ELF file" % path)
+    if elf[4] == 1:  # 32-bit
+        phoff, shoff = struct.unpack_from("<II", elf, 28)
+        phentsize, phnum, shentsize, shnum, shstrndx = struct.unpack_from("<HHHHH", elf, 42)
+        ph_fmt, sh_fmt = "<IIIIIIII", "<IIIIIIIIII"
+    else:
+        phoff, shoff = struct.unpack_from("<QQ", elf, 32)
+        phentsize, phnum, shentsize, shnum, shstrndx = struct.unpack_from("<HHHHH", elf, 54)
+        ph_fmt, sh_fmt = "<IIQQQQQQ", "<IIQQQQIIQQ"
+
+    segments = []
+    for i in range(phnum):
+        ph = struct.unpack_from(ph_fmt, elf, phoff + i * phentsize)
+        if elf[4] == 1:
+            p_type, p_offset, p_vaddr, _, p_filesz = ph[:5]
+        else:
+            p_type, _, p_offset, p_vaddr, _, p_filesz = ph[:6]
+        if p_type == 1:  # PT_LOAD
+            segments.append((p_vaddr, elf[p_offset:p_offset + p_filesz]))
+
+    headers = [struct.unpack_from(sh_fmt, elf, shoff + i * shentsize) for i in range(shnum)]
+    names = headers[shstrndx]
+    names = elf[names[4]:names[4] + names[5]]
+    sections = {}
+    for name, _, _, addr, offset, size in (h[:6] for h in headers):
+        name = names[name:names.index(b"\0", name)].decode()
+        sections[name] = (addr, elf[offset:offset + size])
+    return segments, sections
+
+
+class Firmware:
+    def __init__(self, path):
+        self.segments, sections = read_elf(path)
+        if FORMAT_SECTION not in sections:
+            sys.exit("No %s section in %s" % (FORMAT_SECTION, path))
+        self.formats = {}
+        base, data = sections[FORMAT_SECTION]
+        offset = 0
+        while offset < len(data):
+            end = data.index(b"\0", offset)
+            self.formats[base + offset] = data[offset:end].decode("utf-8", "replace")
+            offset = end + 1
+            while offset < len(data) and data[offset] == 0:
+                offset += 1  # Alignment padding
+
+    def string_at(self, address):
+        for base, data in self.segments:
+            if base <= address < base + len(data):
+                offset = address - base
+                return data[offset:data.index(b"\0", offset)].decode("utf-8", "replace")
+        return "<%#x?>" % address
+
+    def format(self, fmt, args):
+        args = iter(args)
+
+        def convert(match):
+            flags, _, kind = match.groups()
+            if kind == "%":
+                return "%"
+            value = next(args, 0)
+            if kind in "di":
+                value = struct.unpack("<i", struct.pack("<I", value))[0]
+            elif kind == "s":
+                value = self.string_at(value)
+            elif kind == "c":
+                value = chr(value & 0xFF)
+            elif kind == "p":
+                return "0x%08x" % value
+            return ("%" + flags + kind) % value
+
+        return CONVERSION.sub(convert, fmt)
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data) + 1:
+            return None
+        out += data[i + 1:i + code]
+        i += code
+        if code < 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def decode_record(firmware, frame):
+    record = cobs_decode(frame)
+    if record is None or len(record) < 8 or len(record) % 4:
+        return "[klog: corrupt frame]\n"
+    words = struct.unpack("<%dI" % (len(record) // 4), record)
+    fmt, time_us, args = words[0], words[1], words[2:]
+    stamp = "[%10.3f] " % (time_us / 1000.0)
+    if fmt == 0:
+        return stamp + "[klog: %d records dropped on core %d]\n" % (args[0], args[1])
+    if fmt not in firmware.formats:
+        return stamp + "[klog: unknown format %#x, wrong ELF?]\n" % fmt
+    return stamp + firmware.format(firmware.formats[fmt], args)
+
+
+def decode_stream(firmware, read, write):
+    # 0x00 opens a frame and the next 0x00 closes it; text has no zero bytes
+    in_frame = False
+    frame = bytearray()
+    while True:
+        chunk = read()
+        if not chunk:
+            return
+        for byte in chunk:
+            if byte == 0:
+                if in_frame and frame:
+                    write(decode_record(firmware, bytes(frame)))
+                in_frame = not in_frame or not frame
+                frame.clear()
+            elif in_frame:
+                frame.append(byte)
+            else:
+                write(chr(byte))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("elf", help="Firmware ELF the device is running")
+    parser.add_argument("source", help="Serial port, capture file or - for stdin")
+    parser.add_argument("--baud", type=int, default=115200)
+    args = parser.parse_args()
+
+    firmware = Firmware(args.elf)
+    out = sys.stdout
+
+    def write(text):
+        out.write(text)
+        out.flush()
+
+    if args.source == "-":
+        decode_stream(firmware, lambda: sys.stdin.buffer.read1(4096), write)
+    elif args.source.startswith("/dev/") or args.source.upper().startswith("COM"):
+        import serial
+        port = serial.Serial(args.source, args.baud)
+        decode_stream(firmware, lambda: port.read(max(1, port.in_waiting)), write)
+    else:
+        with open(args.source, "rb") as f:
+            decode_stream(firmware, lambda: f.read(4096), write)
+
+
+if __name__ == "__main__":
+    main()
@@ -31,14 +31,14 @@ extern "C" {
 #define CFG_TUD_ENDPOINT0_SIZE      64
 
 //------------- CLASS -------------//
-#define CFG_TUD_HID                 1
+#define CFG_TUD_HID                 2   // Keyboard/mouse + raw HID configuration
 #define CFG_TUD_CDC                 0
 #define CFG_TUD_MSC                 0
 #define CFG_TUD_MIDI                0
 #define CFG_TUD_VENDOR              0
 
 // HID buffer size
-#define CFG_TUD_HID_EP_BUFSIZE      16
+#define CFG_TUD_HID_EP_BUFSIZE      32  // Raw HID reports are 32 bytes
 
 #ifdef __cplusplus
 }
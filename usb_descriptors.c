@@ -1,11 +1,13 @@
 /**
- * USB HID Descriptors for composite keyboard + mouse
+ * USB HID Descriptors for composite keyboard + mouse + consumer control
  */
 
 // Prevent BTstack HID definitions from conflicting
 #define __HID_H
 
 #include "tusb.h"
+#include "usb_descriptors.h"
+#include "raw_hid.h"
 
 //--------------------------------------------------------------------+
 // Device Descriptors
@@ -39,37 +41,137 @@ uint8_t const * tud_descriptor_device_cb(void) {
 //--------------------------------------------------------------------+
 // HID Report Descriptor
 //--------------------------------------------------------------------+
+
+// Resolution Multiplier feature field (2 bits): logical 0..1 maps to a
+// physical multiplier of 1..SCROLL_RESOLUTION. The physical range is reset
+// afterwards so it doesn't leak into the following input items.
+#define HID_RES_MULTIPLIER_FEATURE \
+    HID_REPORT_ID   ( REPORT_ID_MOUSE_RES_MULTIPLIER                         ) \
+    HID_USAGE       ( HID_USAGE_DESKTOP_RESOLUTION_MULTIPLIER                ), \
+    HID_LOGICAL_MIN ( 0                                                      ), \
+    HID_LOGICAL_MAX ( 1                                                      ), \
+    HID_PHYSICAL_MIN( 1                                                      ), \
+    HID_PHYSICAL_MAX( SCROLL_RESOLUTION                                      ), \
+    HID_REPORT_SIZE ( 2                                                      ), \
+    HID_REPORT_COUNT( 1                                                      ), \
+    HID_FEATURE     ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE                 ), \
+    HID_PHYSICAL_MIN( 0                                                      ), \
+    HID_PHYSICAL_MAX( 0                                                      )
+
+// Mouse with high-resolution wheel and horizontal pan.
+// Input report layout matches hid_mouse_report_t (buttons, x, y, wheel, pan)
+// so tud_hid_mouse_report() can still be used to send it.
+#define TUD_HID_REPORT_DESC_HIRES_MOUSE() \
+    HID_USAGE_PAGE  ( HID_USAGE_PAGE_DESKTOP                                 ), \
+    HID_USAGE       ( HID_USAGE_DESKTOP_MOUSE                                ), \
+    HID_COLLECTION  ( HID_COLLECTION_APPLICATION                             ), \
+      HID_USAGE     ( HID_USAGE_DESKTOP_POINTER                              ), \
+      HID_COLLECTION( HID_COLLECTION_PHYSICAL                                ), \
+        HID_REPORT_ID   ( REPORT_ID_MOUSE                                    ) \
+        /* 5 buttons + 3 bits padding */ \
+        HID_USAGE_PAGE  ( HID_USAGE_PAGE_BUTTON                              ), \
+        HID_USAGE_MIN   ( 1                                                  ), \
+        HID_USAGE_MAX   ( 5                                                  ), \
+        HID_LOGICAL_MIN ( 0                                                  ), \
+        HID_LOGICAL_MAX ( 1                                                  ), \
+        HID_REPORT_COUNT( 5                                                  ), \
+        HID_REPORT_SIZE ( 1                                                  ), \
+        HID_INPUT       ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE             ), \
+        HID_REPORT_COUNT( 1                                                  ), \
+        HID_REPORT_SIZE ( 3                                                  ), \
+        HID_INPUT       ( HID_CONSTANT                                       ), \
+        /* X, Y */ \
+        HID_USAGE_PAGE  ( HID_USAGE_PAGE_DESKTOP                             ), \
+        HID_USAGE       ( HID_USAGE_DESKTOP_X                                ), \
+        HID_USAGE       ( HID_USAGE_DESKTOP_Y                                ), \
+        HID_LOGICAL_MIN ( 0x81                                               ), \
+        HID_LOGICAL_MAX ( 0x7f                                               ), \
+        HID_REPORT_COUNT( 2                                                  ), \
+        HID_REPORT_SIZE ( 8                                                  ), \
+        HID_INPUT       ( HID_DATA | HID_VARIABLE | HID_RELATIVE             ), \
+        /* Vertical wheel with its own multiplier */ \
+        HID_COLLECTION  ( HID_COLLECTION_LOGICAL                             ), \
+          HID_RES_MULTIPLIER_FEATURE, \
+          HID_REPORT_ID   ( REPORT_ID_MOUSE                                  ) \
+          HID_USAGE       ( HID_USAGE_DESKTOP_WHEEL                          ), \
+          HID_LOGICAL_MIN ( 0x81                                             ), \
+          HID_LOGICAL_MAX ( 0x7f                                             ), \
+          HID_REPORT_COUNT( 1                                                ), \
+          HID_REPORT_SIZE ( 8                                                ), \
+          HID_INPUT       ( HID_DATA | HID_VARIABLE | HID_RELATIVE           ), \
+        HID_COLLECTION_END, \
+        /* Horizontal pan with its own multiplier (+4 bits feature padding) */ \
+        HID_COLLECTION  ( HID_COLLECTION_LOGICAL                             ), \
+          HID_RES_MULTIPLIER_FEATURE, \
+          HID_REPORT_SIZE ( 4                                                ), \
+          HID_REPORT_COUNT( 1                                                ), \
+          HID_FEATURE     ( HID_CONSTANT                                     ), \
+          HID_REPORT_ID   ( REPORT_ID_MOUSE                                  ) \
+          HID_USAGE_PAGE  ( HID_USAGE_PAGE_CONSUMER                          ), \
+          HID_USAGE_N     ( HID_USAGE_CONSUMER_AC_PAN, 2                     ), \
+          HID_LOGICAL_MIN ( 0x81                                             ), \
+          HID_LOGICAL_MAX ( 0x7f                                             ), \
+          HID_REPORT_COUNT( 1                                                ), \
+          HID_REPORT_SIZE ( 8                                                ), \
+          HID_INPUT       ( HID_DATA | HID_VARIABLE | HID_RELATIVE           ), \
+        HID_COLLECTION_END, \
+      HID_COLLECTION_END, \
+    HID_COLLECTION_END
+
 uint8_t const desc_hid_report[] = {
-    TUD_HID_REPORT_DESC_KEYBOARD(HID_REPORT_ID(1)),
-    TUD_HID_REPORT_DESC_MOUSE(HID_REPORT_ID(2))
+    TUD_HID_REPORT_DESC_KEYBOARD(HID_REPORT_ID(REPORT_ID_KEYBOARD)),
+    TUD_HID_REPORT_DESC_HIRES_MOUSE(),
+    TUD_HID_REPORT_DESC_CONSUMER(HID_REPORT_ID(REPORT_ID_CONSUMER))
+};
+
+// Raw HID: one vendor-defined input and output report, no report ID.
+// Same usage page/usage as other configurable keyboards, so host tools find
+// the interface without a driver.
+uint8_t const desc_raw_hid_report[] = {
+    HID_USAGE_PAGE_N( RAW_HID_USAGE_PAGE, 2                                  ),
+    HID_USAGE       ( RAW_HID_USAGE                                          ),
+    HID_COLLECTION  ( HID_COLLECTION_APPLICATION                             ),
+      HID_USAGE       ( 0x62                                                 ),
+      HID_LOGICAL_MIN ( 0x00                                                 ),
+      HID_LOGICAL_MAX_N( 0xff, 2                                             ),
+      HID_REPORT_SIZE ( 8                                                    ),
+      HID_REPORT_COUNT( RAW_HID_REPORT_SIZE                                  ),
+      HID_INPUT       ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE               ),
+      HID_USAGE       ( 0x63                                                 ),
+      HID_LOGICAL_MIN ( 0x00                                                 ),
+      HID_LOGICAL_MAX_N( 0xff, 2                                             ),
+      HID_REPORT_SIZE ( 8                                                    ),
+      HID_REPORT_COUNT( RAW_HID_REPORT_SIZE                                  ),
+      HID_OUTPUT      ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE               ),
+    HID_COLLECTION_END
 };
 
 // Invoked when received GET HID REPORT DESCRIPTOR
 // Application return pointer to descriptor
 // Descriptor contents must exist long enough for transfer to complete
 uint8_t const * tud_hid_descriptor_report_cb(uint8_t instance) {
-    (void) instance;
-    return desc_hid_report;
+    return instance == ITF_NUM_RAW_HID ? desc_raw_hid_report : desc_hid_report;
 }
 
 //--------------------------------------------------------------------+
 // Configuration Descriptor
 //--------------------------------------------------------------------+
-enum {
-    ITF_NUM_HID,
-    ITF_NUM_TOTAL
-};
-
-#define CONFIG_TOTAL_LEN    (TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN)
+#define CONFIG_TOTAL_LEN    (TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN + TUD_HID_INOUT_DESC_LEN)
 
-#define EPNUM_HID   0x81
+#define EPNUM_HID           0x81
+#define EPNUM_RAW_HID_OUT   0x02
+#define EPNUM_RAW_HID_IN    0x82
 
 uint8_t const desc_configuration[] = {
     // Config number, interface count, string index, total length, attribute, power in mA
     TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP, 100),
 
     // Interface number, string index, protocol, report descriptor len, EP In address, size & polling interval
-    TUD_HID_DESCRIPTOR(ITF_NUM_HID, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_report), EPNUM_HID, CFG_TUD_HID_EP_BUFSIZE, 1)
+    TUD_HID_DESCRIPTOR(ITF_NUM_HID, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_report), EPNUM_HID, CFG_TUD_HID_EP_BUFSIZE, 1),
+
+    // Interface number, string index, protocol, report descriptor len, EP Out & In address, size & polling interval
+    TUD_HID_INOUT_DESCRIPTOR(ITF_NUM_RAW_HID, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_raw_hid_report),
+                             EPNUM_RAW_HID_OUT, EPNUM_RAW_HID_IN, RAW_HID_REPORT_SIZE, 1)
 };
 
 // Invoked when received GET CONFIGURATION DESCRIPTOR
@@ -0,0 +1,30 @@
+/**
+ * USB interface numbers and HID report IDs shared by the descriptors and the dongle
+ */
+
+#ifndef USB_DESCRIPTORS_H
+#define USB_DESCRIPTORS_H
+
+// Interfaces, also the TinyUSB HID instance numbers
+enum {
+    ITF_NUM_HID,        // Keyboard + mouse + consumer control
+    ITF_NUM_RAW_HID,    // Vendor-defined configuration interface (raw_hid.c)
+    ITF_NUM_TOTAL
+};
+
+enum {
+    REPORT_ID_KEYBOARD = 1,
+    REPORT_ID_MOUSE,
+    REPORT_ID_MOUSE_RES_MULTIPLIER,   // Feature report: wheel/pan Resolution Multiplier
+    REPORT_ID_CONSUMER,               // Consumer control: one 16-bit usage
+};
+
+// Physical maximum of the Resolution Multiplier: with it enabled the host
+// treats 120 wheel/pan counts as one detent (Windows/Linux hi-res scrolling)
+#define SCROLL_RESOLUTION 120
+
+// Feature report layout (1 byte): bits 0-1 wheel multiplier, bits 2-3 pan multiplier
+#define RES_MULTIPLIER_WHEEL_MASK 0x03
+#define RES_MULTIPLIER_PAN_SHIFT  2
+
+#endif // USB_DESCRIPTORS_H